@@ -35,6 +35,15 @@ NTSTATUS CreateMiniportTopology(
     IN  POOL_TYPE
 );
 
+#ifdef RTSD_WAVERT
+NTSTATUS CreateMiniportWaveRT( 
+    OUT PUNKNOWN *,
+    IN  REFCLSID,
+    IN  PUNKNOWN,
+    IN  POOL_TYPE
+);
+#endif
+
 //-----------------------------------------------------------------------------
 // Referenced forward.
 //-----------------------------------------------------------------------------
@@ -342,6 +351,34 @@ Return Value:
             );
     }
 
+#ifdef RTSD_WAVERT
+    // With the WaveRT setting the wave filter goes on the WaveRT port, the
+    // audio engine then reads and writes the streams' buffers directly.
+    BOOLEAN         fWaveRT         = FALSE;
+    PREGISTRYKEY    settingsKey     = NULL;
+
+    if (NT_SUCCESS(ntStatus) && NT_SUCCESS(OpenSettingsKey(DeviceObject, &settingsKey))) {
+        fWaveRT = (ReadSettingDword(settingsKey, L"WaveRT", 0) != 0);
+        settingsKey->Release();
+    }
+
+    // install wavert miniport.
+    if (NT_SUCCESS(ntStatus) && fWaveRT) {
+        ntStatus = InstallSubdevice( 
+                DeviceObject,
+                Irp,
+                L"Wave",
+                CLSID_PortWaveRT,
+                CLSID_PortWaveRT,   
+                CreateMiniportWaveRT,
+                pAdapterCommon,
+                NULL,
+                IID_IPortWaveRT,
+                NULL,
+                &unknownWave 
+            );
+    } else
+#endif
     // install MSVAD wavecyclic miniport.
     if (NT_SUCCESS(ntStatus)) {
         ntStatus = InstallSubdevice( 
@@ -58,6 +58,69 @@ Return Value:
     return pWfx;
 } // GetWaveFormatEx
 
+//-----------------------------------------------------------------------------
+USHORT
+GetWaveFormatTag
+(
+    IN  PWAVEFORMATEX           pWfx
+)
+/*
+Routine Description:
+  Returns the format tag of a waveformatex, looking through
+  WAVE_FORMAT_EXTENSIBLE to the tag its SubFormat stands for.
+
+Arguments:
+  pWfx - wave format.
+
+Return Value:
+  
+    WAVE_FORMAT_PCM, WAVE_FORMAT_IEEE_FLOAT, ... 
+    WAVE_FORMAT_UNKNOWN for extensible formats without a tag.
+
+--*/
+{
+    if (pWfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE)
+    {
+        PWAVEFORMATEXTENSIBLE pWfxExt = (PWAVEFORMATEXTENSIBLE) pWfx;
+
+        if (IS_VALID_WAVEFORMATEX_GUID(&pWfxExt->SubFormat))
+        {
+            return EXTRACT_WAVEFORMATEX_ID(&pWfxExt->SubFormat);
+        }
+        return WAVE_FORMAT_UNKNOWN;
+    }
+
+    return pWfx->wFormatTag;
+} // GetWaveFormatTag
+
+//-----------------------------------------------------------------------------
+ULONG
+GetWaveChannelMask
+(
+    IN  PWAVEFORMATEX           pWfx
+)
+/*
+Routine Description:
+  Returns the speaker positions of a waveformatex.
+
+Arguments:
+  pWfx - wave format.
+
+Return Value:
+  
+    dwChannelMask of a WAVE_FORMAT_EXTENSIBLE format, 0 for other formats.
+
+--*/
+{
+    if ((pWfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE) &&
+        (pWfx->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)))
+    {
+        return ((PWAVEFORMATEXTENSIBLE) pWfx)->dwChannelMask;
+    }
+
+    return 0;
+} // GetWaveChannelMask
+
 //-----------------------------------------------------------------------------
 NTSTATUS                        
 PropertyHandler_BasicSupport
@@ -13,6 +13,10 @@ Abstract:
 
 PWAVEFORMATEX GetWaveFormatEx(IN PKSDATAFORMAT pDataFormat);
 
+USHORT GetWaveFormatTag(IN PWAVEFORMATEX pWfx);
+
+ULONG GetWaveChannelMask(IN PWAVEFORMATEX pWfx);
+
 NTSTATUS PropertyHandler_BasicSupport(IN PPCPROPERTY_REQUEST PropertyRequest, IN ULONG Flags, IN DWORD PropTypeSetId);
 
 NTSTATUS ValidatePropertyParams(IN PPCPROPERTY_REQUEST PropertyRequest, IN ULONG cbValueSize, IN ULONG cbInstanceSize = 0);
@@ -13,6 +13,7 @@ Abstract:
 #include <stdunk.h>
 #include <ksdebug.h>
 #include "kshelper.h"
+#include "rtsdprop.h"
 
 //=============================================================================
 // Defines
@@ -55,21 +56,42 @@ DEFINE_GUIDSTRUCT("946A7B1A-EBBC-422a-A81F-F07C8D40D3B4", NAME_RTSDAUDIO);
 #define CHAN_MASTER                 (-1)
 
 // Pin properties.
-#define MAX_OUTPUT_STREAMS          1       // Number of capture streams.
+#define MAX_OUTPUT_STREAMS          RTSD_LOOPBACK_MAX_READERS // Number of capture streams.
 #define MAX_INPUT_STREAMS           1       // Number of render streams.
 #define MAX_TOTAL_STREAMS           MAX_OUTPUT_STREAMS + MAX_INPUT_STREAMS                      
 
 // PCM Info
-#define MIN_CHANNELS                2       // Min Channels.
-#define MAX_CHANNELS_PCM            2       // Max Channels.
+#define MIN_CHANNELS                1       // Min Channels.
+#define MAX_CHANNELS_PCM            8       // Max Channels.
 #define MIN_BITS_PER_SAMPLE_PCM     16      // Min Bits Per Sample
-#define MAX_BITS_PER_SAMPLE_PCM     16      // Max Bits Per Sample
-#define MIN_SAMPLE_RATE             44100   // Min Sample Rate
-#define MAX_SAMPLE_RATE             44100   // Max Sample Rate
+#define MAX_BITS_PER_SAMPLE_PCM     32      // Max Bits Per Sample
+
+// IEEE Float Info
+#define BITS_PER_SAMPLE_FLOAT       32      // Bits Per Sample
+#define MIN_SAMPLE_RATE             8000    // Min Sample Rate
+#define MAX_SAMPLE_RATE             192000  // Max Sample Rate
 
 // Dma Settings.
 #define DMA_BUFFER_SIZE             0x16000
 
+// The WaveRT port exists from Windows Vista on. Builds for it can install
+// the wave subdevice on it, see the WaveRT setting.
+#if defined(NTDDI_VISTA) && (NTDDI_VERSION >= NTDDI_VISTA)
+#define RTSD_WAVERT
+#endif
+
+// Time between two transfers of the WaveRT streams, in 100 ns units (1 ms).
+#define WAVERT_SERVICE_PERIOD       10000
+
+// Loopback ring depth. Defaults for the LoopbackBufferMs and
+// LoopbackBufferFrames values under the driver's Settings key.
+#define LOOPBACK_BUFFER_MS          300     // Default depth.
+#define LOOPBACK_BUFFER_MS_MIN      2       // Min depth.
+#define LOOPBACK_BUFFER_MS_MAX      10000   // Max depth.
+
+// Channel mixes the CaptureRouting value under the Settings key can hold.
+#define CAPTURE_ROUTING_DEFAULTS    4
+
 #define KSPROPERTY_TYPE_ALL         KSPROPERTY_TYPE_BASICSUPPORT | \
                                     KSPROPERTY_TYPE_GET | \
                                     KSPROPERTY_TYPE_SET
@@ -78,6 +100,14 @@ DEFINE_GUIDSTRUCT("946A7B1A-EBBC-422a-A81F-F07C8D40D3B4", NAME_RTSDAUDIO);
 // Enumerations
 //=============================================================================
 
+// Clock of the capture DMA position. Values of the CaptureClock setting.
+enum
+{
+    CAPTURE_CLOCK_TIMER = 0,            // Interrupt time, like a hardware clock.
+    CAPTURE_CLOCK_RENDER,               // The frames the render stream delivered.
+    CAPTURE_CLOCK_COUNT
+};
+
 // Wave pins
 enum 
 {
@@ -148,4 +178,12 @@ extern NTSTATUS PropertyHandler_Wave(IN PPCPROPERTY_REQUEST PropertyRequest);
 // Handles the GeneralComponentId request.
 extern NTSTATUS PropertyHandler_WaveFilter(IN PPCPROPERTY_REQUEST PropertyRequest);
 
+// Capture pin automation table.
+// Handles the loopback routing request.
+extern NTSTATUS PropertyHandler_WaveCapturePin(IN PPCPROPERTY_REQUEST PropertyRequest);
+
+// The Settings key under the driver's key, and its REG_DWORD values.
+extern NTSTATUS OpenSettingsKey(IN PDEVICE_OBJECT DeviceObject, OUT PREGISTRYKEY *SettingsKey);
+extern ULONG ReadSettingDword(IN PREGISTRYKEY Key, IN PCWSTR Name, IN ULONG Default);
+
 #endif
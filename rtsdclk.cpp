@@ -0,0 +1,87 @@
+/*
+Module Name:
+  rtsdclk.cpp
+
+Abstract:
+  Implementation of the clock behind the DMA position of a WaveCyclic
+  stream.
+*/
+
+#include "rtsdclk.h"
+
+//=============================================================================
+CDmaClock::CDmaClock()
+/*
+Routine Description:
+  Constructor for the DMA clock. It counts nothing before Start.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  m_ulRate = 0;
+  m_ullFrames = 0;
+  m_ullCopiedFrames = 0;
+  m_ullClockFrames = 0;
+  m_ullClockTime = 0;
+} // CDmaClock
+
+//=============================================================================
+void CDmaClock::Start(
+  IN  ULONGLONG               CurrentTime,
+  IN  ULONG                   Rate
+)
+/*
+Routine Description:
+  Starts counting from 0 at CurrentTime.
+
+Arguments:
+  CurrentTime - interrupt time, in 100 ns units
+  Rate - frames per second
+
+Return Value:
+  void
+*/
+{
+  m_ulRate = Rate;
+  m_ullFrames = 0;
+  m_ullCopiedFrames = 0;
+  m_ullClockFrames = 0;
+  m_ullClockTime = CurrentTime;
+} // Start
+
+//=============================================================================
+ULONGLONG CDmaClock::GetFrames(
+  IN  ULONGLONG               CurrentTime,
+  IN  LONGLONG                Available
+)
+/*
+Routine Description:
+  Frames the stream has moved since Start at CurrentTime.
+
+Arguments:
+  CurrentTime - interrupt time, in 100 ns units, not before the last call
+  Available - frames the data source holds for the stream, or
+    DMA_CLOCK_FREE_RUN to count on the interrupt time
+
+Return Value:
+  Frames since Start
+*/
+{
+  if (Available == DMA_CLOCK_FREE_RUN) {
+    m_ullFrames = RTSD_MAX(m_ullFrames, m_ullClockFrames + RtsdElapsedFrames(CurrentTime - m_ullClockTime, m_ulRate));
+    return m_ullFrames;
+  }
+
+  // frames the count already covers but were not copied out yet
+  Available -= (LONGLONG)(m_ullFrames - m_ullCopiedFrames);
+  if (Available > 0) {
+    m_ullFrames += Available;
+  }
+
+  m_ullClockFrames = m_ullFrames;
+  m_ullClockTime = CurrentTime;
+  return m_ullFrames;
+} // GetFrames
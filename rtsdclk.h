@@ -0,0 +1,57 @@
+/*
+Module Name:
+  rtsdclk.h
+
+Abstract:
+  Definition of the clock behind the DMA position of a WaveCyclic stream.
+  It only depends on rtsdplat.h, so it builds in user mode like the
+  engine.
+*/
+
+#ifndef __RTSDCLK_H_
+#define __RTSDCLK_H_
+
+#include "rtsdplat.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+
+// Available of GetFrames when no data drives the clock: it runs on the
+// interrupt time.
+#define DMA_CLOCK_FREE_RUN          (-0x7FFFFFFFFFFFFFFFLL - 1)
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CDmaClock
+//
+// Counts the frames a running stream has moved since Start. On the
+// interrupt time the count is derived from the time of Start, to the frame,
+// so nothing is rounded away between calls and the count does not depend
+// on how often it is read. Driven by data, the count moves on by the frames
+// that are available and not counted yet; frames counted but not copied
+// out are not counted again. When the data stops, the count moves on with
+// the interrupt time from where the data left off, and it never goes back.
+// Start runs at PASSIVE_LEVEL, the owner keeps it from overlapping the
+// rest. GetFrames and Copied can run at any IRQL.
+
+class CDmaClock {
+private:
+  ULONG                       m_ulRate;           // Frames per second.
+  ULONGLONG                   m_ullFrames;        // Frames since Start.
+  ULONGLONG                   m_ullCopiedFrames;  // Frames the owner copied out since Start.
+  ULONGLONG                   m_ullClockFrames;   // m_ullFrames when the data last drove the count.
+  ULONGLONG                   m_ullClockTime;     // Interrupt time of that, or of Start.
+
+public:
+  CDmaClock();
+
+  void Start(IN ULONGLONG CurrentTime, IN ULONG Rate);
+  ULONGLONG GetFrames(IN ULONGLONG CurrentTime, IN LONGLONG Available);
+  void Copied(IN ULONG Frames)    { m_ullCopiedFrames += Frames; }
+};
+typedef CDmaClock *PCDmaClock;
+
+#endif
@@ -0,0 +1,849 @@
+/*
+Module Name:
+  rtsdconv.cpp
+
+Abstract:
+  Sample format conversion kernels of the loopback engine. The pivot format
+  is a 32 bit integer that uses the full range, so 16 and 24 bit samples
+  are shifted into its upper bits and float samples are scaled by 2^31.
+  The scalar and SIMD kernels produce bit identical results: float to
+  pivot truncates towards zero and saturates, pivot to float rounds to
+  nearest even, NaN becomes silence. The dither and mix kernels are bit
+  identical as well.
+*/
+
+#include "rtsdconv.h"
+
+#ifdef RTSD_CONVERT_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RTSD_CONVERT_AVX2
+#include <immintrin.h>
+#define RTSD_TARGET_AVX2    __attribute__((target("avx2")))
+#endif
+
+const ULONG LoopbackSampleSize[LOOPBACK_SAMPLE_TYPE_COUNT] = {
+  sizeof(SHORT),                      // LOOPBACK_SAMPLE_INT16
+  3,                                  // LOOPBACK_SAMPLE_INT24
+  sizeof(LONG),                       // LOOPBACK_SAMPLE_INT32
+  sizeof(ULONG)                       // LOOPBACK_SAMPLE_FLOAT32
+};
+
+//=============================================================================
+// Scalar kernels. Integer math only, so they can run at any IRQL without
+// saving the floating point state.
+//=============================================================================
+
+// Pivot sample of the IEEE float with the bit pattern Bits.
+__forceinline LONG FloatBitsToPivot(ULONG Bits)
+{
+  LONG exponent = (Bits >> 23) & 0xFF;
+
+  if ((exponent == 0xFF) && (Bits & 0x7FFFFF)) {
+    return 0;                           // NaN
+  }
+  if (exponent >= 127) {                // |x| >= 1.0, or Inf
+    return (Bits & 0x80000000) ? (LONG)0x80000000 : 0x7FFFFFFF;
+  }
+
+  // x * 2^31 = mantissa * 2^(exponent - 127 - 23 + 31)
+  LONG shift = exponent - 119;
+  if (shift <= -24) {
+    return 0;                           // also takes care of denormals
+  }
+
+  ULONG mantissa = (Bits & 0x7FFFFF) | 0x800000;
+  ULONG magnitude = (shift >= 0) ? (mantissa << shift) : (mantissa >> -shift);
+  return (Bits & 0x80000000) ? -(LONG)magnitude : (LONG)magnitude;
+}
+
+// Bit pattern of the IEEE float Sample / 2^31, rounded to nearest even.
+__forceinline ULONG PivotToFloatBits(LONG Sample)
+{
+  if (!Sample) {
+    return 0;
+  }
+
+  ULONG sign = (Sample < 0) ? 0x80000000 : 0;
+  ULONG magnitude = sign ? (ULONG)0 - (ULONG)Sample : (ULONG)Sample;
+  ULONG msb = RtsdHighestBit(magnitude);
+  ULONG mantissa;
+
+  if (msb > 23) {
+    ULONG shift = msb - 23;
+    ULONG rest = magnitude & ((1UL << shift) - 1);
+    ULONG half = 1UL << (shift - 1);
+
+    mantissa = magnitude >> shift;
+    if ((rest > half) || ((rest == half) && (mantissa & 1))) {
+      mantissa++;
+      if (mantissa == 0x1000000) {
+        mantissa >>= 1;
+        msb++;
+      }
+    }
+  } else {
+    mantissa = magnitude << (23 - msb);
+  }
+
+  // magnitude / 2^31 = 1.mantissa * 2^(msb - 31)
+  return sign | ((msb + 96) << 23) | (mantissa & 0x7FFFFF);
+}
+
+static void Int16ToPivot(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PLONG pDst = (PLONG)Destination;
+  PSHORT pSrc = (PSHORT)Source;
+
+  for (ULONG i = 0; i < SampleCount; i++) {
+    pDst[i] = (LONG)((ULONG)pSrc[i] << 16);
+  }
+}
+
+static void Int24ToPivot(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PLONG pDst = (PLONG)Destination;
+  PUCHAR pSrc = (PUCHAR)Source;
+
+  for (ULONG i = 0; i < SampleCount; i++, pSrc += 3) {
+    pDst[i] = (LONG)(((ULONG)pSrc[0] << 8) | ((ULONG)pSrc[1] << 16) | ((ULONG)pSrc[2] << 24));
+  }
+}
+
+static void Int32ToPivot(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  RtlCopyMemory(Destination, Source, SampleCount * sizeof(LONG));
+}
+
+static void FloatToPivot(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PLONG pDst = (PLONG)Destination;
+  PULONG pSrc = (PULONG)Source;
+
+  for (ULONG i = 0; i < SampleCount; i++) {
+    pDst[i] = FloatBitsToPivot(pSrc[i]);
+  }
+}
+
+static void PivotToInt16(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PSHORT pDst = (PSHORT)Destination;
+  PLONG pSrc = (PLONG)Source;
+
+  for (ULONG i = 0; i < SampleCount; i++) {
+    pDst[i] = (SHORT)(pSrc[i] >> 16);
+  }
+}
+
+static void PivotToInt24(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PUCHAR pDst = (PUCHAR)Destination;
+  PLONG pSrc = (PLONG)Source;
+
+  for (ULONG i = 0; i < SampleCount; i++, pDst += 3) {
+    ULONG value = (ULONG)pSrc[i];
+    pDst[0] = (UCHAR)(value >> 8);
+    pDst[1] = (UCHAR)(value >> 16);
+    pDst[2] = (UCHAR)(value >> 24);
+  }
+}
+
+static void PivotToFloat(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PULONG pDst = (PULONG)Destination;
+  PLONG pSrc = (PLONG)Source;
+
+  for (ULONG i = 0; i < SampleCount; i++) {
+    pDst[i] = PivotToFloatBits(pSrc[i]);
+  }
+}
+
+//=============================================================================
+// Scalar dither. With k = Shift the sample is split in hi = x >> k and the
+// k bits below the LSB of the stream. Both halves of the TPDF noise come
+// from one xorshift step as k bit values, so all sums fit in 32 bits.
+//=============================================================================
+
+__forceinline ULONG DitherRandom(PULONG State)
+{
+  ULONG x = *State;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *State = x;
+  return x;
+}
+
+// Sample rounded to Shift fewer bits after adding TPDF noise of +-1 LSB
+// made from Random, saturated.
+__forceinline LONG DitherSample(LONG Sample, ULONG Random, ULONG Shift)
+{
+  LONG mask = (1L << Shift) - 1;
+  LONG limit = 0x7FFFFFFF >> Shift;
+  LONG noise = (LONG)(Random >> (32 - Shift)) + (LONG)((Random >> (16 - Shift)) & mask) - (1L << (Shift - 1));
+  LONG hi = (Sample >> Shift) + (((Sample & mask) + noise) >> Shift);
+
+  hi = RTSD_MAX(RTSD_MIN(hi, limit), -limit - 1);
+  return (LONG)((ULONG)hi << Shift);
+}
+
+static void DitherTpdf(IN OUT PLONG Samples, IN ULONG First, IN ULONG SampleCount, IN OUT PLOOPBACK_DITHER Dither)
+{
+  for (ULONG i = First; i < SampleCount; i++) {
+    Samples[i] = DitherSample(Samples[i], DitherRandom(&Dither->Random[i % LOOPBACK_DITHER_LANES]), Dither->Shift);
+  }
+}
+
+// The error of every sample is subtracted from the next sample of its
+// channel, which moves the noise towards high frequencies.
+static void DitherShaped(IN OUT PLONG Samples, IN ULONG SampleCount, IN OUT PLOOPBACK_DITHER Dither)
+{
+  ULONG shift = Dither->Shift;
+  LONGLONG errorLimit = (LONGLONG)2 << shift;
+
+  for (ULONG i = 0, c = 0; i < SampleCount; i++) {
+    LONGLONG wanted = (LONGLONG)Samples[i] - Dither->Error[c];
+    wanted = RTSD_MAX(RTSD_MIN(wanted, (LONGLONG)0x7FFFFFFF), -(LONGLONG)0x80000000);
+
+    LONG sample = DitherSample((LONG)wanted, DitherRandom(&Dither->Random[i % LOOPBACK_DITHER_LANES]), shift);
+    Dither->Error[c] = (LONG)RTSD_MAX(RTSD_MIN(sample - wanted, errorLimit), -errorLimit);
+    Samples[i] = sample;
+
+    if (++c == Dither->Channels) {
+      c = 0;
+    }
+  }
+}
+
+static void DitherPivot(IN OUT PLONG Samples, IN ULONG FrameCount, IN OUT PLOOPBACK_DITHER Dither)
+{
+  ULONG sampleCount = FrameCount * Dither->Channels;
+  ULONG low = 0;
+
+  // samples that already fit the stream, like a 16 bit render stream read
+  // at 16 bit, pass unchanged
+  for (ULONG i = 0; i < sampleCount; i++) {
+    low |= (ULONG)Samples[i];
+  }
+  if (!(low & ((1UL << Dither->Shift) - 1))) {
+    RtlZeroMemory(Dither->Error, sizeof(Dither->Error));
+    return;
+  }
+
+  if (Dither->Mode == LOOPBACK_DITHER_SHAPED) {
+    DitherShaped(Samples, sampleCount, Dither);
+  } else {
+    DitherTpdf(Samples, 0, sampleCount, Dither);
+  }
+}
+
+//=============================================================================
+// Channel mix. Every output is the sum of the inputs times their 16.16
+// gains, rounded and saturated; a matrix that only picks inputs is a copy.
+// The SIMD kernels copy a run of neighbouring inputs with one load per
+// frame.
+//=============================================================================
+
+static void MixPivot(OUT PLONG Destination, IN PLONG Source, IN ULONG FrameCount, IN PLOOPBACK_MATRIX Matrix)
+{
+  ULONG inputs = Matrix->InputChannels;
+  ULONG outputs = Matrix->OutputChannels;
+
+  if (Matrix->Select) {
+    for (ULONG k = 0; k < FrameCount; k++, Source += inputs, Destination += outputs) {
+      for (ULONG o = 0; o < outputs; o++) {
+        Destination[o] = (Matrix->Source[o] < inputs) ? Source[Matrix->Source[o]] : 0;
+      }
+    }
+    return;
+  }
+
+  for (ULONG k = 0; k < FrameCount; k++, Source += inputs, Destination += outputs) {
+    for (ULONG o = 0; o < outputs; o++) {
+      const LONG *pGain = Matrix->Gain[o];
+      LONGLONG sum = 0x8000;
+      for (ULONG i = 0; i < inputs; i++) {
+        sum += (LONGLONG)Source[i] * pGain[i];
+      }
+      sum >>= 16;
+      Destination[o] = (sum > 0x7FFFFFFF) ? 0x7FFFFFFF : (sum < -(LONGLONG)0x80000000) ? (LONG)0x80000000 : (LONG)sum;
+    }
+  }
+}
+
+//=============================================================================
+// SSE2 kernels. The tail that does not fill a vector is left to the scalar
+// kernel. Only 16 bit and float samples are worth vectorizing; packed 24 bit
+// samples need byte shuffles SSE2 does not have.
+//=============================================================================
+#ifdef RTSD_CONVERT_SSE2
+
+static void Int16ToPivotSse2(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PLONG pDst = (PLONG)Destination;
+  PSHORT pSrc = (PSHORT)Source;
+  __m128i zero = _mm_setzero_si128();
+  ULONG i = 0;
+
+  for (; i + 8 <= SampleCount; i += 8) {
+    __m128i x = _mm_loadu_si128((__m128i *)(pSrc + i));
+    _mm_storeu_si128((__m128i *)(pDst + i), _mm_unpacklo_epi16(zero, x));
+    _mm_storeu_si128((__m128i *)(pDst + i + 4), _mm_unpackhi_epi16(zero, x));
+  }
+  Int16ToPivot(pDst + i, pSrc + i, SampleCount - i);
+}
+
+static void PivotToInt16Sse2(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PSHORT pDst = (PSHORT)Destination;
+  PLONG pSrc = (PLONG)Source;
+  ULONG i = 0;
+
+  for (; i + 8 <= SampleCount; i += 8) {
+    __m128i lo = _mm_srai_epi32(_mm_loadu_si128((__m128i *)(pSrc + i)), 16);
+    __m128i hi = _mm_srai_epi32(_mm_loadu_si128((__m128i *)(pSrc + i + 4)), 16);
+    _mm_storeu_si128((__m128i *)(pDst + i), _mm_packs_epi32(lo, hi));
+  }
+  PivotToInt16(pDst + i, pSrc + i, SampleCount - i);
+}
+
+static void FloatToPivotSse2(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PLONG pDst = (PLONG)Destination;
+  PULONG pSrc = (PULONG)Source;
+  __m128 scale = _mm_set1_ps(2147483648.0f);
+  ULONG i = 0;
+
+  for (; i + 4 <= SampleCount; i += 4) {
+    __m128 x = _mm_loadu_ps((float *)(pSrc + i));
+    x = _mm_and_ps(_mm_mul_ps(x, scale), _mm_cmpord_ps(x, x));
+    // out of range converts to 0x80000000, flip it to 0x7FFFFFFF where
+    // the sample was positive
+    __m128i overflow = _mm_castps_si128(_mm_cmpge_ps(x, scale));
+    _mm_storeu_si128((__m128i *)(pDst + i), _mm_xor_si128(_mm_cvttps_epi32(x), overflow));
+  }
+  FloatToPivot(pDst + i, pSrc + i, SampleCount - i);
+}
+
+static void PivotToFloatSse2(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PULONG pDst = (PULONG)Destination;
+  PLONG pSrc = (PLONG)Source;
+  __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+  ULONG i = 0;
+
+  for (; i + 4 <= SampleCount; i += 4) {
+    __m128 x = _mm_cvtepi32_ps(_mm_loadu_si128((__m128i *)(pSrc + i)));
+    _mm_storeu_ps((float *)(pDst + i), _mm_mul_ps(x, scale));
+  }
+  PivotToFloat(pDst + i, pSrc + i, SampleCount - i);
+}
+
+// Steps the four generators together. The noise shaper depends on the
+// previous sample of each channel, so it stays scalar.
+static void DitherPivotSse2(IN OUT PLONG Samples, IN ULONG FrameCount, IN OUT PLOOPBACK_DITHER Dither)
+{
+  if (Dither->Mode != LOOPBACK_DITHER_TPDF) {
+    DitherPivot(Samples, FrameCount, Dither);
+    return;
+  }
+
+  ULONG shift = Dither->Shift;
+  ULONG sampleCount = FrameCount * Dither->Channels;
+  __m128i mask = _mm_set1_epi32((1L << shift) - 1);
+  __m128i low = _mm_setzero_si128();
+  ULONG i = 0;
+
+  for (; i + 4 <= sampleCount; i += 4) {
+    low = _mm_or_si128(low, _mm_loadu_si128((__m128i *)(Samples + i)));
+  }
+  for (; i < sampleCount; i++) {
+    low = _mm_or_si128(low, _mm_cvtsi32_si128(Samples[i]));
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(low, mask), _mm_setzero_si128())) == 0xFFFF) {
+    return;
+  }
+
+  __m128i count = _mm_cvtsi32_si128(shift);
+  __m128i highCount = _mm_cvtsi32_si128(32 - shift);
+  __m128i midCount = _mm_cvtsi32_si128(16 - shift);
+  __m128i half = _mm_set1_epi32(1L << (shift - 1));
+  __m128i limit = _mm_set1_epi32(0x7FFFFFFF >> shift);
+  __m128i lowest = _mm_set1_epi32(-(0x7FFFFFFF >> shift) - 1);
+  __m128i state = _mm_loadu_si128((__m128i *)Dither->Random);
+
+  for (i = 0; i + 4 <= sampleCount; i += 4) {
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+
+    __m128i noise = _mm_add_epi32(_mm_srl_epi32(state, highCount), _mm_and_si128(_mm_srl_epi32(state, midCount), mask));
+    __m128i x = _mm_loadu_si128((__m128i *)(Samples + i));
+    __m128i round = _mm_sra_epi32(_mm_add_epi32(_mm_and_si128(x, mask), _mm_sub_epi32(noise, half)), count);
+    __m128i hi = _mm_add_epi32(_mm_sra_epi32(x, count), round);
+
+    // no signed 32 bit min / max before SSE4.1
+    __m128i above = _mm_cmpgt_epi32(hi, limit);
+    hi = _mm_or_si128(_mm_andnot_si128(above, hi), _mm_and_si128(above, limit));
+    __m128i below = _mm_cmpgt_epi32(lowest, hi);
+    hi = _mm_or_si128(_mm_andnot_si128(below, hi), _mm_and_si128(below, lowest));
+
+    _mm_storeu_si128((__m128i *)(Samples + i), _mm_sll_epi32(hi, count));
+  }
+  _mm_storeu_si128((__m128i *)Dither->Random, state);
+
+  DitherTpdf(Samples, i, sampleCount, Dither);
+}
+
+// Picks two or four neighbouring channels with one load per frame, and a
+// pair apart with two loads and no lookups. Other selections are left to
+// the scalar kernel.
+static void MixSelectSse2(OUT PLONG Destination, IN PLONG Source, IN ULONG FrameCount, IN PLOOPBACK_MATRIX Matrix)
+{
+  ULONG inputs = Matrix->InputChannels;
+  ULONG first = Matrix->First;
+  ULONG second = Matrix->Source[1];
+  ULONG k = 0;
+
+  if (first == MAXULONG) {
+    first = Matrix->Source[0];
+    if ((Matrix->OutputChannels == 2) && (first < inputs) && (second < inputs)) {
+      for (; k < FrameCount; k++, Source += inputs, Destination += 2) {
+        Destination[0] = Source[first];
+        Destination[1] = Source[second];
+      }
+    }
+    MixPivot(Destination, Source, FrameCount - k, Matrix);
+    return;
+  }
+
+  PLONG pSrc = Source + first;
+  switch (Matrix->OutputChannels) {
+  case 2:
+    for (; k + 2 <= FrameCount; k += 2, pSrc += 2 * inputs, Destination += 4) {
+      __m128i a = _mm_loadl_epi64((__m128i *)pSrc);
+      __m128i b = _mm_loadl_epi64((__m128i *)(pSrc + inputs));
+      _mm_storeu_si128((__m128i *)Destination, _mm_unpacklo_epi64(a, b));
+    }
+    break;
+  case 4:
+    for (; k < FrameCount; k++, pSrc += inputs, Destination += 4) {
+      _mm_storeu_si128((__m128i *)Destination, _mm_loadu_si128((__m128i *)pSrc));
+    }
+    break;
+  }
+  MixPivot(Destination, Source + k * inputs, FrameCount - k, Matrix);
+}
+
+// SSE2 has no signed 32 bit multiply, so the sums are taken in doubles, two
+// outputs to a vector. A sample times a gain of at most 2^19 fits in 51
+// bits and eight of them in 54, so every sum is exact up to where the
+// result saturates anyway, and the mix is bit identical to the scalar one.
+// A mono output would leave half of every vector idle, it stays scalar.
+static void MixPivotSse2(OUT PLONG Destination, IN PLONG Source, IN ULONG FrameCount, IN PLOOPBACK_MATRIX Matrix)
+{
+  ULONG inputs = Matrix->InputChannels;
+  ULONG outputs = Matrix->OutputChannels;
+  ULONG pairs = (outputs + 1) / 2;
+  __m128d gain[RTSD_LOOPBACK_MAX_CHANNELS][RTSD_LOOPBACK_MAX_CHANNELS / 2];
+  __m128d round = _mm_set1_pd(32768.0);
+  __m128d scale = _mm_set1_pd(1.0 / 65536.0);
+  __m128d low = _mm_set1_pd(-2147483648.0);
+  __m128d high = _mm_set1_pd(2147483647.0);
+
+  if (Matrix->Select) {
+    MixSelectSse2(Destination, Source, FrameCount, Matrix);
+    return;
+  }
+  if (Matrix->Select || (outputs == 1)) {
+    MixPivot(Destination, Source, FrameCount, Matrix);
+    return;
+  }
+
+  // one column of gains per input
+  for (ULONG i = 0; i < inputs; i++) {
+    for (ULONG p = 0; p < pairs; p++) {
+      LONG odd = (2 * p + 1 < outputs) ? Matrix->Gain[2 * p + 1][i] : 0;
+      gain[i][p] = _mm_set_pd((double)odd, (double)Matrix->Gain[2 * p][i]);
+    }
+  }
+
+  for (ULONG k = 0; k < FrameCount; k++, Source += inputs, Destination += outputs) {
+    __m128d sum[RTSD_LOOPBACK_MAX_CHANNELS / 2];
+    for (ULONG p = 0; p < pairs; p++) {
+      sum[p] = round;
+    }
+    for (ULONG i = 0; i < inputs; i++) {
+      __m128d x = _mm_set1_pd((double)Source[i]);
+      for (ULONG p = 0; p < pairs; p++) {
+        sum[p] = _mm_add_pd(sum[p], _mm_mul_pd(x, gain[i][p]));
+      }
+    }
+    for (ULONG p = 0; p < pairs; p++) {
+      // floor of the saturated sum: truncate, then step down where that
+      // went up
+      __m128d v = _mm_min_pd(_mm_max_pd(_mm_mul_pd(sum[p], scale), low), high);
+      __m128i x = _mm_cvttpd_epi32(v);
+      __m128i up = _mm_castpd_si128(_mm_cmpgt_pd(_mm_cvtepi32_pd(x), v));
+      x = _mm_add_epi32(x, _mm_shuffle_epi32(up, 0x08));
+      if (2 * p + 1 < outputs) {
+        _mm_storel_epi64((__m128i *)(Destination + 2 * p), x);
+      } else {
+        Destination[2 * p] = _mm_cvtsi128_si32(x);
+      }
+    }
+  }
+}
+
+#endif // RTSD_CONVERT_SSE2
+
+//=============================================================================
+// AVX2 kernels, user mode only.
+//=============================================================================
+#ifdef RTSD_CONVERT_AVX2
+
+static RTSD_TARGET_AVX2 void Int16ToPivotAvx2(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PLONG pDst = (PLONG)Destination;
+  PSHORT pSrc = (PSHORT)Source;
+  ULONG i = 0;
+
+  for (; i + 8 <= SampleCount; i += 8) {
+    __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *)(pSrc + i)));
+    _mm256_storeu_si256((__m256i *)(pDst + i), _mm256_slli_epi32(x, 16));
+  }
+  Int16ToPivot(pDst + i, pSrc + i, SampleCount - i);
+}
+
+static RTSD_TARGET_AVX2 void PivotToInt16Avx2(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PSHORT pDst = (PSHORT)Destination;
+  PLONG pSrc = (PLONG)Source;
+  ULONG i = 0;
+
+  for (; i + 16 <= SampleCount; i += 16) {
+    __m256i lo = _mm256_srai_epi32(_mm256_loadu_si256((__m256i *)(pSrc + i)), 16);
+    __m256i hi = _mm256_srai_epi32(_mm256_loadu_si256((__m256i *)(pSrc + i + 8)), 16);
+    // packs works within 128 bit lanes, put the quarters back in order
+    __m256i x = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+    _mm256_storeu_si256((__m256i *)(pDst + i), x);
+  }
+  PivotToInt16(pDst + i, pSrc + i, SampleCount - i);
+}
+
+static RTSD_TARGET_AVX2 void FloatToPivotAvx2(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PLONG pDst = (PLONG)Destination;
+  PULONG pSrc = (PULONG)Source;
+  __m256 scale = _mm256_set1_ps(2147483648.0f);
+  ULONG i = 0;
+
+  for (; i + 8 <= SampleCount; i += 8) {
+    __m256 x = _mm256_loadu_ps((float *)(pSrc + i));
+    x = _mm256_and_ps(_mm256_mul_ps(x, scale), _mm256_cmp_ps(x, x, _CMP_ORD_Q));
+    __m256i overflow = _mm256_castps_si256(_mm256_cmp_ps(x, scale, _CMP_GE_OQ));
+    _mm256_storeu_si256((__m256i *)(pDst + i), _mm256_xor_si256(_mm256_cvttps_epi32(x), overflow));
+  }
+  FloatToPivot(pDst + i, pSrc + i, SampleCount - i);
+}
+
+static RTSD_TARGET_AVX2 void PivotToFloatAvx2(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  PULONG pDst = (PULONG)Destination;
+  PLONG pSrc = (PLONG)Source;
+  __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+  ULONG i = 0;
+
+  for (; i + 8 <= SampleCount; i += 8) {
+    __m256 x = _mm256_cvtepi32_ps(_mm256_loadu_si256((__m256i *)(pSrc + i)));
+    _mm256_storeu_ps((float *)(pDst + i), _mm256_mul_ps(x, scale));
+  }
+  PivotToFloat(pDst + i, pSrc + i, SampleCount - i);
+}
+
+// The SSE2 mix four outputs to a vector, with a real floor. Up to two
+// outputs the SSE2 vectors are as wide as needed and cheaper to store.
+static RTSD_TARGET_AVX2 void MixPivotAvx2(OUT PLONG Destination, IN PLONG Source, IN ULONG FrameCount, IN PLOOPBACK_MATRIX Matrix)
+{
+  ULONG inputs = Matrix->InputChannels;
+  ULONG outputs = Matrix->OutputChannels;
+  ULONG quads = (outputs + 3) / 4;
+  __m256d gain[RTSD_LOOPBACK_MAX_CHANNELS][RTSD_LOOPBACK_MAX_CHANNELS / 4];
+  __m256d round = _mm256_set1_pd(32768.0);
+  __m256d scale = _mm256_set1_pd(1.0 / 65536.0);
+  __m256d low = _mm256_set1_pd(-2147483648.0);
+  __m256d high = _mm256_set1_pd(2147483647.0);
+
+  if (Matrix->Select || (outputs <= 2)) {
+#ifdef RTSD_CONVERT_SSE2
+    MixPivotSse2(Destination, Source, FrameCount, Matrix);
+#else
+    MixPivot(Destination, Source, FrameCount, Matrix);
+#endif
+    return;
+  }
+
+  for (ULONG i = 0; i < inputs; i++) {
+    for (ULONG q = 0; q < quads; q++) {
+      double column[4];
+      for (ULONG n = 0; n < 4; n++) {
+        column[n] = (4 * q + n < outputs) ? (double)Matrix->Gain[4 * q + n][i] : 0.0;
+      }
+      gain[i][q] = _mm256_loadu_pd(column);
+    }
+  }
+
+  for (ULONG k = 0; k < FrameCount; k++, Source += inputs, Destination += outputs) {
+    __m256d sum[RTSD_LOOPBACK_MAX_CHANNELS / 4];
+    for (ULONG q = 0; q < quads; q++) {
+      sum[q] = round;
+    }
+    for (ULONG i = 0; i < inputs; i++) {
+      __m256d x = _mm256_set1_pd((double)Source[i]);
+      for (ULONG q = 0; q < quads; q++) {
+        sum[q] = _mm256_add_pd(sum[q], _mm256_mul_pd(x, gain[i][q]));
+      }
+    }
+    for (ULONG q = 0; q < quads; q++) {
+      __m256d v = _mm256_floor_pd(_mm256_mul_pd(sum[q], scale));
+      __m128i x = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(v, low), high));
+      ULONG count = RTSD_MIN(outputs - 4 * q, 4);
+      if (count == 4) {
+        _mm_storeu_si128((__m128i *)(Destination + 4 * q), x);
+      } else {
+        LONG last[4];
+        _mm_storeu_si128((__m128i *)last, x);
+        for (ULONG n = 0; n < count; n++) {
+          Destination[4 * q + n] = last[n];
+        }
+      }
+    }
+  }
+}
+
+#endif // RTSD_CONVERT_AVX2
+
+//=============================================================================
+// Kernel tables, indexed by LOOPBACK_CONVERT_LEVEL.
+//=============================================================================
+static const LOOPBACK_CONVERTERS ConvertersScalar = {
+  { Int16ToPivot, Int24ToPivot, Int32ToPivot, FloatToPivot },
+  { PivotToInt16, PivotToInt24, Int32ToPivot, PivotToFloat },
+  DitherPivot,
+  MixPivot
+};
+
+#ifdef RTSD_CONVERT_SSE2
+static const LOOPBACK_CONVERTERS ConvertersSse2 = {
+  { Int16ToPivotSse2, Int24ToPivot, Int32ToPivot, FloatToPivotSse2 },
+  { PivotToInt16Sse2, PivotToInt24, Int32ToPivot, PivotToFloatSse2 },
+  DitherPivotSse2,
+  MixPivotSse2
+};
+#endif
+
+#ifdef RTSD_CONVERT_AVX2
+static const LOOPBACK_CONVERTERS ConvertersAvx2 = {
+  { Int16ToPivotAvx2, Int24ToPivot, Int32ToPivot, FloatToPivotAvx2 },
+  { PivotToInt16Avx2, PivotToInt24, Int32ToPivot, PivotToFloatAvx2 },
+#ifdef RTSD_CONVERT_SSE2
+  DitherPivotSse2,                    // the generators are four wide
+#else
+  DitherPivot,
+#endif
+  MixPivotAvx2
+};
+#endif
+
+//=============================================================================
+LOOPBACK_CONVERT_LEVEL GetBestConvertLevel(void)
+/*
+Routine Description:
+  Returns the best conversion level this build supports on the running
+  processor. SSE2 is part of x64, AVX2 is only used in user mode and only
+  if the processor has it.
+
+Arguments:
+
+Return Value:
+  LOOPBACK_CONVERT_LEVEL
+*/
+{
+#ifdef RTSD_CONVERT_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return LOOPBACK_CONVERT_AVX2;
+  }
+#endif
+#ifdef RTSD_CONVERT_SSE2
+  return LOOPBACK_CONVERT_SSE2;
+#else
+  return LOOPBACK_CONVERT_SCALAR;
+#endif
+} // GetBestConvertLevel
+
+//=============================================================================
+PCLOOPBACK_CONVERTERS GetConverters(
+  IN  LOOPBACK_CONVERT_LEVEL  Level
+)
+/*
+Routine Description:
+  Returns the kernels of the given level. Levels this build does not have
+  fall back to the next lower one. The caller makes sure the processor
+  supports the level, see GetBestConvertLevel.
+
+Arguments:
+  Level - requested level
+
+Return Value:
+  Table of conversion kernels
+*/
+{
+  switch (Level) {
+    case LOOPBACK_CONVERT_AVX2:
+#ifdef RTSD_CONVERT_AVX2
+      return &ConvertersAvx2;
+#endif
+    case LOOPBACK_CONVERT_SSE2:
+#ifdef RTSD_CONVERT_SSE2
+      return &ConvertersSse2;
+#endif
+    default:
+      return &ConvertersScalar;
+  }
+} // GetConverters
+
+//=============================================================================
+BOOLEAN InitDither(
+  OUT PLOOPBACK_DITHER        Dither,
+  IN  ULONG                   Mode,
+  IN  LOOPBACK_SAMPLE_TYPE    SampleType,
+  IN  ULONG                   Channels,
+  IN  ULONG                   Seed
+)
+/*
+Routine Description:
+  Sets up the dither of a stream. Only 16 and 24 bit integer streams have
+  fewer bits than the pivot. The shaper keeps an error per channel, with
+  more than RTSD_LOOPBACK_MAX_CHANNELS channels plain TPDF is used.
+
+Arguments:
+  Dither - state to set up
+  Mode - LOOPBACK_DITHER_MODE
+  SampleType - sample layout of the stream
+  Channels - samples per frame
+  Seed - start value of the generators, anything but the same for every
+         stream
+
+Return Value:
+  TRUE if the stream is to be dithered
+*/
+{
+  RtlZeroMemory(Dither, sizeof(*Dither));
+
+  if (!Channels || (Mode == LOOPBACK_DITHER_NONE) || (Mode >= LOOPBACK_DITHER_MODE_COUNT)) {
+    return FALSE;
+  }
+
+  switch (SampleType) {
+    case LOOPBACK_SAMPLE_INT16:
+      Dither->Shift = 16;
+      break;
+    case LOOPBACK_SAMPLE_INT24:
+      Dither->Shift = 8;
+      break;
+    default:
+      return FALSE;
+  }
+
+  if ((Mode == LOOPBACK_DITHER_SHAPED) && (Channels > RTSD_LOOPBACK_MAX_CHANNELS)) {
+    Mode = LOOPBACK_DITHER_TPDF;
+  }
+  Dither->Mode = Mode;
+  Dither->Channels = Channels;
+
+  // xorshift must not start at 0
+  for (ULONG lane = 0; lane < LOOPBACK_DITHER_LANES; lane++) {
+    ULONG state = (Seed ^ 0xA511E9B3) * 0x9E3779B9 + lane * 0x6C8E9CF5;
+    Dither->Random[lane] = state ? state : lane + 1;
+  }
+
+  return TRUE;
+} // InitDither
+
+//=============================================================================
+BOOLEAN InitMatrix(
+  OUT PLOOPBACK_MATRIX        Matrix,
+  IN  ULONG                   InputChannels,
+  IN  ULONG                   OutputChannels,
+  IN  const LONG              *Gains,
+  IN  ULONG                   GainStride
+)
+/*
+Routine Description:
+  Sets up the channel mix of a capture stream. Gains are clamped to
+  +-RTSD_ROUTING_MAX_GAIN. The default mix passes the channels both sides
+  have, averages everything into a mono stream, copies a mono ring to
+  every channel and leaves the other channels silent.
+
+Arguments:
+  Matrix - mix to set up
+  InputChannels - channels of the ring
+  OutputChannels - channels of the stream
+  Gains - OutputChannels rows of InputChannels 16.16 gains, NULL for the
+          default mix
+  GainStride - distance between two rows of Gains, in gains
+
+Return Value:
+  TRUE if the mix changes the channels and has to be applied
+*/
+{
+  ASSERT(InputChannels && (InputChannels <= RTSD_LOOPBACK_MAX_CHANNELS));
+  ASSERT(OutputChannels && (OutputChannels <= RTSD_LOOPBACK_MAX_CHANNELS));
+
+  RtlZeroMemory(Matrix, sizeof(*Matrix));
+  Matrix->InputChannels = InputChannels;
+  Matrix->OutputChannels = OutputChannels;
+
+  for (ULONG o = 0; o < OutputChannels; o++) {
+    for (ULONG i = 0; i < InputChannels; i++) {
+      LONG gain;
+      if (Gains) {
+        gain = RTSD_MAX(RTSD_MIN(Gains[o * GainStride + i], RTSD_ROUTING_MAX_GAIN), -RTSD_ROUTING_MAX_GAIN);
+      } else if (OutputChannels == 1) {
+        gain = (RTSD_ROUTING_UNITY + InputChannels / 2) / InputChannels;
+      } else if (InputChannels == 1) {
+        gain = RTSD_ROUTING_UNITY;
+      } else {
+        gain = (o == i) ? RTSD_ROUTING_UNITY : 0;
+      }
+      Matrix->Gain[o][i] = gain;
+    }
+  }
+
+  // outputs that take one input unchanged need no multiplies
+  BOOLEAN identity = (InputChannels == OutputChannels);
+  Matrix->Select = TRUE;
+  for (ULONG o = 0; o < OutputChannels; o++) {
+    Matrix->Source[o] = MAXULONG;
+    for (ULONG i = 0; i < InputChannels; i++) {
+      if (!Matrix->Gain[o][i]) {
+        continue;
+      }
+      if ((Matrix->Gain[o][i] != RTSD_ROUTING_UNITY) || (Matrix->Source[o] != MAXULONG)) {
+        Matrix->Select = FALSE;
+      }
+      Matrix->Source[o] = i;
+    }
+    identity = identity && (Matrix->Source[o] == o);
+  }
+
+  // a run of neighbouring inputs can be gathered as a block per frame
+  Matrix->First = Matrix->Select ? Matrix->Source[0] : MAXULONG;
+  for (ULONG o = 0; (o < OutputChannels) && (Matrix->First != MAXULONG); o++) {
+    if (Matrix->Source[o] != Matrix->First + o) {
+      Matrix->First = MAXULONG;
+    }
+  }
+
+  return !(identity && Matrix->Select);
+} // InitMatrix
@@ -0,0 +1,141 @@
+/*
+Module Name:
+  rtsdconv.h
+
+Abstract:
+  Sample format conversion of the loopback engine. The ring holds 32 bit
+  integer samples (the pivot format), or float samples if a float stream
+  allocated it; every other stream format is converted to the pivot on the
+  way in and from it on the way out, so render and capture can use
+  different sample formats.
+  The kernels exist in a scalar version that only uses integer math and,
+  where the platform allows it, in SSE2 (x64 and user mode) and AVX2 (user
+  mode only, the kernel would have to save the extended state) versions.
+  Define RTSD_NO_SIMD to build the scalar kernels only.
+  Streams with fewer bits than the pivot can have the pivot samples
+  dithered before they are requantized, see LOOPBACK_DITHER, and capture
+  streams can get a mix of the channels, see LOOPBACK_MATRIX.
+*/
+
+#ifndef __RTSDCONV_H_
+#define __RTSDCONV_H_
+
+#include "rtsdplat.h"
+
+#if !defined(RTSD_NO_SIMD) && (defined(_M_AMD64) || (defined(RTSD_USERMODE) && defined(__SSE2__)))
+#define RTSD_CONVERT_SSE2
+#endif
+
+#if !defined(RTSD_NO_SIMD) && defined(RTSD_USERMODE) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RTSD_CONVERT_AVX2
+#endif
+
+//=============================================================================
+// Defines
+//=============================================================================
+
+// Independent xorshift generators of the dither. Sample i uses generator
+// i % LOOPBACK_DITHER_LANES, so a vector kernel can step them together.
+#define LOOPBACK_DITHER_LANES       4
+
+//=============================================================================
+// Enumerations
+//=============================================================================
+
+// Sample layout of a stream.
+typedef enum {
+  LOOPBACK_SAMPLE_INT16 = 0,
+  LOOPBACK_SAMPLE_INT24,              // Packed, 3 bytes
+  LOOPBACK_SAMPLE_INT32,              // Also 24 bit in a 32 bit container. The pivot format.
+  LOOPBACK_SAMPLE_FLOAT32,
+  LOOPBACK_SAMPLE_TYPE_COUNT
+} LOOPBACK_SAMPLE_TYPE;
+
+// Dither of samples that are requantized to fewer bits. Values of the
+// DitherMode setting.
+typedef enum {
+  LOOPBACK_DITHER_NONE = 0,           // Truncate.
+  LOOPBACK_DITHER_TPDF,               // Triangular dither of +-1 LSB, then round.
+  LOOPBACK_DITHER_SHAPED,             // TPDF with a first order noise shaper.
+  LOOPBACK_DITHER_MODE_COUNT
+} LOOPBACK_DITHER_MODE;
+
+// Instruction sets the conversion kernels can use.
+typedef enum {
+  LOOPBACK_CONVERT_SCALAR = 0,
+  LOOPBACK_CONVERT_SSE2,
+  LOOPBACK_CONVERT_AVX2,
+  LOOPBACK_CONVERT_LEVEL_COUNT
+} LOOPBACK_CONVERT_LEVEL;
+
+//=============================================================================
+// Typedefs
+//=============================================================================
+
+// Converts SampleCount interleaved samples. Source and Destination may be
+// unaligned but must not overlap.
+typedef void (*PLOOPBACK_CONVERT)(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount);
+
+// Dither state of one stream. Set up by InitDither.
+typedef struct _LOOPBACK_DITHER {
+  ULONG                       Mode;               // LOOPBACK_DITHER_MODE
+  ULONG                       Shift;              // Bits the stream drops, 16 or 8.
+  ULONG                       Channels;
+  ULONG                       Random[LOOPBACK_DITHER_LANES];
+  LONG                        Error[RTSD_LOOPBACK_MAX_CHANNELS];
+} LOOPBACK_DITHER, *PLOOPBACK_DITHER;
+
+// Channel mix of a capture stream, see RTSD_LOOPBACK_ROUTING. Set up by
+// InitMatrix.
+typedef struct _LOOPBACK_MATRIX {
+  ULONG                       InputChannels;
+  ULONG                       OutputChannels;
+  BOOLEAN                     Select;             // Every output is one input or silence.
+  ULONG                       Source[RTSD_LOOPBACK_MAX_CHANNELS]; // Input of each output if Select, MAXULONG for silence.
+  ULONG                       First;              // If Select picks inputs First, First + 1, ... in order, else MAXULONG.
+  LONG                        Gain[RTSD_LOOPBACK_MAX_CHANNELS][RTSD_LOOPBACK_MAX_CHANNELS];
+} LOOPBACK_MATRIX, *PLOOPBACK_MATRIX;
+
+// Mixes FrameCount frames of InputChannels pivot samples to frames of
+// OutputChannels. A Select matrix copies the samples as they are, so it
+// works on the samples of a float ring as well. Source and Destination may
+// be unaligned but must not overlap.
+typedef void (*PLOOPBACK_MIX_KERNEL)(OUT PLONG Destination, IN PLONG Source, IN ULONG FrameCount, IN PLOOPBACK_MATRIX Matrix);
+
+// Dithers FrameCount frames of pivot samples in place. Afterwards the bits
+// below the LSB of the stream are zero, so FromPivot drops them exactly.
+typedef void (*PLOOPBACK_DITHER_KERNEL)(IN OUT PLONG Samples, IN ULONG FrameCount, IN OUT PLOOPBACK_DITHER Dither);
+
+// One kernel per sample type and direction.
+typedef struct _LOOPBACK_CONVERTERS {
+  PLOOPBACK_CONVERT           ToPivot[LOOPBACK_SAMPLE_TYPE_COUNT];
+  PLOOPBACK_CONVERT           FromPivot[LOOPBACK_SAMPLE_TYPE_COUNT];
+  PLOOPBACK_DITHER_KERNEL     Dither;
+  PLOOPBACK_MIX_KERNEL        Mix;
+} LOOPBACK_CONVERTERS, *PLOOPBACK_CONVERTERS;
+typedef const LOOPBACK_CONVERTERS *PCLOOPBACK_CONVERTERS;
+
+//=============================================================================
+// Functions
+//=============================================================================
+
+// Bytes per sample of each LOOPBACK_SAMPLE_TYPE.
+extern const ULONG LoopbackSampleSize[LOOPBACK_SAMPLE_TYPE_COUNT];
+
+// Best level this build supports on the running processor.
+LOOPBACK_CONVERT_LEVEL GetBestConvertLevel(void);
+
+// Kernels of the given level, or of the best level below it that this
+// build supports.
+PCLOOPBACK_CONVERTERS GetConverters(IN LOOPBACK_CONVERT_LEVEL Level);
+
+// Sets up Dither for a stream of SampleType. Returns FALSE, and leaves the
+// samples alone, if the mode is off or the type needs no dither.
+BOOLEAN InitDither(OUT PLOOPBACK_DITHER Dither, IN ULONG Mode, IN LOOPBACK_SAMPLE_TYPE SampleType, IN ULONG Channels, IN ULONG Seed);
+
+// Sets up Matrix from Gains, OutputChannels rows of InputChannels gains,
+// or with the default mix if Gains is NULL. Returns FALSE if the result
+// passes every channel unchanged, so it need not be applied.
+BOOLEAN InitMatrix(OUT PLOOPBACK_MATRIX Matrix, IN ULONG InputChannels, IN ULONG OutputChannels, IN const LONG *Gains, IN ULONG GainStride);
+
+#endif
@@ -0,0 +1,418 @@
+/*
+Module Name:
+  rtsdcycl.cpp
+
+Abstract:
+  Implementation of the cyclic buffer of a WaveRT stream.
+*/
+
+#include "rtsdcycl.h"
+
+#ifndef RTSD_USERMODE
+#pragma code_seg("PAGE")
+#endif
+
+//=============================================================================
+CCyclicBuffer::CCyclicBuffer()
+/*
+Routine Description:
+  Constructor for the cyclic buffer. It has no buffer and is stopped.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  m_pfnTransfer = NULL;
+  m_pfnNotify = NULL;
+  m_pContext = NULL;
+  m_fCapture = FALSE;
+  m_ulBlockAlign = 0;
+  m_ulRate = 0;
+  m_pBuffer = NULL;
+  m_ulFrames = 0;
+  m_pRegister = NULL;
+  m_State = CYCLIC_STATE_STOP;
+  m_ullStartTime = 0;
+  m_ullStartFrames = 0;
+  m_llDoneFrames = 0;
+  m_ulSkipped = 0;
+  m_ulNotifications = 0;
+} // CCyclicBuffer
+
+//=============================================================================
+void CCyclicBuffer::Init(
+  IN  PCYCLIC_TRANSFER        Transfer,
+  IN  PCYCLIC_NOTIFY          Notify,
+  IN  PVOID                   Context,
+  IN  BOOLEAN                 Capture
+)
+/*
+Routine Description:
+  Sets the routines Service moves the frames and signals the notifications
+  with.
+
+Arguments:
+  Transfer - moves frames between the buffer and the loopback ring
+  Notify - signals a notification, or NULL without notifications
+  Context - passed to Transfer and Notify
+  Capture - the buffer belongs to a capture stream
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(Transfer);
+
+  m_pfnTransfer = Transfer;
+  m_pfnNotify = Notify;
+  m_pContext = Context;
+  m_fCapture = Capture;
+} // Init
+
+//=============================================================================
+void CCyclicBuffer::SetFormat(
+  IN  ULONG                   BlockAlign,
+  IN  ULONG                   Rate
+)
+/*
+Routine Description:
+  Sets the frame size and rate of the stream. A buffer that is already set
+  keeps its bytes and is cut to whole frames of the new size. Only while
+  the stream is stopped.
+
+Arguments:
+  BlockAlign - bytes per frame
+  Rate - frames per second
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(BlockAlign && Rate);
+  ASSERT(m_State == CYCLIC_STATE_STOP);
+
+  ULONG bufferSize = m_ulFrames * m_ulBlockAlign;
+
+  m_ulBlockAlign = BlockAlign;
+  m_ulRate = Rate;
+  m_ulFrames = bufferSize / BlockAlign;
+} // SetFormat
+
+//=============================================================================
+ULONG CCyclicBuffer::SetBuffer(
+  IN  PVOID                   Buffer,
+  IN  ULONG                   BufferSize
+)
+/*
+Routine Description:
+  Sets the memory the audio engine shares with the stream, or takes it
+  away if Buffer is NULL. Only whole frames are used. Only while the stream
+  is stopped and after SetFormat.
+
+Arguments:
+  Buffer - system address of the buffer
+  BufferSize - bytes
+
+Return Value:
+  Bytes of the buffer that are used
+*/
+{
+  PAGED_CODE();
+  ASSERT(m_ulBlockAlign);
+  ASSERT(m_State == CYCLIC_STATE_STOP);
+
+  m_pBuffer = (PUCHAR)Buffer;
+  m_ulFrames = Buffer ? BufferSize / m_ulBlockAlign : 0;
+
+  return m_ulFrames * m_ulBlockAlign;
+} // SetBuffer
+
+//=============================================================================
+void CCyclicBuffer::SetRegister(
+  IN  volatile ULONG *        Register
+)
+/*
+Routine Description:
+  Sets a position register, or removes it if Register is NULL. Service
+  stores the byte offset of the position in it, so the audio engine can
+  map the register and read the position without asking the driver.
+
+Arguments:
+  Register - system address of the register
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+
+  m_pRegister = Register;
+  if (m_pRegister) {
+    *m_pRegister = 0;
+  }
+} // SetRegister
+
+//=============================================================================
+void CCyclicBuffer::SetState(
+  IN  ULONG                   State,
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Moves the stream to State. Running starts the clock where it was left,
+  acquire and pause hold it, stop sets it and the buffer position back to
+  the start of the buffer. Must not overlap with Service.
+
+Arguments:
+  State - CYCLIC_STATE
+  CurrentTime - RtsdQueryTime of the change
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+
+  if (State == m_State) {
+    return;
+  }
+
+  if (m_State == CYCLIC_STATE_RUN) {
+    m_ullStartFrames = GetClockFrames(CurrentTime);
+  }
+
+  switch (State) {
+    case CYCLIC_STATE_RUN:
+      m_ullStartTime = CurrentTime;
+      break;
+
+    case CYCLIC_STATE_STOP:
+      m_ullStartFrames = 0;
+      StoreRelease(&m_llDoneFrames, 0);
+      if (m_pRegister) {
+        *m_pRegister = 0;
+      }
+      break;
+  }
+
+  m_State = State;
+} // SetState
+
+#ifndef RTSD_USERMODE
+#pragma code_seg()
+#endif
+
+//=============================================================================
+ULONGLONG CCyclicBuffer::GetClockFrames(
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Frames the clock has moved since the stream stopped.
+
+Arguments:
+  CurrentTime - RtsdQueryTime
+
+Return Value:
+  ULONGLONG
+*/
+{
+  if ((m_State != CYCLIC_STATE_RUN) || (CurrentTime < m_ullStartTime)) {
+    return m_ullStartFrames;
+  }
+
+  return m_ullStartFrames + RtsdElapsedFrames(CurrentTime - m_ullStartTime, m_ulRate);
+} // GetClockFrames
+
+//=============================================================================
+ULONGLONG CCyclicBuffer::GetPosition(
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Frames the stream has moved since it stopped: the clock for a render
+  stream, the frames that are in the buffer for a capture stream.
+
+Arguments:
+  CurrentTime - RtsdQueryTime
+
+Return Value:
+  ULONGLONG
+*/
+{
+  if (m_fCapture) {
+    return (ULONGLONG)LoadAcquire(&m_llDoneFrames);
+  }
+
+  return GetClockFrames(CurrentTime);
+} // GetPosition
+
+//=============================================================================
+ULONG CCyclicBuffer::GetOffset(
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Byte offset of GetPosition in the buffer.
+
+Arguments:
+  CurrentTime - RtsdQueryTime
+
+Return Value:
+  ULONG
+*/
+{
+  if (!m_ulFrames) {
+    return 0;
+  }
+
+  return (ULONG)(GetPosition(CurrentTime) % m_ulFrames) * m_ulBlockAlign;
+} // GetOffset
+
+//=============================================================================
+void CCyclicBuffer::Service(
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Transfers the frames between the last transfer and the clock, moves
+  the position register along and signals the notifications the position
+  passed on the way, skipped frames included.
+
+Arguments:
+  CurrentTime - RtsdQueryTime of the service
+
+Return Value:
+  void
+*/
+{
+  if ((m_State != CYCLIC_STATE_RUN) || !m_ulFrames) {
+    return;
+  }
+
+  ULONGLONG start = (ULONGLONG)m_llDoneFrames;
+  ULONGLONG done = start;
+  ULONGLONG target = GetClockFrames(CurrentTime);
+
+  // More than a buffer behind: the engine is past those frames.
+  if (target - done > m_ulFrames) {
+    m_ulSkipped += (ULONG)(target - done - m_ulFrames);
+    done = target - m_ulFrames;
+  }
+
+  while (done < target) {
+    ULONG offset = (ULONG)(done % m_ulFrames);
+    ULONG frames = (ULONG)RTSD_MIN(target - done, (ULONGLONG)(m_ulFrames - offset));
+
+    m_pfnTransfer(m_pContext, m_pBuffer + offset * m_ulBlockAlign, frames);
+    done += frames;
+  }
+
+  StoreRelease(&m_llDoneFrames, (LONGLONG)done);
+  if (m_pRegister) {
+    *m_pRegister = (ULONG)(done % m_ulFrames) * m_ulBlockAlign;
+  }
+
+  Notify(start, done);
+} // Service
+
+//=============================================================================
+void CCyclicBuffer::Notify(
+  IN  ULONGLONG               FromFrames,
+  IN  ULONGLONG               ToFrames
+)
+/*
+Routine Description:
+  Signals the notifications the position reaches when it moves from
+  FromFrames to ToFrames. A notification is reached when the position
+  comes to the frame its offset lies in, or to the next frame if the
+  offset lies inside a frame; the offset is taken modulo the buffer. A
+  move of a whole buffer or more reaches all of them.
+
+Arguments:
+  FromFrames - position before, in frames since the stream stopped
+  ToFrames - position after
+
+Return Value:
+  void
+*/
+{
+  if (!m_pfnNotify || (ToFrames <= FromFrames)) {
+    return;
+  }
+
+  ULONG from = (ULONG)(FromFrames % m_ulFrames);
+  ULONGLONG moved = ToFrames - FromFrames;
+
+  for (ULONG i = 0; i < m_ulNotifications; i++) {
+    ULONG offset = m_Notifications[i].Offset;
+    ULONG frame = (offset / m_ulBlockAlign + ((offset % m_ulBlockAlign) ? 1 : 0)) % m_ulFrames;
+
+    // frames from FromFrames to the next time the position is at frame, 1 to m_ulFrames
+    ULONG ahead = (frame + m_ulFrames - from - 1) % m_ulFrames + 1;
+    if (ahead <= moved) {
+      m_pfnNotify(m_pContext, m_Notifications[i].Notification);
+    }
+  }
+} // Notify
+
+//=============================================================================
+NTSTATUS CCyclicBuffer::AddNotification(
+  IN  PVOID                   Notification,
+  IN  ULONG                   Offset
+)
+/*
+Routine Description:
+  Has Service signal Notification each time the position reaches Offset,
+  until it is removed.
+
+Arguments:
+  Notification - passed to the notify routine
+  Offset - byte offset in the buffer
+
+Return Value:
+  NT status code.
+*/
+{
+  ASSERT(Notification);
+
+  if (m_ulNotifications == CYCLIC_MAX_NOTIFICATIONS) {
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  m_Notifications[m_ulNotifications].Notification = Notification;
+  m_Notifications[m_ulNotifications].Offset = Offset;
+  m_ulNotifications++;
+
+  return STATUS_SUCCESS;
+} // AddNotification
+
+//=============================================================================
+BOOLEAN CCyclicBuffer::RemoveNotification(
+  IN  PVOID                   Notification
+)
+/*
+Routine Description:
+  Stops signaling Notification. The last notification takes its place.
+
+Arguments:
+  Notification - as passed to AddNotification
+
+Return Value:
+  TRUE if Notification was found
+*/
+{
+  for (ULONG i = 0; i < m_ulNotifications; i++) {
+    if (m_Notifications[i].Notification == Notification) {
+      m_ulNotifications--;
+      m_Notifications[i] = m_Notifications[m_ulNotifications];
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+} // RemoveNotification
@@ -0,0 +1,120 @@
+/*
+Module Name:
+  rtsdcycl.h
+
+Abstract:
+  Definition of the cyclic buffer a WaveRT stream shares with the audio
+  engine: the stream's state machine, its position on the interrupt time
+  clock and the transfer between the buffer and the loopback ring. It only
+  depends on rtsdplat.h, so it builds in user mode like the engine.
+*/
+
+#ifndef __RTSDCYCL_H_
+#define __RTSDCYCL_H_
+
+#include "rtsdplat.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+
+// Position notifications a buffer holds at most.
+#define CYCLIC_MAX_NOTIFICATIONS    16
+
+//=============================================================================
+// Enumerations
+//=============================================================================
+
+// States of a stream, the values of KSSTATE.
+typedef enum {
+  CYCLIC_STATE_STOP = 0,
+  CYCLIC_STATE_ACQUIRE,
+  CYCLIC_STATE_PAUSE,
+  CYCLIC_STATE_RUN
+} CYCLIC_STATE;
+
+//=============================================================================
+// Typedefs
+//=============================================================================
+
+// Moves FrameCount frames between Data, a piece of the cyclic buffer, and
+// the loopback ring: from Data for a render stream, to Data for a capture
+// stream.
+typedef void (*PCYCLIC_TRANSFER)(IN PVOID Context, IN PUCHAR Data, IN ULONG FrameCount);
+
+// Signals Notification, the position just reached its offset.
+typedef void (*PCYCLIC_NOTIFY)(IN PVOID Context, IN PVOID Notification);
+
+//=============================================================================
+// Structs
+//=============================================================================
+
+typedef struct _CYCLIC_NOTIFICATION {
+  PVOID                       Notification;
+  ULONG                       Offset;             // Byte offset in the buffer.
+} CYCLIC_NOTIFICATION, *PCYCLIC_NOTIFICATION;
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CCyclicBuffer
+//
+// The audio engine reads and writes the buffer directly, the driver is
+// only asked for the position. The position of a render stream is the
+// clock: frames at the stream's rate since it started to run. A capture
+// stream reports the frames that were transferred into the buffer, which
+// trail the clock by less than a service period, so the engine never reads
+// a frame that is not there yet. Service moves the frames between the last
+// transfer and the clock, in at most two pieces around the end of the
+// buffer. If it comes more than a buffer late, the frames the engine has
+// overwritten or skipped since are left out and counted.
+// Every Service also signals the notifications whose offsets the position
+// reached since the last one, so their precision is the service period.
+// SetFormat, SetBuffer, SetRegister and SetState run at PASSIVE_LEVEL,
+// Service in the scheduler's DPC; the owner keeps them, AddNotification and
+// RemoveNotification from overlapping.
+// GetPosition can run at any time.
+
+class CCyclicBuffer {
+private:
+  PCYCLIC_TRANSFER            m_pfnTransfer;
+  PCYCLIC_NOTIFY              m_pfnNotify;
+  PVOID                       m_pContext;
+  BOOLEAN                     m_fCapture;
+  ULONG                       m_ulBlockAlign;     // Bytes per frame.
+  ULONG                       m_ulRate;           // Frames per second.
+  PUCHAR                      m_pBuffer;
+  ULONG                       m_ulFrames;         // Size of m_pBuffer in frames.
+  volatile ULONG             *m_pRegister;        // Position register, or NULL.
+  ULONG                       m_State;            // CYCLIC_STATE
+  ULONGLONG                   m_ullStartTime;     // RtsdQueryTime the stream last started to run.
+  ULONGLONG                   m_ullStartFrames;   // Clock then, or while not running.
+  volatile LONGLONG           m_llDoneFrames;     // Frames transferred since the stream stopped.
+  ULONG                       m_ulSkipped;        // Frames Service left out.
+  CYCLIC_NOTIFICATION         m_Notifications[CYCLIC_MAX_NOTIFICATIONS];
+  ULONG                       m_ulNotifications;  // In use, from the start of m_Notifications.
+
+  ULONGLONG GetClockFrames(IN ULONGLONG CurrentTime);
+  void Notify(IN ULONGLONG FromFrames, IN ULONGLONG ToFrames);
+
+public:
+  CCyclicBuffer();
+
+  void Init(IN PCYCLIC_TRANSFER Transfer, IN PCYCLIC_NOTIFY Notify, IN PVOID Context, IN BOOLEAN Capture);
+  void SetFormat(IN ULONG BlockAlign, IN ULONG Rate);
+  ULONG SetBuffer(IN PVOID Buffer, IN ULONG BufferSize);
+  void SetRegister(IN volatile ULONG *Register);
+  void SetState(IN ULONG State, IN ULONGLONG CurrentTime);
+  ULONGLONG GetPosition(IN ULONGLONG CurrentTime);
+  ULONG GetOffset(IN ULONGLONG CurrentTime);
+  void Service(IN ULONGLONG CurrentTime);
+  NTSTATUS AddNotification(IN PVOID Notification, IN ULONG Offset);
+  BOOLEAN RemoveNotification(IN PVOID Notification);
+
+  ULONG     GetState(void)        { return m_State; }
+  ULONG     GetSkipped(void)      { return m_ulSkipped; }
+};
+typedef CCyclicBuffer *PCCyclicBuffer;
+
+#endif
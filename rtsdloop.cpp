@@ -0,0 +1,1023 @@
+/*
+Module Name:
+  rtsdloop.cpp
+
+Abstract:
+  Implementation of the loopback engine. Does nothing OS related itself,
+  everything goes through rtsdplat.h.
+*/
+
+#include "rtsdloop.h"
+
+//=============================================================================
+// Conversion kernel of samples that are already in the right layout.
+//=============================================================================
+static void CopySamples(OUT PVOID Destination, IN PVOID Source, IN ULONG SampleCount)
+{
+  RtlCopyMemory(Destination, Source, SampleCount * sizeof(LONG));
+}
+
+//=============================================================================
+// What a Read does to the frames between the ring and the reader's buffer.
+//=============================================================================
+typedef struct _LOOPBACK_READ_PATH {
+  ULONG                       RingChannels;
+  ULONG                       Channels;           // per frame of the reader's buffer
+  ULONG                       FrameSize;          // bytes per frame of the reader's buffer
+  PLOOPBACK_CONVERT           Convert;
+  PLOOPBACK_CONVERT           Unpack;             // float ring to pivot, NULL for a pivot ring
+  BOOLEAN                     Direct;             // Mix writes the reader's buffer from the ring
+  PLOOPBACK_MIX_KERNEL        Mix;
+  PLOOPBACK_MATRIX            Matrix;             // NULL if the channels pass unchanged
+  PLOOPBACK_DITHER_KERNEL     DitherKernel;
+  PLOOPBACK_DITHER            Dither;             // NULL to truncate
+} LOOPBACK_READ_PATH, *PLOOPBACK_READ_PATH;
+
+//=============================================================================
+// Converts Count frames out of the ring. Unpacking a float ring, a mix and
+// the dither work on pivot samples in a chunk on the stack, because the
+// other readers still need the ring as it is. A mix into the ring's own
+// sample type goes straight to the reader's buffer, so a stream that picks
+// a few channels only moves those.
+//=============================================================================
+__forceinline void ConvertFromRing(PUCHAR Destination, PLONG Ring, ULONG Count, PLOOPBACK_READ_PATH Path)
+{
+  if (Path->Direct) {
+    Path->Mix((PLONG)Destination, Ring, Count, Path->Matrix);
+    return;
+  }
+  if (!Path->Unpack && !Path->Matrix && !Path->Dither) {
+    Path->Convert(Destination, Ring, Count * Path->Channels);
+    return;
+  }
+
+  //a float ring that is mixed needs room for the unpacked frames as well
+  LONG scratch[LOOPBACK_READ_CHUNK];
+  PLONG pPivot = scratch;
+  ULONG chunkFrames = LOOPBACK_READ_CHUNK / Path->Channels;
+  if (Path->Unpack && Path->Matrix) {
+    chunkFrames = LOOPBACK_READ_CHUNK / (Path->RingChannels + Path->Channels);
+    pPivot = scratch + chunkFrames * Path->Channels;
+  }
+
+  while (Count) {
+    ULONG frames = RTSD_MIN(Count, chunkFrames);
+    PLONG pFrames = Ring;
+    if (Path->Unpack) {
+      Path->Unpack(pPivot, Ring, frames * Path->RingChannels);
+      pFrames = pPivot;
+    }
+    if (Path->Matrix) {
+      Path->Mix(scratch, pFrames, frames, Path->Matrix);
+    } else if (!Path->Unpack) {
+      RtlCopyMemory(scratch, Ring, frames * Path->Channels * sizeof(LONG));
+    }
+    if (Path->Dither) {
+      Path->DitherKernel(scratch, frames, Path->Dither);
+    }
+    Path->Convert(Destination, scratch, frames * Path->Channels);
+
+    Destination += frames * Path->FrameSize;
+    Ring += frames * Path->RingChannels;
+    Count -= frames;
+  }
+}
+
+//=============================================================================
+// Converts Count frames of Channels samples into the ring. Pack, if not
+// NULL, turns the pivot samples Convert makes into the samples of a float
+// ring, a chunk at a time on the stack. FrameSize is the size of a frame
+// outside the ring.
+//=============================================================================
+__forceinline void ConvertToRing(PLONG Ring, ULONG Channels, PUCHAR Source, ULONG FrameSize, ULONG Count, PLOOPBACK_CONVERT Convert, PLOOPBACK_CONVERT Pack)
+{
+  if (!Pack) {
+    Convert(Ring, Source, Count * Channels);
+    return;
+  }
+
+  LONG scratch[LOOPBACK_READ_CHUNK];
+  ULONG chunkFrames = LOOPBACK_READ_CHUNK / Channels;
+
+  while (Count) {
+    ULONG frames = RTSD_MIN(Count, chunkFrames);
+    Convert(scratch, Source, frames * Channels);
+    Pack(Ring, scratch, frames * Channels);
+
+    Source += frames * FrameSize;
+    Ring += frames * Channels;
+    Count -= frames;
+  }
+}
+
+//=============================================================================
+// Converts Count frames starting at cursor Position out of / into the ring,
+// in at most two blocks split where the ring wraps.
+//=============================================================================
+__forceinline void ReadRing(PUCHAR Destination, PLONG Ring, ULONG Mask, LONGLONG Position, ULONG Count, PLOOPBACK_READ_PATH Path)
+{
+  ULONG offset = (ULONG)Position & Mask;
+  ULONG firstCount = RTSD_MIN(Count, Mask + 1 - offset);
+  ConvertFromRing(Destination, Ring + offset * Path->RingChannels, firstCount, Path);
+  ConvertFromRing(Destination + firstCount * Path->FrameSize, Ring, Count - firstCount, Path);
+}
+
+__forceinline void WriteRing(PLONG Ring, ULONG Mask, ULONG Channels, LONGLONG Position, PUCHAR Source, ULONG FrameSize, ULONG Count, PLOOPBACK_CONVERT Convert, PLOOPBACK_CONVERT Pack)
+{
+  ULONG offset = (ULONG)Position & Mask;
+  ULONG firstCount = RTSD_MIN(Count, Mask + 1 - offset);
+  ConvertToRing(Ring + offset * Channels, Channels, Source, FrameSize, firstCount, Convert, Pack);
+  ConvertToRing(Ring, Channels, Source + firstCount * FrameSize, FrameSize, Count - firstCount, Convert, Pack);
+}
+
+//=============================================================================
+// Scales the IEEE float with the bit pattern Bits by Num / Den, Num <= Den.
+// Uses integer math only, so the engine never touches the FPU state.
+// Results too small for a normal float are flushed to zero.
+//=============================================================================
+__forceinline ULONG ScaleFloatBits(ULONG Bits, ULONG Num, ULONG Den)
+{
+  ULONG sign = Bits & 0x80000000;
+  LONG exponent = (Bits >> 23) & 0xFF;
+
+  if ((exponent == 0xFF) || (Num == Den)) {
+    return Bits;                        // Inf / NaN, or nothing to do
+  }
+  if (!exponent || !Num) {
+    return sign;                        // (denormal) zero stays zero
+  }
+
+  // 24 bit mantissa with 24 extra bits for the division
+  ULONGLONG mantissa = ((ULONGLONG)((Bits & 0x7FFFFF) | 0x800000) << 24) * Num / Den;
+  while (mantissa < ((ULONGLONG)1 << 47)) {
+    mantissa <<= 1;
+    exponent--;
+  }
+  if (exponent <= 0) {
+    return sign;
+  }
+
+  return sign | ((ULONG)exponent << 23) | ((ULONG)(mantissa >> 24) & 0x7FFFFF);
+}
+
+#ifndef RTSD_USERMODE
+#pragma code_seg("PAGE")
+#endif
+
+//=============================================================================
+CLoopbackBuffer::CLoopbackBuffer()
+/*
+Routine Description:
+  Constructor for the loopback engine. No ring is allocated yet.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  m_pBuffer = NULL;
+  m_ulSize = 0;
+  m_ulMask = 0;
+  m_ulChannels = 0;
+  m_ulFrameSize = 0;
+  m_SampleType = LOOPBACK_SAMPLE_INT32;
+  m_pConverters = GetConverters(GetBestConvertLevel());
+  m_ulOverrunPolicy = RTSD_OVERRUN_DROP_OLDEST;
+  m_ulUnderrunMode = RTSD_UNDERRUN_SILENCE_HEAD;
+  m_lRunningCount = 0;
+  m_llGatePos = 0;
+  RtlZeroMemory(&m_Writer, sizeof(m_Writer));
+  RtlZeroMemory(m_Readers, sizeof(m_Readers));
+} // CLoopbackBuffer
+
+//=============================================================================
+CLoopbackBuffer::~CLoopbackBuffer()
+/*
+Routine Description:
+  Destructor for the loopback engine
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+
+  Free();
+} // ~CLoopbackBuffer
+
+//=============================================================================
+NTSTATUS CLoopbackBuffer::Allocate(
+  IN  ULONG                   Frames,
+  IN  ULONG                   Channels,
+  IN  LOOPBACK_SAMPLE_TYPE    SampleType
+)
+/*
+Routine Description:
+  (Re)allocates the ring for at least Frames frames of Channels samples,
+  rounded up to a power of two frames and capped at
+  LOOPBACK_BUFFER_MAX_BYTES, and resets its cursors and counters. The
+  samples are pivot samples, or float samples for float streams, which the
+  pivot would clip above full scale and truncate to 32 bit.
+  Must only be called while nobody reads or writes, attached readers stay
+  attached.
+
+Arguments:
+  Frames - requested size of the ring
+  Channels - samples per frame
+  SampleType - LOOPBACK_SAMPLE_INT32 or LOOPBACK_SAMPLE_FLOAT32
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  ULONG FrameSize = Channels * sizeof(LONG);
+  if (!Channels || (Channels > LOOPBACK_READ_CHUNK) ||
+      ((SampleType != LOOPBACK_SAMPLE_INT32) && (SampleType != LOOPBACK_SAMPLE_FLOAT32))) {
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  ULONG size = 1;
+  while ((size < Frames) && ((size << 1) * FrameSize <= LOOPBACK_BUFFER_MAX_BYTES)) {
+    size <<= 1;
+  }
+
+  RtlZeroMemory(&m_Writer, sizeof(m_Writer));
+  m_llGatePos = 0;
+  m_SampleType = SampleType;
+  for (ULONG i = 0; i < RTSD_LOOPBACK_MAX_READERS; i++) {
+    m_Readers[i].ReadPos = 0;
+    m_Readers[i].StretchSeen = 0;
+    m_Readers[i].StretchPending = 0;
+  }
+
+  if (m_pBuffer && (m_ulSize == size) && (m_ulFrameSize == FrameSize)) {
+    return STATUS_SUCCESS;
+  }
+
+  Free();
+
+  m_pBuffer = (PUCHAR) RtsdAllocate(size * FrameSize);
+  if (!m_pBuffer) {
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  m_ulSize = size;
+  m_ulMask = size - 1;
+  m_ulChannels = Channels;
+  m_ulFrameSize = FrameSize;
+
+  return STATUS_SUCCESS;
+} // Allocate
+
+//=============================================================================
+void CLoopbackBuffer::Free(void)
+/*
+Routine Description:
+  Frees the ring. Must only be called while nobody reads or writes.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+
+  if (m_pBuffer) {
+    RtsdFree(m_pBuffer);
+    m_pBuffer = NULL;
+    m_ulSize = 0;
+    m_ulMask = 0;
+    m_ulChannels = 0;
+    m_ulFrameSize = 0;
+  }
+} // Free
+
+//=============================================================================
+NTSTATUS CLoopbackBuffer::AttachReader(
+  OUT PULONG                  Reader
+)
+/*
+Routine Description:
+  Hands a free reader slot to a new capture stream. The reader does not
+  hold the writer back until StartReader.
+
+Arguments:
+  Reader - receives the slot index
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(Reader);
+
+  for (ULONG i = 0; i < RTSD_LOOPBACK_MAX_READERS; i++) {
+    PLOOPBACK_READER pReader = &m_Readers[i];
+
+    if (!pReader->Active) {
+      pReader->OverrunCount = 0;
+      pReader->StretchSeen = LoadAcquire(&m_Writer.StretchCount);
+      pReader->StretchPending = 0;
+      RtlZeroMemory(pReader->UnderrunCount, sizeof(pReader->UnderrunCount));
+      StoreRelease(&pReader->ReadPos, LoadAcquire(&m_Writer.WritePos));
+
+      RtsdInterlockedStore(&pReader->Active, TRUE);
+
+      *Reader = i;
+      return STATUS_SUCCESS;
+    }
+  }
+
+  return STATUS_INSUFFICIENT_RESOURCES;
+} // AttachReader
+
+//=============================================================================
+void CLoopbackBuffer::DetachReader(
+  IN  ULONG                   Reader
+)
+/*
+Routine Description:
+  Releases the slot of a capture stream that is going away.
+
+Arguments:
+  Reader - slot index returned by AttachReader
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(Reader < RTSD_LOOPBACK_MAX_READERS);
+
+  StopReader(Reader);
+  RtsdInterlockedStore(&m_Readers[Reader].Active, FALSE);
+} // DetachReader
+
+//=============================================================================
+void CLoopbackBuffer::StartReader(
+  IN  ULONG                   Reader
+)
+/*
+Routine Description:
+  Lets a reader hold the writer back, from the current write cursor on:
+  what it did not read before is dropped, so it only sees audio written
+  from now on. The writer may be running while this is called.
+
+Arguments:
+  Reader - slot index returned by AttachReader
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(Reader < RTSD_LOOPBACK_MAX_READERS);
+
+  PLOOPBACK_READER pReader = &m_Readers[Reader];
+
+  if (!pReader->Active || pReader->Running) {
+    return;
+  }
+
+  pReader->StretchSeen = LoadAcquire(&m_Writer.StretchCount);
+  pReader->StretchPending = 0;
+  StoreRelease(&pReader->ReadPos, RTSD_MAX(LoadAcquire(&m_Writer.WritePos), pReader->ReadPos));
+
+  // Without other running readers the gate is stale, move it up to us
+  // before Write starts to honour it again.
+  if (!m_lRunningCount) {
+    StoreMax(&m_llGatePos, pReader->ReadPos);
+  }
+
+  RtsdInterlockedStore(&pReader->Running, TRUE);
+  RtsdInterlockedAdd(&m_lRunningCount, 1);
+} // StartReader
+
+//=============================================================================
+void CLoopbackBuffer::StopReader(
+  IN  ULONG                   Reader
+)
+/*
+Routine Description:
+  Stops a reader from holding the writer back, while its stream pauses or
+  stops.
+
+Arguments:
+  Reader - slot index returned by AttachReader
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(Reader < RTSD_LOOPBACK_MAX_READERS);
+
+  if (m_Readers[Reader].Running) {
+    RtsdInterlockedStore(&m_Readers[Reader].Running, FALSE);
+    RtsdInterlockedAdd(&m_lRunningCount, -1);
+
+    // This may have been the slowest reader, let the writer move on.
+    UpdateReaderGate();
+  }
+} // StopReader
+
+//=============================================================================
+void CLoopbackBuffer::GetStatistics(
+  OUT PRTSD_LOOPBACK_STATISTICS Statistics
+)
+/*
+Routine Description:
+  Fills in the overrun counters of the writer and the counters of every
+  reader slot.
+
+Arguments:
+  Statistics - receives the counters
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(Statistics);
+
+  Statistics->OverrunDropOldest = m_Writer.OverrunCount[RTSD_OVERRUN_DROP_OLDEST];
+  Statistics->OverrunDropNewest = m_Writer.OverrunCount[RTSD_OVERRUN_DROP_NEWEST];
+  Statistics->OverrunStretch    = m_Writer.OverrunCount[RTSD_OVERRUN_STRETCH];
+
+  for (ULONG i = 0; i < RTSD_LOOPBACK_MAX_READERS; i++) {
+    PRTSD_LOOPBACK_READER_STATISTICS pReader = &Statistics->Readers[i];
+
+    pReader->Active              = m_Readers[i].Active;
+    pReader->Overrun             = m_Readers[i].OverrunCount;
+    pReader->UnderrunSilenceHead = m_Readers[i].UnderrunCount[RTSD_UNDERRUN_SILENCE_HEAD];
+    pReader->UnderrunSilenceTail = m_Readers[i].UnderrunCount[RTSD_UNDERRUN_SILENCE_TAIL];
+    pReader->UnderrunRepeat      = m_Readers[i].UnderrunCount[RTSD_UNDERRUN_REPEAT];
+    pReader->UnderrunFade        = m_Readers[i].UnderrunCount[RTSD_UNDERRUN_FADE];
+  }
+} // GetStatistics
+
+//=============================================================================
+NTSTATUS CLoopbackBuffer::SetOverrunPolicy(
+  IN  ULONG                   Policy
+)
+/*
+Routine Description:
+  Selects the RTSD_OVERRUN_POLICY. Write picks it up with its next call.
+
+Arguments:
+  Policy - new policy
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  if (Policy >= RTSD_OVERRUN_POLICY_COUNT) {
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  m_ulOverrunPolicy = Policy;
+  return STATUS_SUCCESS;
+} // SetOverrunPolicy
+
+//=============================================================================
+NTSTATUS CLoopbackBuffer::SetUnderrunMode(
+  IN  ULONG                   Mode
+)
+/*
+Routine Description:
+  Selects the RTSD_UNDERRUN_MODE. Read picks it up with its next call.
+
+Arguments:
+  Mode - new mode
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  if (Mode >= RTSD_UNDERRUN_MODE_COUNT) {
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  m_ulUnderrunMode = Mode;
+  return STATUS_SUCCESS;
+} // SetUnderrunMode
+
+//=============================================================================
+NTSTATUS CLoopbackBuffer::SetConvertLevel(
+  IN  ULONG                   Level
+)
+/*
+Routine Description:
+  Selects the LOOPBACK_CONVERT_LEVEL of the conversion kernels. The best
+  one the processor supports is used by default. Read and Write pick it up
+  with their next call.
+
+Arguments:
+  Level - new level
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  if (Level > (ULONG)GetBestConvertLevel()) {
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  m_pConverters = GetConverters((LOOPBACK_CONVERT_LEVEL)Level);
+  return STATUS_SUCCESS;
+} // SetConvertLevel
+
+#ifdef RTSD_USERMODE
+//=============================================================================
+void CLoopbackBuffer::SetCursors(
+  IN  LONGLONG                Position
+)
+/*
+Routine Description:
+  Moves all cursors to Position, as if that many frames had been written
+  and read by every reader, so tests can reach cursor values a real stream only reaches
+  after hours. Must only be called while nobody reads or writes.
+
+Arguments:
+  Position - new value of the cursors
+
+Return Value:
+  void
+*/
+{
+  m_Writer.WritePos = Position;
+  m_Writer.WriteReserve = Position;
+  m_llGatePos = Position;
+  for (ULONG i = 0; i < RTSD_LOOPBACK_MAX_READERS; i++) {
+    m_Readers[i].ReadPos = Position;
+  }
+} // SetCursors
+#endif
+
+#ifndef RTSD_USERMODE
+#pragma code_seg()
+#endif
+
+//=============================================================================
+void CLoopbackBuffer::UpdateReaderGate(void)
+/*
+Routine Description:
+  Raises m_llGatePos to the slowest running read cursor. Called by every
+  reader after it moved its cursor, so Write only has to look at the gate.
+  Cursors only move forward, so the minimum seen here never exceeds the
+  real one.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  LONGLONG gatePos = LoadAcquire(&m_Writer.WritePos);
+
+  for (ULONG i = 0; i < RTSD_LOOPBACK_MAX_READERS; i++) {
+    if (m_Readers[i].Running) {
+      LONGLONG readPos = LoadAcquire(&m_Readers[i].ReadPos);
+      if (readPos < gatePos)
+        gatePos = readPos;
+    }
+  }
+
+  StoreMax(&m_llGatePos, gatePos);
+} // UpdateReaderGate
+
+//=============================================================================
+LONG CLoopbackBuffer::TakeStretchCount(
+  IN  PLOOPBACK_READER        Reader
+)
+/*
+Routine Description:
+  Works out how many of the frames Write kept out since the reader last
+  looked were kept out for lack of room behind this reader, so Write never
+  has to look at the readers. The read cursor has not moved since then:
+  the writer offered WritePos + kept out frames in that time, of which
+  the frames past ReadPos + the ring size had no room behind this reader.
+  Only the reader itself may call it.
+
+Arguments:
+  Reader - the reader's slot
+
+Return Value:
+  Number of frames
+*/
+{
+  //the count first, the cursor is then at least as new
+  LONGLONG stretchCount = LoadAcquire(&m_Writer.StretchCount);
+  LONGLONG keptOut = stretchCount - Reader->StretchSeen;
+
+  if (!keptOut) {
+    return 0;
+  }
+  Reader->StretchSeen = stretchCount;
+
+  LONGLONG behind = LoadAcquire(&m_Writer.WritePos) + keptOut - Reader->ReadPos - m_ulSize;
+  return (LONG)RTSD_MAX(RTSD_MIN(behind, RTSD_MIN(keptOut, (LONGLONG)m_ulSize)), 0);
+} // TakeStretchCount
+
+//=============================================================================
+void CLoopbackBuffer::FadeOut(
+  IN OUT PUCHAR               Frames,
+  IN  LOOPBACK_SAMPLE_TYPE    SampleType,
+  IN  ULONG                   Channels,
+  IN  ULONG                   FrameCount
+)
+/*
+Routine Description:
+  Fades FrameCount frames linearly to silence. Every frame gets one gain,
+  so all channels fade together.
+
+Arguments:
+  Frames - frames to fade
+  SampleType - layout of the samples in Frames
+  Channels - samples per frame
+  FrameCount - number of frames
+
+Return Value:
+  void
+*/
+{
+  ULONG samplesPerFrame = Channels;
+
+  switch (SampleType) {
+    case LOOPBACK_SAMPLE_INT16: {
+      PSHORT pSample = (PSHORT)Frames;
+      for (ULONG k = 0; k < FrameCount; k++) {
+        for (ULONG c = 0; c < samplesPerFrame; c++, pSample++) {
+          *pSample = (SHORT)(((LONG)*pSample * (LONG)(FrameCount - k)) / (LONG)FrameCount);
+        }
+      }
+      break;
+    }
+
+    case LOOPBACK_SAMPLE_INT24: {
+      PUCHAR pSample = Frames;
+      for (ULONG k = 0; k < FrameCount; k++) {
+        for (ULONG c = 0; c < samplesPerFrame; c++, pSample += 3) {
+          LONG value = (LONG)(((ULONG)pSample[0] << 8) | ((ULONG)pSample[1] << 16) | ((ULONG)pSample[2] << 24)) >> 8;
+          value = (LONG)(((LONGLONG)value * (FrameCount - k)) / FrameCount);
+          pSample[0] = (UCHAR)value;
+          pSample[1] = (UCHAR)(value >> 8);
+          pSample[2] = (UCHAR)(value >> 16);
+        }
+      }
+      break;
+    }
+
+    case LOOPBACK_SAMPLE_INT32: {
+      PLONG pSample = (PLONG)Frames;
+      for (ULONG k = 0; k < FrameCount; k++) {
+        for (ULONG c = 0; c < samplesPerFrame; c++, pSample++) {
+          *pSample = (LONG)(((LONGLONG)*pSample * (FrameCount - k)) / FrameCount);
+        }
+      }
+      break;
+    }
+
+    case LOOPBACK_SAMPLE_FLOAT32: {
+      PULONG pSample = (PULONG)Frames;
+      for (ULONG k = 0; k < FrameCount; k++) {
+        for (ULONG c = 0; c < samplesPerFrame; c++, pSample++) {
+          *pSample = ScaleFloatBits(*pSample, FrameCount - k, FrameCount);
+        }
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+} // FadeOut
+
+//=============================================================================
+void CLoopbackBuffer::Write(
+  IN  PVOID                   Source,
+  IN  LOOPBACK_SAMPLE_TYPE    SourceType,
+  IN  ULONG                   FrameCount
+)
+/*
+Routine Description:
+  Appends FrameCount frames to the ring, converted to the ring's samples,
+  applying the overrun policy if the slowest running reader has not made
+  room for all of them.
+
+Arguments:
+  Source - frames to append, m_ulChannels samples each
+  SourceType - layout of the samples in Source
+  FrameCount - number of frames
+
+Return Value:
+  void
+*/
+{
+  PLONG pRing = (PLONG)m_pBuffer;
+  PUCHAR pSource = (PUCHAR) Source;
+  ULONG frameSize = LoopbackSampleSize[SourceType] * m_ulChannels;
+  LONGLONG writePos = m_Writer.WritePos; //we are the only writer of the write cursor
+  LONGLONG gatePos = LoadAcquire(&m_llGatePos);
+  ULONG size = m_ulSize;
+  ULONG stretchCount = 0;
+
+  ASSERT(pRing);
+
+  //frames in the ring's own layout are copied as they are
+  PLOOPBACK_CONVERT convert = m_pConverters->ToPivot[SourceType];
+  PLOOPBACK_CONVERT pack = NULL;
+  if (SourceType == m_SampleType) {
+    convert = CopySamples;
+  } else if (m_SampleType != LOOPBACK_SAMPLE_INT32) {
+    pack = m_pConverters->FromPivot[m_SampleType];
+  }
+
+  //the cursors never wrap, so the fill level is a plain difference and
+  //the whole ring can be used. The gate is the slowest reader, which may be
+  //more than a ring behind once it was lapped. Without running readers
+  //nothing can overrun.
+  ULONG freeCount = (writePos - gatePos >= size) ? 0 : size - (ULONG)(writePos - gatePos);
+  if (!m_lRunningCount) {
+    freeCount = size;
+  }
+  if (FrameCount > freeCount) {
+    ULONG policy = m_ulOverrunPolicy;
+    m_Writer.OverrunCount[policy]++;
+
+    switch (policy) {
+      case RTSD_OVERRUN_DROP_OLDEST:
+        //overwrite the oldest frames, Read skips over them in one step.
+        //of a period longer than the whole ring only the tail survives
+        if (FrameCount > size) {
+          pSource += (FrameCount - size) * frameSize;
+          writePos += FrameCount - size;
+          FrameCount = size;
+        }
+        break;
+
+      case RTSD_OVERRUN_STRETCH:
+        //keep what fits and count the rest, each reader works out how much
+        //of it was its own doing when it reads
+        stretchCount = FrameCount - freeCount;
+        FrameCount = freeCount;
+        break;
+
+      default:
+        //keep what fits, the rest of this period is lost
+        FrameCount = freeCount;
+        break;
+    }
+  }
+
+  //announce the range we are about to (over)write before touching it
+  StoreRelease(&m_Writer.WriteReserve, writePos + FrameCount);
+  RtsdMemoryBarrier();
+
+  WriteRing(pRing, m_ulMask, m_ulChannels, writePos, pSource, frameSize, FrameCount, convert, pack);
+
+  writePos += FrameCount;
+
+  //make the new frames visible to Read, stamped with the time and length
+  //of this period for GetFillLevel. It retries while the sequence is odd
+  LONG sequence = m_Writer.StampSequence;
+  RtsdInterlockedStore(&m_Writer.StampSequence, sequence + 1);
+  m_Writer.WriteCount = FrameCount;
+  m_Writer.WriteTime = RtsdQueryTime();
+  StoreRelease(&m_Writer.WritePos, writePos);
+  RtsdInterlockedStore(&m_Writer.StampSequence, sequence + 2);
+
+  //after the write cursor, so a reader that sees the count sees the cursor
+  //of the same period too
+  if (stretchCount) {
+    StoreRelease(&m_Writer.StretchCount, m_Writer.StretchCount + stretchCount);
+  }
+} // Write
+
+//=============================================================================
+void CLoopbackBuffer::Read(
+  IN  ULONG                   Reader,
+  OUT PVOID                   Destination,
+  IN  LOOPBACK_SAMPLE_TYPE    DestinationType,
+  IN  ULONG                   FrameCount,
+  IN  PLOOPBACK_MATRIX        Matrix,
+  IN OUT PLOOPBACK_DITHER     Dither
+)
+/*
+Routine Description:
+  Hands the next FrameCount frames to a reader, converted to its sample
+  layout. If the writer lapped
+  the reader it skips ahead; if the writer has not delivered enough
+  frames the gap is concealed according to the underrun mode. Only the
+  owner of the slot may call this.
+
+Arguments:
+  Reader - slot index returned by AttachReader
+  Destination - receives the frames, m_ulChannels samples each or the
+                output channels of Matrix
+  DestinationType - layout of the samples in Destination
+  FrameCount - number of frames
+  Matrix - channel mix of the reader, see InitMatrix. NULL to pass the
+           channels unchanged.
+  Dither - dither state of the reader, see InitDither. NULL to truncate.
+
+Return Value:
+  void
+*/
+{
+  ASSERT(Reader < RTSD_LOOPBACK_MAX_READERS);
+
+  PLOOPBACK_READER pReader = &m_Readers[Reader];
+  PLONG pRing = (PLONG)m_pBuffer;
+  LONGLONG readPos = pReader->ReadPos; //we are the only writer of our read cursor
+  LONGLONG oldestPos = readPos;
+  ULONG size = m_ulSize;
+  ULONG mask = m_ulMask;
+  ULONG mode = m_ulUnderrunMode;
+  ULONG copyCount, missingCount;
+
+  ASSERT(pRing);
+
+  //what the writer kept out while the cursor stood where it is counts
+  //before the cursor moves
+  LONG stretchCount = pReader->StretchPending + TakeStretchCount(pReader);
+  pReader->StretchPending = RTSD_MIN(stretchCount, (LONG)size);
+
+  LOOPBACK_READ_PATH path;
+  path.RingChannels = m_ulChannels;
+  path.Channels = Matrix ? Matrix->OutputChannels : m_ulChannels;
+  path.FrameSize = LoopbackSampleSize[DestinationType] * path.Channels;
+  path.Convert = m_pConverters->FromPivot[DestinationType];
+  path.Unpack = NULL;
+  path.Direct = FALSE;
+  path.Mix = m_pConverters->Mix;
+  path.Matrix = Matrix;
+  path.DitherKernel = m_pConverters->Dither;
+  path.Dither = Dither;
+  ULONG frameSize = path.FrameSize;
+
+  //a reader of the ring's own layout and channels gets a plain copy, one
+  //of its own layout and other channels a mix straight out of the ring, as
+  //long as the mix only selects from a float ring. The others go through
+  //the pivot.
+  ASSERT(!Matrix || (Matrix->InputChannels == m_ulChannels));
+  if ((DestinationType == m_SampleType) && !Matrix) {
+    path.Convert = CopySamples;
+  } else if ((DestinationType == m_SampleType) && !Dither &&
+             ((m_SampleType == LOOPBACK_SAMPLE_INT32) || Matrix->Select)) {
+    path.Direct = TRUE;
+  } else if (m_SampleType != LOOPBACK_SAMPLE_INT32) {
+    path.Unpack = m_pConverters->ToPivot[m_SampleType];
+  }
+
+  for (;;) {
+    LONGLONG writePos = LoadAcquire(&m_Writer.WritePos);
+
+    //the writer lapped us (RTSD_OVERRUN_DROP_OLDEST) - skip everything it
+    //overwrote in one step
+    if ((writePos - size > readPos) || (oldestPos > readPos)) {
+      readPos = RTSD_MAX(writePos - size, oldestPos);
+      pReader->OverrunCount++;
+    }
+
+    copyCount = (ULONG)RTSD_MIN(writePos - readPos, (LONGLONG)FrameCount);
+    missingCount = FrameCount - copyCount;
+
+    PUCHAR pData = (PUCHAR)Destination;
+    PUCHAR pGap = pData + copyCount * frameSize;
+    LONGLONG firstPos = readPos;
+
+    //only RTSD_UNDERRUN_SILENCE_HEAD puts the gap in front of the data
+    if (mode == RTSD_UNDERRUN_SILENCE_HEAD) {
+      RtlZeroMemory(pData, missingCount * frameSize);
+      pData += missingCount * frameSize;
+      pGap = NULL;
+    }
+
+    ReadRing(pData, pRing, mask, readPos, copyCount, &path);
+
+    if (missingCount && pGap) {
+      //the frames we just handed out (and those before them) are still in
+      //the ring behind the read cursor, repeat them to fill the gap. There
+      //is never more than a ring of them, older ones are overwritten
+      LONGLONG endPos = readPos + copyCount;
+      ULONG fillCount = (mode == RTSD_UNDERRUN_FADE) ? RTSD_MIN(missingCount, LOOPBACK_FADE_FRAMES) : missingCount;
+      ULONG historyCount = (ULONG)RTSD_MIN(RTSD_MIN((LONGLONG)fillCount, endPos), (LONGLONG)size);
+
+      if ((mode == RTSD_UNDERRUN_SILENCE_TAIL) || !historyCount) {
+        fillCount = 0;
+      } else {
+        firstPos = RTSD_MIN(firstPos, endPos - historyCount);
+        for (ULONG done = 0; done < fillCount; done += historyCount) {
+          ReadRing(pGap + done * frameSize, pRing, mask, endPos - historyCount, RTSD_MIN(historyCount, fillCount - done), &path);
+        }
+        if (mode == RTSD_UNDERRUN_FADE) {
+          FadeOut(pGap, DestinationType, path.Channels, fillCount);
+        }
+      }
+      RtlZeroMemory(pGap + fillCount * frameSize, (missingCount - fillCount) * frameSize);
+    }
+
+    //if the writer started to overwrite what we just copied, copy again
+    //from the oldest frame that is still intact
+    RtsdMemoryBarrier();
+    oldestPos = LoadAcquire(&m_Writer.WriteReserve) - size;
+    if (oldestPos <= firstPos) {
+      readPos += copyCount;
+      break;
+    }
+  }
+
+  if (missingCount) {
+    pReader->UnderrunCount[mode]++;
+  }
+
+  //hand the consumed slots back to Write
+  StoreRelease(&pReader->ReadPos, readPos);
+  UpdateReaderGate();
+} // Read
+
+//=============================================================================
+LONG CLoopbackBuffer::GetFillLevel(
+  IN  ULONG                   Reader,
+  IN  ULONG                   Rate
+)
+/*
+Routine Description:
+  Returns how many frames the writer is ahead of a reader, at most a ring.
+  The writer delivers a period at a time; with Rate given, the frames of
+  its last period only count as far as they would have been played by
+  now, so the result does not jump with the phase between the two sides.
+  It can then be negative. Only the reader itself may ask, its cursor does
+  not move meanwhile.
+
+Arguments:
+  Reader - slot index returned by AttachReader
+  Rate - frames per second of the ring, 0 for the plain fill level
+
+Return Value:
+  Number of frames
+*/
+{
+  ASSERT(Reader < RTSD_LOOPBACK_MAX_READERS);
+
+  LONGLONG writePos, writeTime;
+  LONGLONG count;
+  LONG sequence;
+
+  //the cursor and the stamp of the period that ended there have to belong
+  //together, read them again if the writer moved on meanwhile
+  do {
+    sequence = m_Writer.StampSequence;
+    RtsdMemoryBarrier();
+    writePos = m_Writer.WritePos;
+    writeTime = m_Writer.WriteTime;
+    count = m_Writer.WriteCount;
+    RtsdMemoryBarrier();
+  } while ((sequence & 1) || (sequence != m_Writer.StampSequence));
+
+  if (Rate) {
+    LONGLONG elapsed = (LONGLONG)RtsdQueryTime() - writeTime;
+    writePos -= count - RTSD_MAX(RTSD_MIN(elapsed * Rate / _100NS_UNITS_PER_SECOND, count), 0);
+  }
+
+  return (LONG)RTSD_MIN(writePos - m_Readers[Reader].ReadPos, (LONGLONG)m_ulSize);
+} // GetFillLevel
+
+//=============================================================================
+LONG CLoopbackBuffer::TakeStretchPending(
+  IN  ULONG                   Reader
+)
+/*
+Routine Description:
+  Returns the frames RTSD_OVERRUN_STRETCH kept out of the ring for lack of
+  room behind a reader since its last call, and clears them. At most a
+  ring. Only the reader itself may ask.
+
+Arguments:
+  Reader - slot index returned by AttachReader
+
+Return Value:
+  Number of frames
+*/
+{
+  ASSERT(Reader < RTSD_LOOPBACK_MAX_READERS);
+
+  PLOOPBACK_READER pReader = &m_Readers[Reader];
+  LONG pending = pReader->StretchPending + TakeStretchCount(pReader);
+
+  pReader->StretchPending = 0;
+  return RTSD_MIN(pending, (LONG)m_ulSize);
+} // TakeStretchPending
@@ -0,0 +1,164 @@
+/*
+Module Name:
+  rtsdloop.h
+
+Abstract:
+  Definition of the loopback engine, the ring the render stream writes and
+  the capture stream reads. It only depends on rtsdplat.h, rtsdprop.h and
+  rtsdconv.h.
+*/
+
+#ifndef __RTSDLOOP_H_
+#define __RTSDLOOP_H_
+
+#include "rtsdconv.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+
+// Largest ring that is allocated, in bytes.
+#define LOOPBACK_BUFFER_MAX_BYTES   0x1000000
+
+// Length of the fade to silence used by RTSD_UNDERRUN_FADE, in frames.
+#define LOOPBACK_FADE_FRAMES        128
+
+// Samples a Read or Write that goes through the pivot (a float ring, a mix
+// or dither) converts at a time, on the stack.
+#define LOOPBACK_READ_CHUNK         256
+
+// Cache line size. Used to keep the loopback producer and consumer state
+// apart so the render and capture DPCs don't bounce one line between cores.
+// Whatever holds a CLoopbackBuffer must start on a cache line for this to
+// hold, see CMiniportWaveCyclic::operator new.
+#define RTSD_CACHE_LINE             64
+
+//=============================================================================
+// Typedefs
+//=============================================================================
+
+// State only the writer changes while streaming. Fills a cache line.
+typedef struct DECLSPEC_ALIGN(RTSD_CACHE_LINE) _LOOPBACK_WRITER {
+  volatile LONGLONG WritePos;
+  volatile LONGLONG WriteReserve;
+  volatile LONGLONG WriteTime;          // RtsdQueryTime of the last Write
+  volatile LONGLONG StretchCount;       // Frames RTSD_OVERRUN_STRETCH kept out of the ring
+  ULONG             WriteCount;         // Frames of the last Write
+  volatile LONG     StampSequence;      // Odd while WritePos, WriteTime and WriteCount change
+  ULONG             OverrunCount[RTSD_OVERRUN_POLICY_COUNT];
+} LOOPBACK_WRITER, *PLOOPBACK_WRITER;
+C_ASSERT(sizeof(LOOPBACK_WRITER) == RTSD_CACHE_LINE);
+
+// One capture stream reading the loopback ring. The owning stream is the
+// only writer of ReadPos, the stretch state and the counters; Active is set
+// and cleared by AttachReader / DetachReader, Running by StartReader /
+// StopReader, all at PASSIVE_LEVEL. Only running readers hold the writer
+// back. A slot fills a cache line.
+typedef struct DECLSPEC_ALIGN(RTSD_CACHE_LINE) _LOOPBACK_READER {
+  volatile LONGLONG ReadPos;
+  LONGLONG          StretchSeen;        // m_Writer.StretchCount the reader last looked at
+  volatile LONG     Active;
+  volatile LONG     Running;
+  LONG              StretchPending;     // Frames this reader should catch up on
+  ULONG             OverrunCount;       // Times the writer lapped this reader
+  ULONG             UnderrunCount[RTSD_UNDERRUN_MODE_COUNT];
+} LOOPBACK_READER, *PLOOPBACK_READER;
+C_ASSERT(sizeof(LOOPBACK_READER) == RTSD_CACHE_LINE);
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CLoopbackBuffer
+//
+// Single producer / multiple consumer ring of frames:
+// only Write moves the write cursor and every reader moves only the ReadPos
+// of its own slot, so nobody needs a lock. Each cursor sits on its own
+// cache line. The cursors count whole frames since the ring was allocated
+// and are never wrapped; they are masked with m_ulMask when the ring is
+// indexed. So the fill level is a plain difference and the whole ring is
+// usable. Every move, drop and fill is a whole number of frames, so an
+// overrun can never shift the channel order. When the ring is full Write
+// applies the RTSD_OVERRUN_POLICY.
+// The ring holds pivot samples (see rtsdconv.h), or float samples if a
+// float stream allocated it, so float passes unchanged. Write converts from
+// the sample type of the render stream and Read to that of each capture
+// stream, and mixes the channels for capture streams that ask for it, so
+// only the render stream has to match the channel count of the ring.
+// Streams of the ring's sample type and channels get a plain copy.
+// With RTSD_OVERRUN_DROP_OLDEST the writer may overwrite unread frames. It
+// publishes WriteReserve before it does, so Read can tell whether what it
+// copied was overwritten underneath it. The other policies keep the writer
+// behind m_llGatePos, a lower bound of the read cursors of the running
+// readers that the readers maintain, so Write never has to look at the
+// individual readers. Under RTSD_OVERRUN_STRETCH it only counts the frames
+// it keeps out; each reader works out its own share of them when it reads.
+// When the ring holds less than a Read asks for, Read conceals the gap
+// according to the RTSD_UNDERRUN_MODE. The repeat modes take the frames
+// they repeat from behind the read cursor, so they need no history buffer.
+//
+// The ring is (re)allocated at PASSIVE_LEVEL while no stream is open, so
+// Write and Read never see it change and can run at any IRQL. AttachReader,
+// DetachReader, StartReader and StopReader run at PASSIVE_LEVEL while the
+// writer and the other readers may be running.
+
+class CLoopbackBuffer {
+private:
+  PUCHAR                      m_pBuffer;
+  ULONG                       m_ulSize;           // in frames, always a power of two
+  ULONG                       m_ulMask;           // m_ulSize - 1
+  ULONG                       m_ulChannels;
+  ULONG                       m_ulFrameSize;      // bytes per frame
+  LOOPBACK_SAMPLE_TYPE        m_SampleType;       // pivot or float samples
+  PCLOOPBACK_CONVERTERS       m_pConverters;
+  ULONG                       m_ulOverrunPolicy;
+  ULONG                       m_ulUnderrunMode;
+  volatile LONG               m_lRunningCount;    // Readers that hold the writer back.
+
+  // Each on cache lines of its own, apart from the configuration above.
+  LOOPBACK_WRITER             m_Writer;
+  DECLSPEC_ALIGN(RTSD_CACHE_LINE) volatile LONGLONG m_llGatePos;
+  LOOPBACK_READER             m_Readers[RTSD_LOOPBACK_MAX_READERS];
+
+  void UpdateReaderGate(void);
+  LONG TakeStretchCount(IN PLOOPBACK_READER Reader);
+  void FadeOut(IN OUT PUCHAR Frames, IN LOOPBACK_SAMPLE_TYPE SampleType, IN ULONG Channels, IN ULONG FrameCount);
+
+public:
+  CLoopbackBuffer();
+  ~CLoopbackBuffer();
+
+  NTSTATUS Allocate(IN ULONG Frames, IN ULONG Channels, IN LOOPBACK_SAMPLE_TYPE SampleType);
+  void Free(void);
+  NTSTATUS AttachReader(OUT PULONG Reader);
+  void DetachReader(IN ULONG Reader);
+  void StartReader(IN ULONG Reader);
+  void StopReader(IN ULONG Reader);
+
+  void Write(IN PVOID Source, IN LOOPBACK_SAMPLE_TYPE SourceType, IN ULONG FrameCount);
+  void Read(IN ULONG Reader, OUT PVOID Destination, IN LOOPBACK_SAMPLE_TYPE DestinationType, IN ULONG FrameCount, IN PLOOPBACK_MATRIX Matrix, IN OUT PLOOPBACK_DITHER Dither);
+
+  LONG GetFillLevel(IN ULONG Reader, IN ULONG Rate);
+  LONG TakeStretchPending(IN ULONG Reader);
+
+  void GetStatistics(OUT PRTSD_LOOPBACK_STATISTICS Statistics);
+
+  BOOLEAN IsAllocated(void)       { return m_pBuffer != NULL; }
+  ULONG   GetSize(void)           { return m_ulSize; }
+  ULONG   GetFrameSize(void)      { return m_ulFrameSize; }
+  ULONG   GetChannels(void)       { return m_ulChannels; }
+  LOOPBACK_SAMPLE_TYPE GetSampleType(void) { return m_SampleType; }
+  PCLOOPBACK_CONVERTERS GetConvertKernels(void) { return m_pConverters; }
+  ULONG   GetOverrunPolicy(void)  { return m_ulOverrunPolicy; }
+  ULONG   GetUnderrunMode(void)   { return m_ulUnderrunMode; }
+  NTSTATUS SetOverrunPolicy(IN ULONG Policy);
+  NTSTATUS SetUnderrunMode(IN ULONG Mode);
+  NTSTATUS SetConvertLevel(IN ULONG Level);
+
+#ifdef RTSD_USERMODE
+  void SetCursors(IN LONGLONG Position);
+#endif
+};
+typedef CLoopbackBuffer *PCLoopbackBuffer;
+
+#endif
@@ -0,0 +1,354 @@
+/*
+Module Name:
+  rtsdplat.h
+
+Abstract:
+  Platform layer of the loopback engine (rtsdloop.cpp), the stream
+  scheduler (rtsdsched.cpp) and the WaveRT cyclic buffer (rtsdcycl.cpp):
+  atomics, memory, time and timers. In the driver this maps onto the
+  kernel; with RTSD_USERMODE defined it maps onto the C runtime and
+  GCC/Clang builtins, so the engine can also be built as a user-mode
+  library for profiling, fuzzing and benchmarks. Define RTSD_VIRTUAL_CLOCK
+  as well to drive the engine's clock from the RtsdVirtualTime variable,
+  for simulations.
+*/
+
+#ifndef __RTSDPLAT_H_
+#define __RTSDPLAT_H_
+
+#ifndef RTSD_USERMODE
+
+#include "rtsdaudio.h"
+
+#else // RTSD_USERMODE
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//=============================================================================
+// The subset of the DDK the engine and rtsdprop.h depend on.
+//=============================================================================
+typedef void                VOID, *PVOID;
+typedef uint8_t             UCHAR, *PUCHAR, BOOLEAN;
+typedef int16_t             SHORT, *PSHORT;
+typedef uint16_t            WORD, *PWORD;
+typedef int32_t             LONG, *PLONG, NTSTATUS;
+typedef uint32_t            ULONG, *PULONG;
+typedef int64_t             LONGLONG, *PLONGLONG;
+typedef uint64_t            ULONGLONG, *PULONGLONG;
+typedef size_t              SIZE_T;
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define TRUE                1
+#define FALSE               0
+#define MAXULONG            0xFFFFFFFF
+#define _100NS_UNITS_PER_SECOND 10000000L
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define NT_SUCCESS(Status)              (((NTSTATUS)(Status)) >= 0)
+
+#define _100NS_UNITS_PER_SECOND         10000000L
+
+#define __forceinline       inline __attribute__((always_inline))
+#define ASSERT(x)           assert(x)
+#define C_ASSERT(e)         static_assert(e, #e)
+#define DECLSPEC_ALIGN(x)   alignas(x)
+#define PAGED_CODE()
+#define RtlCopyMemory(d, s, n)  memcpy((d), (s), (n))
+#define RtlZeroMemory(d, n)     memset((d), 0, (n))
+#define RtlMoveMemory(d, s, n)  memmove((d), (s), (n))
+
+// rtsdprop.h declares its property set GUID, which is of no use here.
+#define DEFINE_GUIDSTRUCT(guid, name)   struct name
+#define DEFINE_GUIDNAMED(name)          name
+
+#include "rtsdprop.h"
+
+#endif // RTSD_USERMODE
+
+// The C++ library clashes with min / max macros, so the engine uses these.
+#define RTSD_MIN(a, b)      (((a) < (b)) ? (a) : (b))
+#define RTSD_MAX(a, b)      (((a) > (b)) ? (a) : (b))
+
+//=============================================================================
+// Atomics
+//=============================================================================
+__forceinline void RtsdMemoryBarrier(void)
+{
+#ifndef RTSD_USERMODE
+  KeMemoryBarrier();
+#else
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+__forceinline LONGLONG RtsdCompareExchange64(volatile LONGLONG *Target, LONGLONG Exchange, LONGLONG Comperand)
+{
+#ifndef RTSD_USERMODE
+  return InterlockedCompareExchange64(Target, Exchange, Comperand);
+#else
+  __atomic_compare_exchange_n(Target, &Comperand, Exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return Comperand;
+#endif
+}
+
+// Returns the new value.
+__forceinline LONG RtsdInterlockedAdd(volatile LONG *Target, LONG Value)
+{
+#ifndef RTSD_USERMODE
+  return InterlockedExchangeAdd(Target, Value) + Value;
+#else
+  return __atomic_add_fetch(Target, Value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Returns the old value.
+__forceinline LONG RtsdInterlockedExchange(volatile LONG *Target, LONG Value)
+{
+#ifndef RTSD_USERMODE
+  return InterlockedExchange(Target, Value);
+#else
+  return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+__forceinline void RtsdInterlockedStore(volatile LONG *Target, LONG Value)
+{
+#ifndef RTSD_USERMODE
+  InterlockedExchange(Target, Value);
+#else
+  __atomic_store_n(Target, Value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+//=============================================================================
+// Bits
+//=============================================================================
+
+// Index of the highest set bit. Value must not be zero.
+__forceinline ULONG RtsdHighestBit(ULONG Value)
+{
+#ifndef RTSD_USERMODE
+  ULONG Index;
+  _BitScanReverse(&Index, Value);
+  return Index;
+#else
+  return 31 - __builtin_clz(Value);
+#endif
+}
+
+//=============================================================================
+// Loopback ring cursors. A cursor is published with release semantics once
+// the samples it covers are written, and loaded with acquire semantics before
+// those samples are touched by the other side.
+//=============================================================================
+__forceinline LONGLONG LoadAcquire(volatile LONGLONG *Cursor)
+{
+#ifndef RTSD_USERMODE
+  LONGLONG Value;
+#if defined(_X86_)
+  // A plain 64-bit load may tear on x86.
+  Value = InterlockedCompareExchange64(Cursor, 0, 0);
+#else
+  Value = *Cursor;
+#endif
+  KeMemoryBarrier();
+  return Value;
+#else
+  return __atomic_load_n(Cursor, __ATOMIC_ACQUIRE);
+#endif
+}
+
+__forceinline void StoreRelease(volatile LONGLONG *Cursor, LONGLONG Value)
+{
+#ifndef RTSD_USERMODE
+  KeMemoryBarrier();
+#if defined(_X86_)
+  // A plain 64-bit store may tear on x86.
+  LONGLONG Old;
+  do {
+    Old = *Cursor;
+  } while (InterlockedCompareExchange64(Cursor, Value, Old) != Old);
+#else
+  *Cursor = Value;
+#endif
+#else
+  __atomic_store_n(Cursor, Value, __ATOMIC_RELEASE);
+#endif
+}
+
+// Raises a cursor that several threads advance, never lowers it.
+__forceinline void StoreMax(volatile LONGLONG *Cursor, LONGLONG Value)
+{
+  LONGLONG Old;
+  do {
+    Old = LoadAcquire(Cursor);
+    if (Old >= Value)
+      return;
+  } while (RtsdCompareExchange64(Cursor, Value, Old) != Old);
+}
+
+//=============================================================================
+// Memory. Engine memory is touched at DISPATCH_LEVEL, so it is nonpaged.
+//=============================================================================
+__forceinline PVOID RtsdAllocate(SIZE_T Size)
+{
+#ifndef RTSD_USERMODE
+  return ExAllocatePoolWithTag(NonPagedPool, Size, RTSDAUDIO_POOLTAG);
+#else
+  return malloc(Size);
+#endif
+}
+
+__forceinline void RtsdFree(PVOID Memory)
+{
+#ifndef RTSD_USERMODE
+  ExFreePool(Memory);
+#else
+  free(Memory);
+#endif
+}
+
+//=============================================================================
+// Floating point. Only allowed at PASSIVE_LEVEL, between a successful save
+// and the matching restore.
+//=============================================================================
+typedef struct _RTSD_FLOATING_SAVE {
+#ifndef RTSD_USERMODE
+  KFLOATING_SAVE    Save;
+#else
+  ULONG             Unused;
+#endif
+} RTSD_FLOATING_SAVE, *PRTSD_FLOATING_SAVE;
+
+__forceinline NTSTATUS RtsdSaveFloatingPointState(PRTSD_FLOATING_SAVE State)
+{
+#ifndef RTSD_USERMODE
+  return KeSaveFloatingPointState(&State->Save);
+#else
+  (void)State;
+  return STATUS_SUCCESS;
+#endif
+}
+
+__forceinline void RtsdRestoreFloatingPointState(PRTSD_FLOATING_SAVE State)
+{
+#ifndef RTSD_USERMODE
+  KeRestoreFloatingPointState(&State->Save);
+#else
+  (void)State;
+#endif
+}
+
+//=============================================================================
+// Time. Monotonic, in 100 ns units like KeQueryInterruptTime.
+//=============================================================================
+__forceinline ULONGLONG RtsdQueryTime(void)
+{
+#ifndef RTSD_USERMODE
+  return KeQueryInterruptTime();
+#elif defined(RTSD_VIRTUAL_CLOCK)
+  // Simulations run on a time base of their own.
+  extern ULONGLONG RtsdVirtualTime;
+  return RtsdVirtualTime;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ULONGLONG)ts.tv_sec * _100NS_UNITS_PER_SECOND + ts.tv_nsec / 100;
+#endif
+}
+
+// Frames at Rate in Elapsed 100 ns units, rounded down. Split in seconds
+// and the rest, so Elapsed * Rate can not overflow.
+__forceinline ULONGLONG RtsdElapsedFrames(ULONGLONG Elapsed, ULONG Rate)
+{
+  return (Elapsed / _100NS_UNITS_PER_SECOND) * Rate +
+         (Elapsed % _100NS_UNITS_PER_SECOND) * Rate / _100NS_UNITS_PER_SECOND;
+}
+
+//=============================================================================
+// Timer. In the driver Routine runs in a DPC once RtsdQueryTime reaches the
+// due time. In user mode nothing fires by itself: DueTime tells a
+// simulation when to call Routine.
+//=============================================================================
+typedef void (*PRTSD_TIMER_ROUTINE)(IN PVOID Context);
+
+typedef struct _RTSD_TIMER {
+#ifndef RTSD_USERMODE
+  KTIMER            Timer;
+  KDPC              Dpc;
+#endif
+  PRTSD_TIMER_ROUTINE Routine;
+  PVOID             Context;
+  volatile ULONGLONG DueTime;           // 0 while not armed
+} RTSD_TIMER, *PRTSD_TIMER;
+
+#ifndef RTSD_USERMODE
+static VOID RtsdTimerDpc(IN PKDPC Dpc, IN PVOID DeferredContext, IN PVOID SA1, IN PVOID SA2)
+{
+  PRTSD_TIMER Timer = (PRTSD_TIMER)DeferredContext;
+  Timer->DueTime = 0;
+  Timer->Routine(Timer->Context);
+}
+#endif
+
+__forceinline void RtsdInitializeTimer(PRTSD_TIMER Timer, PRTSD_TIMER_ROUTINE Routine, PVOID Context)
+{
+  Timer->Routine = Routine;
+  Timer->Context = Context;
+  Timer->DueTime = 0;
+#ifndef RTSD_USERMODE
+  KeInitializeTimer(&Timer->Timer);
+  KeInitializeDpc(&Timer->Dpc, RtsdTimerDpc, Timer);
+#endif
+}
+
+// Arms the timer for RtsdQueryTime DueTime, or replaces the due time it has.
+__forceinline void RtsdSetTimer(PRTSD_TIMER Timer, ULONGLONG DueTime)
+{
+  Timer->DueTime = DueTime;
+#ifndef RTSD_USERMODE
+  // Negative due times are relative, in 100 ns units; 0 would be absolute.
+  LARGE_INTEGER Due;
+  Due.QuadPart = -RTSD_MAX((LONGLONG)(DueTime - KeQueryInterruptTime()), 1);
+  KeSetTimer(&Timer->Timer, Due, &Timer->Dpc);
+#endif
+}
+
+__forceinline void RtsdCancelTimer(PRTSD_TIMER Timer)
+{
+  Timer->DueTime = 0;
+#ifndef RTSD_USERMODE
+  KeCancelTimer(&Timer->Timer);
+#endif
+}
+
+// Waits for timer routines that already started. PASSIVE_LEVEL only.
+__forceinline void RtsdFlushTimers(void)
+{
+#ifndef RTSD_USERMODE
+  KeFlushQueuedDpcs();
+#endif
+}
+
+// Asks the system for timers at least as fine as Resolution (100 ns units),
+// or drops the request if Set is FALSE. Calls must pair up.
+// PASSIVE_LEVEL only.
+__forceinline void RtsdSetTimerResolution(ULONG Resolution, BOOLEAN Set)
+{
+#ifndef RTSD_USERMODE
+  ExSetTimerResolution(Resolution, Set);
+#else
+  (void)Resolution;
+  (void)Set;
+#endif
+}
+
+#endif
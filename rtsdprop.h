@@ -0,0 +1,107 @@
+/*
+Module Name:
+  rtsdprop.h
+
+Abstract:
+  Private property set of the loopback device. This header is shared with
+  user-mode tools, so it must only depend on ks.h / ksmedia.h.
+*/
+
+#ifndef __RTSDPROP_H_
+#define __RTSDPROP_H_
+
+//=============================================================================
+// Defines
+//=============================================================================
+
+// Loopback property set
+// {47ED0EDA-1A48-4D7F-84BE-279B9D5B402F}
+#define STATIC_KSPROPSETID_RtsdLoopback 0x47ed0eda, 0x1a48, 0x4d7f, 0x84, 0xbe, 0x27, 0x9b, 0x9d, 0x5b, 0x40, 0x2f
+DEFINE_GUIDSTRUCT("47ED0EDA-1A48-4D7F-84BE-279B9D5B402F", KSPROPSETID_RtsdLoopback);
+#define KSPROPSETID_RtsdLoopback DEFINE_GUIDNAMED(KSPROPSETID_RtsdLoopback)
+
+// Number of capture streams that can read the loopback at the same time.
+#define RTSD_LOOPBACK_MAX_READERS   4
+
+// Most channels a stream can have.
+#define RTSD_LOOPBACK_MAX_CHANNELS  8
+
+// Routing gain that passes a channel unchanged (16.16 fixed point), and
+// the largest gain accepted.
+#define RTSD_ROUTING_UNITY          0x10000
+#define RTSD_ROUTING_MAX_GAIN       (8 * RTSD_ROUTING_UNITY)
+
+//=============================================================================
+// Enumerations
+//=============================================================================
+
+typedef enum {
+    KSPROPERTY_RTSD_LOOPBACK_BUFFER = 0,    // RTSD_LOOPBACK_BUFFER, filter
+    KSPROPERTY_RTSD_LOOPBACK_OVERRUN_POLICY,// ULONG (RTSD_OVERRUN_POLICY), filter
+    KSPROPERTY_RTSD_LOOPBACK_STATISTICS,    // RTSD_LOOPBACK_STATISTICS, filter, get only
+    KSPROPERTY_RTSD_LOOPBACK_UNDERRUN_MODE, // ULONG (RTSD_UNDERRUN_MODE), filter
+    KSPROPERTY_RTSD_LOOPBACK_ROUTING        // RTSD_LOOPBACK_ROUTING, capture pin
+} KSPROPERTY_RTSD_LOOPBACK;
+
+// What the render side does when the capture side is a full ring behind.
+typedef enum {
+    RTSD_OVERRUN_DROP_OLDEST = 0,           // Overwrite, the reader skips ahead in one step.
+    RTSD_OVERRUN_DROP_NEWEST,               // Keep what fits, discard the rest of the period.
+    RTSD_OVERRUN_STRETCH,                   // Keep what fits and ask the reader to catch up.
+    RTSD_OVERRUN_POLICY_COUNT
+} RTSD_OVERRUN_POLICY;
+
+// How the capture side fills the part of a period the render side did not
+// deliver in time.
+typedef enum {
+    RTSD_UNDERRUN_SILENCE_HEAD = 0,         // Silence first, then the data that is there.
+    RTSD_UNDERRUN_SILENCE_TAIL,             // The data that is there, then silence.
+    RTSD_UNDERRUN_REPEAT,                   // The data that is there, then the last samples again.
+    RTSD_UNDERRUN_FADE,                     // Like REPEAT, but faded out to silence.
+    RTSD_UNDERRUN_MODE_COUNT
+} RTSD_UNDERRUN_MODE;
+
+//=============================================================================
+// Typedefs
+//=============================================================================
+
+// Depth of the loopback ring. Frames overrides Milliseconds when it is not
+// zero. The ring is rounded up to a power of two and (re)allocated when the
+// next stream is opened, so it can only be set while no stream is open.
+typedef struct _RTSD_LOOPBACK_BUFFER {
+    ULONG       Milliseconds;
+    ULONG       Frames;
+} RTSD_LOOPBACK_BUFFER, *PRTSD_LOOPBACK_BUFFER;
+
+// Mix of the loopback channels a capture stream receives: output channel
+// o is the sum of input channel i times Gain[o][i]. The channel counts are
+// those of the loopback ring and of the stream; a set must repeat them.
+// Can only be set while the stream is not running.
+typedef struct _RTSD_LOOPBACK_ROUTING {
+    ULONG       InputChannels;
+    ULONG       OutputChannels;
+    LONG        Gain[RTSD_LOOPBACK_MAX_CHANNELS][RTSD_LOOPBACK_MAX_CHANNELS];
+} RTSD_LOOPBACK_ROUTING, *PRTSD_LOOPBACK_ROUTING;
+
+// Counters of one capture stream since it was opened.
+typedef struct _RTSD_LOOPBACK_READER_STATISTICS {
+    ULONG       Active;                     // Slot is used by an open capture stream.
+    ULONG       Overrun;                    // Times the render side lapped this reader.
+    ULONG       UnderrunSilenceHead;        // Underruns handled by RTSD_UNDERRUN_SILENCE_HEAD.
+    ULONG       UnderrunSilenceTail;        // Underruns handled by RTSD_UNDERRUN_SILENCE_TAIL.
+    ULONG       UnderrunRepeat;             // Underruns handled by RTSD_UNDERRUN_REPEAT.
+    ULONG       UnderrunFade;               // Underruns handled by RTSD_UNDERRUN_FADE.
+} RTSD_LOOPBACK_READER_STATISTICS, *PRTSD_LOOPBACK_READER_STATISTICS;
+
+// Counters since the loopback ring was last (re)allocated.
+typedef struct _RTSD_LOOPBACK_STATISTICS {
+    ULONG       OverrunDropOldest;          // Overruns handled by RTSD_OVERRUN_DROP_OLDEST.
+    ULONG       OverrunDropNewest;          // Overruns handled by RTSD_OVERRUN_DROP_NEWEST.
+    ULONG       OverrunStretch;             // Overruns handled by RTSD_OVERRUN_STRETCH.
+    RTSD_LOOPBACK_READER_STATISTICS Readers[RTSD_LOOPBACK_MAX_READERS];
+    ULONG       SchedulerTicks;             // Ticks of the stream scheduler since the device started.
+    ULONG       SchedulerSkipped;           // Ticks it left out because it was a period late.
+    ULONG       SchedulerLateMax;           // Worst lateness of a tick, in 100 ns units.
+} RTSD_LOOPBACK_STATISTICS, *PRTSD_LOOPBACK_STATISTICS;
+
+#endif
@@ -0,0 +1,223 @@
+/*
+Module Name:
+  rtsdsched.cpp
+
+Abstract:
+  Implementation of the stream scheduler.
+*/
+
+#include "rtsdsched.h"
+
+#ifndef RTSD_USERMODE
+#pragma code_seg("PAGE")
+#endif
+
+//=============================================================================
+CStreamScheduler::CStreamScheduler()
+/*
+Routine Description:
+  Constructor for the stream scheduler. Nothing runs before Init.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  RtlZeroMemory(&m_Timer, sizeof(m_Timer));
+  m_pfnService = NULL;
+  m_pContext = NULL;
+  RtlZeroMemory((PVOID)m_lRunning, sizeof(m_lRunning));
+  m_lActive = 0;
+  m_ullPeriod = SCHEDULER_DEFAULT_PERIOD;
+  m_ullDeadline = 0;
+  m_ulTicks = 0;
+  m_ulSkipped = 0;
+  m_ullLateMax = 0;
+} // CStreamScheduler
+
+//=============================================================================
+void CStreamScheduler::Init(
+  IN  PSCHEDULER_SERVICE      Service,
+  IN  PVOID                   Context
+)
+/*
+Routine Description:
+  Sets up the timer. Service is called once per tick for every lane with a
+  running stream.
+
+Arguments:
+  Service - routine that services a lane
+  Context - passed to Service
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(Service);
+
+  m_pfnService = Service;
+  m_pContext = Context;
+  RtsdInitializeTimer(&m_Timer, TimerRoutine, this);
+} // Init
+
+//=============================================================================
+void CStreamScheduler::Shutdown(void)
+/*
+Routine Description:
+  Makes sure no tick is pending or running, before the scheduler goes
+  away. A tick that was running may have armed the timer again, so it is
+  cancelled once more after the wait. Does nothing before Init.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(!m_lActive);
+
+  if (!m_pfnService) {
+    return;
+  }
+
+  RtsdCancelTimer(&m_Timer);
+  RtsdFlushTimers();
+  RtsdCancelTimer(&m_Timer);
+} // Shutdown
+
+//=============================================================================
+void CStreamScheduler::SetPeriod(
+  IN  ULONG                   Period
+)
+/*
+Routine Description:
+  Sets the time between two ticks. A running scheduler takes it from the
+  next tick on.
+
+Arguments:
+  Period - 100 ns units
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+
+  if (Period) {
+    m_ullPeriod = Period;
+  }
+} // SetPeriod
+
+//=============================================================================
+void CStreamScheduler::Start(
+  IN  ULONG                   Lane
+)
+/*
+Routine Description:
+  A stream of Lane starts to run. The first one starts the timer one
+  period from now and asks the system for timers that fine.
+
+Arguments:
+  Lane - SCHEDULER_LANE of the stream
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(Lane < SCHEDULER_LANE_COUNT);
+
+  RtsdInterlockedAdd(&m_lRunning[Lane], 1);
+  if (RtsdInterlockedAdd(&m_lActive, 1) == 1) {
+    RtsdSetTimerResolution((ULONG)m_ullPeriod, TRUE);
+    m_ullDeadline = RtsdQueryTime() + m_ullPeriod;
+    RtsdSetTimer(&m_Timer, m_ullDeadline);
+  }
+} // Start
+
+//=============================================================================
+void CStreamScheduler::Stop(
+  IN  ULONG                   Lane
+)
+/*
+Routine Description:
+  A stream of Lane stops running. The last one stops the timer.
+
+Arguments:
+  Lane - SCHEDULER_LANE of the stream
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(Lane < SCHEDULER_LANE_COUNT);
+  ASSERT(m_lRunning[Lane] > 0);
+
+  RtsdInterlockedAdd(&m_lRunning[Lane], -1);
+  if (RtsdInterlockedAdd(&m_lActive, -1) == 0) {
+    RtsdCancelTimer(&m_Timer);
+    RtsdSetTimerResolution(0, FALSE);
+  }
+} // Stop
+
+#ifndef RTSD_USERMODE
+#pragma code_seg()
+#endif
+
+//=============================================================================
+void CStreamScheduler::TimerRoutine(
+  IN  PVOID                   Context
+)
+/*
+Routine Description:
+  Timer routine, runs the tick of the scheduler in Context.
+
+Arguments:
+  Context - the scheduler
+
+Return Value:
+  void
+*/
+{
+  ((PCStreamScheduler)Context)->Tick(RtsdQueryTime());
+} // TimerRoutine
+
+//=============================================================================
+void CStreamScheduler::Tick(
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Services the lanes with running streams, render first, and arms the
+  timer for the next deadline on the grid that has not passed yet.
+
+Arguments:
+  CurrentTime - RtsdQueryTime when the timer fired
+
+Return Value:
+  void
+*/
+{
+  ULONGLONG late = (CurrentTime > m_ullDeadline) ? CurrentTime - m_ullDeadline : 0;
+  m_ullLateMax = RTSD_MAX(m_ullLateMax, late);
+  m_ulTicks++;
+
+  for (ULONG lane = 0; lane < SCHEDULER_LANE_COUNT; lane++) {
+    if (m_lRunning[lane] > 0) {
+      m_pfnService(m_pContext, lane, CurrentTime);
+    }
+  }
+
+  // late by a period or more: leave out the deadlines that passed
+  ULONGLONG skipped = late / m_ullPeriod;
+  m_ulSkipped += (ULONG)skipped;
+  m_ullDeadline += (skipped + 1) * m_ullPeriod;
+
+  if (m_lActive > 0) {
+    RtsdSetTimer(&m_Timer, m_ullDeadline);
+  }
+} // Tick
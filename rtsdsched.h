@@ -0,0 +1,91 @@
+/*
+Module Name:
+  rtsdsched.h
+
+Abstract:
+  Definition of the stream scheduler. One timer per device drives every
+  running stream, render before capture, on a fixed grid of deadlines.
+*/
+
+#ifndef __RTSDSCHED_H_
+#define __RTSDSCHED_H_
+
+#include "rtsdplat.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+
+// Period used until a stream sets one, in 100 ns units (10 ms).
+#define SCHEDULER_DEFAULT_PERIOD    100000
+
+//=============================================================================
+// Enumerations
+//=============================================================================
+
+// Groups of streams, serviced in this order on every tick.
+typedef enum {
+  SCHEDULER_LANE_RENDER = 0,
+  SCHEDULER_LANE_CAPTURE,
+  SCHEDULER_LANE_COUNT
+} SCHEDULER_LANE;
+
+//=============================================================================
+// Typedefs
+//=============================================================================
+
+// Services the running streams of Lane. All lanes of a tick get the same
+// CurrentTime.
+typedef void (*PSCHEDULER_SERVICE)(IN PVOID Context, IN ULONG Lane, IN ULONGLONG CurrentTime);
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CStreamScheduler
+//
+// Ticks at m_ullPeriod while any lane has a running stream. Every tick
+// services the lanes with running streams in lane order, so the render
+// stream has written its period before the capture streams read theirs.
+// The deadlines lie on a grid from the first start on and the timer is
+// armed for the next one each tick, so the lateness of one tick does not
+// shift the following ones; deadlines that already passed are skipped and
+// counted.
+// A tick that races with the last Stop may arm the timer once more; that
+// tick finds no running stream and does not arm it again.
+// Init, Start, Stop, SetPeriod and Shutdown run at PASSIVE_LEVEL, Tick
+// runs in the timer's DPC.
+
+class CStreamScheduler {
+private:
+  RTSD_TIMER                  m_Timer;
+  PSCHEDULER_SERVICE          m_pfnService;
+  PVOID                       m_pContext;
+  volatile LONG               m_lRunning[SCHEDULER_LANE_COUNT];
+  volatile LONG               m_lActive;          // sum of m_lRunning
+  ULONGLONG                   m_ullPeriod;        // 100 ns units
+  ULONGLONG                   m_ullDeadline;      // RtsdQueryTime of the next tick
+  ULONG                       m_ulTicks;
+  ULONG                       m_ulSkipped;        // deadlines passed without a tick
+  ULONGLONG                   m_ullLateMax;       // worst lateness of a tick, 100 ns units
+
+  static void TimerRoutine(IN PVOID Context);
+
+public:
+  CStreamScheduler();
+
+  void Init(IN PSCHEDULER_SERVICE Service, IN PVOID Context);
+  void Shutdown(void);
+  void SetPeriod(IN ULONG Period);
+  void Start(IN ULONG Lane);
+  void Stop(IN ULONG Lane);
+  void Tick(IN ULONGLONG CurrentTime);
+
+  ULONG     GetTicks(void)        { return m_ulTicks; }
+  ULONG     GetSkipped(void)      { return m_ulSkipped; }
+  ULONGLONG GetLateMax(void)      { return m_ullLateMax; }
+  ULONGLONG GetDueTime(void)      { return m_Timer.DueTime; }
+};
+typedef CStreamScheduler *PCStreamScheduler;
+
+#endif
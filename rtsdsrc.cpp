@@ -0,0 +1,596 @@
+/*
+Module Name:
+  rtsdsrc.cpp
+
+Abstract:
+  Implementation of the sample rate converter of the loopback path and of
+  its drift controller.
+*/
+
+#include "rtsdsrc.h"
+
+#define RESAMPLER_MAX_TAPS          64
+#define RESAMPLER_PI                3.14159265358979323846
+
+//=============================================================================
+// Filter design. Floating point, PASSIVE_LEVEL only. The kernel has no C
+// runtime math, so sin is a Taylor series after range reduction.
+//=============================================================================
+#ifndef RTSD_USERMODE
+#pragma code_seg("PAGE")
+#endif
+
+static double ResamplerSin(double x)
+{
+  LONGLONG turns = (LONGLONG)(x / (2 * RESAMPLER_PI) + ((x >= 0) ? 0.5 : -0.5));
+  x -= (double)turns * 2 * RESAMPLER_PI;
+
+  // |x| <= pi, 12 terms are exact to double precision
+  double term = x;
+  double sum = x;
+  for (int n = 1; n < 12; n++) {
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+static double ResamplerCos(double x)
+{
+  return ResamplerSin(x + RESAMPLER_PI / 2);
+}
+
+// Lowpass with cutoff Cutoff (1.0 = Nyquist of the input) at distance t
+// input frames from the center, Blackman windowed to HalfWidth frames.
+static double ResamplerKernel(double t, double Cutoff, double HalfWidth)
+{
+  if ((t <= -HalfWidth) || (t >= HalfWidth)) {
+    return 0;
+  }
+
+  double x = RESAMPLER_PI * Cutoff * t;
+  double sinc = (t == 0) ? 1.0 : ResamplerSin(x) / x;
+  double w = t / HalfWidth;
+  double window = 0.42 + 0.5 * ResamplerCos(RESAMPLER_PI * w) + 0.08 * ResamplerCos(2 * RESAMPLER_PI * w);
+
+  return Cutoff * sinc * window;
+}
+
+//=============================================================================
+CResampler::CResampler()
+/*
+Routine Description:
+  Constructor for the sample rate converter. It stays inactive until Init
+  is called.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  m_pCoefficients = NULL;
+  m_pInput = NULL;
+  m_pOutput = NULL;
+  m_ulChannels = 0;
+  m_ulTaps = 0;
+  m_ulPhaseShift = 0;
+  m_ulInputSize = 0;
+  m_ulOutputSize = 0;
+  m_ulBlockFrames = 0;
+  m_ulFill = 0;
+  m_ullBaseStep = 0;
+  m_ullStep = 0;
+  m_ullPosition = 0;
+  m_pfnFilter = NULL;
+} // CResampler
+
+//=============================================================================
+CResampler::~CResampler()
+/*
+Routine Description:
+  Destructor for the sample rate converter
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+
+  Free();
+} // ~CResampler
+
+//=============================================================================
+NTSTATUS CResampler::BuildFilter(
+  IN  ULONG                   InRate,
+  IN  ULONG                   OutRate,
+  IN  ULONG                   Phases
+)
+/*
+Routine Description:
+  Computes the polyphase table for m_ulTaps taps. When the rate goes down,
+  the cutoff follows the output rate so nothing aliases. Every phase is
+  normalized to unity gain at DC.
+
+Arguments:
+  InRate - input frames per second
+  OutRate - output frames per second
+  Phases - number of phases, a power of two
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  RTSD_FLOATING_SAVE floatSave;
+  NTSTATUS ntStatus = RtsdSaveFloatingPointState(&floatSave);
+  if (!NT_SUCCESS(ntStatus)) {
+    return ntStatus;
+  }
+
+  // leave a transition band below Nyquist, narrower with more taps
+  double rolloff = (m_ulTaps > 16) ? 0.94 : 0.85;
+  double cutoff = rolloff * ((OutRate < InRate) ? (double)OutRate / InRate : 1.0);
+  double halfWidth = m_ulTaps / 2;
+
+  for (ULONG p = 0; p <= Phases; p++) {
+    double taps[RESAMPLER_MAX_TAPS];
+    double sum = 0;
+
+    // tap j sits at j - (m_ulTaps / 2 - 1) - p / Phases from the output
+    for (ULONG j = 0; j < m_ulTaps; j++) {
+      double t = (double)j - (halfWidth - 1) - (double)p / Phases;
+      taps[j] = ResamplerKernel(t, cutoff, halfWidth);
+      sum += taps[j];
+    }
+
+    PLONG pPhase = m_pCoefficients + p * m_ulTaps;
+    for (ULONG j = 0; j < m_ulTaps; j++) {
+      double value = taps[j] / sum * (1 << 30);
+      pPhase[j] = (LONG)(value + ((value >= 0) ? 0.5 : -0.5));
+    }
+  }
+
+  RtsdRestoreFloatingPointState(&floatSave);
+  return STATUS_SUCCESS;
+} // BuildFilter
+
+//=============================================================================
+NTSTATUS CResampler::Init(
+  IN  ULONG                   InRate,
+  IN  ULONG                   OutRate,
+  IN  ULONG                   Channels,
+  IN  ULONG                   Quality,
+  IN  ULONG                   BlockFrames
+)
+/*
+Routine Description:
+  (Re)initializes the converter for a rate pair and allocates its buffers.
+  A Process call takes at most BlockFrames input frames or, when the
+  caller asks GetInputFrames first, produces at most BlockFrames output
+  frames.
+
+Arguments:
+  InRate - input frames per second
+  OutRate - output frames per second
+  Channels - samples per frame
+  Quality - RESAMPLER_QUALITY
+  BlockFrames - frames per Process call, see above
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  Free();
+
+  if (!InRate || !OutRate || !Channels || !BlockFrames || (Quality >= RESAMPLER_QUALITY_COUNT)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  ULONG phases;
+  switch (Quality) {
+    case RESAMPLER_QUALITY_LINEAR:
+      m_ulTaps = 2;
+      phases = 0;
+      break;
+    case RESAMPLER_QUALITY_16TAP:
+      m_ulTaps = 16;
+      phases = 128;
+      break;
+    default:
+      m_ulTaps = RESAMPLER_MAX_TAPS;
+      phases = 256;
+      break;
+  }
+
+  m_ulChannels = Channels;
+  m_ulBlockFrames = BlockFrames;
+  m_pfnFilter = s_Filters[Quality][(Channels <= RESAMPLER_SPECIALIZED_CHANNELS) ? Channels : 0];
+  m_ullBaseStep = ((ULONGLONG)InRate << 32) / OutRate;
+  m_ullStep = m_ullBaseStep;
+
+  // the frames kept for the next output, plus a block of input or the
+  // input for a block of output at the highest ratio SetRatioAdjust allows
+  m_ulInputSize = 2 * m_ulTaps + BlockFrames + (ULONG)(((ULONGLONG)(BlockFrames + 1) * InRate + OutRate - 1) / OutRate) * 2 + 2;
+  m_ulOutputSize = BlockFrames + (ULONG)(((ULONGLONG)(BlockFrames + m_ulTaps) * OutRate + InRate - 1) / InRate) + 2;
+
+  m_pInput = (PLONG) RtsdAllocate(m_ulInputSize * Channels * sizeof(LONG));
+  m_pOutput = (PLONG) RtsdAllocate(m_ulOutputSize * Channels * sizeof(LONG));
+  if (phases) {
+    m_pCoefficients = (PLONG) RtsdAllocate((phases + 1) * m_ulTaps * sizeof(LONG));
+  }
+  if (!m_pInput || !m_pOutput || (phases && !m_pCoefficients)) {
+    Free();
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  if (phases) {
+    m_ulPhaseShift = 32 - RtsdHighestBit(phases);
+    NTSTATUS ntStatus = BuildFilter(InRate, OutRate, phases);
+    if (!NT_SUCCESS(ntStatus)) {
+      Free();
+      return ntStatus;
+    }
+  }
+
+  Reset();
+  return STATUS_SUCCESS;
+} // Init
+
+//=============================================================================
+void CResampler::Free(void)
+/*
+Routine Description:
+  Frees the buffers, the converter is inactive afterwards.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+
+  if (m_pCoefficients) {
+    RtsdFree(m_pCoefficients);
+    m_pCoefficients = NULL;
+  }
+  if (m_pInput) {
+    RtsdFree(m_pInput);
+    m_pInput = NULL;
+  }
+  if (m_pOutput) {
+    RtsdFree(m_pOutput);
+    m_pOutput = NULL;
+  }
+  m_ulFill = 0;
+} // Free
+
+#ifndef RTSD_USERMODE
+#pragma code_seg()
+#endif
+
+//=============================================================================
+void CResampler::Reset(void)
+/*
+Routine Description:
+  Forgets the buffered input. The history starts out as silence, which
+  delays the output by half a filter.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  if (m_pInput) {
+    m_ulFill = m_ulTaps - 1;
+    RtlZeroMemory(m_pInput, m_ulFill * m_ulChannels * sizeof(LONG));
+  }
+  m_ullPosition = 0;
+} // Reset
+
+//=============================================================================
+ULONG CResampler::GetInputFrames(
+  IN  ULONG                   OutputFrames
+)
+/*
+Routine Description:
+  Returns how many input frames Process needs to produce OutputFrames
+  output frames.
+
+Arguments:
+  OutputFrames - at most GetBlockFrames
+
+Return Value:
+  Number of input frames
+*/
+{
+  ASSERT(OutputFrames <= m_ulBlockFrames);
+
+  if (!OutputFrames) {
+    return 0;
+  }
+
+  ULONGLONG lastPosition = m_ullPosition + (OutputFrames - 1) * m_ullStep;
+  ULONG needed = (ULONG)(lastPosition >> 32) + m_ulTaps;
+
+  return (needed > m_ulFill) ? needed - m_ulFill : 0;
+} // GetInputFrames
+
+//=============================================================================
+template <ULONG Channels, ULONG Taps>
+ULONG CResampler::Filter(
+  IN OUT PULONGLONG           Position,
+  IN  ULONG                   OutputFrames
+)
+/*
+Routine Description:
+  Inner loop of Process. Channels and Taps are constants, so the compiler
+  unrolls the loops over them; Channels 0 stands for m_ulChannels and Taps
+  2 for linear interpolation.
+
+Arguments:
+  Position - first input frame of the next output, 32.32. Advanced past
+             the produced frames.
+  OutputFrames - maximum number of frames to produce
+
+Return Value:
+  Number of frames produced
+*/
+{
+  ULONG channels = Channels ? Channels : m_ulChannels;
+  ULONGLONG position = *Position;
+  ULONGLONG step = m_ullStep;
+  ULONG fill = m_ulFill;
+  PLONG pOut = m_pOutput;
+  ULONG produced;
+
+  for (produced = 0; produced < OutputFrames; produced++, position += step) {
+    ULONG first = (ULONG)(position >> 32);
+    ULONG fraction = (ULONG)position;
+
+    if (first + Taps > fill) {
+      break;
+    }
+
+    PLONG pIn = m_pInput + first * channels;
+
+    if (Taps == 2) {
+      // linear, the fraction as Q30 keeps the product in 64 bits
+      for (ULONG c = 0; c < channels; c++, pOut++) {
+        LONGLONG delta = (LONGLONG)pIn[channels + c] - pIn[c];
+        *pOut = pIn[c] + (LONG)((delta * (fraction >> 2)) >> 30);
+      }
+      continue;
+    }
+
+    // coefficients of the exact position, between two phases
+    LONG coefficients[Taps];
+    PLONG pPhase = m_pCoefficients + (fraction >> m_ulPhaseShift) * Taps;
+    LONGLONG weight = (fraction & ((1UL << m_ulPhaseShift) - 1)) >> (m_ulPhaseShift - 16);
+    for (ULONG j = 0; j < Taps; j++) {
+      coefficients[j] = pPhase[j] + (LONG)(((LONGLONG)(pPhase[Taps + j] - pPhase[j]) * weight) >> 16);
+    }
+
+    for (ULONG c = 0; c < channels; c++, pOut++) {
+      PLONG pSample = pIn + c;
+      LONGLONG sum = 0;
+      for (ULONG j = 0; j < Taps; j++, pSample += channels) {
+        sum += (LONGLONG)*pSample * coefficients[j];
+      }
+      sum >>= 30;
+      *pOut = (sum > 0x7FFFFFFF) ? 0x7FFFFFFF : (sum < -(LONGLONG)0x80000000) ? (LONG)0x80000000 : (LONG)sum;
+    }
+  }
+
+  *Position = position;
+  return produced;
+} // Filter
+
+// One inner loop per quality and channel count, the generic one first.
+#define RESAMPLER_FILTER_ROW(Taps) { \
+  &CResampler::Filter<0, Taps>, &CResampler::Filter<1, Taps>, &CResampler::Filter<2, Taps>, \
+  &CResampler::Filter<3, Taps>, &CResampler::Filter<4, Taps>, &CResampler::Filter<5, Taps>, \
+  &CResampler::Filter<6, Taps>, &CResampler::Filter<7, Taps>, &CResampler::Filter<8, Taps> }
+
+const CResampler::PFILTER CResampler::s_Filters[RESAMPLER_QUALITY_COUNT][RESAMPLER_SPECIALIZED_CHANNELS + 1] = {
+  RESAMPLER_FILTER_ROW(2),                        // RESAMPLER_QUALITY_LINEAR
+  RESAMPLER_FILTER_ROW(16),                       // RESAMPLER_QUALITY_16TAP
+  RESAMPLER_FILTER_ROW(RESAMPLER_MAX_TAPS)        // RESAMPLER_QUALITY_64TAP
+};
+
+//=============================================================================
+ULONG CResampler::Process(
+  IN  ULONG                   InputFrames,
+  IN  ULONG                   OutputFrames
+)
+/*
+Routine Description:
+  Appends the InputFrames frames the caller put at GetInputBuffer and
+  converts as many of the buffered frames as possible, but not more than
+  OutputFrames, to GetOutputBuffer.
+
+Arguments:
+  InputFrames - frames added at GetInputBuffer
+  OutputFrames - maximum number of frames to produce
+
+Return Value:
+  Number of frames produced
+*/
+{
+  ASSERT(m_pInput);
+
+  ULONG channels = m_ulChannels;
+  ULONGLONG position = m_ullPosition;
+
+  m_ulFill += InputFrames;
+  ASSERT(m_ulFill <= m_ulInputSize);
+
+  ULONG produced = (this->*m_pfnFilter)(&position, RTSD_MIN(OutputFrames, m_ulOutputSize));
+
+  // drop the input no later output needs
+  ULONG consumed = RTSD_MIN((ULONG)(position >> 32), m_ulFill);
+  if (consumed) {
+    m_ulFill -= consumed;
+    RtlMoveMemory(m_pInput, m_pInput + consumed * channels, m_ulFill * channels * sizeof(LONG));
+    position -= (ULONGLONG)consumed << 32;
+  }
+  m_ullPosition = position;
+
+  return produced;
+} // Process
+
+//=============================================================================
+void CResampler::SetRatioAdjust(
+  IN  LONG                    Ppb
+)
+/*
+Routine Description:
+  Makes the converter consume its input faster (positive) or slower
+  (negative) than the nominal ratio.
+
+Arguments:
+  Ppb - correction in parts per billion, at most DRIFT_MAX_ADJUST_PPB
+
+Return Value:
+  void
+*/
+{
+  ASSERT((Ppb >= -DRIFT_MAX_ADJUST_PPB) && (Ppb <= DRIFT_MAX_ADJUST_PPB));
+
+  m_ullStep = m_ullBaseStep + (LONGLONG)m_ullBaseStep / 1000 * Ppb / 1000000;
+} // SetRatioAdjust
+
+#ifdef RTSD_USERMODE
+//=============================================================================
+void CResampler::SetGenericFilter(void)
+/*
+Routine Description:
+  Binds the inner loop that takes the channel count from m_ulChannels in
+  place of the one Init picked for it, so the two can be compared.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  for (ULONG quality = 0; quality < RESAMPLER_QUALITY_COUNT; quality++) {
+    for (ULONG channels = 0; channels <= RESAMPLER_SPECIALIZED_CHANNELS; channels++) {
+      if (m_pfnFilter == s_Filters[quality][channels]) {
+        m_pfnFilter = s_Filters[quality][0];
+        return;
+      }
+    }
+  }
+} // SetGenericFilter
+#endif
+
+//=============================================================================
+CDriftController::CDriftController()
+/*
+Routine Description:
+  Constructor for the drift controller. Init has to be called before use.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  m_lTarget = 0;
+  m_ulStreamRate = 0;
+  m_llFiltered = 0;
+  m_llIntegral = 0;
+  m_llIntegralLimit = 0;
+  m_llProportionalDivisor = 1;
+  m_llIntegralDivisor = 1;
+  m_fPrimed = FALSE;
+} // CDriftController
+
+//=============================================================================
+void CDriftController::Init(
+  IN  ULONG                   RingRate,
+  IN  ULONG                   StreamRate,
+  IN  ULONG                   TargetFrames
+)
+/*
+Routine Description:
+  Resets the controller. With the fill level error e in ring frames and
+  the time constant T, the loop gains are 2 / (T * RingRate) for e and
+  1 / (T^2 * RingRate) for the integral of e over seconds, which makes the
+  loop critically damped.
+
+Arguments:
+  RingRate - frames per second of the ring
+  StreamRate - frames per second of the reading stream
+  TargetFrames - fill level to hold, in ring frames
+
+Return Value:
+  void
+*/
+{
+  ASSERT(RingRate && StreamRate);
+
+  m_lTarget = (LONG)TargetFrames;
+  m_ulStreamRate = StreamRate;
+  m_llFiltered = 0;
+  m_llIntegral = 0;
+  m_fPrimed = FALSE;
+
+  // ppb = e * 2e9 / (T * RingRate)
+  m_llProportionalDivisor = (LONGLONG)DRIFT_TIME_CONSTANT_S * RingRate;
+
+  // ppb = sum(e * frames) * 1e9 / (T^2 * RingRate * StreamRate), kept in
+  // range by dividing both sides by 1e6
+  m_llIntegralDivisor = RTSD_MAX((LONGLONG)DRIFT_TIME_CONSTANT_S * DRIFT_TIME_CONSTANT_S *
+                                 RingRate * StreamRate / 1000000, 1);
+  m_llIntegralLimit = (LONGLONG)DRIFT_MAX_ADJUST_PPB * m_llIntegralDivisor / 1000;
+} // Init
+
+//=============================================================================
+LONG CDriftController::Update(
+  IN  LONG                    FillLevel,
+  IN  LONG                    CatchUp,
+  IN  ULONG                   Frames
+)
+/*
+Routine Description:
+  Feeds one period into the loop and returns the ratio correction for it.
+
+Arguments:
+  FillLevel - frames the reader is behind the writer, see
+              CLoopbackBuffer::GetFillLevel
+  CatchUp - frames the writer had to drop for this reader
+            (RTSD_OVERRUN_STRETCH). Counted as if the reader had been that
+            far behind for a second.
+  Frames - stream frames the reader is about to consume
+
+Return Value:
+  Correction for SetRatioAdjust, in parts per billion
+*/
+{
+  LONGLONG error = (LONGLONG)FillLevel - m_lTarget;
+
+  // the first period starts the filter where the fill level is
+  if (!m_fPrimed) {
+    m_llFiltered = error << 8;
+    m_fPrimed = TRUE;
+  }
+  m_llFiltered += ((error << 8) - m_llFiltered) / 16;
+  error = m_llFiltered >> 8;
+
+  m_llIntegral += error * Frames + (LONGLONG)CatchUp * m_ulStreamRate;
+  m_llIntegral = RTSD_MAX(RTSD_MIN(m_llIntegral, m_llIntegralLimit), -m_llIntegralLimit);
+
+  LONGLONG adjust = error * 2000000000 / m_llProportionalDivisor + m_llIntegral * 1000 / m_llIntegralDivisor;
+  adjust = RTSD_MAX(RTSD_MIN(adjust, DRIFT_MAX_ADJUST_PPB), -DRIFT_MAX_ADJUST_PPB);
+
+  return (LONG)adjust;
+} // Update
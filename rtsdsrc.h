@@ -0,0 +1,163 @@
+/*
+Module Name:
+  rtsdsrc.h
+
+Abstract:
+  Definition of the sample rate converter of the loopback path and of the
+  drift controller that trims its ratio. Both use fixed point math only,
+  so they can run at DISPATCH_LEVEL without saving the floating point
+  state. Only the filter table is computed with floating point, at
+  PASSIVE_LEVEL.
+*/
+
+#ifndef __RTSDSRC_H_
+#define __RTSDSRC_H_
+
+#include "rtsdconv.h"
+
+//=============================================================================
+// Defines
+//=============================================================================
+
+// Frames a stream resamples per step. Bounds the scratch buffers.
+#define RESAMPLER_BLOCK_FRAMES      256
+
+// Channel counts up to this one get an inner loop of their own, more use
+// the generic one.
+#define RESAMPLER_SPECIALIZED_CHANNELS 8
+
+// Largest ratio correction of the drift controller, in parts per billion.
+#define DRIFT_MAX_ADJUST_PPB        2000000
+
+// Time constant of the drift control loop, in seconds. Slow enough that
+// the ratio changes are inaudible.
+#define DRIFT_TIME_CONSTANT_S       50
+
+// Default fill level the drift controller holds the ring at, in ms. 0
+// leaves drift control off, so capture streams at the rate of the ring
+// get the samples of the render stream unchanged.
+#define DRIFT_TARGET_MS             0
+
+//=============================================================================
+// Enumerations
+//=============================================================================
+
+// Filter of the converter. Values of the ResamplerQuality setting.
+typedef enum {
+  RESAMPLER_QUALITY_LINEAR = 0,       // Linear interpolation, no filter.
+  RESAMPLER_QUALITY_16TAP,            // 16 tap windowed sinc.
+  RESAMPLER_QUALITY_64TAP,            // 64 tap windowed sinc.
+  RESAMPLER_QUALITY_COUNT
+} RESAMPLER_QUALITY;
+
+//=============================================================================
+// Inline functions
+//=============================================================================
+
+// Whether a stream at StreamRate needs a converter to or from a ring at
+// RingRate. Capture streams under drift control (TargetLatencyMs other
+// than 0) always do, so the controller can trim the ratio; all others at
+// the ring's rate get a plain copy.
+__forceinline BOOLEAN ResamplerNeeded(BOOLEAN Capture, ULONG StreamRate, ULONG RingRate, ULONG TargetLatencyMs)
+{
+  return (StreamRate != RingRate) || (Capture && (TargetLatencyMs != 0));
+}
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CResampler
+//
+// Streaming polyphase converter. The filter table holds m_ulPhases + 1
+// phases of m_ulTaps coefficients; the coefficients of the exact position
+// are interpolated between the two closest phases. The read position is a
+// 32.32 fixed point frame index into the input buffer, so the ratio does
+// not have to be rational with a small denominator.
+// The caller appends input at GetInputBuffer and calls Process, which
+// writes to GetOutputBuffer. The input that is still needed for the next
+// outputs is kept at the front of the input buffer.
+// The inner loop is instantiated per channel count and filter length, so
+// it runs without format branches; Init picks the instance.
+// Init and Free run at PASSIVE_LEVEL, everything else at any IRQL.
+
+class CResampler {
+private:
+  // Produces up to OutputFrames frames from Position on, see Filter.
+  typedef ULONG (CResampler::*PFILTER)(IN OUT PULONGLONG Position, IN ULONG OutputFrames);
+  static const PFILTER        s_Filters[RESAMPLER_QUALITY_COUNT][RESAMPLER_SPECIALIZED_CHANNELS + 1];
+
+  PLONG                       m_pCoefficients;    // (m_ulPhases + 1) * m_ulTaps, Q30
+  PLONG                       m_pInput;
+  PLONG                       m_pOutput;
+  ULONG                       m_ulChannels;
+  ULONG                       m_ulTaps;
+  ULONG                       m_ulPhaseShift;     // 32 - log2(m_ulPhases)
+  ULONG                       m_ulInputSize;      // in frames
+  ULONG                       m_ulOutputSize;     // in frames
+  ULONG                       m_ulBlockFrames;
+  ULONG                       m_ulFill;           // frames in m_pInput
+  ULONGLONG                   m_ullBaseStep;      // InRate / OutRate, 32.32
+  ULONGLONG                   m_ullStep;          // input frames per output frame, 32.32
+  ULONGLONG                   m_ullPosition;      // first input frame of the next output, 32.32
+  PFILTER                     m_pfnFilter;
+
+  NTSTATUS BuildFilter(IN ULONG InRate, IN ULONG OutRate, IN ULONG Phases);
+  template <ULONG Channels, ULONG Taps> ULONG Filter(IN OUT PULONGLONG Position, IN ULONG OutputFrames);
+
+public:
+  CResampler();
+  ~CResampler();
+
+  NTSTATUS Init(IN ULONG InRate, IN ULONG OutRate, IN ULONG Channels, IN ULONG Quality, IN ULONG BlockFrames);
+  void Free(void);
+  void Reset(void);
+
+  ULONG GetInputFrames(IN ULONG OutputFrames);
+  ULONG Process(IN ULONG InputFrames, IN ULONG OutputFrames);
+  void SetRatioAdjust(IN LONG Ppb);
+
+  BOOLEAN IsActive(void)          { return m_pInput != NULL; }
+  ULONG   GetBlockFrames(void)    { return m_ulBlockFrames; }
+  PLONG   GetInputBuffer(void)    { return m_pInput + m_ulFill * m_ulChannels; }
+  PLONG   GetOutputBuffer(void)   { return m_pOutput; }
+
+#ifdef RTSD_USERMODE
+  // For benchmarks: runs the inner loop for any channel count.
+  void SetGenericFilter(void);
+#endif
+};
+typedef CResampler *PCResampler;
+
+///////////////////////////////////////////////////////////////////////////////
+// CDriftController
+//
+// PI controller that holds the fill level of a reader of the loopback ring
+// at a target by trimming the ratio of the reader's resampler. Render and
+// capture are paced by separate timers, so without it the ring slowly
+// fills up or runs dry. The fill level comes from GetFillLevel, which
+// already hides the period steps of the writer; the controller low-passes
+// it against timer jitter. The loop is critically damped with
+// a time constant of DRIFT_TIME_CONSTANT_S; the integral is clamped so it
+// can not wind up beyond DRIFT_MAX_ADJUST_PPB.
+
+class CDriftController {
+private:
+  LONG                        m_lTarget;          // in ring frames
+  ULONG                       m_ulStreamRate;
+  LONGLONG                    m_llFiltered;       // smoothed error, Q8 ring frames
+  LONGLONG                    m_llIntegral;       // sum of error * stream frames
+  LONGLONG                    m_llIntegralLimit;
+  LONGLONG                    m_llProportionalDivisor;
+  LONGLONG                    m_llIntegralDivisor;
+  BOOLEAN                     m_fPrimed;
+
+public:
+  CDriftController();
+
+  void Init(IN ULONG RingRate, IN ULONG StreamRate, IN ULONG TargetFrames);
+  LONG Update(IN LONG FillLevel, IN LONG CatchUp, IN ULONG Frames);
+};
+typedef CDriftController *PCDriftController;
+
+#endif
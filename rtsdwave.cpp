@@ -10,6 +10,8 @@ Abstract:
 #include "common.h"
 #include "rtsdwave.h"
 #include "rtsdwavestream.h"
+#include "rtsdwavert.h"
+#include "rtsdwavertstream.h"
 #include "wavtable.h"
 
 #pragma code_seg("PAGE")
@@ -45,6 +47,78 @@ Return Value:
   STD_CREATE_BODY(CMiniportWaveCyclic, Unknown, UnknownOuter, PoolType);
 }
 
+//=============================================================================
+PVOID CMiniportWaveCyclic::operator new( 
+  IN  size_t                  Size,
+  IN  POOL_TYPE               PoolType,
+  IN  ULONG                   Tag
+)
+/*
+Routine Description:
+  Allocates a miniport that starts on a cache line, as m_Loopback needs.
+  The pool only aligns small blocks to 16 bytes, but a block of a page or
+  more starts on a page, so the size is rounded up to one. There is one
+  miniport per filter. Zeroed like the portcls operator new.
+
+Arguments:
+  Size - size of the miniport
+  PoolType - pool to allocate from
+  Tag - pool tag
+
+Return Value:
+  The miniport's memory, or NULL.
+*/
+{
+  PVOID pMemory = ExAllocatePoolWithTag(PoolType, RTSD_MAX(Size, (size_t) PAGE_SIZE), Tag);
+
+  if (pMemory) {
+    ASSERT(((ULONG_PTR) pMemory & (RTSD_CACHE_LINE - 1)) == 0);
+    RtlZeroMemory(pMemory, Size);
+  }
+
+  return pMemory;
+} // operator new
+
+//=============================================================================
+PVOID CMiniportWaveCyclic::operator new( 
+  IN  size_t                  Size,
+  IN  POOL_TYPE               PoolType
+)
+/*
+Routine Description:
+  As above, with the driver's pool tag.
+
+Arguments:
+  Size - size of the miniport
+  PoolType - pool to allocate from
+
+Return Value:
+  The miniport's memory, or NULL.
+*/
+{
+  return operator new(Size, PoolType, RTSDAUDIO_POOLTAG);
+} // operator new
+
+//=============================================================================
+void CMiniportWaveCyclic::operator delete( 
+  IN  PVOID                   Memory
+)
+/*
+Routine Description:
+  Frees a miniport of operator new.
+
+Arguments:
+  Memory - the miniport's memory
+
+Return Value:
+  void
+*/
+{
+  if (Memory) {
+    ExFreePool(Memory);
+  }
+} // operator delete
+
 //=============================================================================
 CMiniportWaveCyclic::~CMiniportWaveCyclic(void)
 /*
@@ -60,12 +134,21 @@ Return Value:
   PAGED_CODE();
   DPF_ENTER(("[CMiniportWaveCyclic::~CMiniportWaveCyclic]"));
 
-  if (m_Port)
+  // No stream is left, but a last tick may still be on its way and
+  // notifies through the port.
+  m_Scheduler.Shutdown();
+
+  if (m_Port) {
       m_Port->Release();
+      m_Port = NULL;
+  }
 
   if (m_ServiceGroup)
       m_ServiceGroup->Release();
 
+  if (m_CaptureServiceGroup)
+      m_CaptureServiceGroup->Release();
+
   if (m_AdapterCommon)
       m_AdapterCommon->Release();
 }
@@ -83,7 +166,8 @@ STDMETHODIMP_(NTSTATUS) CMiniportWaveCyclic::DataRangeIntersection(
 /*
 Routine Description:
   The DataRangeIntersection function determines the highest quality 
-  intersection of two data ranges.
+  intersection of two data ranges. While streams are open, the format of the
+  loopback ring is preferred, so capture picks up the render stream's rate.
 
 Arguments:
   PinId -           Pin for which data intersection is being determined. 
@@ -91,8 +175,7 @@ Arguments:
                     range submitted by client in the data range intersection 
                     property request. 
   MyDataRange -         Pin's data range to be compared with client's data 
-                        range. In this case we actually ignore our own data 
-                        range, because we know that we only support one range.
+                        range.
   OutputBufferLength -  Size of the buffer pointed to by the resultant format 
                         parameter. 
   ResultantFormat -     Pointer to value where the resultant format should be 
@@ -106,11 +189,85 @@ Return Value:
 */
 {
   PAGED_CODE();
+  ASSERT(ClientDataRange);
+  ASSERT(MyDataRange);
+  ASSERT(ResultantFormatLength);
+
+  // Portcls can only build a WAVEFORMATEX, which can't describe more than
+  // two channels. Build a WAVEFORMATEXTENSIBLE for PCM and float ranges
+  // ourselves and leave everything else (wildcards, DSOUND) to portcls.
+  if (!IsEqualGUIDAligned(ClientDataRange->Specifier, KSDATAFORMAT_SPECIFIER_WAVEFORMATEX) ||
+      !IsEqualGUIDAligned(ClientDataRange->SubFormat, MyDataRange->SubFormat) ||
+      (ClientDataRange->FormatSize < sizeof(KSDATARANGE_AUDIO))) {
+    return STATUS_NOT_IMPLEMENTED;
+  }
+
+  // Ours, too, has to be an audio range before it is read as one.
+  if (!IsEqualGUIDAligned(MyDataRange->Specifier, KSDATAFORMAT_SPECIFIER_WAVEFORMATEX) ||
+      (MyDataRange->FormatSize < sizeof(KSDATARANGE_AUDIO))) {
+    return STATUS_NOT_IMPLEMENTED;
+  }
+
+  PKSDATARANGE_AUDIO pClient = (PKSDATARANGE_AUDIO) ClientDataRange;
+  PKSDATARANGE_AUDIO pMine = (PKSDATARANGE_AUDIO) MyDataRange;
+
+  ULONG minBits = RTSD_MAX(pClient->MinimumBitsPerSample, pMine->MinimumBitsPerSample);
+  ULONG minRate = RTSD_MAX(pClient->MinimumSampleFrequency, pMine->MinimumSampleFrequency);
 
-  // This driver only supports PCM formats.
-  // Portcls will handle the request for us.
+  // Highest quality both ranges allow.
+  ULONG channels = RTSD_MIN(pClient->MaximumChannels, pMine->MaximumChannels);
+  ULONG bits = RTSD_MIN(pClient->MaximumBitsPerSample, pMine->MaximumBitsPerSample) & ~7;
+  ULONG rate = RTSD_MIN(pClient->MaximumSampleFrequency, pMine->MaximumSampleFrequency);
 
-  return STATUS_NOT_IMPLEMENTED;
+  if ((channels < m_MinChannels) || (bits < minBits) || (rate < minRate)) {
+    return STATUS_NO_MATCH;
+  }
+
+  // While streams are open, the loopback ring has a channel count the other
+  // streams have to match, and a rate that saves them the resampler. Offer
+  // them if they fit. The sample type is converted, so the highest sample
+  // size is kept.
+  if (m_ulCaptureAllocated || m_fRenderAllocated) {
+    if ((m_LoopbackFormat.nSamplesPerSec >= minRate) &&
+        (m_LoopbackFormat.nSamplesPerSec <= rate)) {
+      rate = m_LoopbackFormat.nSamplesPerSec;
+    }
+    if ((m_LoopbackFormat.nChannels >= m_MinChannels) &&
+        (m_LoopbackFormat.nChannels <= channels)) {
+      channels = m_LoopbackFormat.nChannels;
+    }
+  }
+
+  // Tell the caller how big a buffer it needs.
+  if (!OutputBufferLength) {
+    *ResultantFormatLength = sizeof(KSDATAFORMAT) + sizeof(WAVEFORMATEXTENSIBLE);
+    return STATUS_BUFFER_OVERFLOW;
+  }
+  if (OutputBufferLength < sizeof(KSDATAFORMAT) + sizeof(WAVEFORMATEXTENSIBLE)) {
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+
+  PKSDATAFORMAT pFormat = (PKSDATAFORMAT) ResultantFormat;
+  PWAVEFORMATEXTENSIBLE pWfxExt = (PWAVEFORMATEXTENSIBLE) (pFormat + 1);
+
+  *pFormat = *ClientDataRange;
+  pFormat->FormatSize = sizeof(KSDATAFORMAT) + sizeof(WAVEFORMATEXTENSIBLE);
+
+  pWfxExt->Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  pWfxExt->Format.nChannels = (WORD) channels;
+  pWfxExt->Format.nSamplesPerSec = rate;
+  pWfxExt->Format.wBitsPerSample = (WORD) bits;
+  pWfxExt->Format.nBlockAlign = (WORD) (channels * bits / 8);
+  pWfxExt->Format.nAvgBytesPerSec = rate * pWfxExt->Format.nBlockAlign;
+  pWfxExt->Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+  pWfxExt->Samples.wValidBitsPerSample = (WORD) bits;
+  pWfxExt->dwChannelMask = ChannelMasks[channels - 1];
+  pWfxExt->SubFormat = MyDataRange->SubFormat;
+
+  pFormat->SampleSize = pWfxExt->Format.nBlockAlign;
+
+  *ResultantFormatLength = pFormat->FormatSize;
+  return STATUS_SUCCESS;
 } // DataRangeIntersection
 
 //=============================================================================
@@ -165,6 +322,43 @@ Return Value:
   ASSERT(Port_);
   DPF_ENTER(("[CMiniportWaveCyclic::Init]"));
 
+  NTSTATUS ntStatus = InitEngine(UnknownAdapter_, SchedulerNotify, this);
+
+  if (NT_SUCCESS(ntStatus)) {
+    // AddRef() is required because we are keeping this pointer.
+    m_Port = Port_;
+    m_Port->AddRef();
+  }
+
+  return ntStatus;
+} // Init
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclic::InitEngine( 
+  IN  PUNKNOWN                UnknownAdapter_,
+  IN  PSCHEDULER_SERVICE      Service,
+  IN  PVOID                   Context
+)
+/*
+Routine Description:
+  Initializes everything but the port: settings, service groups, the
+  scheduler and the filter descriptor. Init does this for the wavecyclic
+  port; the WaveRT miniport calls it directly and has the scheduler service
+  its own streams.
+
+Arguments:
+  UnknownAdapter - A pointer to the Iuknown interface of the adapter object. 
+  Service - routine the scheduler services the running streams with
+  Context - passed to Service
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(UnknownAdapter_);
+  ASSERT(Service);
+
   NTSTATUS ntStatus;
   
   m_AdapterCommon = NULL;
@@ -175,6 +369,7 @@ Return Value:
   m_SamplingFrequency = 0;
 
   m_ServiceGroup = NULL;
+  m_CaptureServiceGroup = NULL;
   m_MaxDmaBufferSize = DMA_BUFFER_SIZE;
 
   m_MaxOutputStreams      = MAX_OUTPUT_STREAMS;
@@ -189,29 +384,34 @@ Return Value:
   m_MinSampleRatePcm      = MIN_SAMPLE_RATE;
   m_MaxSampleRatePcm      = MAX_SAMPLE_RATE;
 
-  // eigenes
-  myBuffer=NULL;
-  myBufferSize = 0;
-  myBufferLocked = TRUE;
-  myBufferWritePos = 0;
-  myBufferReadPos = 0;
-  myBufferReading = FALSE;
-  // eigenes
-
-  // AddRef() is required because we are keeping this pointer.
-  m_Port = Port_;
-  m_Port->AddRef();
+  m_LoopbackBufferMs      = LOOPBACK_BUFFER_MS;
+  m_LoopbackBufferFrames  = 0;
+  m_ResamplerQuality      = RESAMPLER_QUALITY_16TAP;
+  m_TargetLatencyMs       = DRIFT_TARGET_MS;
+  m_DitherMode            = LOOPBACK_DITHER_TPDF;
+  m_CaptureClock          = CAPTURE_CLOCK_TIMER;
+  m_CaptureRoutingCount   = 0;
+  RtlZeroMemory(&m_LoopbackFormat, sizeof(m_LoopbackFormat));
+  m_LoopbackChannelMask   = 0;
 
   // We want the IAdapterCommon interface on the adapter common object,
   // which is given to us as a IUnknown.  The QueryInterface call gives us
   // an AddRefed pointer to the interface we want.
   ntStatus = UnknownAdapter_->QueryInterface(IID_IAdapterCommon, (PVOID *) &m_AdapterCommon);
   if (NT_SUCCESS(ntStatus)) {
+    ReadSettings();
+
     KeInitializeMutex(&m_SampleRateSync, 1);
+    KeInitializeMutex(&m_StreamSync, 1);
     ntStatus = PcNewServiceGroup(&m_ServiceGroup, NULL);
 
     if (NT_SUCCESS(ntStatus)) {
       m_AdapterCommon->SetWaveServiceGroup(m_ServiceGroup);
+      ntStatus = PcNewServiceGroup(&m_CaptureServiceGroup, NULL);
+    }
+
+    if (NT_SUCCESS(ntStatus)) {
+      m_Scheduler.Init(Service, Context);
     }
   }
 
@@ -224,26 +424,27 @@ Return Value:
         m_ServiceGroup->Release();
         m_ServiceGroup = NULL;
       }
+      if (m_CaptureServiceGroup) {
+        m_CaptureServiceGroup->Release();
+        m_CaptureServiceGroup = NULL;
+      }
 
       m_AdapterCommon->Release();
       m_AdapterCommon = NULL;
     }
-
-    // release the port
-    m_Port->Release();
-    m_Port = NULL;
   }
 
   if (NT_SUCCESS(ntStatus)) {
     // Set filter descriptor.
     m_FilterDescriptor = &MiniportFilterDescriptor;
 
-    m_fCaptureAllocated = FALSE;
+    m_ulCaptureAllocated = 0;
     m_fRenderAllocated = FALSE;
+    m_fRenderRunning = FALSE;
   }
 
   return ntStatus;
-} // Init
+} // InitEngine
 
 //=============================================================================
 STDMETHODIMP_(NTSTATUS) CMiniportWaveCyclic::NewStream( 
@@ -288,10 +489,18 @@ Return Value:
   NTSTATUS                    ntStatus = STATUS_SUCCESS;
   PCMiniportWaveCyclicStream  stream = NULL;
 
+  // The stream flags and the loopback ring must not change under us, see
+  // PropertyHandlerLoopbackBuffer.
+  ntStatus = KeWaitForSingleObject(&m_StreamSync, Executive, KernelMode, FALSE, NULL);
+  if (!NT_SUCCESS(ntStatus)) {
+    DPF(D_TERSE, ("[StreamSync failed: %08X]", ntStatus));
+    return ntStatus;
+  }
+
   // Check if we have enough streams.
   if (Capture) {
-    if (m_fCaptureAllocated) {
-      DPF(D_TERSE, ("[Only one capture stream supported]"));
+    if (m_ulCaptureAllocated >= m_MaxOutputStreams) {
+      DPF(D_TERSE, ("[Only %d capture streams supported]", m_MaxOutputStreams));
       ntStatus = STATUS_INSUFFICIENT_RESOURCES;
     }
   } else {
@@ -306,6 +515,18 @@ Return Value:
     ntStatus = ValidateFormat(DataFormat);
   }
 
+  // The render stream has to match the channel count of the shared ring,
+  // capture streams mix it to theirs.
+  if (NT_SUCCESS(ntStatus) && (m_ulCaptureAllocated || m_fRenderAllocated)) {
+    ntStatus = ValidateLoopbackFormat(GetWaveFormatEx(DataFormat), Capture);
+  }
+
+  // The loopback ring is sized for the first stream that is opened. It is
+  // allocated here at PASSIVE_LEVEL so the streaming path never has to.
+  if (NT_SUCCESS(ntStatus) && !m_ulCaptureAllocated && !m_fRenderAllocated) {
+    ntStatus = AllocateLoopbackBuffer(GetWaveFormatEx(DataFormat), Capture);
+  }
+
   // Instantiate a stream. Stream must be in
   // NonPagedPool because of file saving.
   if (NT_SUCCESS(ntStatus)) {
@@ -320,7 +541,7 @@ Return Value:
 
   if (NT_SUCCESS(ntStatus)) {
     if (Capture) {
-      m_fCaptureAllocated = TRUE;
+      m_ulCaptureAllocated++;
     } else {
       m_fRenderAllocated = TRUE;
     }
@@ -331,7 +552,7 @@ Return Value:
     *OutDmaChannel = PDMACHANNEL(stream);
     (*OutDmaChannel)->AddRef();
 
-    *OutServiceGroup = m_ServiceGroup;
+    *OutServiceGroup = Capture ? m_CaptureServiceGroup : m_ServiceGroup;
     (*OutServiceGroup)->AddRef();
 
     // The stream, the DMA channel, and the service group have
@@ -339,6 +560,8 @@ Return Value:
     // references to be there.
   }
 
+  KeReleaseMutex(&m_StreamSync, FALSE);
+
   // This is our private reference to the stream.  The caller has
   // its own, so we can release in any case.
   if (stream)
@@ -437,6 +660,66 @@ Return Value:
   return ntStatus;
 } // PropertyHandlerComponentId
 
+//=============================================================================
+static PCMiniportWaveCyclic GetWaveMiniport( 
+  IN PUNKNOWN                 MajorTarget 
+)
+/*
+Routine Description:
+  Returns the wavecyclic miniport behind the miniport a property request
+  is for. Under the WaveRT port that is the one the WaveRT miniport runs.
+
+Arguments:
+  MajorTarget - miniport of the request
+
+Return Value:
+  PCMiniportWaveCyclic
+*/
+{
+  PAGED_CODE();
+
+#ifdef RTSD_WAVERT
+  PMINIPORTWAVERT pMiniportRT;
+  if (NT_SUCCESS(MajorTarget->QueryInterface(IID_IMiniportWaveRT, (PVOID *) &pMiniportRT))) {
+    PCMiniportWaveCyclic pWave = ((PCMiniportWaveRT) pMiniportRT)->GetWave();
+    pMiniportRT->Release();
+    return pWave;
+  }
+#endif
+
+  return (PCMiniportWaveCyclic) MajorTarget;
+} // GetWaveMiniport
+
+//=============================================================================
+static PCMiniportWaveCyclicStream GetWaveStream( 
+  IN PVOID                    MinorTarget 
+)
+/*
+Routine Description:
+  Returns the wavecyclic stream behind the stream a property request is
+  for, see GetWaveMiniport.
+
+Arguments:
+  MinorTarget - stream of the request
+
+Return Value:
+  PCMiniportWaveCyclicStream
+*/
+{
+  PAGED_CODE();
+
+#ifdef RTSD_WAVERT
+  PMINIPORTWAVERTSTREAM pStreamRT;
+  if (NT_SUCCESS(PUNKNOWN(MinorTarget)->QueryInterface(IID_IMiniportWaveRTStream, (PVOID *) &pStreamRT))) {
+    PCMiniportWaveCyclicStream pStream = ((PCMiniportWaveRTStream) pStreamRT)->GetWaveStream();
+    pStreamRT->Release();
+    return pStream;
+  }
+#endif
+
+  return (PCMiniportWaveCyclicStream) (PMINIPORTWAVECYCLICSTREAM) MinorTarget;
+} // GetWaveStream
+
 //=============================================================================
 NTSTATUS PropertyHandler_WaveFilter( 
   IN PPCPROPERTY_REQUEST      PropertyRequest 
@@ -455,7 +738,11 @@ Return Value:
   PAGED_CODE();
 
   NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
-  PCMiniportWaveCyclic pWave = (PCMiniportWaveCyclic) PropertyRequest->MajorTarget;
+  PCMiniportWaveCyclic pWave = GetWaveMiniport(PropertyRequest->MajorTarget);
+
+  if (IsEqualGUIDAligned(*PropertyRequest->PropertyItem->Set, KSPROPSETID_RtsdLoopback)) {
+    return pWave->PropertyHandlerLoopback(PropertyRequest);
+  }
 
   switch (PropertyRequest->PropertyItem->Id) {
     case KSPROPERTY_GENERAL_COMPONENTID:
@@ -469,6 +756,262 @@ Return Value:
   return ntStatus;
 } // PropertyHandler_WaveFilter
 
+//=============================================================================
+NTSTATUS PropertyHandler_WaveCapturePin( 
+  IN PPCPROPERTY_REQUEST      PropertyRequest 
+)
+/*
+Routine Description:
+  Redirects property requests of a capture pin instance to its stream.
+  Requests on the pin factory have no stream to go to.
+
+Arguments:
+  PropertyRequest - 
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  if (!PropertyRequest->MinorTarget) {
+    DPF(D_TERSE, ("[PropertyHandler_WaveCapturePin: No stream]"));
+    return STATUS_INVALID_DEVICE_REQUEST;
+  }
+
+  PCMiniportWaveCyclicStream pStream = GetWaveStream(PropertyRequest->MinorTarget);
+
+  if (IsEqualGUIDAligned(*PropertyRequest->PropertyItem->Set, KSPROPSETID_RtsdLoopback) &&
+      (PropertyRequest->PropertyItem->Id == KSPROPERTY_RTSD_LOOPBACK_ROUTING)) {
+    return pStream->PropertyHandlerRouting(PropertyRequest);
+  }
+
+  DPF(D_TERSE, ("[PropertyHandler_WaveCapturePin: Invalid Device Request]"));
+  return STATUS_INVALID_DEVICE_REQUEST;
+} // PropertyHandler_WaveCapturePin
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclic::PropertyHandlerLoopback(
+  IN  PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*
+Routine Description:
+  Handles the private KSPROPSETID_RtsdLoopback property set.
+
+Arguments:
+  PropertyRequest - property request structure
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(PropertyRequest);
+  ASSERT(PropertyRequest->PropertyItem);
+
+  NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+  switch (PropertyRequest->PropertyItem->Id) {
+    case KSPROPERTY_RTSD_LOOPBACK_BUFFER:
+      ntStatus = PropertyHandlerLoopbackBuffer(PropertyRequest);
+      break;
+
+    case KSPROPERTY_RTSD_LOOPBACK_OVERRUN_POLICY:
+      ntStatus = PropertyHandlerOverrunPolicy(PropertyRequest);
+      break;
+
+    case KSPROPERTY_RTSD_LOOPBACK_STATISTICS:
+      ntStatus = PropertyHandlerStatistics(PropertyRequest);
+      break;
+
+    case KSPROPERTY_RTSD_LOOPBACK_UNDERRUN_MODE:
+      ntStatus = PropertyHandlerUnderrunMode(PropertyRequest);
+      break;
+
+    default:
+      DPF(D_TERSE, ("[PropertyHandlerLoopback: Invalid Device Request]"));
+  }
+
+  return ntStatus;
+} // PropertyHandlerLoopback
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclic::PropertyHandlerLoopbackBuffer(
+  IN  PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*
+Routine Description:
+  Processes KSPROPERTY_RTSD_LOOPBACK_BUFFER. The new depth takes effect when
+  the next stream is opened, so it can only be changed while no stream is
+  open. m_StreamSync keeps NewStream from opening one meanwhile.
+
+Arguments:
+  PropertyRequest - property request structure
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(PropertyRequest);
+  DPF_ENTER(("[CMiniportWaveCyclic::PropertyHandlerLoopbackBuffer]"));
+
+  NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+  if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT) {
+    ntStatus = PropertyHandler_BasicSupport(PropertyRequest, KSPROPERTY_TYPE_ALL, VT_ILLEGAL);
+  } else {
+    ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(RTSD_LOOPBACK_BUFFER), 0);
+    if (NT_SUCCESS(ntStatus)) {
+      PRTSD_LOOPBACK_BUFFER pBuffer = (PRTSD_LOOPBACK_BUFFER) PropertyRequest->Value;
+
+      if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET) {
+        pBuffer->Milliseconds = m_LoopbackBufferMs;
+        pBuffer->Frames = m_LoopbackBufferFrames;
+        PropertyRequest->ValueSize = sizeof(RTSD_LOOPBACK_BUFFER);
+      } else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET) {
+        ntStatus = KeWaitForSingleObject(&m_StreamSync, Executive, KernelMode, FALSE, NULL);
+        if (NT_SUCCESS(ntStatus)) {
+          if (m_ulCaptureAllocated || m_fRenderAllocated) {
+            DPF(D_TERSE, ("[Loopback buffer can't be resized while streams are open]"));
+            ntStatus = STATUS_INVALID_DEVICE_STATE;
+          } else if (!pBuffer->Frames &&
+                     ((pBuffer->Milliseconds < LOOPBACK_BUFFER_MS_MIN) ||
+                      (pBuffer->Milliseconds > LOOPBACK_BUFFER_MS_MAX))) {
+            ntStatus = STATUS_INVALID_PARAMETER;
+          } else {
+            m_LoopbackBufferMs = pBuffer->Milliseconds ? pBuffer->Milliseconds : m_LoopbackBufferMs;
+            m_LoopbackBufferFrames = pBuffer->Frames;
+          }
+          KeReleaseMutex(&m_StreamSync, FALSE);
+        }
+      }
+    }
+  }
+
+  return ntStatus;
+} // PropertyHandlerLoopbackBuffer
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclic::PropertyHandlerOverrunPolicy(
+  IN  PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*
+Routine Description:
+  Processes KSPROPERTY_RTSD_LOOPBACK_OVERRUN_POLICY. The policy can be
+  changed while streaming; CopyTo picks it up with its next period.
+
+Arguments:
+  PropertyRequest - property request structure
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(PropertyRequest);
+  DPF_ENTER(("[CMiniportWaveCyclic::PropertyHandlerOverrunPolicy]"));
+
+  NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+  if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT) {
+    ntStatus = PropertyHandler_BasicSupport(PropertyRequest, KSPROPERTY_TYPE_ALL, VT_UI4);
+  } else {
+    ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(ULONG), 0);
+    if (NT_SUCCESS(ntStatus)) {
+      PULONG pPolicy = (PULONG) PropertyRequest->Value;
+
+      if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET) {
+        *pPolicy = m_Loopback.GetOverrunPolicy();
+        PropertyRequest->ValueSize = sizeof(ULONG);
+      } else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET) {
+        ntStatus = m_Loopback.SetOverrunPolicy(*pPolicy);
+      }
+    }
+  }
+
+  return ntStatus;
+} // PropertyHandlerOverrunPolicy
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclic::PropertyHandlerStatistics(
+  IN  PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*
+Routine Description:
+  Processes KSPROPERTY_RTSD_LOOPBACK_STATISTICS
+
+Arguments:
+  PropertyRequest - property request structure
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(PropertyRequest);
+  DPF_ENTER(("[CMiniportWaveCyclic::PropertyHandlerStatistics]"));
+
+  NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+  if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT) {
+    ntStatus = PropertyHandler_BasicSupport(PropertyRequest, KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT, VT_ILLEGAL);
+  } else if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET) {
+    ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(RTSD_LOOPBACK_STATISTICS), 0);
+    if (NT_SUCCESS(ntStatus)) {
+      PRTSD_LOOPBACK_STATISTICS pStatistics = (PRTSD_LOOPBACK_STATISTICS) PropertyRequest->Value;
+      m_Loopback.GetStatistics(pStatistics);
+      pStatistics->SchedulerTicks = m_Scheduler.GetTicks();
+      pStatistics->SchedulerSkipped = m_Scheduler.GetSkipped();
+      pStatistics->SchedulerLateMax = (ULONG) RTSD_MIN(m_Scheduler.GetLateMax(), (ULONGLONG) MAXULONG);
+      PropertyRequest->ValueSize = sizeof(RTSD_LOOPBACK_STATISTICS);
+    }
+  }
+
+  return ntStatus;
+} // PropertyHandlerStatistics
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclic::PropertyHandlerUnderrunMode(
+  IN  PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*
+Routine Description:
+  Processes KSPROPERTY_RTSD_LOOPBACK_UNDERRUN_MODE. The mode can be changed
+  while streaming; CopyFrom picks it up with its next period.
+
+Arguments:
+  PropertyRequest - property request structure
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(PropertyRequest);
+  DPF_ENTER(("[CMiniportWaveCyclic::PropertyHandlerUnderrunMode]"));
+
+  NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+  if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT) {
+    ntStatus = PropertyHandler_BasicSupport(PropertyRequest, KSPROPERTY_TYPE_ALL, VT_UI4);
+  } else {
+    ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(ULONG), 0);
+    if (NT_SUCCESS(ntStatus)) {
+      PULONG pMode = (PULONG) PropertyRequest->Value;
+
+      if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET) {
+        *pMode = m_Loopback.GetUnderrunMode();
+        PropertyRequest->ValueSize = sizeof(ULONG);
+      } else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET) {
+        ntStatus = m_Loopback.SetUnderrunMode(*pMode);
+      }
+    }
+  }
+
+  return ntStatus;
+} // PropertyHandlerUnderrunMode
+
 //=============================================================================
 NTSTATUS CMiniportWaveCyclic::PropertyHandlerCpuResources(
   IN  PPCPROPERTY_REQUEST     PropertyRequest
@@ -538,6 +1081,290 @@ Return Value:
   return ntStatus;
 } // PropertyHandlerGeneric
 
+//=============================================================================
+NTSTATUS OpenSettingsKey(
+  IN  PDEVICE_OBJECT          DeviceObject,
+  OUT PREGISTRYKEY *          SettingsKey
+)
+/*
+Routine Description:
+  Opens the Settings key under the driver's key, which holds the values
+  the INF writes.
+
+Arguments:
+  DeviceObject - the adapter's device object
+  SettingsKey - receives the key, the caller releases it
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(SettingsKey);
+
+  NTSTATUS       ntStatus;
+  PREGISTRYKEY   driverKey = NULL;
+  UNICODE_STRING settingsName;
+
+  *SettingsKey = NULL;
+
+  ntStatus = PcNewRegistryKey(
+    &driverKey,
+    NULL,
+    DriverRegistryKey,
+    KEY_READ,
+    DeviceObject,
+    NULL,
+    NULL,
+    0,
+    NULL
+  );
+  if (NT_SUCCESS(ntStatus)) {
+    RtlInitUnicodeString(&settingsName, L"Settings");
+    ntStatus = driverKey->NewSubKey(SettingsKey, NULL, KEY_READ, &settingsName, REG_OPTION_NON_VOLATILE, NULL);
+    driverKey->Release();
+  }
+
+  return ntStatus;
+} // OpenSettingsKey
+
+//=============================================================================
+ULONG ReadSettingDword(
+  IN  PREGISTRYKEY            Key,
+  IN  PCWSTR                  Name,
+  IN  ULONG                   Default
+)
+/*
+Routine Description:
+  Reads a REG_DWORD value from the driver's Settings key.
+
+Arguments:
+  Key - opened Settings key
+  Name - value name
+  Default - returned if the value is missing or not a REG_DWORD
+
+Return Value:
+  ULONG
+*/
+{
+  PAGED_CODE();
+
+  UNICODE_STRING valueName;
+  UCHAR          buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)];
+  ULONG          resultLength;
+  PKEY_VALUE_PARTIAL_INFORMATION pInfo = (PKEY_VALUE_PARTIAL_INFORMATION) buffer;
+
+  RtlInitUnicodeString(&valueName, Name);
+  if (NT_SUCCESS(Key->QueryValueKey(&valueName, KeyValuePartialInformation, pInfo, sizeof(buffer), &resultLength)) &&
+      (pInfo->Type == REG_DWORD) &&
+      (pInfo->DataLength == sizeof(ULONG))) {
+    return *(PULONG) pInfo->Data;
+  }
+
+  return Default;
+} // ReadSettingDword
+
+//=============================================================================
+static ULONG ReadSettingRouting(
+  IN  PREGISTRYKEY            Key,
+  IN  PCWSTR                  Name,
+  OUT PRTSD_LOOPBACK_ROUTING  Routing,
+  IN  ULONG                   MaxCount
+)
+/*
+Routine Description:
+  Reads channel mixes from a REG_BINARY value of the driver's Settings
+  key. The value is a list of records of ULONG InputChannels, ULONG
+  OutputChannels and OutputChannels rows of InputChannels LONG gains,
+  see RTSD_LOOPBACK_ROUTING. Reading stops at the first broken record.
+
+Arguments:
+  Key - opened Settings key
+  Name - value name
+  Routing - receives the mixes
+  MaxCount - number of entries in Routing
+
+Return Value:
+  Number of mixes read
+*/
+{
+  PAGED_CODE();
+
+  UNICODE_STRING valueName;
+  ULONG          resultLength;
+  ULONG          bufferSize = sizeof(KEY_VALUE_PARTIAL_INFORMATION) + MaxCount * sizeof(RTSD_LOOPBACK_ROUTING);
+  ULONG          count = 0;
+
+  PKEY_VALUE_PARTIAL_INFORMATION pInfo = (PKEY_VALUE_PARTIAL_INFORMATION) ExAllocatePoolWithTag(PagedPool, bufferSize, RTSDAUDIO_POOLTAG);
+  if (!pInfo) {
+    return 0;
+  }
+
+  RtlInitUnicodeString(&valueName, Name);
+  if (NT_SUCCESS(Key->QueryValueKey(&valueName, KeyValuePartialInformation, pInfo, bufferSize, &resultLength)) &&
+      (pInfo->Type == REG_BINARY)) {
+    PLONG pData = (PLONG) pInfo->Data;
+    ULONG left = pInfo->DataLength / sizeof(LONG);
+
+    while ((count < MaxCount) && (left >= 2)) {
+      ULONG inputs = (ULONG) pData[0];
+      ULONG outputs = (ULONG) pData[1];
+
+      if (!inputs || (inputs > RTSD_LOOPBACK_MAX_CHANNELS) ||
+          !outputs || (outputs > RTSD_LOOPBACK_MAX_CHANNELS) ||
+          (left < 2 + inputs * outputs)) {
+        DPF(D_TERSE, ("[Broken record %d in %ws]", count, Name));
+        break;
+      }
+
+      RtlZeroMemory(&Routing[count], sizeof(RTSD_LOOPBACK_ROUTING));
+      Routing[count].InputChannels = inputs;
+      Routing[count].OutputChannels = outputs;
+      for (ULONG o = 0; o < outputs; o++) {
+        RtlCopyMemory(Routing[count].Gain[o], pData + 2 + o * inputs, inputs * sizeof(LONG));
+      }
+
+      pData += 2 + inputs * outputs;
+      left -= 2 + inputs * outputs;
+      count++;
+    }
+  }
+
+  ExFreePool(pInfo);
+  return count;
+} // ReadSettingRouting
+
+//=============================================================================
+void CMiniportWaveCyclic::ReadSettings(void)
+/*
+Routine Description:
+  Reads the loopback settings written by the INF from the driver's Settings
+  key. Missing or invalid values keep their defaults.
+
+Arguments:
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  DPF_ENTER(("[CMiniportWaveCyclic::ReadSettings]"));
+
+  NTSTATUS       ntStatus;
+  PREGISTRYKEY   settingsKey = NULL;
+
+  ntStatus = OpenSettingsKey(m_AdapterCommon->GetDeviceObject(), &settingsKey);
+  if (!NT_SUCCESS(ntStatus)) {
+    DPF(D_TERSE, ("[No Settings key, using defaults: %08X]", ntStatus));
+    return;
+  }
+
+  ULONG bufferMs = ReadSettingDword(settingsKey, L"LoopbackBufferMs", m_LoopbackBufferMs);
+  if ((bufferMs >= LOOPBACK_BUFFER_MS_MIN) && (bufferMs <= LOOPBACK_BUFFER_MS_MAX)) {
+    m_LoopbackBufferMs = bufferMs;
+  }
+  m_LoopbackBufferFrames = ReadSettingDword(settingsKey, L"LoopbackBufferFrames", m_LoopbackBufferFrames);
+
+  // Out of range values are rejected and leave the defaults in place.
+  m_Loopback.SetOverrunPolicy(ReadSettingDword(settingsKey, L"OverrunPolicy", m_Loopback.GetOverrunPolicy()));
+  m_Loopback.SetUnderrunMode(ReadSettingDword(settingsKey, L"UnderrunMode", m_Loopback.GetUnderrunMode()));
+
+  ULONG resamplerQuality = ReadSettingDword(settingsKey, L"ResamplerQuality", m_ResamplerQuality);
+  if (resamplerQuality < RESAMPLER_QUALITY_COUNT) {
+    m_ResamplerQuality = resamplerQuality;
+  }
+
+  // Streams clamp the target to half the ring they find.
+  ULONG targetLatencyMs = ReadSettingDword(settingsKey, L"TargetLatencyMs", m_TargetLatencyMs);
+  if (targetLatencyMs <= LOOPBACK_BUFFER_MS_MAX / 2) {
+    m_TargetLatencyMs = targetLatencyMs;
+  }
+
+  ULONG ditherMode = ReadSettingDword(settingsKey, L"DitherMode", m_DitherMode);
+  if (ditherMode < LOOPBACK_DITHER_MODE_COUNT) {
+    m_DitherMode = ditherMode;
+  }
+
+  ULONG captureClock = ReadSettingDword(settingsKey, L"CaptureClock", m_CaptureClock);
+  if (captureClock < CAPTURE_CLOCK_COUNT) {
+    m_CaptureClock = captureClock;
+  }
+
+  // Only levels the processor supports are accepted.
+  m_Loopback.SetConvertLevel(ReadSettingDword(settingsKey, L"ConvertLevel", GetBestConvertLevel()));
+
+  m_CaptureRoutingCount = ReadSettingRouting(settingsKey, L"CaptureRouting", m_CaptureRouting, CAPTURE_ROUTING_DEFAULTS);
+
+  settingsKey->Release();
+} // ReadSettings
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclic::AllocateLoopbackBuffer(
+  IN  PWAVEFORMATEX           pWfx,
+  IN  BOOLEAN                 Capture
+)
+/*
+Routine Description:
+  (Re)allocates the loopback ring for the given format and resets its
+  cursors. The depth is LoopbackBufferFrames, or LoopbackBufferMs converted
+  to frames, rounded up to a power of two. The ring takes the channel count
+  of the format; its samples are float for a float format and pivot
+  samples (see rtsdconv.h) for everything else.
+  A capture stream opened first makes the ring at least stereo, so a mono
+  capture client does not restrict the render stream to mono. The ring's
+  speaker positions are those of a render format that names them, else
+  the ones offered for its channel count.
+  Must only be called while no stream is open.
+
+Arguments:
+  pWfx - format of the stream that is being opened
+  Capture - the stream is a capture stream
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(pWfx);
+  DPF_ENTER(("[CMiniportWaveCyclic::AllocateLoopbackBuffer]"));
+
+  ULONG frames = m_LoopbackBufferFrames;
+  if (!frames) {
+    frames = (ULONG) (((ULONGLONG) pWfx->nSamplesPerSec * m_LoopbackBufferMs + 999) / 1000);
+  }
+
+  // Float streams keep float samples in the ring, everything else pivot
+  // samples.
+  LOOPBACK_SAMPLE_TYPE sampleType = LOOPBACK_SAMPLE_INT32;
+  if (GetSampleType(pWfx) == LOOPBACK_SAMPLE_FLOAT32) {
+    sampleType = LOOPBACK_SAMPLE_FLOAT32;
+  }
+
+  WORD channels = pWfx->nChannels;
+  if (Capture) {
+    channels = RTSD_MAX(channels, 2);
+  }
+
+  NTSTATUS ntStatus = m_Loopback.Allocate(frames, channels, sampleType);
+  if (NT_SUCCESS(ntStatus)) {
+    m_LoopbackFormat = *pWfx;
+    m_LoopbackFormat.wFormatTag = GetWaveFormatTag(pWfx);
+    m_LoopbackFormat.nChannels = channels;
+    m_LoopbackFormat.nBlockAlign = pWfx->nBlockAlign / pWfx->nChannels * channels;
+    m_LoopbackFormat.nAvgBytesPerSec = m_LoopbackFormat.nBlockAlign * pWfx->nSamplesPerSec;
+    m_LoopbackFormat.cbSize = 0;
+    m_LoopbackChannelMask = GetWaveChannelMask(pWfx);
+    if (Capture || !m_LoopbackChannelMask) {
+      m_LoopbackChannelMask = ChannelMasks[channels - 1];
+    }
+    DPF(D_TERSE, ("[Loopback buffer: %d frames of %d bytes]", m_Loopback.GetSize(), m_Loopback.GetFrameSize()));
+  } else {
+    DPF(D_TERSE, ("[Could not allocate loopback buffer: %08X]", ntStatus));
+  }
+
+  return ntStatus;
+} // AllocateLoopbackBuffer
+
 //=============================================================================
 NTSTATUS CMiniportWaveCyclic::ValidateFormat(
     IN  PKSDATAFORMAT           pDataFormat
@@ -545,7 +1372,9 @@ NTSTATUS CMiniportWaveCyclic::ValidateFormat(
 /*
 Routine Description:
   Validates that the given dataformat is valid.
-  This version of the driver only supports PCM.
+  This version of the driver supports PCM and IEEE float, as WAVEFORMATEX
+  for mono and stereo or as WAVEFORMATEXTENSIBLE for up to MAX_CHANNELS_PCM.
+  The SubFormat of the KSDATAFORMAT has to agree with the wave format.
 
 Arguments:
   pDataFormat - The dataformat for validation.
@@ -568,11 +1397,26 @@ Return Value:
 
       switch (wfxID) {
         case WAVE_FORMAT_PCM:
+        case WAVE_FORMAT_IEEE_FLOAT:
 	      switch (pwfx->wFormatTag) {
             case WAVE_FORMAT_PCM:
-              ntStatus = ValidatePcm(pwfx);
+            case WAVE_FORMAT_IEEE_FLOAT:
+              // A plain WAVEFORMATEX has no channel mask, so it is only
+              // accepted for mono and stereo.
+              if ((pwfx->cbSize == 0) && (pwfx->nChannels <= 2)) {
+                ntStatus = ValidatePcm(pwfx);
+              }
+              break;
+            case WAVE_FORMAT_EXTENSIBLE:
+              if (pDataFormat->FormatSize >= sizeof(KSDATAFORMAT) + sizeof(WAVEFORMATEXTENSIBLE)) {
+                ntStatus = ValidateWfxExt((PWAVEFORMATEXTENSIBLE) pwfx);
+              }
               break;
 		  }
+          if (NT_SUCCESS(ntStatus) && (GetWaveFormatTag(pwfx) != wfxID)) {
+            DPF(D_TERSE, ("SubFormat and wave format disagree!"));
+            ntStatus = STATUS_INVALID_PARAMETER;
+          }
           break;
         default:
           DPF(D_TERSE, ("Invalid format EXTRACT_WAVEFORMATEX_ID!"));
@@ -593,7 +1437,8 @@ NTSTATUS CMiniportWaveCyclic::ValidatePcm(
 /*
 Routine Description:
   Given a waveformatex and format size validates that the format is in device
-  datarange.
+  datarange. Integer samples come in 16, 24 or 32 bit containers, float
+  samples in 32 bit ones.
 
 Arguments:
   pWfx - wave format structure.
@@ -606,13 +1451,16 @@ Return Value:
   DPF_ENTER(("CMiniportWaveCyclic::ValidatePcm"));
 
   if ( pWfx                                                &&
-      (pWfx->cbSize == 0)                                 &&
       (pWfx->nChannels >= m_MinChannels)                  &&
       (pWfx->nChannels <= m_MaxChannelsPcm)               &&
       (pWfx->nSamplesPerSec >= m_MinSampleRatePcm)        &&
       (pWfx->nSamplesPerSec <= m_MaxSampleRatePcm)        &&
       (pWfx->wBitsPerSample >= m_MinBitsPerSamplePcm)     &&
-      (pWfx->wBitsPerSample <= m_MaxBitsPerSamplePcm))
+      (pWfx->wBitsPerSample <= m_MaxBitsPerSamplePcm)     &&
+      !(pWfx->wBitsPerSample % 8)                         &&
+      ((GetWaveFormatTag(pWfx) != WAVE_FORMAT_IEEE_FLOAT) || (pWfx->wBitsPerSample == 32)) &&
+      (pWfx->nBlockAlign == pWfx->nChannels * pWfx->wBitsPerSample / 8) &&
+      (pWfx->nAvgBytesPerSec == pWfx->nSamplesPerSec * pWfx->nBlockAlign))
   {
       return STATUS_SUCCESS;
   }
@@ -622,32 +1470,163 @@ Return Value:
 } // ValidatePcm
 
 //=============================================================================
-void TimerNotify(
-  IN  PKDPC                   Dpc,
-  IN  PVOID                   DeferredContext,
-  IN  PVOID                   SA1,
-  IN  PVOID                   SA2
+NTSTATUS CMiniportWaveCyclic::ValidateWfxExt(
+    IN  PWAVEFORMATEXTENSIBLE   pWfxExt
 )
 /*
 Routine Description:
-  Dpc routine. This simulates an interrupt service routine. The Dpc will be
-  called whenever CMiniportWaveCyclicStreamMSVAD::m_pTimer triggers.
+  Given a WAVEFORMATEXTENSIBLE validates that the format is in device
+  datarange. The channel mask may be 0 (no speaker positions) or has to
+  name exactly nChannels speakers. All container bits have to be valid,
+  except for 24 bit PCM in a 32 bit container.
 
 Arguments:
-  Dpc - the Dpc object
-  DeferredContext - Pointer to a caller-supplied context to be passed to
-                    the DeferredRoutine when it is called
-  SA1 - System argument 1
-  SA2 - System argument 2
+  pWfxExt - wave format extensible structure.
 
 Return Value:
-  NT status code.
+    NT status code.
+*/
+{
+  PAGED_CODE();
+  DPF_ENTER(("CMiniportWaveCyclic::ValidateWfxExt"));
+
+  ULONG maskChannels = 0;
+  for (ULONG mask = pWfxExt->dwChannelMask; mask; mask &= mask - 1) {
+    maskChannels++;
+  }
+
+  if ( (pWfxExt->Format.cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) &&
+       (IsEqualGUIDAligned(pWfxExt->SubFormat, KSDATAFORMAT_SUBTYPE_PCM) ||
+        IsEqualGUIDAligned(pWfxExt->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT))        &&
+       ((pWfxExt->Samples.wValidBitsPerSample == pWfxExt->Format.wBitsPerSample) ||
+        ((pWfxExt->Samples.wValidBitsPerSample == 24) && (pWfxExt->Format.wBitsPerSample == 32) &&
+         IsEqualGUIDAligned(pWfxExt->SubFormat, KSDATAFORMAT_SUBTYPE_PCM)))             &&
+       (!pWfxExt->dwChannelMask || (maskChannels == pWfxExt->Format.nChannels)))
+  {
+      return ValidatePcm(&pWfxExt->Format);
+  }
+
+  DPF(D_TERSE, ("Invalid WAVEFORMATEXTENSIBLE format"));
+  return STATUS_INVALID_PARAMETER;
+} // ValidateWfxExt
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclic::ValidateLoopbackFormat(
+    IN  PWAVEFORMATEX           pWfx,
+    IN  BOOLEAN                 Capture
+)
+/*
+Routine Description:
+  Checks that a stream format can be converted to and from the loopback
+  ring. Sample type and rate are converted and capture streams get the
+  channels mixed, but a render stream has to have the channel count the
+  ring was allocated for.
+
+Arguments:
+  pWfx - wave format structure.
+  Capture - format of a capture stream
+
+Return Value:
+    NT status code.
+*/
+{
+  PAGED_CODE();
+
+  if (pWfx && (Capture || (pWfx->nChannels == m_LoopbackFormat.nChannels)))
+  {
+      return STATUS_SUCCESS;
+  }
+
+  DPF(D_TERSE, ("Format differs from the loopback format"));
+  return STATUS_INVALID_PARAMETER;
+} // ValidateLoopbackFormat
+
+//=============================================================================
+PRTSD_LOOPBACK_ROUTING CMiniportWaveCyclic::GetCaptureRouting(
+    IN  ULONG                   InputChannels,
+    IN  ULONG                   OutputChannels
+)
+/*
+Routine Description:
+  Returns the mix the CaptureRouting setting has for a pair of channel
+  counts.
+
+Arguments:
+  InputChannels - channels of the loopback ring
+  OutputChannels - channels of the capture stream
+
+Return Value:
+  Mix, or NULL to use the default mix of InitMatrix
+*/
+{
+  PAGED_CODE();
+
+  for (ULONG i = 0; i < m_CaptureRoutingCount; i++) {
+    if ((m_CaptureRouting[i].InputChannels == InputChannels) &&
+        (m_CaptureRouting[i].OutputChannels == OutputChannels)) {
+      return &m_CaptureRouting[i];
+    }
+  }
+
+  return NULL;
+} // GetCaptureRouting
+
+//=============================================================================
+LOOPBACK_SAMPLE_TYPE CMiniportWaveCyclic::GetSampleType(
+    IN  PWAVEFORMATEX           pWfx
+)
+/*
+Routine Description:
+  Returns the sample layout of a format ValidateFormat accepted. 24 bit
+  samples in a 32 bit container are handled as 32 bit samples.
+
+Arguments:
+  pWfx - wave format structure.
+
+Return Value:
+    LOOPBACK_SAMPLE_TYPE
+*/
+{
+  PAGED_CODE();
+  ASSERT(pWfx);
+
+  switch (pWfx->wBitsPerSample) {
+    case 16:
+      return LOOPBACK_SAMPLE_INT16;
+    case 24:
+      return LOOPBACK_SAMPLE_INT24;
+    default:
+      return (GetWaveFormatTag(pWfx) == WAVE_FORMAT_IEEE_FLOAT) ? LOOPBACK_SAMPLE_FLOAT32 : LOOPBACK_SAMPLE_INT32;
+  }
+} // GetSampleType
+
+#pragma code_seg()
+
+//=============================================================================
+void SchedulerNotify(
+  IN  PVOID                   Context,
+  IN  ULONG                   Lane,
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Service routine of the stream scheduler. This simulates an interrupt
+  service routine: it has portcls service the streams of one lane, which
+  moves their DMA positions and copies their data.
+
+Arguments:
+  Context - the miniport
+  Lane - SCHEDULER_LANE to service
+  CurrentTime - time of the tick, the streams read the clock themselves
+
+Return Value:
+  void
 */
 {
-  PCMiniportWaveCyclic pMiniport = (PCMiniportWaveCyclic) DeferredContext;
+  PCMiniportWaveCyclic pMiniport = (PCMiniportWaveCyclic) Context;
 
   if (pMiniport && pMiniport->m_Port) {
-      pMiniport->m_Port->Notify(pMiniport->m_ServiceGroup);
+      pMiniport->m_Port->Notify((Lane == SCHEDULER_LANE_RENDER) ? pMiniport->m_ServiceGroup : pMiniport->m_CaptureServiceGroup);
   }
-} // TimerNotify
+} // SchedulerNotify
 
@@ -10,15 +10,18 @@ Abstract:
 #define __RTSDWAVE_H_
 
 #include "rtsdwave.h"
+#include "rtsdloop.h"
+#include "rtsdsrc.h"
+#include "rtsdclk.h"
+#include "rtsdsched.h"
 
 //=============================================================================
 // Referenced Forward
 //=============================================================================
-void TimerNotify( 
-    IN  PKDPC                   Dpc,
-    IN  PVOID                   DeferredContext,
-    IN  PVOID                   SA1, 
-    IN  PVOID                   SA2 
+void SchedulerNotify( 
+    IN  PVOID                   Context,
+    IN  ULONG                   Lane,
+    IN  ULONGLONG               CurrentTime
 );
 
 //=============================================================================
@@ -30,8 +33,9 @@ void TimerNotify(
 
 class CMiniportWaveCyclic : public IMiniportWaveCyclic, public CUnknown {
 private:
-  BOOL                        m_fCaptureAllocated;
+  ULONG                       m_ulCaptureAllocated; // Open capture streams
   BOOL                        m_fRenderAllocated;
+  volatile BOOLEAN            m_fRenderRunning;   // The render stream is in KSSTATE_RUN.
 
 protected:
   PADAPTERCOMMON              m_AdapterCommon;    // Adapter common object
@@ -41,8 +45,11 @@ protected:
   ULONG                       m_NotificationInterval; // milliseconds.
   ULONG                       m_SamplingFrequency;    // Frames per second.
 
-  PSERVICEGROUP               m_ServiceGroup;     // For notification.
+  PSERVICEGROUP               m_ServiceGroup;     // For notification of the render stream.
+  PSERVICEGROUP               m_CaptureServiceGroup; // For notification of the capture streams.
+  CStreamScheduler            m_Scheduler;        // Drives all running streams.
   KMUTEX                      m_SampleRateSync;   // Sync for sample rate 
+  KMUTEX                      m_StreamSync;       // Sync for opening and closing streams and resizing the ring
 
   ULONG                       m_MaxDmaBufferSize; // Dma buffer size.
 
@@ -58,9 +65,31 @@ protected:
   ULONG                       m_MinSampleRatePcm;
   ULONG                       m_MaxSampleRatePcm;
 
+  ULONG                       m_LoopbackBufferMs;     // Ring depth, milliseconds.
+  ULONG                       m_LoopbackBufferFrames; // Ring depth, frames. Overrides ms.
+  ULONG                       m_ResamplerQuality;     // RESAMPLER_QUALITY of new streams.
+  ULONG                       m_TargetLatencyMs;      // Fill level capture streams hold, 0 = no drift control.
+  ULONG                       m_DitherMode;           // LOOPBACK_DITHER_MODE of 16 and 24 bit capture streams.
+  ULONG                       m_CaptureClock;         // CAPTURE_CLOCK of new capture streams.
+  RTSD_LOOPBACK_ROUTING       m_CaptureRouting[CAPTURE_ROUTING_DEFAULTS]; // Default mixes of capture streams.
+  ULONG                       m_CaptureRoutingCount;
+  WAVEFORMATEX                m_LoopbackFormat;       // Format the ring was allocated for.
+  ULONG                       m_LoopbackChannelMask;  // Speaker positions of the ring's channels.
+
 protected:
   NTSTATUS ValidateFormat(IN PKSDATAFORMAT pDataFormat);
   NTSTATUS ValidatePcm(IN PWAVEFORMATEX pWfx);
+  NTSTATUS ValidateWfxExt(IN PWAVEFORMATEXTENSIBLE pWfxExt);
+  NTSTATUS ValidateLoopbackFormat(IN PWAVEFORMATEX pWfx, IN BOOLEAN Capture);
+  LOOPBACK_SAMPLE_TYPE GetSampleType(IN PWAVEFORMATEX pWfx);
+  PRTSD_LOOPBACK_ROUTING GetCaptureRouting(IN ULONG InputChannels, IN ULONG OutputChannels);
+
+  void ReadSettings(void);
+  NTSTATUS AllocateLoopbackBuffer(IN PWAVEFORMATEX pWfx, IN BOOLEAN Capture);
+
+  // The WaveRT miniport runs this miniport without a port, its streams
+  // move no data by themselves.
+  BOOLEAN IsWaveRT(void)      { return m_Port == NULL; }
 
 public:
   DECLARE_STD_UNKNOWN();
@@ -69,28 +98,36 @@ public:
 
   IMP_IMiniportWaveCyclic;
 
+  // m_Loopback keeps its cursors on cache lines of their own, so the
+  // miniport has to start on one.
+  PVOID operator new(size_t Size, POOL_TYPE PoolType, ULONG Tag);
+  PVOID operator new(size_t Size, POOL_TYPE PoolType);
+  void operator delete(PVOID Memory);
+
+  NTSTATUS InitEngine(IN PUNKNOWN UnknownAdapter, IN PSCHEDULER_SERVICE Service, IN PVOID Context);
+
   //--> muss hier her, da CopyTo und CopyFrom in verschiedenen Stream-Instanzen aufgerufen werden.
-  PVOID myBuffer;
-  LONG myBufferSize;
-  LONG myBufferLocked;
-  LONG myBufferWritePos;
-  LONG myBufferReadPos;
-  LONG myBufferReading; //Determines wether there is a client that still reads data
-  
+  CLoopbackBuffer m_Loopback;
+
 
   // Property Handler
   NTSTATUS PropertyHandlerGeneric(IN PPCPROPERTY_REQUEST PropertyRequest);
   NTSTATUS PropertyHandlerComponentId(IN PPCPROPERTY_REQUEST PropertyRequest);
   NTSTATUS PropertyHandlerCpuResources(IN PPCPROPERTY_REQUEST PropertyRequest);
+  NTSTATUS PropertyHandlerLoopback(IN PPCPROPERTY_REQUEST PropertyRequest);
+  NTSTATUS PropertyHandlerLoopbackBuffer(IN PPCPROPERTY_REQUEST PropertyRequest);
+  NTSTATUS PropertyHandlerOverrunPolicy(IN PPCPROPERTY_REQUEST PropertyRequest);
+  NTSTATUS PropertyHandlerStatistics(IN PPCPROPERTY_REQUEST PropertyRequest);
+  NTSTATUS PropertyHandlerUnderrunMode(IN PPCPROPERTY_REQUEST PropertyRequest);
 
   // Friends
   friend class                CMiniportWaveCyclicStream;
   friend class                CMiniportTopologySimple;
-  friend void                 TimerNotify( 
-      IN  PKDPC               Dpc, 
-      IN  PVOID               DeferredContext, 
-      IN  PVOID               SA1, 
-      IN  PVOID               SA2 
+  friend class                CMiniportWaveRT;
+  friend void                 SchedulerNotify( 
+      IN  PVOID               Context, 
+      IN  ULONG               Lane,
+      IN  ULONGLONG           CurrentTime
   );
 };
 typedef CMiniportWaveCyclic *PCMiniportWaveCyclic;
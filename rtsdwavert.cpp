@@ -0,0 +1,589 @@
+/*
+Module Name:
+    rtsdwavert.cpp
+
+Abstract:
+    Implementation of wavert miniport.
+*/
+
+#include "rtsdaudio.h"
+#include "common.h"
+#include "rtsdwavert.h"
+#include "rtsdwavertstream.h"
+
+#ifdef RTSD_WAVERT
+
+//=============================================================================
+// Events of the streaming pins, added to their automation tables in Init.
+static PCEVENT_ITEM EventsWaveRTStreamPin[] = {
+  {
+    &KSEVENTSETID_LoopedStreaming,
+    KSEVENT_LOOPEDSTREAMING_POSITION,
+    KSEVENT_TYPE_ENABLE | KSEVENT_TYPE_BASICSUPPORT,
+    EventHandler_WaveRTStreamPin
+  },
+};
+
+#pragma code_seg("PAGE")
+
+//=============================================================================
+// CMiniportWaveRT
+//=============================================================================
+
+//=============================================================================
+NTSTATUS CreateMiniportWaveRT(
+  OUT PUNKNOWN *              Unknown,
+  IN  REFCLSID,
+  IN  PUNKNOWN                UnknownOuter OPTIONAL,
+  IN  POOL_TYPE               PoolType
+)
+/*
+Routine Description:
+  Create the wavert miniport.
+
+Arguments:
+  Unknown -
+  RefClsId -
+  UnknownOuter -
+  PoolType -
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(Unknown);
+
+  STD_CREATE_BODY(CMiniportWaveRT, Unknown, UnknownOuter, PoolType);
+}
+
+//=============================================================================
+CMiniportWaveRT::~CMiniportWaveRT(void)
+/*
+Routine Description:
+  Destructor for wavert miniport
+
+Arguments:
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  DPF_ENTER(("[CMiniportWaveRT::~CMiniportWaveRT]"));
+
+  // Stops the scheduler and frees the loopback ring. Goes first, as the
+  // last tick signals through the port.
+  if (m_pWave) {
+      m_pWave->Release();
+      m_pWave = NULL;
+  }
+
+  if (m_pPortEvents) {
+      m_pPortEvents->Release();
+      m_pPortEvents = NULL;
+  }
+
+  if (m_Port) {
+      m_Port->Release();
+      m_Port = NULL;
+  }
+}
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRT::DataRangeIntersection(
+  IN  ULONG                       PinId,
+  IN  PKSDATARANGE                ClientDataRange,
+  IN  PKSDATARANGE                MyDataRange,
+  IN  ULONG                       OutputBufferLength,
+  OUT PVOID                       ResultantFormat,
+  OUT PULONG                      ResultantFormatLength
+)
+/*
+Routine Description:
+  The DataRangeIntersection function determines the highest quality
+  intersection of two data ranges, the same way the wavecyclic miniport
+  does.
+
+Arguments:
+  PinId -           Pin for which data intersection is being determined.
+  ClientDataRange - Pointer to KSDATARANGE structure which contains the data
+                    range submitted by client in the data range intersection
+                    property request.
+  MyDataRange -         Pin's data range to be compared with client's data
+                        range.
+  OutputBufferLength -  Size of the buffer pointed to by the resultant format
+                        parameter.
+  ResultantFormat -     Pointer to value where the resultant format should be
+                        returned.
+  ResultantFormatLength -   Actual length of the resultant format placed in
+                            ResultantFormat. This should be less than or equal
+                            to OutputBufferLength.
+
+Return Value:
+    NT status code.
+*/
+{
+  PAGED_CODE();
+
+  return m_pWave->DataRangeIntersection(PinId, ClientDataRange, MyDataRange, OutputBufferLength,
+                                        ResultantFormat, ResultantFormatLength);
+} // DataRangeIntersection
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRT::GetDescription(OUT PPCFILTER_DESCRIPTOR * OutFilterDescriptor)
+/*
+Routine Description:
+  The GetDescription function gets a pointer to a filter description. The
+  filter is the one of the wavecyclic miniport: its property handlers find
+  their way back through GetWave. Init adds the position events to its
+  streaming pins.
+
+Arguments:
+  OutFilterDescriptor - Pointer to the filter description.
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(OutFilterDescriptor);
+  DPF_ENTER(("[CMiniportWaveRT::GetDescription]"));
+
+  *OutFilterDescriptor = &m_FilterDescriptor;
+
+  return STATUS_SUCCESS;
+} // GetDescription
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRT::GetDeviceDescription(OUT PDEVICE_DESCRIPTION DeviceDescription)
+/*
+Routine Description:
+  Describes the DMA the port would set up for the device. There is no
+  hardware; the cyclic buffers only need to be in memory the processor
+  can reach.
+
+Arguments:
+  DeviceDescription - Pointer to the description.
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(DeviceDescription);
+
+  RtlZeroMemory(DeviceDescription, sizeof(DEVICE_DESCRIPTION));
+  DeviceDescription->Version = DEVICE_DESCRIPTION_VERSION;
+  DeviceDescription->Master = TRUE;
+  DeviceDescription->ScatterGather = TRUE;
+  DeviceDescription->Dma32BitAddresses = TRUE;
+  DeviceDescription->InterfaceType = PCIBus;
+  DeviceDescription->MaximumLength = MAXULONG;
+
+  return STATUS_SUCCESS;
+} // GetDeviceDescription
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRT::Init(
+  IN  PUNKNOWN                UnknownAdapter_,
+  IN  PRESOURCELIST           ResourceList_,
+  IN  PPORTWAVERT             Port_
+)
+/*
+Routine Description:
+  The Init function initializes the miniport and the wavecyclic miniport it
+  runs. The scheduler of that one services the streams of this one, every
+  WAVERT_SERVICE_PERIOD. Callers of this function should run at IRQL
+  PASSIVE_LEVEL
+
+Arguments:
+  UnknownAdapter - A pointer to the Iuknown interface of the adapter object.
+  ResourceList - Pointer to the resource list to be supplied to the miniport
+                 during initialization.
+  Port - Pointer to the wavert port object that is linked with this miniport.
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(UnknownAdapter_);
+  ASSERT(Port_);
+  DPF_ENTER(("[CMiniportWaveRT::Init]"));
+
+  NTSTATUS ntStatus = STATUS_SUCCESS;
+
+  m_Port = NULL;
+  m_pPortEvents = NULL;
+  KeInitializeSpinLock(&m_StreamLock);
+  RtlZeroMemory(m_pRunning, sizeof(m_pRunning));
+
+  m_pWave = new (NonPagedPool, RTSDAUDIO_POOLTAG) CMiniportWaveCyclic(NULL);
+  if (m_pWave) {
+    m_pWave->AddRef();
+    ntStatus = m_pWave->InitEngine(UnknownAdapter_, SchedulerServiceRT, this);
+  } else {
+    ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  if (NT_SUCCESS(ntStatus)) {
+    m_pWave->m_Scheduler.SetPeriod(WAVERT_SERVICE_PERIOD);
+
+    // AddRef() is required because we are keeping this pointer.
+    m_Port = Port_;
+    m_Port->AddRef();
+
+    ntStatus = m_Port->QueryInterface(IID_IPortEvents, (PVOID *) &m_pPortEvents);
+  }
+
+  // The wavecyclic filter, with the position events added to the automation
+  // tables of its streaming pins.
+  if (NT_SUCCESS(ntStatus)) {
+    PPCFILTER_DESCRIPTOR pWaveDescriptor;
+
+    m_pWave->GetDescription(&pWaveDescriptor);
+    ASSERT(pWaveDescriptor->PinCount <= SIZEOF_ARRAY(m_Pins));
+    ASSERT(pWaveDescriptor->PinSize == sizeof(PCPIN_DESCRIPTOR));
+
+    m_FilterDescriptor = *pWaveDescriptor;
+    m_FilterDescriptor.Pins = m_Pins;
+    RtlCopyMemory(m_Pins, pWaveDescriptor->Pins, pWaveDescriptor->PinCount * sizeof(PCPIN_DESCRIPTOR));
+    RtlZeroMemory(m_PinAutomation, sizeof(m_PinAutomation));
+
+    for (ULONG i = 0; i < m_FilterDescriptor.PinCount; i++) {
+      if (m_Pins[i].KsPinDescriptor.Communication != KSPIN_COMMUNICATION_SINK) {
+        continue;
+      }
+
+      if (m_Pins[i].AutomationTable) {
+        m_PinAutomation[i] = *m_Pins[i].AutomationTable;
+      } else {
+        m_PinAutomation[i].PropertyItemSize = sizeof(PCPROPERTY_ITEM);
+        m_PinAutomation[i].MethodItemSize = sizeof(PCMETHOD_ITEM);
+      }
+      m_PinAutomation[i].EventItemSize = sizeof(PCEVENT_ITEM);
+      m_PinAutomation[i].EventCount = SIZEOF_ARRAY(EventsWaveRTStreamPin);
+      m_PinAutomation[i].Events = EventsWaveRTStreamPin;
+      m_Pins[i].AutomationTable = &m_PinAutomation[i];
+    }
+  }
+
+  if (!NT_SUCCESS(ntStatus)) {
+    if (m_Port) {
+      m_Port->Release();
+      m_Port = NULL;
+    }
+
+    if (m_pWave) {
+      m_pWave->Release();
+      m_pWave = NULL;
+    }
+  }
+
+  return ntStatus;
+} // Init
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRT::NewStream(
+  OUT PMINIPORTWAVERTSTREAM * OutStream,
+  IN  PPORTWAVERTSTREAM       PortStream,
+  IN  ULONG                   Pin,
+  IN  BOOLEAN                 Capture,
+  IN  PKSDATAFORMAT           DataFormat
+)
+/*
+Routine Description:
+  The NewStream function creates a new instance of a logical stream
+  associated with a specified physical channel. Callers of NewStream should
+  run at IRQL PASSIVE_LEVEL.
+
+Arguments:
+  OutStream -
+  PortStream -
+  Pin -
+  Capture -
+  DataFormat -
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  ASSERT(OutStream);
+  ASSERT(PortStream);
+  ASSERT(DataFormat);
+
+  DPF_ENTER(("[CMiniportWaveRT::NewStream]"));
+
+  NTSTATUS                    ntStatus = STATUS_SUCCESS;
+  PCMiniportWaveRTStream      stream = NULL;
+
+  // Stream counts, formats and the loopback ring are checked and set up
+  // by the wavecyclic stream the new stream opens in Init.
+  stream = new (NonPagedPool, RTSDAUDIO_POOLTAG) CMiniportWaveRTStream(NULL);
+  if (stream) {
+    stream->AddRef();
+    ntStatus = stream->Init(this, PortStream, Pin, Capture, DataFormat);
+  } else {
+    ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  if (NT_SUCCESS(ntStatus)) {
+    *OutStream = PMINIPORTWAVERTSTREAM(stream);
+    (*OutStream)->AddRef();
+  }
+
+  // This is our private reference to the stream.  The caller has
+  // its own, so we can release in any case.
+  if (stream)
+    stream->Release();
+
+  return ntStatus;
+} // NewStream
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRT::NonDelegatingQueryInterface(
+  IN  REFIID  Interface,
+  OUT PVOID * Object
+)
+/*
+Routine Description:
+  QueryInterface
+
+Arguments:
+  Interface - GUID
+  Object - interface pointer to be returned.
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(Object);
+
+  if (IsEqualGUIDAligned(Interface, IID_IUnknown)) {
+    *Object = PVOID(PUNKNOWN(PMINIPORTWAVERT(this)));
+  } else if (IsEqualGUIDAligned(Interface, IID_IMiniport)) {
+    *Object = PVOID(PMINIPORT(this));
+  } else if (IsEqualGUIDAligned(Interface, IID_IMiniportWaveRT)) {
+    *Object = PVOID(PMINIPORTWAVERT(this));
+  } else {
+    *Object = NULL;
+  }
+
+  if (*Object) {
+    // We reference the interface for the caller.
+    PUNKNOWN(*Object)->AddRef();
+    return STATUS_SUCCESS;
+  }
+
+  return STATUS_INVALID_PARAMETER;
+} // NonDelegatingQueryInterface
+
+#pragma code_seg()
+
+//=============================================================================
+NTSTATUS EventHandler_WaveRTStreamPin(
+  IN  PPCEVENT_REQUEST        EventRequest
+)
+/*
+Routine Description:
+  Enables and disables KSEVENT_LOOPEDSTREAMING_POSITION on a stream. The
+  event is signaled each time the position of the stream reaches the byte
+  offset in the cyclic buffer the client passed, until it is disabled.
+  Not paged, the port removes events at DISPATCH_LEVEL.
+
+Arguments:
+  EventRequest -
+
+Return Value:
+  NT status code.
+*/
+{
+  ASSERT(EventRequest);
+
+  PCMiniportWaveRT pMiniport = (PCMiniportWaveRT) PMINIPORTWAVERT(EventRequest->MajorTarget);
+  PCMiniportWaveRTStream pStream = (PCMiniportWaveRTStream) PMINIPORTWAVERTSTREAM(EventRequest->MinorTarget);
+
+  if (!pStream) {
+    return STATUS_INVALID_DEVICE_REQUEST;
+  }
+
+  switch (EventRequest->Verb) {
+    case PCEVENT_VERB_SUPPORT:
+      return STATUS_SUCCESS;
+
+    case PCEVENT_VERB_ADD: {
+      // The event data holds the position only while the event is enabled.
+      PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(EventRequest->Irp);
+      if (irpStack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(LOOPEDSTREAMING_POSITION_EVENT_DATA)) {
+        return STATUS_BUFFER_TOO_SMALL;
+      }
+
+      PLOOPEDSTREAMING_POSITION_EVENT_DATA pData = (PLOOPEDSTREAMING_POSITION_EVENT_DATA) EventRequest->EventEntry->EventData;
+      if (pData->Position > MAXULONG) {
+        return STATUS_INVALID_PARAMETER;
+      }
+
+      NTSTATUS ntStatus = pMiniport->AddPositionEvent(pStream, EventRequest->EventEntry, (ULONG) pData->Position);
+      if (NT_SUCCESS(ntStatus)) {
+        pMiniport->m_pPortEvents->AddEventToEventList(EventRequest->EventEntry);
+      }
+      return ntStatus;
+    }
+
+    case PCEVENT_VERB_REMOVE:
+      pMiniport->RemovePositionEvent(pStream, EventRequest->EventEntry);
+      return STATUS_SUCCESS;
+  }
+
+  return STATUS_INVALID_DEVICE_REQUEST;
+} // EventHandler_WaveRTStreamPin
+
+//=============================================================================
+void CMiniportWaveRT::StartStream(
+  IN  PCMiniportWaveRTStream  Stream
+)
+/*
+Routine Description:
+  Hands a stream that entered KSSTATE_RUN to the scheduler.
+
+Arguments:
+  Stream - the stream
+
+Return Value:
+  void
+*/
+{
+  KIRQL oldIrql;
+
+  KeAcquireSpinLock(&m_StreamLock, &oldIrql);
+  for (ULONG i = 0; i < MAX_TOTAL_STREAMS; i++) {
+    if (!m_pRunning[i]) {
+      m_pRunning[i] = Stream;
+      break;
+    }
+  }
+  KeReleaseSpinLock(&m_StreamLock, oldIrql);
+} // StartStream
+
+//=============================================================================
+void CMiniportWaveRT::StopStream(
+  IN  PCMiniportWaveRTStream  Stream
+)
+/*
+Routine Description:
+  Takes a stream that leaves KSSTATE_RUN from the scheduler. A tick that
+  is servicing it holds the lock, so once this returns the stream is not
+  touched any more.
+
+Arguments:
+  Stream - the stream
+
+Return Value:
+  void
+*/
+{
+  KIRQL oldIrql;
+
+  KeAcquireSpinLock(&m_StreamLock, &oldIrql);
+  for (ULONG i = 0; i < MAX_TOTAL_STREAMS; i++) {
+    if (m_pRunning[i] == Stream) {
+      m_pRunning[i] = NULL;
+    }
+  }
+  KeReleaseSpinLock(&m_StreamLock, oldIrql);
+} // StopStream
+
+//=============================================================================
+NTSTATUS CMiniportWaveRT::AddPositionEvent(
+  IN  PCMiniportWaveRTStream  Stream,
+  IN  PKSEVENT_ENTRY          EventEntry,
+  IN  ULONG                   Position
+)
+/*
+Routine Description:
+  Has the scheduler signal a position event of a stream. The lock keeps
+  the tick that services the stream out.
+
+Arguments:
+  Stream - the stream
+  EventEntry - the event
+  Position - byte offset in the cyclic buffer
+
+Return Value:
+  NT status code.
+*/
+{
+  KIRQL oldIrql;
+  NTSTATUS ntStatus;
+
+  KeAcquireSpinLock(&m_StreamLock, &oldIrql);
+  ntStatus = Stream->m_Cyclic.AddNotification(EventEntry, Position);
+  KeReleaseSpinLock(&m_StreamLock, oldIrql);
+
+  return ntStatus;
+} // AddPositionEvent
+
+//=============================================================================
+void CMiniportWaveRT::RemovePositionEvent(
+  IN  PCMiniportWaveRTStream  Stream,
+  IN  PKSEVENT_ENTRY          EventEntry
+)
+/*
+Routine Description:
+  Takes a position event of a stream from the scheduler. Once this returns
+  the event is not signaled any more.
+
+Arguments:
+  Stream - the stream
+  EventEntry - the event
+
+Return Value:
+  void
+*/
+{
+  KIRQL oldIrql;
+
+  KeAcquireSpinLock(&m_StreamLock, &oldIrql);
+  Stream->m_Cyclic.RemoveNotification(EventEntry);
+  KeReleaseSpinLock(&m_StreamLock, oldIrql);
+} // RemovePositionEvent
+
+//=============================================================================
+void SchedulerServiceRT(
+  IN  PVOID                   Context,
+  IN  ULONG                   Lane,
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Service routine of the stream scheduler under the WaveRT port. Moves the
+  data of the running streams of one lane between their cyclic buffers and
+  the loopback ring, up to the position they have at CurrentTime, and
+  signals the position events they passed. Runs in the scheduler's DPC.
+
+Arguments:
+  Context - the miniport
+  Lane - SCHEDULER_LANE to service
+  CurrentTime - time of the tick
+
+Return Value:
+  void
+*/
+{
+  PCMiniportWaveRT pMiniport = (PCMiniportWaveRT) Context;
+
+  KeAcquireSpinLockAtDpcLevel(&pMiniport->m_StreamLock);
+  for (ULONG i = 0; i < MAX_TOTAL_STREAMS; i++) {
+    PCMiniportWaveRTStream pStream = pMiniport->m_pRunning[i];
+    if (pStream && (pStream->m_pWaveStream->GetSchedulerLane() == Lane)) {
+      pStream->m_Cyclic.Service(CurrentTime);
+    }
+  }
+  KeReleaseSpinLockFromDpcLevel(&pMiniport->m_StreamLock);
+} // SchedulerServiceRT
+
+#endif // RTSD_WAVERT
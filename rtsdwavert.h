@@ -0,0 +1,87 @@
+/*
+Module Name:
+    rtsdwavert.h
+
+Abstract:
+    Definition of wavert miniport class.
+*/
+
+#ifndef __RTSDWAVERT_H_
+#define __RTSDWAVERT_H_
+
+#include "rtsdwave.h"
+
+#ifdef RTSD_WAVERT
+
+//=============================================================================
+// Referenced Forward
+//=============================================================================
+class CMiniportWaveRTStream;
+typedef CMiniportWaveRTStream *PCMiniportWaveRTStream;
+
+void SchedulerServiceRT(
+    IN  PVOID                   Context,
+    IN  ULONG                   Lane,
+    IN  ULONGLONG               CurrentTime
+);
+
+// Streaming pin automation table.
+// Handles the looped streaming position event.
+NTSTATUS EventHandler_WaveRTStreamPin(IN PPCEVENT_REQUEST EventRequest);
+
+//=============================================================================
+// Classes
+//=============================================================================
+///////////////////////////////////////////////////////////////////////////////
+// CMiniportWaveRT
+//
+// The wave filter on the WaveRT port. The audio engine reads and writes the
+// streams' cyclic buffers directly, so there are no copy callbacks; the
+// scheduler moves the data between the cyclic buffers and the loopback ring
+// once per WAVERT_SERVICE_PERIOD instead. The loopback ring, the settings,
+// the formats and the loopback properties are those of a wavecyclic
+// miniport this miniport runs without a port, and every stream converts
+// its data through a stream of it.
+// The WaveRT port has no position events of its own, so the streaming pins
+// of the filter get KSEVENT_LOOPEDSTREAMING_POSITION from the miniport;
+// the scheduler signals them when it moves the data.
+
+class CMiniportWaveRT : public IMiniportWaveRT, public CUnknown {
+private:
+  PCMiniportWaveCyclic        m_pWave;            // Owns the loopback ring.
+  PPORTWAVERT                 m_Port;             // Callback interface
+  PPORTEVENTS                 m_pPortEvents;      // Keeps the event entries of the pins.
+  PCFILTER_DESCRIPTOR         m_FilterDescriptor; // The wavecyclic filter with position events.
+  PCPIN_DESCRIPTOR            m_Pins[KSPIN_WAVE_RENDER_SOURCE + 1];
+  PCAUTOMATION_TABLE          m_PinAutomation[KSPIN_WAVE_RENDER_SOURCE + 1];
+  KSPIN_LOCK                  m_StreamLock;       // Keeps the scheduler off streams that leave KSSTATE_RUN.
+  PCMiniportWaveRTStream      m_pRunning[MAX_TOTAL_STREAMS]; // Streams in KSSTATE_RUN, NULL for free slots.
+
+public:
+  DECLARE_STD_UNKNOWN();
+  DEFINE_STD_CONSTRUCTOR(CMiniportWaveRT);
+  ~CMiniportWaveRT();
+
+  IMP_IMiniportWaveRT;
+
+  PCMiniportWaveCyclic GetWave(void)  { return m_pWave; }
+  void StartStream(IN PCMiniportWaveRTStream Stream);
+  void StopStream(IN PCMiniportWaveRTStream Stream);
+  NTSTATUS AddPositionEvent(IN PCMiniportWaveRTStream Stream, IN PKSEVENT_ENTRY EventEntry, IN ULONG Position);
+  void RemovePositionEvent(IN PCMiniportWaveRTStream Stream, IN PKSEVENT_ENTRY EventEntry);
+
+  // Friends
+  friend void                 SchedulerServiceRT(
+      IN  PVOID               Context,
+      IN  ULONG               Lane,
+      IN  ULONGLONG           CurrentTime
+  );
+  friend NTSTATUS             EventHandler_WaveRTStreamPin(
+      IN  PPCEVENT_REQUEST    EventRequest
+  );
+};
+typedef CMiniportWaveRT *PCMiniportWaveRT;
+
+#endif // RTSD_WAVERT
+
+#endif
@@ -0,0 +1,529 @@
+/*
+Module Name:
+  rtsdwavertstream.cpp
+
+Abstract:
+  WaveRTStream-Miniport implementation. Does nothing HW related.
+*/
+#include "rtsdaudio.h"
+#include "common.h"
+#include "rtsdwavert.h"
+#include "rtsdwavertstream.h"
+
+#ifdef RTSD_WAVERT
+
+#pragma code_seg("PAGE")
+
+//=============================================================================
+CMiniportWaveRTStream::~CMiniportWaveRTStream(void)
+/*
+Routine Description:
+  Destructor for wavertstream
+
+Arguments:
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  DPF_ENTER(("[CMiniportWaveRTStream::~CMiniportWaveRTStream]"));
+
+  if (NULL != m_pMiniport && m_ksState == KSSTATE_RUN) {
+      m_pMiniport->StopStream(this);
+  }
+  m_Cyclic.SetState(CYCLIC_STATE_STOP, 0);
+
+  // Also stops the scheduler lane if the stream was still running.
+  if (m_pWaveStream) {
+      m_pWaveStream->Release();
+  }
+
+  if (m_pBufferMdl) {
+      FreeAudioBuffer(m_pBufferMdl, 0);
+  }
+
+  if (m_pRegisterMdl) {
+      if (m_pulRegister) {
+          m_PortStream->UnmapAllocatedPages(m_pulRegister, m_pRegisterMdl);
+      }
+      m_PortStream->FreePagesFromMdl(m_pRegisterMdl);
+  }
+
+  if (m_PortStream) {
+      m_PortStream->Release();
+  }
+} // ~CMiniportWaveRTStream
+
+//=============================================================================
+NTSTATUS CMiniportWaveRTStream::Init(
+  IN PCMiniportWaveRT             Miniport_,
+  IN PPORTWAVERTSTREAM            PortStream_,
+  IN ULONG                        Pin_,
+  IN BOOLEAN                      Capture_,
+  IN PKSDATAFORMAT                DataFormat_
+)
+/*
+Routine Description:
+  Initializes the stream object. Opens the wavecyclic stream that converts
+  the data and maps the page of the position register. Without the page
+  the stream still works, the audio engine then asks for the position.
+
+Arguments:
+  Miniport_ -
+  PortStream_ -
+  Pin_ -
+  Capture_ -
+  DataFormat_ -
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  DPF_ENTER(("[CMiniportWaveRTStream::Init]"));
+  ASSERT(Miniport_);
+  ASSERT(PortStream_);
+  ASSERT(DataFormat_);
+
+  m_pMiniport = Miniport_;
+  m_pWaveStream = NULL;
+  m_PortStream = PortStream_;
+  m_PortStream->AddRef();
+
+  m_fCapture = Capture_;
+  m_ulBlockAlign = 0;
+  m_ulSampleRate = 0;
+  m_ksState = KSSTATE_STOP;
+
+  m_pBufferMdl = NULL;
+  m_pvBuffer = NULL;
+  m_pRegisterMdl = NULL;
+  m_pulRegister = NULL;
+
+  NTSTATUS ntStatus = STATUS_SUCCESS;
+  PWAVEFORMATEX pWfx;
+
+  pWfx = GetWaveFormatEx(DataFormat_);
+  if (!pWfx) {
+    DPF(D_TERSE, ("Invalid DataFormat param in NewStream"));
+    ntStatus = STATUS_INVALID_PARAMETER;
+  }
+
+  // The wavecyclic miniport has no port, so the DMA channel and service
+  // group it hands out are not used.
+  if (NT_SUCCESS(ntStatus)) {
+    PMINIPORTWAVECYCLICSTREAM pWaveStream = NULL;
+    PDMACHANNEL pDmaChannel = NULL;
+    PSERVICEGROUP pServiceGroup = NULL;
+
+    ntStatus = m_pMiniport->GetWave()->NewStream(&pWaveStream, NULL, NonPagedPool, Pin_, Capture_,
+                                                 DataFormat_, &pDmaChannel, &pServiceGroup);
+    if (NT_SUCCESS(ntStatus)) {
+      m_pWaveStream = (PCMiniportWaveCyclicStream) pWaveStream;
+      pDmaChannel->Release();
+      pServiceGroup->Release();
+    }
+  }
+
+  if (NT_SUCCESS(ntStatus)) {
+    m_ulBlockAlign = pWfx->nBlockAlign;
+    m_ulSampleRate = pWfx->nSamplesPerSec;
+    m_Cyclic.Init(Transfer, Signal, this, m_fCapture);
+    m_Cyclic.SetFormat(m_ulBlockAlign, m_ulSampleRate);
+
+    // The audio engine maps the whole page, so it must hold nothing else.
+    PHYSICAL_ADDRESS highAddress;
+    highAddress.QuadPart = MAXLONGLONG;
+
+    m_pRegisterMdl = m_PortStream->AllocatePagesForMdl(highAddress, PAGE_SIZE);
+    if (m_pRegisterMdl) {
+      m_pulRegister = (PULONG) m_PortStream->MapAllocatedPages(m_pRegisterMdl, MmCached);
+    }
+    if (m_pulRegister) {
+      RtlZeroMemory(m_pulRegister, PAGE_SIZE);
+      m_Cyclic.SetRegister(m_pulRegister);
+    } else {
+      DPF(D_TERSE, ("[No position register]"));
+    }
+  }
+
+  return ntStatus;
+} // Init
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRTStream::NonDelegatingQueryInterface(
+  IN  REFIID  Interface,
+  OUT PVOID * Object
+)
+/*
+Routine Description:
+  QueryInterface
+
+Arguments:
+  Interface - GUID
+  Object - interface pointer to be returned
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(Object);
+
+  if (IsEqualGUIDAligned(Interface, IID_IUnknown)) {
+    *Object = PVOID(PUNKNOWN(PMINIPORTWAVERTSTREAM(this)));
+  } else if (IsEqualGUIDAligned(Interface, IID_IMiniportWaveRTStream)) {
+    *Object = PVOID(PMINIPORTWAVERTSTREAM(this));
+  } else {
+    *Object = NULL;
+  }
+
+  if (*Object) {
+    PUNKNOWN(*Object)->AddRef();
+    return STATUS_SUCCESS;
+  }
+
+  return STATUS_INVALID_PARAMETER;
+} // NonDelegatingQueryInterface
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRTStream::AllocateAudioBuffer(
+  IN  ULONG                   RequestedSize,
+  OUT PMDL *                  AudioBufferMdl,
+  OUT ULONG *                 ActualSize,
+  OUT ULONG *                 OffsetFromFirstPage,
+  OUT MEMORY_CACHING_TYPE *   CacheType
+)
+/*
+Routine Description:
+  Allocates the cyclic buffer the audio engine and the stream share. It
+  holds a whole number of frames, at most RequestedSize bytes. The pages
+  are zeroed, the engine maps all of them. Only one buffer at a time.
+
+Arguments:
+  RequestedSize - bytes the audio engine asks for
+  AudioBufferMdl - receives the pages
+  ActualSize - receives the bytes of the buffer
+  OffsetFromFirstPage - receives where the buffer starts in the first page
+  CacheType - receives how the pages are mapped
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(AudioBufferMdl && ActualSize && OffsetFromFirstPage && CacheType);
+  DPF_ENTER(("[CMiniportWaveRTStream::AllocateAudioBuffer]"));
+
+  if (m_pBufferMdl) {
+    return STATUS_INVALID_DEVICE_STATE;
+  }
+
+  ULONG size = RequestedSize - (RequestedSize % m_ulBlockAlign);
+  if (!size) {
+    return STATUS_INVALID_BUFFER_SIZE;
+  }
+
+  PHYSICAL_ADDRESS highAddress;
+  highAddress.QuadPart = MAXLONGLONG;
+
+  PMDL pMdl = m_PortStream->AllocatePagesForMdl(highAddress, size);
+  if (!pMdl) {
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  // The allocation can come back with fewer pages than asked for.
+  PVOID pvBuffer = NULL;
+  if (m_PortStream->GetPhysicalPagesCount(pMdl) >= ADDRESS_AND_SIZE_TO_SPAN_PAGES(0, size)) {
+    pvBuffer = m_PortStream->MapAllocatedPages(pMdl, MmCached);
+  }
+  if (!pvBuffer) {
+    m_PortStream->FreePagesFromMdl(pMdl);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  RtlZeroMemory(pvBuffer, ROUND_TO_PAGES(size));
+
+  m_pBufferMdl = pMdl;
+  m_pvBuffer = pvBuffer;
+  m_Cyclic.SetBuffer(m_pvBuffer, size);
+
+  *AudioBufferMdl = m_pBufferMdl;
+  *ActualSize = size;
+  *OffsetFromFirstPage = 0;
+  *CacheType = MmCached;
+
+  DPF(D_TERSE, ("[Cyclic buffer: %d bytes]", size));
+  return STATUS_SUCCESS;
+} // AllocateAudioBuffer
+
+//=============================================================================
+STDMETHODIMP_(VOID) CMiniportWaveRTStream::FreeAudioBuffer(
+  IN  PMDL                    AudioBufferMdl,
+  IN  ULONG                   BufferSize
+)
+/*
+Routine Description:
+  Frees the buffer AllocateAudioBuffer allocated.
+
+Arguments:
+  AudioBufferMdl - pages of the buffer
+  BufferSize - bytes of the buffer
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  DPF_ENTER(("[CMiniportWaveRTStream::FreeAudioBuffer]"));
+
+  if (!AudioBufferMdl || (AudioBufferMdl != m_pBufferMdl)) {
+    return;
+  }
+
+  m_Cyclic.SetBuffer(NULL, 0);
+  m_PortStream->UnmapAllocatedPages(m_pvBuffer, m_pBufferMdl);
+  m_PortStream->FreePagesFromMdl(m_pBufferMdl);
+
+  m_pBufferMdl = NULL;
+  m_pvBuffer = NULL;
+} // FreeAudioBuffer
+
+//=============================================================================
+STDMETHODIMP_(VOID) CMiniportWaveRTStream::GetHWLatency(
+  OUT KSRTAUDIO_HWLATENCY *   HwLatency
+)
+/*
+Routine Description:
+  Reports the delays of the hardware. There is no FIFO, chipset or codec;
+  the frames a capture stream reports are already in the buffer.
+
+Arguments:
+  HwLatency - receives the delays
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(HwLatency);
+
+  HwLatency->FifoSize = 0;
+  HwLatency->ChipsetDelay = 0;
+  HwLatency->CodecDelay = 0;
+} // GetHWLatency
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRTStream::GetPositionRegister(
+  OUT KSRTAUDIO_HWREGISTER *  Register
+)
+/*
+Routine Description:
+  Hands out the position register, so the audio engine reads the position
+  without a call into the driver. It holds the byte offset of the position
+  in the cyclic buffer and moves once per WAVERT_SERVICE_PERIOD.
+
+Arguments:
+  Register - receives the register
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(Register);
+
+  if (!m_pulRegister) {
+    return STATUS_NOT_SUPPORTED;
+  }
+
+  Register->Register = m_pulRegister;
+  Register->Width = 32;
+  Register->Numerator = 0;
+  Register->Denominator = 0;
+  Register->Accuracy = (ULONG) ((ULONGLONG) m_ulSampleRate * WAVERT_SERVICE_PERIOD / _100NS_UNITS_PER_SECOND + 1) * m_ulBlockAlign;
+
+  return STATUS_SUCCESS;
+} // GetPositionRegister
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRTStream::GetClockRegister(
+  OUT KSRTAUDIO_HWREGISTER *  Register
+)
+/*
+Routine Description:
+  There is no clock register, the position runs on the interrupt time.
+
+Arguments:
+  Register -
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+
+  return STATUS_NOT_SUPPORTED;
+} // GetClockRegister
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRTStream::SetFormat(
+  IN  PKSDATAFORMAT           Format
+)
+/*
+Routine Description:
+  The SetFormat function changes the format associated with a stream.
+  The wavecyclic stream checks and takes the format. Only while the
+  stream is stopped.
+
+Arguments:
+  Format - Pointer to a KSDATAFORMAT structure which indicates the new format
+           of the stream.
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(Format);
+  DPF_ENTER(("[CMiniportWaveRTStream::SetFormat]"));
+
+  if (m_ksState != KSSTATE_STOP) {
+    return STATUS_INVALID_DEVICE_STATE;
+  }
+
+  NTSTATUS ntStatus = m_pWaveStream->SetFormat(Format);
+  if (NT_SUCCESS(ntStatus)) {
+    PWAVEFORMATEX pWfx = GetWaveFormatEx(Format);
+    m_ulBlockAlign = pWfx->nBlockAlign;
+    m_ulSampleRate = pWfx->nSamplesPerSec;
+    m_Cyclic.SetFormat(m_ulBlockAlign, m_ulSampleRate);
+  }
+
+  return ntStatus;
+} // SetFormat
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRTStream::SetState(
+  IN  KSSTATE                 State
+)
+/*
+Routine Description:
+  The SetState function sets the new state of playback or recording for the
+  stream. The wavecyclic stream starts or stops the scheduler lane and the
+  loopback side of the stream; the stream is only on the scheduler's list
+  while it runs. SetState should run at IRQL PASSIVE_LEVEL
+
+Arguments:
+  State - KSSTATE indicating the new state for the stream.
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  DPF_ENTER(("[CMiniportWaveRTStream::SetState]"));
+
+  if (m_ksState == State) {
+    return STATUS_SUCCESS;
+  }
+
+  if (m_ksState == KSSTATE_RUN) {
+    m_pMiniport->StopStream(this);
+  }
+
+  NTSTATUS ntStatus = m_pWaveStream->SetState(State);
+  m_Cyclic.SetState(State, RtsdQueryTime());
+
+  if (State == KSSTATE_RUN) {
+    m_pMiniport->StartStream(this);
+  }
+
+  m_ksState = State;
+  return ntStatus;
+} // SetState
+
+#pragma code_seg()
+
+//=============================================================================
+STDMETHODIMP_(NTSTATUS) CMiniportWaveRTStream::GetPosition(
+  OUT KSAUDIO_POSITION *      Position
+)
+/*
+Routine Description:
+  Reports the byte offset of the position in the cyclic buffer, computed
+  from the interrupt time (render) or the frames that are in the buffer
+  (capture). Callers of GetPosition should run at
+  IRQL <= DISPATCH_LEVEL.
+
+Arguments:
+  Position - receives the position
+
+Return Value:
+  NT status code.
+*/
+{
+  ASSERT(Position);
+
+  ULONG offset = m_Cyclic.GetOffset(RtsdQueryTime());
+
+  Position->PlayOffset = offset;
+  Position->WriteOffset = offset;
+
+  return STATUS_SUCCESS;
+} // GetPosition
+
+//=============================================================================
+void CMiniportWaveRTStream::Transfer(
+  IN  PVOID                   Context,
+  IN  PUCHAR                  Data,
+  IN  ULONG                   FrameCount
+)
+/*
+Routine Description:
+  Transfer routine of the cyclic buffer. The wavecyclic stream converts
+  the frames to or from the loopback ring, as it does for the copies of
+  the wavecyclic port.
+
+Arguments:
+  Context - the stream
+  Data - frames in the cyclic buffer
+  FrameCount - number of frames
+
+Return Value:
+  void
+*/
+{
+  PCMiniportWaveRTStream pStream = (PCMiniportWaveRTStream) Context;
+  ULONG byteCount = FrameCount * pStream->m_ulBlockAlign;
+
+  if (pStream->m_fCapture) {
+    pStream->m_pWaveStream->CopyFrom(Data, NULL, byteCount);
+  } else {
+    pStream->m_pWaveStream->CopyTo(NULL, Data, byteCount);
+  }
+} // Transfer
+
+//=============================================================================
+void CMiniportWaveRTStream::Signal(
+  IN  PVOID                   Context,
+  IN  PVOID                   Notification
+)
+/*
+Routine Description:
+  Notify routine of the cyclic buffer. Signals a position event the
+  client enabled on the pin.
+
+Arguments:
+  Context - the stream
+  Notification - KSEVENT_ENTRY of the event
+
+Return Value:
+  void
+*/
+{
+  KsGenerateEvent((PKSEVENT_ENTRY) Notification);
+} // Signal
+
+#endif // RTSD_WAVERT
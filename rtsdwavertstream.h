@@ -0,0 +1,70 @@
+/*
+Module Name:
+    rtsdwavertstream.h
+
+Abstract:
+    Definition of wavert miniport stream class.
+*/
+
+#ifndef __RTSDWAVERTSTREAM_H_
+#define __RTSDWAVERTSTREAM_H_
+
+#include "rtsdwavert.h"
+#include "rtsdwavestream.h"
+#include "rtsdcycl.h"
+
+#ifdef RTSD_WAVERT
+
+///////////////////////////////////////////////////////////////////////////////
+// CMiniportWaveRTStream
+//
+
+class CMiniportWaveRTStream : public IMiniportWaveRTStream, public CUnknown {
+protected:
+  PCMiniportWaveRT          m_pMiniport;        // Miniport that created us
+  PCMiniportWaveCyclicStream m_pWaveStream;     // Converts to and from the loopback ring.
+  PPORTWAVERTSTREAM         m_PortStream;       // Allocates the shared pages.
+  BOOLEAN                   m_fCapture;         // Capture or render.
+  ULONG                     m_ulBlockAlign;     // Bytes per frame.
+  ULONG                     m_ulSampleRate;     // Frames per second.
+  KSSTATE                   m_ksState;          // Stop, acquire, pause, run.
+  CCyclicBuffer             m_Cyclic;           // State, position and transfer.
+
+  PMDL                      m_pBufferMdl;       // Cyclic buffer, or NULL.
+  PVOID                     m_pvBuffer;         // System address of it.
+  PMDL                      m_pRegisterMdl;     // Page of the position register, or NULL.
+  PULONG                    m_pulRegister;      // System address of it.
+
+  static void Transfer(IN PVOID Context, IN PUCHAR Data, IN ULONG FrameCount);
+  static void Signal(IN PVOID Context, IN PVOID Notification);
+
+public:
+    DECLARE_STD_UNKNOWN();
+    DEFINE_STD_CONSTRUCTOR(CMiniportWaveRTStream);
+    ~CMiniportWaveRTStream();
+
+    IMP_IMiniportWaveRTStream;
+
+    NTSTATUS Init
+    (
+        IN  PCMiniportWaveRT    Miniport,
+        IN  PPORTWAVERTSTREAM   PortStream,
+        IN  ULONG               Pin,
+        IN  BOOLEAN             Capture,
+        IN  PKSDATAFORMAT       DataFormat
+    );
+
+    PCMiniportWaveCyclicStream GetWaveStream(void)  { return m_pWaveStream; }
+
+    // Friends
+    friend class CMiniportWaveRT;
+    friend void SchedulerServiceRT(
+        IN  PVOID               Context,
+        IN  ULONG               Lane,
+        IN  ULONGLONG           CurrentTime
+    );
+};
+
+#endif // RTSD_WAVERT
+
+#endif
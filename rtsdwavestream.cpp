@@ -37,20 +37,26 @@ Return Value:
   PAGED_CODE();
   DPF_ENTER(("[CMiniportWaveCyclicStream::~CMiniportWaveCyclicStream]"));
 
+  // Take the lane out of the scheduler before the reader goes away, so
+  // no tick can service a detached reader.
+  if (NULL != m_pMiniport && m_ksState == KSSTATE_RUN) {
+      m_pMiniport->m_Scheduler.Stop(GetSchedulerLane());
+  }
+
   if (NULL != m_pMiniport) {
-      if (m_fCapture)
-          m_pMiniport->m_fCaptureAllocated = FALSE;
-      else
+      // NewStream and the ring size property look at the flags.
+      KeWaitForSingleObject(&m_pMiniport->m_StreamSync, Executive, KernelMode, FALSE, NULL);
+      if (m_fCapture) {
+          if (m_ulReader != (ULONG)-1) {
+              m_pMiniport->m_Loopback.DetachReader(m_ulReader);
+              m_pMiniport->m_ulCaptureAllocated--;
+          }
+      } else {
           m_pMiniport->m_fRenderAllocated = FALSE;
+          m_pMiniport->m_fRenderRunning = FALSE;
+      }
+      KeReleaseMutex(&m_pMiniport->m_StreamSync, FALSE);
   }
-  if (m_pTimer) {
-      KeCancelTimer(m_pTimer);
-      ExFreePool(m_pTimer);
-  }
-
-  if (m_pDpc)
-      ExFreePool( m_pDpc );
-
   // Free the DMA buffer
   FreeBuffer();
 
@@ -86,20 +92,23 @@ Return Value:
   m_pMiniport = Miniport_;
 
   m_fCapture = FALSE;
-  m_fFormat16Bit = FALSE;
-  m_fFormatStereo = FALSE;
+  m_ulBlockAlign = 0;
+  m_ulChannels = 0;
+  m_ulChannelMask = 0;
+  m_pfnConvert = NULL;
+  m_pDither = NULL;
+  m_pMatrix = NULL;
   m_ksState = KSSTATE_STOP;
   m_ulPin = (ULONG)-1;
-
-  m_pDpc = NULL;
-  m_pTimer = NULL;
+  m_ulReader = (ULONG)-1;
+  m_fDriftControl = FALSE;
 
   m_fDmaActive = FALSE;
   m_ulDmaPosition = 0;
   m_pvDmaBuffer = NULL;
   m_ulDmaBufferSize = 0;
   m_ulDmaMovementRate = 0;    
-  m_ullDmaTimeStamp = 0;
+  m_fRenderClock = FALSE;
 
 
   NTSTATUS ntStatus = STATUS_SUCCESS;
@@ -114,19 +123,25 @@ Return Value:
   if (NT_SUCCESS(ntStatus)) {
     m_ulPin         = Pin_;
     m_fCapture      = Capture_;
-    m_fFormatStereo = (pWfx->nChannels == 2);
-    m_fFormat16Bit  = (pWfx->wBitsPerSample == 16);
+    m_fRenderClock  = Capture_ && (m_pMiniport->m_CaptureClock == CAPTURE_CLOCK_RENDER) && !m_pMiniport->IsWaveRT();
+    m_ulBlockAlign  = pWfx->nBlockAlign;
+    m_ulChannels    = pWfx->nChannels;
+    m_SampleType    = m_pMiniport->GetSampleType(pWfx);
+    m_pfnConvert    = GetConvertKernel(m_SampleType);
+    m_ulSampleRate  = pWfx->nSamplesPerSec;
     m_ksState       = KSSTATE_STOP;
     m_ulDmaPosition = 0;
     m_fDmaActive    = FALSE;
-    m_pDpc          = NULL;
-    m_pTimer        = NULL;
     m_pvDmaBuffer   = NULL;
   }
 
-  // Allocate DMA buffer for this stream.
-  if (NT_SUCCESS(ntStatus)) {
-      ntStatus = AllocateBuffer(m_pMiniport->m_MaxDmaBufferSize, NULL);
+  // Allocate DMA buffer for this stream. Under the WaveRT miniport the
+  // data goes through its cyclic buffer instead.
+  if (NT_SUCCESS(ntStatus) && !m_pMiniport->IsWaveRT()) {
+      // A whole number of frames, so no frame straddles the wrap of the
+      // buffer when the port splits a copy.
+      ntStatus = AllocateBuffer(m_pMiniport->m_MaxDmaBufferSize -
+                                (m_pMiniport->m_MaxDmaBufferSize % m_ulBlockAlign), NULL);
   }
 
   // Set sample frequency. Note that m_SampleRateSync access should
@@ -151,33 +166,11 @@ Return Value:
       ntStatus = SetFormat(DataFormat_);
   }
 
-  if (NT_SUCCESS(ntStatus)) {
-      m_pDpc = (PRKDPC) ExAllocatePoolWithTag(
-        NonPagedPool,
-        sizeof(KDPC),
-        RTSDAUDIO_POOLTAG
-      );
-      if (!m_pDpc) {
-        DPF(D_TERSE, ("[Could not allocate memory for DPC]"));
-        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
-      }
-  }
-
-  if (NT_SUCCESS(ntStatus)) {
-    m_pTimer = (PKTIMER) ExAllocatePoolWithTag(
-      NonPagedPool,
-      sizeof(KTIMER),
-      RTSDAUDIO_POOLTAG
-    );
-    if (!m_pTimer) {
-      DPF(D_TERSE, ("[Could not allocate memory for Timer]"));
-      ntStatus = STATUS_INSUFFICIENT_RESOURCES;
-    }
-  }
-
-  if (NT_SUCCESS(ntStatus)) {
-    KeInitializeDpc(m_pDpc, TimerNotify, m_pMiniport);
-    KeInitializeTimerEx(m_pTimer, NotificationTimer);
+  // Every capture stream gets its own read cursor on the loopback ring.
+  // This has to be the last step, the destructor only detaches readers
+  // of streams that initialized completely.
+  if (NT_SUCCESS(ntStatus) && m_fCapture) {
+    ntStatus = m_pMiniport->m_Loopback.AttachReader(&m_ulReader);
   }
 
   return ntStatus;
@@ -240,23 +233,56 @@ Return Value:
 */
 {
   if (m_fDmaActive) {
-    ULONGLONG CurrentTime = KeQueryInterruptTime();
+    *Position = GetDmaPosition(KeQueryInterruptTime());
+  } else {
+    *Position = m_ulDmaPosition;
+  }
 
-    ULONG TimeElapsedInMS = ( (ULONG) (CurrentTime - m_ullDmaTimeStamp) ) / 10000;
+  return STATUS_SUCCESS;
+} // GetPosition
 
-    ULONG ByteDisplacement = (m_ulDmaMovementRate * TimeElapsedInMS) / 1000;
+//=============================================================================
+ULONG CMiniportWaveCyclicStream::GetDmaPosition(
+  IN  ULONGLONG               CurrentTime
+)
+/*
+Routine Description:
+  Computes the DMA position of a running stream at CurrentTime from
+  m_Clock, to the frame, so the position does not depend on how often it
+  is polled.
+  A capture stream clocked by the render stream moves on by the frames
+  the render stream wrote to the ring for it. CopyFrom then never reads
+  ahead of the data, and the two sides can not drift apart. While no
+  render stream runs the position moves on with the interrupt time from
+  where the render stream left off, so the client keeps getting silence.
+  Callers of GetDmaPosition can run at any IRQL.
 
-    m_ulDmaPosition = (m_ulDmaPosition + ByteDisplacement) % m_ulDmaBufferSize;
+Arguments:
+  CurrentTime - interrupt time, in 100 ns units
 
-    *Position = m_ulDmaPosition;
+Return Value:
+  Byte offset into the DMA buffer
+*/
+{
+  if (!m_ulDmaBufferSize) {
+    return 0;
+  }
 
-    m_ullDmaTimeStamp = CurrentTime;
-  } else {
-    *Position = m_ulDmaPosition;
+  PCLoopbackBuffer pLoopback = &m_pMiniport->m_Loopback;
+  LONGLONG available = DMA_CLOCK_FREE_RUN;
+
+  if (m_fRenderClock && m_pMiniport->m_fRenderRunning && pLoopback->IsAllocated()) {
+    available = pLoopback->GetFillLevel(m_ulReader, 0);
+    if (m_Resampler.IsActive()) {
+      // the filter holds back the frame after the last one it interpolates
+      available = available * m_ulSampleRate / m_pMiniport->m_LoopbackFormat.nSamplesPerSec - 1;
+    }
   }
 
-  return STATUS_SUCCESS;
-} // GetPosition
+  ULONGLONG frames = m_Clock.GetFrames(CurrentTime, available);
+
+  return (ULONG) ((m_ulDmaPosition + frames % m_ulDmaBufferSize * m_ulBlockAlign) % m_ulDmaBufferSize);
+} // GetDmaPosition
 
 //=============================================================================
 STDMETHODIMP CMiniportWaveCyclicStream::NormalizePhysicalPosition(
@@ -276,7 +302,10 @@ Return Value:
   NT status code.
 */
 {
-  *PhysicalPosition = ( _100NS_UNITS_PER_SECOND / ( 1 << ( m_fFormatStereo + m_fFormat16Bit ) ) * *PhysicalPosition ) / m_pMiniport->m_SamplingFrequency;
+  LONGLONG frames = *PhysicalPosition / m_ulBlockAlign;
+
+  *PhysicalPosition = (frames / m_ulSampleRate) * _100NS_UNITS_PER_SECOND +
+                      (frames % m_ulSampleRate) * _100NS_UNITS_PER_SECOND / m_ulSampleRate;
   return STATUS_SUCCESS;
 } // NormalizePhysicalPosition
 
@@ -310,6 +339,12 @@ Return Value:
     //First validate the format
     NTSTATUS ntValidFormat;
     ntValidFormat = m_pMiniport->ValidateFormat(Format);
+    if (NT_SUCCESS(ntValidFormat)) {
+      ntValidFormat = m_pMiniport->ValidateLoopbackFormat(GetWaveFormatEx(Format), m_fCapture);
+    }
+    if (NT_SUCCESS(ntValidFormat)) {
+      ntValidFormat = InitResampler(GetWaveFormatEx(Format));
+    }
     if (NT_SUCCESS(ntValidFormat)) {
       pWfx = GetWaveFormatEx(Format);
       if (pWfx) {
@@ -321,8 +356,21 @@ Return Value:
           NULL
         );
         if (NT_SUCCESS(ntStatus)) {
-            m_fFormatStereo = (pWfx->nChannels == 2);
-            m_fFormat16Bit  = (pWfx->wBitsPerSample == 16);
+            m_ulBlockAlign  = pWfx->nBlockAlign;
+            m_ulChannels    = pWfx->nChannels;
+            m_ulChannelMask = GetWaveChannelMask(pWfx);
+            m_SampleType    = m_pMiniport->GetSampleType(pWfx);
+            m_pfnConvert    = GetConvertKernel(m_SampleType);
+            m_pDither       = NULL;
+            m_pMatrix       = NULL;
+            if (m_fCapture) {
+              if (InitDither(&m_Dither, m_pMiniport->m_DitherMode, m_SampleType, pWfx->nChannels,
+                             (ULONG)KeQueryInterruptTime() ^ (ULONG)(ULONG_PTR)this)) {
+                m_pDither = &m_Dither;
+              }
+              InitRouting(NULL);
+            }
+            m_ulSampleRate  = pWfx->nSamplesPerSec;
             m_pMiniport->m_SamplingFrequency = pWfx->nSamplesPerSec;
             m_ulDmaMovementRate = pWfx->nAvgBytesPerSec;
 
@@ -336,6 +384,192 @@ Return Value:
   return ntStatus;
 } // SetFormat
 
+//=============================================================================
+PLOOPBACK_CONVERT CMiniportWaveCyclicStream::GetConvertKernel(
+  IN  LOOPBACK_SAMPLE_TYPE    SampleType
+)
+/*
+Routine Description:
+  Returns the kernel that converts between SampleType and the pivot
+  samples of the ring in the direction of this stream: to the pivot for
+  render, from it for capture.
+
+Arguments:
+  SampleType - sample layout of the stream
+
+Return Value:
+  Conversion kernel
+*/
+{
+  PAGED_CODE();
+
+  PCLOOPBACK_CONVERTERS pConverters = m_pMiniport->m_Loopback.GetConvertKernels();
+
+  return m_fCapture ? pConverters->FromPivot[SampleType] : pConverters->ToPivot[SampleType];
+} // GetConvertKernel
+
+//=============================================================================
+void CMiniportWaveCyclicStream::InitRouting(
+  IN  PRTSD_LOOPBACK_ROUTING  Routing
+)
+/*
+Routine Description:
+  Sets up the channel mix from the loopback ring to this capture stream.
+  A stream whose channel mask only names speakers the ring has gets those
+  channels of the ring, so it can pick a subset of a multichannel render
+  stream without a mix.
+
+Arguments:
+  Routing - mix to use, NULL for the channels the stream's mask names, the
+            one of the CaptureRouting setting or the default mix
+
+Return Value:
+  void
+*/
+{
+  PAGED_CODE();
+  ASSERT(m_fCapture);
+
+  ULONG inputs = m_pMiniport->m_Loopback.GetChannels();
+  ULONG ringMask = m_pMiniport->m_LoopbackChannelMask;
+  RTSD_LOOPBACK_ROUTING subset;
+
+  if (!Routing && m_ulChannelMask && ((m_ulChannelMask & ~ringMask) == 0)) {
+    RtlZeroMemory(&subset, sizeof(subset));
+    subset.InputChannels = inputs;
+    subset.OutputChannels = m_ulChannels;
+
+    // both masks list the channels in the order of their speaker bits
+    ULONG i = 0;
+    ULONG o = 0;
+    for (ULONG speaker = 1; speaker && (i < inputs); speaker <<= 1) {
+      if (!(ringMask & speaker)) {
+        continue;
+      }
+      if ((m_ulChannelMask & speaker) && (o < m_ulChannels)) {
+        subset.Gain[o++][i] = RTSD_ROUTING_UNITY;
+      }
+      i++;
+    }
+    Routing = &subset;
+  }
+
+  if (!Routing) {
+    Routing = m_pMiniport->GetCaptureRouting(inputs, m_ulChannels);
+  }
+
+  m_pMatrix = NULL;
+  if (InitMatrix(&m_Matrix, inputs, m_ulChannels, Routing ? &Routing->Gain[0][0] : NULL, RTSD_LOOPBACK_MAX_CHANNELS)) {
+    m_pMatrix = &m_Matrix;
+  }
+} // InitRouting
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclicStream::PropertyHandlerRouting(
+  IN  PPCPROPERTY_REQUEST     PropertyRequest
+)
+/*
+Routine Description:
+  Processes KSPROPERTY_RTSD_LOOPBACK_ROUTING. A new mix can only be set
+  while the stream is not running; a format change goes back to the
+  default mix.
+
+Arguments:
+  PropertyRequest - property request structure
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(PropertyRequest);
+  DPF_ENTER(("[CMiniportWaveCyclicStream::PropertyHandlerRouting]"));
+
+  NTSTATUS ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+
+  if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT) {
+    ntStatus = PropertyHandler_BasicSupport(PropertyRequest, KSPROPERTY_TYPE_ALL, VT_ILLEGAL);
+  } else if (m_fCapture) {
+    ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(RTSD_LOOPBACK_ROUTING), 0);
+    if (NT_SUCCESS(ntStatus)) {
+      PRTSD_LOOPBACK_ROUTING pRouting = (PRTSD_LOOPBACK_ROUTING) PropertyRequest->Value;
+
+      if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET) {
+        RtlZeroMemory(pRouting, sizeof(RTSD_LOOPBACK_ROUTING));
+        pRouting->InputChannels = m_Matrix.InputChannels;
+        pRouting->OutputChannels = m_Matrix.OutputChannels;
+        RtlCopyMemory(pRouting->Gain, m_Matrix.Gain, sizeof(pRouting->Gain));
+        PropertyRequest->ValueSize = sizeof(RTSD_LOOPBACK_ROUTING);
+      } else if (PropertyRequest->Verb & KSPROPERTY_TYPE_SET) {
+        if (m_ksState == KSSTATE_RUN) {
+          DPF(D_TERSE, ("[Routing can't be changed while the stream runs]"));
+          ntStatus = STATUS_INVALID_DEVICE_STATE;
+        } else if ((pRouting->InputChannels != m_Matrix.InputChannels) ||
+                   (pRouting->OutputChannels != m_Matrix.OutputChannels)) {
+          ntStatus = STATUS_INVALID_PARAMETER;
+        } else {
+          InitRouting(pRouting);
+        }
+      }
+    }
+  }
+
+  return ntStatus;
+} // PropertyHandlerRouting
+
+//=============================================================================
+NTSTATUS CMiniportWaveCyclicStream::InitResampler(
+  IN  PWAVEFORMATEX           pWfx
+)
+/*
+Routine Description:
+  Sets up the sample rate converter between the stream format and the
+  loopback ring, or switches it off if both run at the same rate. Render
+  streams convert to the rate of the ring, capture streams from it.
+  Capture streams with drift control always resample, so the controller
+  can trim the ratio even at the rate of the ring. Streams clocked by the
+  render stream can not drift and need no drift control.
+
+Arguments:
+  pWfx - new format of the stream
+
+Return Value:
+  NT status code.
+*/
+{
+  PAGED_CODE();
+  ASSERT(pWfx);
+
+  ULONG ringRate = m_pMiniport->m_LoopbackFormat.nSamplesPerSec;
+
+  m_fDriftControl = m_fCapture && (m_pMiniport->m_TargetLatencyMs != 0) && !m_fRenderClock;
+
+  if (!ResamplerNeeded(m_fCapture && !m_fRenderClock, pWfx->nSamplesPerSec, ringRate, m_pMiniport->m_TargetLatencyMs)) {
+    m_Resampler.Free();
+    return STATUS_SUCCESS;
+  }
+
+  NTSTATUS ntStatus = m_Resampler.Init(
+    m_fCapture ? ringRate : pWfx->nSamplesPerSec,
+    m_fCapture ? pWfx->nSamplesPerSec : ringRate,
+    pWfx->nChannels,
+    m_pMiniport->m_ResamplerQuality,
+    RESAMPLER_BLOCK_FRAMES
+  );
+  if (!NT_SUCCESS(ntStatus)) {
+    DPF(D_TERSE, ("[Could not set up the resampler: %08X]", ntStatus));
+    m_fDriftControl = FALSE;
+    return ntStatus;
+  }
+
+  if (m_fDriftControl) {
+    ULONG targetFrames = ringRate * m_pMiniport->m_TargetLatencyMs / 1000;
+    m_Drift.Init(ringRate, pWfx->nSamplesPerSec, RTSD_MIN(targetFrames, m_pMiniport->m_Loopback.GetSize() / 2));
+  }
+
+  return ntStatus;
+} // InitResampler
+
 //=============================================================================
 STDMETHODIMP_(ULONG) CMiniportWaveCyclicStream::SetNotificationFreq(
   IN  ULONG                   Interval,
@@ -362,8 +596,9 @@ Return Value:
   DPF_ENTER(("[CMiniportWaveCyclicStream::SetNotificationFreq]"));
 
   m_pMiniport->m_NotificationInterval = Interval;
+  m_pMiniport->m_Scheduler.SetPeriod(Interval * (_100NS_UNITS_PER_SECOND / 1000));
 
-  *FramingSize = ( 1 << ( m_fFormatStereo + m_fFormat16Bit ) ) * m_pMiniport->m_SamplingFrequency * Interval / 1000;
+  *FramingSize = m_ulBlockAlign * m_ulSampleRate * Interval / 1000;
 
   return m_pMiniport->m_NotificationInterval;
 } // SetNotificationFreq
@@ -395,24 +630,38 @@ Return Value:
   }
 
   if (m_ksState != NewState) {
+    // The device-wide scheduler drives the stream while it runs.
+    if (m_ksState == KSSTATE_RUN) {
+      m_pMiniport->m_Scheduler.Stop(GetSchedulerLane());
+    }
+
+    // Only a running capture stream holds the render stream back.
+    if ((m_ksState == KSSTATE_RUN) && m_fCapture) {
+      m_pMiniport->m_Loopback.StopReader(m_ulReader);
+    }
+
     switch(NewState) {
       case KSSTATE_PAUSE:
         DPF(D_TERSE, ("KSSTATE_PAUSE"));
-        m_fDmaActive = FALSE;
+        // Keep the position, a later run continues from it.
+        if (m_fDmaActive) {
+          m_fDmaActive = FALSE;
+          m_ulDmaPosition = GetDmaPosition(KeQueryInterruptTime());
+        }
         break;
 
       case KSSTATE_RUN:
         DPF(D_TERSE, ("KSSTATE_RUN"));
 
-		LARGE_INTEGER   delay;
+        // A capture stream starts with what is rendered from now on; older
+        // samples would only add latency.
+        if (m_fCapture) {
+          m_pMiniport->m_Loopback.StartReader(m_ulReader);
+        }
 
-        // Set the timer for DPC.
-        m_ullDmaTimeStamp   = KeQueryInterruptTime();
+        m_Clock.Start(KeQueryInterruptTime(), m_ulSampleRate);
         m_fDmaActive        = TRUE;
-        delay.HighPart      = 0;
-        delay.LowPart       = m_pMiniport->m_NotificationInterval;
-
-        KeSetTimerEx(m_pTimer, delay, m_pMiniport->m_NotificationInterval, m_pDpc);
+        m_pMiniport->m_Scheduler.Start(GetSchedulerLane());
         break;
 
       case KSSTATE_STOP:
@@ -420,12 +669,13 @@ Return Value:
 
         m_fDmaActive = FALSE;
         m_ulDmaPosition = 0;
-
-        KeCancelTimer( m_pTimer );
         break;
     }
 
     m_ksState = NewState;
+    if (!m_fCapture) {
+      m_pMiniport->m_fRenderRunning = (NewState == KSSTATE_RUN);
+    }
   }
 
   return ntStatus;
@@ -452,7 +702,8 @@ Return Value:
   NT status code.
 */
 {
-  RtlFillMemory(Buffer, ByteCount, m_fFormat16Bit ? 0 : 0x80);
+  // Every format we accept is signed or float, so silence is all zeros.
+  RtlZeroMemory(Buffer, ByteCount);
 } // Silence
 
 #pragma code_seg("PAGE")
@@ -556,50 +807,47 @@ Return Value:
   void
 */
 {
-  ULONG i=0;
-  ULONG FrameCount = ByteCount/2; //we guess 16-Bit sample rate
-  //DbgPrint(DBGMESSAGE "CopyFrom - ReadPos=%d",myBufferReadPos);  DbgPrint(DBGMESSAGE "CopyFrom - WritePos=%d",myBufferWritePos);
-  if (!m_pMiniport->myBufferLocked) {
-	//DbgPrint(DBGMESSAGE "CopyFrom - ByteCount=%d", ByteCount);
-    InterlockedExchange(&m_pMiniport->myBufferLocked, TRUE);
-	
-	ULONG umyBufferSize=(ULONG)m_pMiniport->myBufferSize;
-	ULONG availableDataCount = (umyBufferSize + m_pMiniport->myBufferWritePos) - m_pMiniport->myBufferReadPos;
-	if (availableDataCount >= umyBufferSize)
-		availableDataCount -= umyBufferSize;
-    if (availableDataCount < FrameCount)  {
-	  //if the caller wants to read more data than the buffer size is,
-	  //we fill the rest with silence
-	  //we write the silence at the beginning,
-	  //because in the most cases we need to do this the caller begins to read - so we care
-	  //for a continually stream of sound data
-	  ULONG silenceCount = FrameCount - availableDataCount;
-      //DbgPrint(DBGMESSAGE "CopyFrom - need more data! NeedCount=%d", silenceCount);
-	  for (i=0; i<=silenceCount ; i++) {
-		  ((PWORD)Destination)[i]=0;
-	  }
-    }
+  //the ring only ever moves whole frames, a partial frame at the end of
+  //the period is handed out as silence
+  ULONG FrameCount = ByteCount / m_ulBlockAlign;
+  ASSERT(m_ulBlockAlign == LoopbackSampleSize[m_SampleType] * m_ulChannels);
+  RtlZeroMemory((PUCHAR)Destination + FrameCount * m_ulBlockAlign, ByteCount - FrameCount * m_ulBlockAlign);
+  m_Clock.Copied(FrameCount);
+
+  if (!m_Resampler.IsActive()) {
+    m_pMiniport->m_Loopback.Read(m_ulReader, Destination, m_SampleType, FrameCount, m_pMatrix, m_pDither);
+    return;
+  }
 
-    //i=0;
-    while ((i < FrameCount) && //we have more data in the buffer than the caller would like to get
-		((m_pMiniport->myBufferWritePos != m_pMiniport->myBufferReadPos+1) && !((m_pMiniport->myBufferWritePos==0) && (m_pMiniport->myBufferReadPos==m_pMiniport->myBufferSize))) ) {
-      ((PWORD)Destination)[i]=((PWORD)m_pMiniport->myBuffer)[m_pMiniport->myBufferReadPos];
-      i++;
-      m_pMiniport->myBufferReadPos++;
-      if (m_pMiniport->myBufferReadPos >= m_pMiniport->myBufferSize) //Loop the buffer
-	    m_pMiniport->myBufferReadPos=0;
-    }
-	InterlockedExchange(&m_pMiniport->myBufferReading, TRUE); //now the caller reads from the buffer - so we can notify the CopyTo function
+  //the render side runs on its own timer, trim the ratio so this reader
+  //neither falls behind nor runs dry
+  if (m_fDriftControl) {
+    ULONG ringRate = m_pMiniport->m_LoopbackFormat.nSamplesPerSec;
+    LONG fillLevel = m_pMiniport->m_Loopback.GetFillLevel(m_ulReader, ringRate);
+    m_Resampler.SetRatioAdjust(m_Drift.Update(fillLevel, m_pMiniport->m_Loopback.TakeStretchPending(m_ulReader), FrameCount));
+  }
 
-    //DbgPrint(DBGMESSAGE "CopyFrom TRUE ByteCount=%d", ByteCount);
-    InterlockedExchange(&m_pMiniport->myBufferLocked, FALSE);
-  } else {
-    //in this case we can't obtain the data from buffer because it is locked
-    //the best we can do (to satisfy the caller) is to fill the whole buffer with silence
-    for (i=0; i < FrameCount ; i++) {
-      ((PWORD)Destination)[i]=0;
+  //the ring runs at another rate or is drift controlled. Read the pivot
+  //samples the resampler needs for a block, resample them, dither and
+  //convert the result
+  ULONG channels = m_ulChannels;
+  PUCHAR pDestination = (PUCHAR)Destination;
+
+  while (FrameCount) {
+    ULONG blockFrames = RTSD_MIN(FrameCount, m_Resampler.GetBlockFrames());
+    ULONG inputFrames = m_Resampler.GetInputFrames(blockFrames);
+
+    if (inputFrames) {
+      m_pMiniport->m_Loopback.Read(m_ulReader, m_Resampler.GetInputBuffer(), LOOPBACK_SAMPLE_INT32, inputFrames, m_pMatrix, NULL);
+    }
+    m_Resampler.Process(inputFrames, blockFrames);
+    if (m_pDither) {
+      m_pMiniport->m_Loopback.GetConvertKernels()->Dither(m_Resampler.GetOutputBuffer(), blockFrames, m_pDither);
     }
-    DBGPRINT("CopyFrom FALSE");
+    m_pfnConvert(pDestination, m_Resampler.GetOutputBuffer(), blockFrames * channels);
+
+    pDestination += blockFrames * m_ulBlockAlign;
+    FrameCount -= blockFrames;
   }
 } // CopyFrom
 
@@ -624,48 +872,30 @@ Return Value:
 */
 
 {
-  ULONG i=0;
-  ULONG FrameCount = ByteCount/2; //we guess 16-Bit sample rate
-  if (m_pMiniport->myBuffer==NULL) {
-    ULONG bufSize=64*1024; //size in bytes
-    DBGPRINT("Try to allocate buffer");
-    m_pMiniport->myBuffer = (PVOID) ExAllocatePoolWithTag(NonPagedPool, bufSize, RTSDAUDIO_POOLTAG);
-    if (!m_pMiniport->myBuffer) {
-      DBGPRINT("FAILED to allocate buffer");
-    } else {
-      DBGPRINT("Successfully allocated buffer");
-      m_pMiniport->myBufferSize = bufSize/2; //myBufferSize in frames
-      InterlockedExchange(&m_pMiniport->myBufferLocked, FALSE);
-	}
+  //the ring was allocated by NewStream and only takes whole frames, a
+  //partial frame at the end of the period is dropped
+  ULONG FrameCount = ByteCount / m_ulBlockAlign;
+  ASSERT(m_ulBlockAlign == LoopbackSampleSize[m_SampleType] * m_ulChannels);
+
+  if (!m_Resampler.IsActive()) {
+    m_pMiniport->m_Loopback.Write(Source, m_SampleType, FrameCount);
+    return;
   }
 
-  if (!m_pMiniport->myBufferLocked) {
-    //DbgPrint(DBGMESSAGE "Fill Buffer ByteCount=%d", ByteCount);
-    InterlockedExchange(&m_pMiniport->myBufferLocked, TRUE);
-
-    i=0;
-    while (i < FrameCount) {//while data is available
-      //test wether we arrived at the read-pos
-      //if (! ((myBufferWritePos+1 != myBufferReadPos) && !((myBufferReadPos==0) && (myBufferWritePos==myBufferSize)))) {
-	  if ((m_pMiniport->myBufferWritePos+1==m_pMiniport->myBufferReadPos) || (m_pMiniport->myBufferReadPos==0 && m_pMiniport->myBufferWritePos==m_pMiniport->myBufferSize)){
-        //DbgPrint(DBGMESSAGE "CopyTo - there is no space for new data! NeedCount=%d", FrameCount-i);
-		if (m_pMiniport->myBufferReadPos==m_pMiniport->myBufferSize)
-			m_pMiniport->myBufferReadPos=0;
-		else
-			m_pMiniport->myBufferReadPos++;
-        //break; //we have to break - because there is no space for the rest data
-      }
+  //the ring runs at another rate. Convert a block to pivot samples straight
+  //into the resampler and write what it makes of them
+  ULONG channels = m_ulChannels;
+  PUCHAR pSource = (PUCHAR)Source;
 
-      ((PWORD)m_pMiniport->myBuffer)[m_pMiniport->myBufferWritePos]=((PWORD)Source)[i];
-      i++;
-      m_pMiniport->myBufferWritePos++;
-      if (m_pMiniport->myBufferWritePos >= m_pMiniport->myBufferSize) //Loop the buffer
-	    m_pMiniport->myBufferWritePos=0;
-    }
-  //DbgPrint(DBGMESSAGE "CopyTo - ReadPos=%d",myBufferReadPos);  DbgPrint(DBGMESSAGE "CopyTo - WritePos=%d",myBufferWritePos);
-  InterlockedExchange(&m_pMiniport->myBufferLocked, FALSE);
-  //DbgPrint(DBGMESSAGE "(2) CopyTo - ReadPos=%d",myBufferReadPos);  DbgPrint(DBGMESSAGE "(2) CopyTo - WritePos=%d",myBufferWritePos);
-  //DbgPrint(DBGMESSAGE "(2) CopyTo - Locked=%d",myBufferLocked);
+  while (FrameCount) {
+    ULONG blockFrames = RTSD_MIN(FrameCount, m_Resampler.GetBlockFrames());
+
+    m_pfnConvert(m_Resampler.GetInputBuffer(), pSource, blockFrames * channels);
+    ULONG outputFrames = m_Resampler.Process(blockFrames, MAXULONG);
+    m_pMiniport->m_Loopback.Write(m_Resampler.GetOutputBuffer(), LOOPBACK_SAMPLE_INT32, outputFrames);
+
+    pSource += blockFrames * m_ulBlockAlign;
+    FrameCount -= blockFrames;
   }
 } // CopyTo
 
@@ -692,15 +922,8 @@ Return Value:
     m_ulDmaBufferSize = 0;
     m_pvDmaBuffer = NULL;
   }
-  if (m_pMiniport->myBuffer) {
-	if (!m_pMiniport->myBufferLocked)
-	{
-		InterlockedExchange(&m_pMiniport->myBufferLocked, TRUE); //first lock the buffer, so nobody would try to read from myBuffer
-	    ExFreePool(m_pMiniport->myBuffer);
-		m_pMiniport->myBufferSize = 0;
-	    m_pMiniport->myBuffer = NULL;
-	}
-  }
+  //the loopback ring is still used by the other stream, it is freed
+  //together with the miniport
 } // FreeBuffer
 #pragma code_seg()
 
@@ -825,50 +1048,3 @@ Return Value:
   DBGPRINT("[CMiniportWaveCyclicStream::TransferCount]");
   return m_ulDmaBufferSize;
 }
-
-//=============================================================================
-/*long CMiniportWaveCyclicStream::zoh_process (PWORD source, PWORD destination, long input_frames, long output_frames, int channels)
-{	
-  KFLOATING_SAVE saveData;
-  NTSTATUS status;
-  status = KeSaveFloatingPointState(&saveData);
-
-  if(NT_SUCCESS(status)) {
-    long in_count, out_count, in_used, out_gen;
-    double src_ratio, input_index;
-    int ch;
-
-    in_count = input_frames * channels;
-    out_count = output_frames * channels;
-    in_used = out_gen = 0;
-
-    src_ratio = m_pMiniport->m_SamplingFrequency / 44100;
-    input_index = 0; // TODO: Unbekannt
-
-    in_used += channels * (long)(floor(input_index));
-    input_index -= floor(input_index);
-
-    // Main processing loop.
-    while (out_gen < out_count && in_used + channels * input_index <= in_count) {
-      for (ch = 0 ; ch < channels ; ch++) {
-        destination[out_gen] = source[in_used - channels + ch];
-        out_gen ++ ;
-      } ;
-
-      // Figure out the next index.
-      input_index += 1.0 / src_ratio ;
-
-      in_used += channels * (long)(floor(input_index)) ;
-      input_index -= floor(input_index) ;
-    } ;
-
-    if (in_used > in_count) {
-      input_index += in_used - in_count ;
-      in_used = in_count ;
-    } ;
-    KeRestoreFloatingPointState(&saveData);
-  return out_gen;
-  } else {
-    return 0;
-  }
-}*/
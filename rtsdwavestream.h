@@ -19,20 +19,31 @@ class CMiniportWaveCyclicStream : public IMiniportWaveCyclicStream, public IDmaC
 protected:
   PCMiniportWaveCyclic      m_pMiniport;        // Miniport that created us  
   BOOLEAN                   m_fCapture;         // Capture or render.
-  BOOLEAN                   m_fFormat16Bit;     // 16- or 8-bit samples.
-  BOOLEAN                   m_fFormatStereo;    // Two or one channel.
+  ULONG                     m_ulBlockAlign;     // Bytes per frame.
+  ULONG                     m_ulChannels;       // Samples per frame.
+  ULONG                     m_ulChannelMask;    // Speaker positions the format names, or 0.
+  LOOPBACK_SAMPLE_TYPE      m_SampleType;       // Sample layout of the stream.
+  PLOOPBACK_CONVERT         m_pfnConvert;       // To or from the pivot, bound in SetFormat.
+  PLOOPBACK_DITHER          m_pDither;          // &m_Dither if the stream is dithered (capture only).
+  LOOPBACK_DITHER           m_Dither;
+  PLOOPBACK_MATRIX          m_pMatrix;          // &m_Matrix if the ring's channels are mixed (capture only).
+  LOOPBACK_MATRIX           m_Matrix;
+  ULONG                     m_ulSampleRate;     // Frames per second.
   KSSTATE                   m_ksState;          // Stop, pause, run.
   ULONG                     m_ulPin;            // Pin Id.
-
-  PRKDPC                    m_pDpc;             // Deferred procedure call object
-  PKTIMER                   m_pTimer;           // Timer object
+  ULONG                     m_ulReader;         // Loopback reader slot (capture only).
+  CResampler                m_Resampler;        // Active if the ring runs at another rate or drift is controlled.
+  CDriftController          m_Drift;            // Trims m_Resampler (capture only).
+  BOOLEAN                   m_fDriftControl;    // m_Drift is in use.
 
   BOOLEAN                   m_fDmaActive;       // Dma currently active? 
-  ULONG                     m_ulDmaPosition;    // Position in Dma
+  ULONG                     m_ulDmaPosition;    // Position in Dma when the stream last started to run
   PVOID                     m_pvDmaBuffer;      // Dma buffer pointer
   ULONG                     m_ulDmaBufferSize;  // Size of dma buffer
   ULONG                     m_ulDmaMovementRate;// Rate of transfer specific to system
-  ULONGLONG                 m_ullDmaTimeStamp;  // Dma time elasped 
+  CDmaClock                 m_Clock;            // Frames the position moved since then.
+
+  BOOLEAN                   m_fRenderClock;     // Capture position follows the render stream's data.
   
 public:
     DECLARE_STD_UNKNOWN();
@@ -50,6 +61,13 @@ public:
         IN  PKSDATAFORMAT       DataFormat
     );
 
+    PLOOPBACK_CONVERT GetConvertKernel(IN LOOPBACK_SAMPLE_TYPE SampleType);
+    void InitRouting(IN PRTSD_LOOPBACK_ROUTING Routing);
+    NTSTATUS InitResampler(IN PWAVEFORMATEX pWfx);
+    NTSTATUS PropertyHandlerRouting(IN PPCPROPERTY_REQUEST PropertyRequest);
+    ULONG GetDmaPosition(IN ULONGLONG CurrentTime);
+    ULONG GetSchedulerLane(void)  { return m_fCapture ? SCHEDULER_LANE_CAPTURE : SCHEDULER_LANE_RENDER; }
+
     // Friends
     friend class CMiniportWaveCyclic;
 };
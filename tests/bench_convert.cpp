@@ -0,0 +1,146 @@
+/*
+Module Name:
+  bench_convert.cpp
+
+Abstract:
+  Cost of the sample format conversion. First every kernel alone, to and
+  from the pivot, at every LOOPBACK_CONVERT_LEVEL the processor supports;
+  then every render to capture pair through CLoopbackBuffer at every
+  level, stereo 10 ms periods at 48 kHz, with the ring in the sample type
+  the driver picks for the render format. Last the channel mix kernels
+  alone, on mixes that need a multiply per input and output.
+*/
+
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define CONVERT_SAMPLES             4096
+#define CONVERT_ROUNDS              20000
+#define CONVERT_PERIOD              480
+#define CONVERT_RING_FRAMES         16384
+#define CONVERT_PERIODS             50000
+
+static const char *TypeNames[LOOPBACK_SAMPLE_TYPE_COUNT] = { "int16", "int24", "int32", "float" };
+static const char *LevelNames[LOOPBACK_CONVERT_LEVEL_COUNT] = { "scalar", "sse2", "avx2" };
+
+//=============================================================================
+// ns per sample of Convert on CONVERT_SAMPLES samples.
+//=============================================================================
+static double BenchKernel(PLOOPBACK_CONVERT Convert, PVOID Destination, PVOID Source)
+{
+  double start = BenchSeconds();
+  for (ULONG r = 0; r < CONVERT_ROUNDS; r++) {
+    Convert(Destination, Source, CONVERT_SAMPLES);
+    BenchKeep(Destination);
+  }
+  return (BenchSeconds() - start) / ((double)CONVERT_ROUNDS * CONVERT_SAMPLES) * 1e9;
+}
+
+static void BenchKernels(LOOPBACK_CONVERT_LEVEL Level)
+{
+  PCLOOPBACK_CONVERTERS converters = GetConverters(Level);
+  std::vector<LONG> pivot(CONVERT_SAMPLES);
+  std::vector<UCHAR> stream(CONVERT_SAMPLES * sizeof(LONG));
+
+  // samples over the whole range, floats inside +-1
+  for (ULONG i = 0; i < CONVERT_SAMPLES; i++) {
+    pivot[i] = (LONG)(i * 0x9E3779B9);
+  }
+  converters->FromPivot[LOOPBACK_SAMPLE_FLOAT32](&stream[0], &pivot[0], CONVERT_SAMPLES);
+
+  for (ULONG type = 0; type < LOOPBACK_SAMPLE_TYPE_COUNT; type++) {
+    double from = BenchKernel(converters->FromPivot[type], &stream[0], &pivot[0]);
+    double to = BenchKernel(converters->ToPivot[type], &pivot[0], &stream[0]);
+    printf("%-6s %-5s: to pivot %5.3f ns/sample, from pivot %5.3f ns/sample\n",
+           LevelNames[Level], TypeNames[type], to, from);
+  }
+}
+
+//=============================================================================
+// ns per frame of a Write of Render and a Read of Capture.
+//=============================================================================
+static void BenchPair(LOOPBACK_CONVERT_LEVEL Level, LOOPBACK_SAMPLE_TYPE Render, LOOPBACK_SAMPLE_TYPE Capture)
+{
+  CLoopbackBuffer ring;
+  ULONG reader;
+  std::vector<UCHAR> source(CONVERT_PERIOD * 2 * LoopbackSampleSize[Render], 0);
+  std::vector<UCHAR> destination(CONVERT_PERIOD * 2 * LoopbackSampleSize[Capture]);
+
+  ring.Allocate(CONVERT_RING_FRAMES, 2, (Render == LOOPBACK_SAMPLE_FLOAT32) ? LOOPBACK_SAMPLE_FLOAT32 : LOOPBACK_SAMPLE_INT32);
+  ring.SetConvertLevel(Level);
+  ring.AttachReader(&reader);
+  ring.StartReader(reader);
+
+  double start = BenchSeconds();
+  for (ULONG p = 0; p < CONVERT_PERIODS; p++) {
+    ring.Write(&source[0], Render, CONVERT_PERIOD);
+    ring.Read(reader, &destination[0], Capture, CONVERT_PERIOD, NULL, NULL);
+    BenchKeep(&destination[0]);
+  }
+  double seconds = BenchSeconds() - start;
+
+  printf("%-6s %-5s -> %-5s: %6.2f ns/frame\n", LevelNames[Level], TypeNames[Render], TypeNames[Capture],
+         seconds / ((double)CONVERT_PERIODS * CONVERT_PERIOD) * 1e9);
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+// ns per frame of the mix kernel of Level from Inputs to Outputs channels.
+//=============================================================================
+static void BenchMix(LOOPBACK_CONVERT_LEVEL Level, ULONG Inputs, ULONG Outputs)
+{
+  PCLOOPBACK_CONVERTERS converters = GetConverters(Level);
+  std::vector<LONG> source(CONVERT_PERIOD * Inputs);
+  std::vector<LONG> destination(CONVERT_PERIOD * Outputs);
+  LONG gains[RTSD_LOOPBACK_MAX_CHANNELS * RTSD_LOOPBACK_MAX_CHANNELS];
+  LOOPBACK_MATRIX matrix;
+
+  for (ULONG i = 0; i < source.size(); i++) {
+    source[i] = (LONG)(i * 0x9E3779B9) >> 2;
+  }
+  for (ULONG n = 0; n < Inputs * Outputs; n++) {
+    gains[n] = RTSD_ROUTING_UNITY / 2 + (LONG)n * 0x100;
+  }
+  InitMatrix(&matrix, Inputs, Outputs, gains, Inputs);
+
+  double start = BenchSeconds();
+  for (ULONG p = 0; p < CONVERT_PERIODS; p++) {
+    converters->Mix(&destination[0], &source[0], CONVERT_PERIOD, &matrix);
+    BenchKeep(&destination[0]);
+  }
+  double seconds = BenchSeconds() - start;
+
+  printf("%-6s mix %u -> %u: %6.2f ns/frame\n", LevelNames[Level], Inputs, Outputs,
+         seconds / ((double)CONVERT_PERIODS * CONVERT_PERIOD) * 1e9);
+}
+
+//=============================================================================
+int main()
+{
+  ULONG best = (ULONG)GetBestConvertLevel();
+
+  for (ULONG level = 0; level <= best; level++) {
+    BenchKernels((LOOPBACK_CONVERT_LEVEL)level);
+  }
+  printf("\n");
+
+  for (ULONG render = 0; render < LOOPBACK_SAMPLE_TYPE_COUNT; render++) {
+    for (ULONG capture = 0; capture < LOOPBACK_SAMPLE_TYPE_COUNT; capture++) {
+      for (ULONG level = 0; level <= best; level++) {
+        BenchPair((LOOPBACK_CONVERT_LEVEL)level, (LOOPBACK_SAMPLE_TYPE)render, (LOOPBACK_SAMPLE_TYPE)capture);
+      }
+    }
+  }
+  printf("\n");
+
+  static const ULONG Mixes[][2] = { { 2, 1 }, { 6, 2 }, { 8, 2 }, { 2, 8 }, { 8, 8 } };
+  for (ULONG m = 0; m < sizeof(Mixes) / sizeof(Mixes[0]); m++) {
+    for (ULONG level = 0; level <= best; level++) {
+      BenchMix((LOOPBACK_CONVERT_LEVEL)level, Mixes[m][0], Mixes[m][1]);
+    }
+  }
+
+  return 0;
+}
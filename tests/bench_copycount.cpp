@@ -0,0 +1,108 @@
+/*
+Module Name:
+  bench_copycount.cpp
+
+Abstract:
+  Copies per sample on the way from a render client to a capture client,
+  and what they cost. The driver's path moves a period twice: CopyTo
+  writes the port's render data into the loopback ring, CopyFrom reads the
+  ring into the port's capture buffer. It is set against the path through
+  per-stream DMA buffers, where the data is also copied into the render
+  stream's DMA buffer before the ring and into the capture stream's after
+  it. Every stage counts the bytes it moves, so the copies per sample are
+  measured rather than assumed.
+*/
+
+#include <string.h>
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define COUNT_RING_FRAMES           16384
+#define COUNT_PERIODS               50000
+#define COUNT_DMA_BUFFER_SIZE       0x16000
+
+//=============================================================================
+// A stage of the path. Counts the bytes it moves.
+//=============================================================================
+static ULONGLONG CopiedBytes;
+
+static void StageCopy(PVOID Destination, PVOID Source, ULONG ByteCount)
+{
+  memcpy(Destination, Source, ByteCount);
+  CopiedBytes += ByteCount;
+}
+
+static void StageWrite(CLoopbackBuffer *Ring, PVOID Source, ULONG Frames, ULONG BlockAlign)
+{
+  Ring->Write(Source, LOOPBACK_SAMPLE_INT16, Frames);
+  CopiedBytes += Frames * BlockAlign;
+}
+
+static void StageRead(CLoopbackBuffer *Ring, ULONG Reader, PVOID Destination, ULONG Frames, ULONG BlockAlign)
+{
+  Ring->Read(Reader, Destination, LOOPBACK_SAMPLE_INT16, Frames, NULL, NULL);
+  CopiedBytes += Frames * BlockAlign;
+}
+
+//=============================================================================
+static void BenchPath(BOOLEAN DmaBuffers, ULONG Channels, ULONG Frames)
+{
+  CLoopbackBuffer ring;
+  ULONG reader;
+  ULONG blockAlign = sizeof(SHORT) * Channels;
+  ULONG bytes = Frames * blockAlign;
+  std::vector<UCHAR> render(bytes, 0x21);
+  std::vector<UCHAR> capture(bytes);
+  std::vector<UCHAR> renderDma(COUNT_DMA_BUFFER_SIZE);
+  std::vector<UCHAR> captureDma(COUNT_DMA_BUFFER_SIZE);
+  ULONG dmaOffset = 0;
+
+  ring.Allocate(COUNT_RING_FRAMES, Channels, LOOPBACK_SAMPLE_INT32);
+  ring.AttachReader(&reader);
+  ring.StartReader(reader);
+  CopiedBytes = 0;
+
+  double start = BenchSeconds();
+  for (ULONG p = 0; p < COUNT_PERIODS; p++) {
+    if (DmaBuffers) {
+      // periods are a whole number of frames and fit the DMA buffers
+      if (dmaOffset + bytes > COUNT_DMA_BUFFER_SIZE) {
+        dmaOffset = 0;
+      }
+      StageCopy(&renderDma[dmaOffset], &render[0], bytes);
+      StageWrite(&ring, &renderDma[dmaOffset], Frames, blockAlign);
+      StageRead(&ring, reader, &captureDma[dmaOffset], Frames, blockAlign);
+      StageCopy(&capture[0], &captureDma[dmaOffset], bytes);
+      dmaOffset += bytes;
+    } else {
+      StageWrite(&ring, &render[0], Frames, blockAlign);
+      StageRead(&ring, reader, &capture[0], Frames, blockAlign);
+    }
+    BenchKeep(&capture[0]);
+  }
+  double seconds = BenchSeconds() - start;
+
+  double samples = (double)COUNT_PERIODS * Frames * Channels;
+  printf("%-12s %u ch %4u frames: %.2f copies/sample, %6.2f ns/frame\n",
+         DmaBuffers ? "DMA buffers" : "driver path", Channels, Frames,
+         (double)CopiedBytes / (samples * sizeof(SHORT)),
+         seconds / ((double)COUNT_PERIODS * Frames) * 1e9);
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+int main()
+{
+  static const ULONG Channels[] = { 2, 8 };
+
+  for (ULONG i = 0; i < sizeof(Channels) / sizeof(Channels[0]); i++) {
+    for (ULONG frames = 480; frames <= 1920; frames *= 4) {
+      BenchPath(TRUE, Channels[i], frames);
+      BenchPath(FALSE, Channels[i], frames);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,106 @@
+/*
+Module Name:
+  bench_dither.cpp
+
+Abstract:
+  Cost of dithering 8 channels at 192 kHz down to 16 bit. Each dither
+  kernel is timed alone at every LOOPBACK_CONVERT_LEVEL the processor
+  supports and as part of a Read into a 16 bit capture stream, against
+  the same Read without dither; the result is also given as the share of
+  one core the stream takes.
+*/
+
+#include <string.h>
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define DITHER_RATE                 192000
+#define DITHER_CHANNELS             8
+#define DITHER_PERIOD               (DITHER_RATE / 100)
+#define DITHER_PERIODS              5000
+
+static const char *LevelNames[LOOPBACK_CONVERT_LEVEL_COUNT] = { "scalar", "sse2", "avx2" };
+static const char *ModeNames[LOOPBACK_DITHER_MODE_COUNT] = { "none", "TPDF", "shaped" };
+
+//=============================================================================
+static void Report(const char *What, LOOPBACK_CONVERT_LEVEL Level, ULONG Mode, double Seconds)
+{
+  double frames = (double)DITHER_PERIODS * DITHER_PERIOD;
+  printf("%-10s %-6s %-6s: %6.2f ns/frame, %6.3f%% of a core at %u kHz\n",
+         What, LevelNames[Level], ModeNames[Mode], Seconds / frames * 1e9,
+         Seconds / frames * DITHER_RATE * 100.0, DITHER_RATE / 1000);
+}
+
+//=============================================================================
+static void BenchKernel(LOOPBACK_CONVERT_LEVEL Level, ULONG Mode)
+{
+  PCLOOPBACK_CONVERTERS converters = GetConverters(Level);
+  LOOPBACK_DITHER dither;
+  std::vector<LONG> source(DITHER_PERIOD * DITHER_CHANNELS);
+  std::vector<LONG> samples(source.size());
+
+  for (size_t i = 0; i < source.size(); i++) {
+    source[i] = (LONG)(i * 0x9E3779B9) >> 1;
+  }
+  InitDither(&dither, Mode, LOOPBACK_SAMPLE_INT16, DITHER_CHANNELS, 1);
+
+  // the copy is what Read does before it dithers, it is timed with it
+  double start = BenchSeconds();
+  for (ULONG p = 0; p < DITHER_PERIODS; p++) {
+    memcpy(&samples[0], &source[0], samples.size() * sizeof(LONG));
+    converters->Dither(&samples[0], DITHER_PERIOD, &dither);
+    BenchKeep(&samples[0]);
+  }
+  Report("kernel", Level, Mode, BenchSeconds() - start);
+}
+
+//=============================================================================
+static void BenchRead(LOOPBACK_CONVERT_LEVEL Level, ULONG Mode)
+{
+  CLoopbackBuffer ring;
+  ULONG reader;
+  LOOPBACK_DITHER dither;
+  std::vector<LONG> source(DITHER_PERIOD * DITHER_CHANNELS);
+  std::vector<SHORT> destination(source.size());
+  BOOLEAN dithered = InitDither(&dither, Mode, LOOPBACK_SAMPLE_INT16, DITHER_CHANNELS, 1);
+
+  for (size_t i = 0; i < source.size(); i++) {
+    source[i] = (LONG)(i * 0x9E3779B9) >> 1;
+  }
+  ring.Allocate(4 * DITHER_PERIOD, DITHER_CHANNELS, LOOPBACK_SAMPLE_INT32);
+  ring.SetConvertLevel(Level);
+  ring.AttachReader(&reader);
+  ring.StartReader(reader);
+
+  double start = BenchSeconds();
+  for (ULONG p = 0; p < DITHER_PERIODS; p++) {
+    ring.Write(&source[0], LOOPBACK_SAMPLE_INT32, DITHER_PERIOD);
+    ring.Read(reader, &destination[0], LOOPBACK_SAMPLE_INT16, DITHER_PERIOD, NULL, dithered ? &dither : NULL);
+    BenchKeep(&destination[0]);
+  }
+  Report("write+read", Level, Mode, BenchSeconds() - start);
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+int main()
+{
+  ULONG best = (ULONG)GetBestConvertLevel();
+
+  for (ULONG level = 0; level <= best; level++) {
+    for (ULONG mode = LOOPBACK_DITHER_TPDF; mode < LOOPBACK_DITHER_MODE_COUNT; mode++) {
+      BenchKernel((LOOPBACK_CONVERT_LEVEL)level, mode);
+    }
+  }
+  printf("\n");
+
+  for (ULONG level = 0; level <= best; level++) {
+    for (ULONG mode = 0; mode < LOOPBACK_DITHER_MODE_COUNT; mode++) {
+      BenchRead((LOOPBACK_CONVERT_LEVEL)level, mode);
+    }
+  }
+
+  return 0;
+}
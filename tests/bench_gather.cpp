@@ -0,0 +1,113 @@
+/*
+Module Name:
+  bench_gather.cpp
+
+Abstract:
+  Capture of a subset of the channels of an 8 channel ring. A reader with
+  a selecting LOOPBACK_MATRIX gathers only its channels out of the ring;
+  it is set against reading the full frames and picking the channels out
+  in user space, as a client would without the subset. Neighbouring
+  channels are read with one load per frame, other selections take the
+  generic gather. Float samples come from a float ring, as they would from
+  a float render stream, and are gathered without a conversion. The times
+  include the ring write.
+*/
+
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define GATHER_RING_CHANNELS        8
+#define GATHER_PERIOD               480
+#define GATHER_RING_FRAMES          16384
+#define GATHER_PERIODS              30000
+
+static const char *TypeNames[LOOPBACK_SAMPLE_TYPE_COUNT] = { "int16", "int24", "int32", "float" };
+
+//=============================================================================
+// Picks Channels channels, First, First + Stride, ..., out of Frames.
+//=============================================================================
+template <typename SAMPLE>
+static void Deinterleave(SAMPLE *Subset, const SAMPLE *Frames, ULONG FrameCount, ULONG First, ULONG Stride, ULONG Channels)
+{
+  for (ULONG k = 0; k < FrameCount; k++, Frames += GATHER_RING_CHANNELS) {
+    for (ULONG c = 0; c < Channels; c++) {
+      *Subset++ = Frames[First + c * Stride];
+    }
+  }
+}
+
+//=============================================================================
+// ns per frame of a write and a read of Channels ring channels, First,
+// First + Stride, ..., gathered by the reader or picked out of full frames.
+//=============================================================================
+static void BenchSubset(LOOPBACK_SAMPLE_TYPE Type, ULONG First, ULONG Stride, ULONG Channels, BOOLEAN Gather)
+{
+  CLoopbackBuffer ring;
+  ULONG reader;
+  LOOPBACK_MATRIX matrix;
+  LONG gains[GATHER_RING_CHANNELS * GATHER_RING_CHANNELS] = { 0 };
+  ULONG sampleSize = LoopbackSampleSize[Type];
+  LOOPBACK_SAMPLE_TYPE ringType = (Type == LOOPBACK_SAMPLE_FLOAT32) ? LOOPBACK_SAMPLE_FLOAT32 : LOOPBACK_SAMPLE_INT32;
+  std::vector<LONG> source(GATHER_PERIOD * GATHER_RING_CHANNELS, 0x3E800000); // 0.25 as a float
+  std::vector<UCHAR> frames(GATHER_PERIOD * GATHER_RING_CHANNELS * sampleSize);
+  std::vector<UCHAR> subset(GATHER_PERIOD * Channels * sampleSize);
+
+  for (ULONG c = 0; c < Channels; c++) {
+    gains[c * GATHER_RING_CHANNELS + First + c * Stride] = RTSD_ROUTING_UNITY;
+  }
+  InitMatrix(&matrix, GATHER_RING_CHANNELS, Channels, gains, GATHER_RING_CHANNELS);
+
+  ring.Allocate(GATHER_RING_FRAMES, GATHER_RING_CHANNELS, ringType);
+  ring.AttachReader(&reader);
+  ring.StartReader(reader);
+
+  double start = BenchSeconds();
+  for (ULONG p = 0; p < GATHER_PERIODS; p++) {
+    ring.Write(&source[0], ringType, GATHER_PERIOD);
+    if (Gather) {
+      ring.Read(reader, &subset[0], Type, GATHER_PERIOD, &matrix, NULL);
+    } else {
+      ring.Read(reader, &frames[0], Type, GATHER_PERIOD, NULL, NULL);
+      if (sampleSize == sizeof(SHORT)) {
+        Deinterleave((PSHORT)&subset[0], (PSHORT)&frames[0], GATHER_PERIOD, First, Stride, Channels);
+      } else {
+        Deinterleave((PLONG)&subset[0], (PLONG)&frames[0], GATHER_PERIOD, First, Stride, Channels);
+      }
+    }
+    BenchKeep(&subset[0]);
+  }
+  double seconds = BenchSeconds() - start;
+
+  printf("%-5s channels %u", TypeNames[Type], First);
+  for (ULONG c = 1; c < Channels; c++) {
+    printf(",%u", First + c * Stride);
+  }
+  printf("%*s %-26s: %5.2f ns/frame\n", (int)(2 * (4 - Channels)), "",
+         Gather ? "gathered by the reader" : "full frames, deinterleaved",
+         seconds / ((double)GATHER_PERIODS * GATHER_PERIOD) * 1e9);
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+int main()
+{
+  // the types a client deinterleaves as whole words
+  static const LOOPBACK_SAMPLE_TYPE Types[] = { LOOPBACK_SAMPLE_INT32, LOOPBACK_SAMPLE_INT16, LOOPBACK_SAMPLE_FLOAT32 };
+
+  for (ULONG t = 0; t < sizeof(Types) / sizeof(Types[0]); t++) {
+    // a front pair, a pair further in, four neighbours, a pair apart
+    BenchSubset(Types[t], 0, 1, 2, FALSE);
+    BenchSubset(Types[t], 0, 1, 2, TRUE);
+    BenchSubset(Types[t], 4, 1, 2, FALSE);
+    BenchSubset(Types[t], 4, 1, 2, TRUE);
+    BenchSubset(Types[t], 0, 1, 4, FALSE);
+    BenchSubset(Types[t], 0, 1, 4, TRUE);
+    BenchSubset(Types[t], 1, 4, 2, FALSE);
+    BenchSubset(Types[t], 1, 4, 2, TRUE);
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+/*
+Module Name:
+  bench_kernels.cpp
+
+Abstract:
+  Kernels specialized at compile time against their generic versions.
+  The resampler's inner loop is instantiated per channel count; each is
+  timed against the instance that reads the channel count at run time,
+  for every quality, and the outputs must match. The sample conversion
+  kernel a stream binds once in SetFormat is timed against a loop that
+  switches on the sample type for every sample.
+*/
+
+#include <string.h>
+#include <vector>
+#include "rtsdsrc.h"
+#include "rtsdconv.h"
+#include "rtsdtest.h"
+
+#define KERNEL_OUTPUT_FRAMES        (256 * 1024)
+#define KERNEL_RUNS                 3
+#define KERNEL_SAMPLES              4096
+#define KERNEL_ROUNDS               20000
+
+static const char *QualityNames[RESAMPLER_QUALITY_COUNT] = { "linear", "16 taps", "64 taps" };
+static const char *TypeNames[LOOPBACK_SAMPLE_TYPE_COUNT] = { "int16", "int24", "int32", "float" };
+
+//=============================================================================
+// ns per output frame of a 48 to 44.1 kHz conversion of noise. Output
+// holds the first frames produced.
+//=============================================================================
+static double BenchResampler(ULONG Quality, ULONG Channels, BOOLEAN Generic, std::vector<LONG> *Output)
+{
+  CResampler resampler;
+  ULONG random = 1;
+  ULONG outFrames = 0;
+  double seconds = 0.0;
+
+  resampler.Init(48000, 44100, Channels, Quality, RESAMPLER_BLOCK_FRAMES);
+  if (Generic) {
+    resampler.SetGenericFilter();
+  }
+  Output->clear();
+
+  while (outFrames < KERNEL_OUTPUT_FRAMES) {
+    ULONG block = resampler.GetBlockFrames();
+    ULONG input = resampler.GetInputFrames(block);
+    PLONG pIn = resampler.GetInputBuffer();
+    for (ULONG i = 0; i < input * Channels; i++) {
+      random = random * 1103515245 + 12345;
+      pIn[i] = (LONG)random >> 2;
+    }
+
+    double start = BenchSeconds();
+    ULONG produced = resampler.Process(input, block);
+    seconds += BenchSeconds() - start;
+
+    if (Output->size() < 65536) {
+      Output->insert(Output->end(), resampler.GetOutputBuffer(), resampler.GetOutputBuffer() + produced * Channels);
+    }
+    outFrames += produced;
+  }
+
+  resampler.Free();
+  return seconds / outFrames * 1e9;
+}
+
+//=============================================================================
+// The conversion from the pivot with the sample type tested per sample.
+//=============================================================================
+static void GenericFromPivot(LOOPBACK_SAMPLE_TYPE Type, PUCHAR Destination, PLONG Source, ULONG SampleCount)
+{
+  for (ULONG i = 0; i < SampleCount; i++) {
+    LONG sample = Source[i];
+    switch (Type) {
+      case LOOPBACK_SAMPLE_INT16:
+        ((PSHORT)Destination)[i] = (SHORT)(sample >> 16);
+        break;
+      case LOOPBACK_SAMPLE_INT24:
+        Destination[i * 3] = (UCHAR)(sample >> 8);
+        Destination[i * 3 + 1] = (UCHAR)(sample >> 16);
+        Destination[i * 3 + 2] = (UCHAR)(sample >> 24);
+        break;
+      case LOOPBACK_SAMPLE_INT32:
+        ((PLONG)Destination)[i] = sample;
+        break;
+      default:
+        ((float *)Destination)[i] = (float)sample * (1.0f / 2147483648.0f);
+        break;
+    }
+  }
+}
+
+static void BenchConvert(LOOPBACK_SAMPLE_TYPE Type)
+{
+  PCLOOPBACK_CONVERTERS scalar = GetConverters(LOOPBACK_CONVERT_SCALAR);
+  PCLOOPBACK_CONVERTERS best = GetConverters(GetBestConvertLevel());
+  std::vector<LONG> pivot(KERNEL_SAMPLES);
+  std::vector<UCHAR> stream(KERNEL_SAMPLES * sizeof(LONG));
+  volatile LOOPBACK_SAMPLE_TYPE type = Type;
+
+  for (ULONG i = 0; i < KERNEL_SAMPLES; i++) {
+    pivot[i] = (LONG)(i * 0x9E3779B9);
+  }
+
+  double start = BenchSeconds();
+  for (ULONG r = 0; r < KERNEL_ROUNDS; r++) {
+    GenericFromPivot(type, &stream[0], &pivot[0], KERNEL_SAMPLES);
+    BenchKeep(&stream[0]);
+  }
+  double generic = BenchSeconds() - start;
+
+  start = BenchSeconds();
+  for (ULONG r = 0; r < KERNEL_ROUNDS; r++) {
+    scalar->FromPivot[Type](&stream[0], &pivot[0], KERNEL_SAMPLES);
+    BenchKeep(&stream[0]);
+  }
+  double bound = BenchSeconds() - start;
+
+  start = BenchSeconds();
+  for (ULONG r = 0; r < KERNEL_ROUNDS; r++) {
+    best->FromPivot[Type](&stream[0], &pivot[0], KERNEL_SAMPLES);
+    BenchKeep(&stream[0]);
+  }
+  double vector = BenchSeconds() - start;
+
+  double samples = (double)KERNEL_ROUNDS * KERNEL_SAMPLES;
+  printf("from pivot %-5s: per-sample switch %5.3f ns/sample, bound scalar %5.3f, bound best level %5.3f\n",
+         TypeNames[Type], generic / samples * 1e9, bound / samples * 1e9, vector / samples * 1e9);
+}
+
+//=============================================================================
+int main()
+{
+  std::vector<LONG> specializedOutput;
+  std::vector<LONG> genericOutput;
+
+  for (ULONG quality = 0; quality < RESAMPLER_QUALITY_COUNT; quality++) {
+    for (ULONG channels = 1; channels <= RESAMPLER_SPECIALIZED_CHANNELS; channels++) {
+      // the best of a few runs, against other load on the machine
+      double specialized = 1e9;
+      double generic = 1e9;
+      for (ULONG run = 0; run < KERNEL_RUNS; run++) {
+        specialized = RTSD_MIN(specialized, BenchResampler(quality, channels, FALSE, &specializedOutput));
+        generic = RTSD_MIN(generic, BenchResampler(quality, channels, TRUE, &genericOutput));
+      }
+      printf("resampler %-7s %u ch: specialized %7.2f ns/frame, generic %7.2f ns/frame, specialized %+5.1f%% frames/s%s\n",
+             QualityNames[quality], channels, specialized, generic, (generic / specialized - 1.0) * 100.0,
+             (specializedOutput == genericOutput) ? "" : ", OUTPUT DIFFERS");
+    }
+    printf("\n");
+  }
+
+  for (ULONG type = 0; type < LOOPBACK_SAMPLE_TYPE_COUNT; type++) {
+    BenchConvert((LOOPBACK_SAMPLE_TYPE)type);
+  }
+
+  return 0;
+}
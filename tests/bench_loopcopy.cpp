@@ -0,0 +1,157 @@
+/*
+Module Name:
+  bench_loopcopy.cpp
+
+Abstract:
+  Bytes per cycle of the copy into and out of the loopback ring at several
+  period sizes. The per-sample loop CopyTo and CopyFrom used to run, with
+  the wrap check and the index update on every sample, is set against the
+  copy in at most two blocks split at the wrap, on the same 16 bit ring,
+  and against CLoopbackBuffer, which copies the same way. The ring size is
+  not a multiple of the period, so the periods straddle the wrap at every
+  offset.
+*/
+
+#include <string.h>
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define COPY_RING_SAMPLES           (16384 + 7)
+#define COPY_BYTES                  (256 * 1024 * 1024)
+
+//=============================================================================
+// The 16 bit ring CopyTo and CopyFrom used to keep, with its cursors.
+//=============================================================================
+struct WordRing {
+  std::vector<WORD> Ring;
+  ULONG WritePos;
+  ULONG ReadPos;
+};
+
+// One WORD per iteration, the wrap checked on every sample.
+static void LoopWrite(WordRing *Ring, PWORD Source, ULONG Count)
+{
+  ULONG size = (ULONG)Ring->Ring.size();
+  ULONG writePos = Ring->WritePos;
+  for (ULONG i = 0; i < Count; i++) {
+    Ring->Ring[writePos] = Source[i];
+    writePos++;
+    if (writePos >= size)
+      writePos = 0;
+  }
+  Ring->WritePos = writePos;
+}
+
+static void LoopRead(WordRing *Ring, PWORD Destination, ULONG Count)
+{
+  ULONG size = (ULONG)Ring->Ring.size();
+  ULONG readPos = Ring->ReadPos;
+  for (ULONG i = 0; i < Count; i++) {
+    Destination[i] = Ring->Ring[readPos];
+    readPos++;
+    if (readPos >= size)
+      readPos = 0;
+  }
+  Ring->ReadPos = readPos;
+}
+
+// At most two blocks, the index arithmetic once per call.
+static void BlockWrite(WordRing *Ring, PWORD Source, ULONG Count)
+{
+  ULONG size = (ULONG)Ring->Ring.size();
+  ULONG first = RTSD_MIN(Count, size - Ring->WritePos);
+  memcpy(&Ring->Ring[Ring->WritePos], Source, first * sizeof(WORD));
+  memcpy(&Ring->Ring[0], Source + first, (Count - first) * sizeof(WORD));
+  Ring->WritePos += Count;
+  if (Ring->WritePos >= size)
+    Ring->WritePos -= size;
+}
+
+static void BlockRead(WordRing *Ring, PWORD Destination, ULONG Count)
+{
+  ULONG size = (ULONG)Ring->Ring.size();
+  ULONG first = RTSD_MIN(Count, size - Ring->ReadPos);
+  memcpy(Destination, &Ring->Ring[Ring->ReadPos], first * sizeof(WORD));
+  memcpy(Destination + first, &Ring->Ring[0], (Count - first) * sizeof(WORD));
+  Ring->ReadPos += Count;
+  if (Ring->ReadPos >= size)
+    Ring->ReadPos -= size;
+}
+
+//=============================================================================
+// Bytes per cycle of a write and a read of Samples 16 bit samples per
+// period, and ns per period.
+//=============================================================================
+typedef void (*PCOPY)(WordRing *Ring, PWORD Data, ULONG Count);
+
+static void BenchWordRing(const char *Name, PCOPY Write, PCOPY Read, ULONG Samples)
+{
+  WordRing ring;
+  std::vector<WORD> source(Samples, 0x1234);
+  std::vector<WORD> destination(Samples);
+  ULONG periods = COPY_BYTES / (Samples * sizeof(WORD));
+
+  ring.Ring.assign(COPY_RING_SAMPLES, 0);
+  ring.WritePos = 0;
+  ring.ReadPos = 0;
+
+  double start = BenchSeconds();
+  ULONGLONG cycles = BenchCycles();
+  for (ULONG p = 0; p < periods; p++) {
+    Write(&ring, &source[0], Samples);
+    BenchKeep(&ring.Ring[0]);
+    Read(&ring, &destination[0], Samples);
+    BenchKeep(&destination[0]);
+  }
+  cycles = BenchCycles() - cycles;
+  double seconds = BenchSeconds() - start;
+
+  double bytes = 2.0 * periods * Samples * sizeof(WORD);
+  printf("%-24s %5u samples: %6.2f bytes/cycle, %8.1f ns/period\n",
+         Name, Samples, cycles ? bytes / (double)cycles : 0.0, seconds / periods * 1e9);
+}
+
+//=============================================================================
+static void BenchLoopback(ULONG Samples)
+{
+  CLoopbackBuffer ring;
+  std::vector<WORD> source(Samples, 0x1234);
+  std::vector<WORD> destination(Samples);
+  ULONG periods = COPY_BYTES / (Samples * sizeof(WORD));
+  ULONG reader;
+
+  ring.Allocate(COPY_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32);
+  ring.AttachReader(&reader);
+  ring.StartReader(reader);
+
+  double start = BenchSeconds();
+  ULONGLONG cycles = BenchCycles();
+  for (ULONG p = 0; p < periods; p++) {
+    ring.Write(&source[0], LOOPBACK_SAMPLE_INT16, Samples);
+    ring.Read(reader, &destination[0], LOOPBACK_SAMPLE_INT16, Samples, NULL, NULL);
+    BenchKeep(&destination[0]);
+  }
+  cycles = BenchCycles() - cycles;
+  double seconds = BenchSeconds() - start;
+
+  double bytes = 2.0 * periods * Samples * sizeof(WORD);
+  printf("%-24s %5u samples: %6.2f bytes/cycle, %8.1f ns/period\n",
+         "CLoopbackBuffer", Samples, cycles ? bytes / (double)cycles : 0.0, seconds / periods * 1e9);
+}
+
+//=============================================================================
+int main()
+{
+  // 1 ms to 50 ms of 48 kHz stereo
+  static const ULONG Periods[] = { 96, 480, 960, 1920, 4800 };
+
+  for (ULONG i = 0; i < sizeof(Periods) / sizeof(Periods[0]); i++) {
+    BenchWordRing("per-sample loop", LoopWrite, LoopRead, Periods[i]);
+    BenchWordRing("two blocks", BlockWrite, BlockRead, Periods[i]);
+    BenchLoopback(Periods[i]);
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -0,0 +1,61 @@
+/*
+Module Name:
+  bench_multichannel.cpp
+
+Abstract:
+  Cost per frame of the loopback path at 1 to 8 channels: a render stream
+  writes 10 ms periods at 48 kHz into the ring and a capture stream of the
+  same format reads them back. The ring and the copies are driven by the
+  block alignment only, so the cost per sample should stay flat as
+  channels are added.
+*/
+
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define MULTI_PERIOD                480
+#define MULTI_RING_FRAMES           16384
+#define MULTI_FRAMES                (64 * 1024 * 1024)
+#define MULTI_MAX_CHANNELS          8
+
+//=============================================================================
+static void BenchChannels(ULONG Channels)
+{
+  CLoopbackBuffer ring;
+  ULONG reader;
+  ULONG blockAlign = sizeof(SHORT) * Channels;
+  std::vector<UCHAR> period(MULTI_PERIOD * blockAlign, 3);
+  ULONG periods = MULTI_FRAMES / MULTI_PERIOD / Channels;
+
+  ring.Allocate(MULTI_RING_FRAMES, Channels, LOOPBACK_SAMPLE_INT32);
+  ring.AttachReader(&reader);
+  ring.StartReader(reader);
+
+  double start = BenchSeconds();
+  ULONGLONG cycles = BenchCycles();
+  for (ULONG p = 0; p < periods; p++) {
+    ring.Write(&period[0], LOOPBACK_SAMPLE_INT16, MULTI_PERIOD);
+    ring.Read(reader, &period[0], LOOPBACK_SAMPLE_INT16, MULTI_PERIOD, NULL, NULL);
+    BenchKeep(&period[0]);
+  }
+  cycles = BenchCycles() - cycles;
+  double seconds = BenchSeconds() - start;
+
+  double frames = (double)periods * MULTI_PERIOD;
+  printf("%u ch (%2u bytes/frame): %6.2f ns/frame, %6.2f cycles/frame, %5.2f cycles/sample\n",
+         Channels, blockAlign, seconds / frames * 1e9,
+         (double)cycles / frames, (double)cycles / frames / Channels);
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+int main()
+{
+  for (ULONG channels = 1; channels <= MULTI_MAX_CHANNELS; channels++) {
+    BenchChannels(channels);
+  }
+
+  return 0;
+}
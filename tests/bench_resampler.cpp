@@ -0,0 +1,116 @@
+/*
+Module Name:
+  bench_resampler.cpp
+
+Abstract:
+  Speed and quality of each CResampler tier. Every tier converts a 1 kHz
+  tone between 48 kHz and 44.1 kHz both ways at 1, 2 and 8 channels, in
+  blocks as the streams run it; the benchmark reports output frames per
+  second, ns per frame and channel and the share of one core a 48 kHz
+  stream takes per channel. The signal to noise ratio is the tone fitted
+  to the output against the rest, after the filter has settled.
+*/
+
+#include <math.h>
+#include <vector>
+#include "rtsdsrc.h"
+#include "rtsdtest.h"
+
+#define SRC_TONE_HZ                 1000.0
+#define SRC_AMPLITUDE               0.5
+#define SRC_OUTPUT_FRAMES           (4 * 1024 * 1024)
+#define SRC_SETTLE_FRAMES           4096
+
+static const char *QualityNames[RESAMPLER_QUALITY_COUNT] = { "linear", "16 taps", "64 taps" };
+
+//=============================================================================
+// SNR in dB of the tone at Frequency in Samples, by a least squares fit of
+// a sine and a cosine at that frequency and an offset.
+//=============================================================================
+static double ToneSnr(const std::vector<double> &Samples, double Frequency)
+{
+  double ss = 0, sc = 0, cc = 0, sy = 0, cy = 0;
+  for (size_t n = 0; n < Samples.size(); n++) {
+    double s = sin(2.0 * M_PI * Frequency * n);
+    double c = cos(2.0 * M_PI * Frequency * n);
+    ss += s * s;
+    sc += s * c;
+    cc += c * c;
+    sy += s * Samples[n];
+    cy += c * Samples[n];
+  }
+  double det = ss * cc - sc * sc;
+  double a = (sy * cc - cy * sc) / det;
+  double b = (cy * ss - sy * sc) / det;
+
+  double signal = 0, noise = 0;
+  for (size_t n = 0; n < Samples.size(); n++) {
+    double fit = a * sin(2.0 * M_PI * Frequency * n) + b * cos(2.0 * M_PI * Frequency * n);
+    signal += fit * fit;
+    noise += (Samples[n] - fit) * (Samples[n] - fit);
+  }
+  return 10.0 * log10(signal / noise);
+}
+
+//=============================================================================
+static void BenchTier(ULONG Quality, ULONG InRate, ULONG OutRate, ULONG Channels)
+{
+  CResampler resampler;
+  std::vector<double> tone;
+  ULONGLONG inFrames = 0;
+  ULONGLONG outFrames = 0;
+  double seconds = 0.0;
+
+  if (!NT_SUCCESS(resampler.Init(InRate, OutRate, Channels, Quality, RESAMPLER_BLOCK_FRAMES))) {
+    printf("%s: Init failed\n", QualityNames[Quality]);
+    return;
+  }
+
+  while (outFrames < SRC_OUTPUT_FRAMES) {
+    ULONG block = resampler.GetBlockFrames();
+    ULONG input = resampler.GetInputFrames(block);
+    PLONG pIn = resampler.GetInputBuffer();
+    for (ULONG k = 0; k < input; k++, inFrames++) {
+      LONG sample = (LONG)(SRC_AMPLITUDE * 2147483647.0 * sin(2.0 * M_PI * SRC_TONE_HZ * inFrames / InRate));
+      for (ULONG c = 0; c < Channels; c++) {
+        pIn[k * Channels + c] = sample;
+      }
+    }
+
+    // only the conversion is timed, not making the tone
+    double start = BenchSeconds();
+    ULONG produced = resampler.Process(input, block);
+    seconds += BenchSeconds() - start;
+
+    PLONG pOut = resampler.GetOutputBuffer();
+    for (ULONG k = 0; k < produced; k++, outFrames++) {
+      if ((outFrames >= SRC_SETTLE_FRAMES) && (tone.size() < OutRate)) {
+        tone.push_back(pOut[k * Channels] / 2147483648.0);
+      }
+    }
+  }
+
+  double frames = (double)outFrames;
+  printf("%-7s %5u -> %5u %u ch: %6.1f Mframes/s, %6.2f ns/frame/ch, %5.3f%% of a core per 48 kHz channel, %5.1f dB SNR\n",
+         QualityNames[Quality], InRate, OutRate, Channels, frames / seconds / 1e6,
+         seconds / frames / Channels * 1e9, 48000.0 * seconds / frames / Channels * 100.0,
+         ToneSnr(tone, SRC_TONE_HZ / OutRate));
+
+  resampler.Free();
+}
+
+//=============================================================================
+int main()
+{
+  static const ULONG Channels[] = { 1, 2, 8 };
+
+  for (ULONG quality = 0; quality < RESAMPLER_QUALITY_COUNT; quality++) {
+    for (ULONG i = 0; i < sizeof(Channels) / sizeof(Channels[0]); i++) {
+      BenchTier(quality, 48000, 44100, Channels[i]);
+      BenchTier(quality, 44100, 48000, Channels[i]);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+/*
+Module Name:
+  rtsdtest.h
+
+Abstract:
+  Helpers shared by the user-mode tests and benchmarks of the loopback
+  engine. A test counts its failed checks with TEST_CHECK and returns
+  TestResult from main; a benchmark times its loops with BenchSeconds and
+  BenchCycles.
+*/
+
+#ifndef __RTSDTEST_H_
+#define __RTSDTEST_H_
+
+#include <stdio.h>
+#include <time.h>
+#include "rtsdplat.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//=============================================================================
+// Checks
+//=============================================================================
+
+// Failed checks so far. Only the first few are reported in detail.
+static ULONG TestFailures = 0;
+
+#define TEST_REPORT_MAX             20
+
+#define TEST_CHECK(Condition)                                                 \
+  do {                                                                        \
+    if (!(Condition)) {                                                       \
+      if (TestFailures++ < TEST_REPORT_MAX) {                                 \
+        printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #Condition); \
+      }                                                                       \
+    }                                                                         \
+  } while (0)
+
+static inline int TestResult(const char *Name)
+{
+  printf("%s: %s, %u failed checks\n", Name, TestFailures ? "FAILED" : "passed", TestFailures);
+  return TestFailures ? 1 : 0;
+}
+
+//=============================================================================
+// Timing
+//=============================================================================
+
+// Monotonic wall time in seconds.
+static inline double BenchSeconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Time stamp counter where there is one, else 0. Counts reference cycles,
+// so results are only comparable on one machine.
+static inline ULONGLONG BenchCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Keeps the compiler from dropping a result nobody reads.
+static inline void BenchKeep(const void *Data)
+{
+  __asm__ __volatile__("" : : "r"(Data) : "memory");
+}
+
+#endif
@@ -0,0 +1,345 @@
+/*
+Module Name:
+  test_convert.cpp
+
+Abstract:
+  Sample format conversion of the loopback engine. The SSE2 and AVX2
+  kernels must give the same bits as the scalar ones, for every sample
+  count (so the scalar tails are covered) and from unaligned buffers, on
+  inputs that include full scale, saturation, denormals, Inf and NaN.
+  16, 24 and 32 bit samples must survive the pivot unchanged, and a float
+  ring must hand float samples to a float reader unchanged, including
+  samples above full scale the pivot would clip. The mix kernels must
+  match the scalar one for every channel count, including gains at the
+  limit on full scale samples, and the default mixes must do what
+  InitMatrix says. Selections of ring channels must match as well, and a
+  float ring must hand selected float samples over unchanged.
+*/
+
+#include <string.h>
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define CONVERT_MAX_SAMPLES         67
+#define CONVERT_RING_FRAMES         256
+#define CONVERT_MIX_FRAMES          19
+
+//=============================================================================
+// Input samples in a stream buffer of any type. Random bits, with the edge
+// cases of every type mixed in.
+//=============================================================================
+static void FillStream(std::vector<UCHAR> *Stream, ULONG *Random)
+{
+  static const ULONG Edges[] = {
+    0x00000000, 0x80000000, 0x7FFFFFFF, 0x3F800000, 0xBF800000,
+    0x3F7FFFFF, 0x40200000, 0x7F800000, 0xFF800000, 0x7FC00000,
+    0x00000001, 0x00800000, 0x30000000, 0xFFFFFFFF, 0x00800001,
+  };
+
+  for (ULONG i = 0; i < Stream->size(); i += sizeof(ULONG)) {
+    *Random = *Random * 1103515245 + 12345;
+    ULONG bits = *Random ^ (*Random << 13);
+    if ((*Random >> 28) < 5) {
+      bits = Edges[(*Random >> 8) % (sizeof(Edges) / sizeof(Edges[0]))];
+    } else if ((*Random >> 28) < 10) {
+      // floats inside +-2
+      bits = (bits & 0x807FFFFF) | ((0x70 + ((*Random >> 4) & 0xF)) << 23);
+    }
+    memcpy(&(*Stream)[i], &bits, RTSD_MIN((size_t)sizeof(ULONG), Stream->size() - i));
+  }
+}
+
+//=============================================================================
+// Every kernel of Level against the scalar one.
+//=============================================================================
+static void KernelRun(LOOPBACK_CONVERT_LEVEL Level)
+{
+  PCLOOPBACK_CONVERTERS scalar = GetConverters(LOOPBACK_CONVERT_SCALAR);
+  PCLOOPBACK_CONVERTERS simd = GetConverters(Level);
+  ULONG random = 0x6C078965 + Level;
+
+  for (ULONG type = 0; type < LOOPBACK_SAMPLE_TYPE_COUNT; type++) {
+    for (ULONG count = 0; count <= CONVERT_MAX_SAMPLES; count++) {
+      for (ULONG skew = 0; skew < 4; skew++) {
+        ULONG bytes = count * LoopbackSampleSize[type];
+        std::vector<UCHAR> stream(bytes + sizeof(ULONG) + skew);
+        std::vector<UCHAR> pivot(count * sizeof(LONG) + sizeof(ULONG) + skew);
+        std::vector<UCHAR> expected(pivot.size() + stream.size());
+        std::vector<UCHAR> actual(expected.size());
+
+        FillStream(&stream, &random);
+        FillStream(&pivot, &random);
+
+        scalar->ToPivot[type](&expected[skew], &stream[skew], count);
+        simd->ToPivot[type](&actual[skew], &stream[skew], count);
+        TEST_CHECK(!memcmp(&expected[skew], &actual[skew], count * sizeof(LONG)));
+
+        scalar->FromPivot[type](&expected[skew], &pivot[skew], count);
+        simd->FromPivot[type](&actual[skew], &pivot[skew], count);
+        TEST_CHECK(!memcmp(&expected[skew], &actual[skew], bytes));
+      }
+    }
+  }
+}
+
+//=============================================================================
+// Integer samples round trip through the pivot.
+//=============================================================================
+static void RoundTripRun(LOOPBACK_CONVERT_LEVEL Level)
+{
+  static const LOOPBACK_SAMPLE_TYPE Types[] = {
+    LOOPBACK_SAMPLE_INT16,
+    LOOPBACK_SAMPLE_INT24,
+    LOOPBACK_SAMPLE_INT32,
+  };
+  PCLOOPBACK_CONVERTERS converters = GetConverters(Level);
+  ULONG random = 0x2545F491;
+
+  for (ULONG t = 0; t < sizeof(Types) / sizeof(Types[0]); t++) {
+    ULONG bytes = CONVERT_MAX_SAMPLES * LoopbackSampleSize[Types[t]];
+    std::vector<UCHAR> stream(bytes);
+    std::vector<LONG> pivot(CONVERT_MAX_SAMPLES);
+    std::vector<UCHAR> back(bytes);
+
+    FillStream(&stream, &random);
+    converters->ToPivot[Types[t]](&pivot[0], &stream[0], CONVERT_MAX_SAMPLES);
+    converters->FromPivot[Types[t]](&back[0], &pivot[0], CONVERT_MAX_SAMPLES);
+    TEST_CHECK(!memcmp(&stream[0], &back[0], bytes));
+  }
+}
+
+//=============================================================================
+// A float ring passes float samples unchanged and clips them for others.
+//=============================================================================
+static void FloatRingRun(void)
+{
+  static const float Samples[] = { 0.25f, -0.5f, 2.5f, -3.0f, 1e-30f, 0.999f };
+  const ULONG count = sizeof(Samples) / sizeof(Samples[0]);
+  CLoopbackBuffer ring;
+  ULONG floatReader, int16Reader;
+  float floats[count];
+  SHORT shorts[count];
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(CONVERT_RING_FRAMES, 1, LOOPBACK_SAMPLE_FLOAT32)));
+  TEST_CHECK(ring.GetSampleType() == LOOPBACK_SAMPLE_FLOAT32);
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&floatReader)));
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&int16Reader)));
+  ring.StartReader(floatReader);
+  ring.StartReader(int16Reader);
+
+  ring.Write((PVOID)Samples, LOOPBACK_SAMPLE_FLOAT32, count);
+  ring.Read(floatReader, floats, LOOPBACK_SAMPLE_FLOAT32, count, NULL, NULL);
+  ring.Read(int16Reader, shorts, LOOPBACK_SAMPLE_INT16, count, NULL, NULL);
+
+  TEST_CHECK(!memcmp(floats, Samples, sizeof(floats)));
+  TEST_CHECK(shorts[0] == 0x2000);
+  TEST_CHECK(shorts[1] == -0x4000);
+  TEST_CHECK(shorts[2] == 0x7FFF);
+  TEST_CHECK(shorts[3] == -0x8000);
+  TEST_CHECK(shorts[4] == 0);
+
+  // the other way round, an int16 writer into a float ring
+  SHORT source[2] = { 0x4000, -0x8000 };
+  ring.Write(source, LOOPBACK_SAMPLE_INT16, 2);
+  ring.Read(floatReader, floats, LOOPBACK_SAMPLE_FLOAT32, 2, NULL, NULL);
+  TEST_CHECK((floats[0] == 0.5f) && (floats[1] == -1.0f));
+
+  // a ring of anything else is refused
+  TEST_CHECK(!NT_SUCCESS(ring.Allocate(CONVERT_RING_FRAMES, 1, LOOPBACK_SAMPLE_INT16)));
+
+  ring.DetachReader(floatReader);
+  ring.DetachReader(int16Reader);
+}
+
+//=============================================================================
+// Every mix kernel of Level against the scalar one.
+//=============================================================================
+static void MixRun(LOOPBACK_CONVERT_LEVEL Level)
+{
+  static const LONG Edges[] = { 0, 1, -1, 0x7FFFFFFF, (LONG)0x80000000, 0x8000, -0x8000 };
+  PCLOOPBACK_CONVERTERS scalar = GetConverters(LOOPBACK_CONVERT_SCALAR);
+  PCLOOPBACK_CONVERTERS simd = GetConverters(Level);
+  ULONG random = 0x41C64E6D + Level;
+  LONG gains[RTSD_LOOPBACK_MAX_CHANNELS * RTSD_LOOPBACK_MAX_CHANNELS];
+  LOOPBACK_MATRIX matrix;
+
+  for (ULONG inputs = 1; inputs <= RTSD_LOOPBACK_MAX_CHANNELS; inputs++) {
+    for (ULONG outputs = 1; outputs <= RTSD_LOOPBACK_MAX_CHANNELS; outputs++) {
+      // gains at the limit on full scale, random gains past the limit,
+      // gains around unity, the default mix
+      for (ULONG pass = 0; pass < 4; pass++) {
+        std::vector<LONG> source(CONVERT_MIX_FRAMES * inputs);
+        std::vector<LONG> expected(CONVERT_MIX_FRAMES * outputs + 1, 0x5A5A5A5A);
+        std::vector<LONG> actual(expected.size(), 0x5A5A5A5A);
+
+        for (ULONG n = 0; n < source.size(); n++) {
+          random = random * 1103515245 + 12345;
+          source[n] = (pass == 0) ? ((random & 0x100) ? 0x7FFFFFFF : (LONG)0x80000000) :
+                      ((random >> 28) < 3) ? Edges[(random >> 8) % (sizeof(Edges) / sizeof(Edges[0]))] :
+                      (LONG)(random ^ (random << 13));
+        }
+        for (ULONG n = 0; n < inputs * outputs; n++) {
+          random = random * 1103515245 + 12345;
+          LONG bits = (LONG)(random ^ (random << 13));
+          gains[n] = (pass == 0) ? ((random & 0x100) ? RTSD_ROUTING_MAX_GAIN : -RTSD_ROUTING_MAX_GAIN) :
+                     (pass == 1) ? bits >> 11 :
+                     RTSD_ROUTING_UNITY + (bits >> 20);
+        }
+
+        InitMatrix(&matrix, inputs, outputs, (pass == 3) ? NULL : gains, inputs);
+        scalar->Mix(&expected[0], &source[0], CONVERT_MIX_FRAMES, &matrix);
+        simd->Mix(&actual[0], &source[0], CONVERT_MIX_FRAMES, &matrix);
+        TEST_CHECK(!memcmp(&expected[0], &actual[0], expected.size() * sizeof(LONG)));
+      }
+    }
+  }
+}
+
+//=============================================================================
+// Selections of ring channels at every level: runs of every length and
+// start, pairs apart, and a run with a silent channel.
+//=============================================================================
+static void SelectRun(LOOPBACK_CONVERT_LEVEL Level)
+{
+  PCLOOPBACK_CONVERTERS scalar = GetConverters(LOOPBACK_CONVERT_SCALAR);
+  PCLOOPBACK_CONVERTERS simd = GetConverters(Level);
+  const ULONG inputs = RTSD_LOOPBACK_MAX_CHANNELS;
+  LONG gains[RTSD_LOOPBACK_MAX_CHANNELS * RTSD_LOOPBACK_MAX_CHANNELS];
+  std::vector<LONG> source(CONVERT_MIX_FRAMES * inputs);
+  LOOPBACK_MATRIX matrix;
+
+  for (ULONG n = 0; n < source.size(); n++) {
+    source[n] = (LONG)(n * 0x9E3779B9);
+  }
+
+  for (ULONG outputs = 1; outputs <= inputs; outputs++) {
+    for (ULONG first = 0; first < inputs; first++) {
+      for (ULONG stride = 1; stride <= 3; stride++) {
+        for (ULONG silent = 0; silent <= 1; silent++) {
+          std::vector<LONG> expected(CONVERT_MIX_FRAMES * outputs + 1, 0x5A5A5A5A);
+          std::vector<LONG> actual(expected.size(), 0x5A5A5A5A);
+
+          RtlZeroMemory(gains, sizeof(gains));
+          for (ULONG o = silent; o < outputs; o++) {
+            gains[o * inputs + (first + o * stride) % inputs] = RTSD_ROUTING_UNITY;
+          }
+          InitMatrix(&matrix, inputs, outputs, gains, inputs);
+          TEST_CHECK(matrix.Select);
+          BOOLEAN run = !silent && ((stride == 1) || (outputs == 1)) && (first + outputs <= inputs);
+          TEST_CHECK((matrix.First == first) == run);
+
+          scalar->Mix(&expected[0], &source[0], CONVERT_MIX_FRAMES, &matrix);
+          simd->Mix(&actual[0], &source[0], CONVERT_MIX_FRAMES, &matrix);
+          TEST_CHECK(!memcmp(&expected[0], &actual[0], expected.size() * sizeof(LONG)));
+          if (!silent) {
+            TEST_CHECK(expected[outputs - 1] == source[(first + (outputs - 1) * stride) % inputs]);
+          } else {
+            TEST_CHECK(expected[0] == 0);
+          }
+        }
+      }
+    }
+  }
+}
+
+//=============================================================================
+// A float ring hands the channels a reader picks over unchanged, above
+// full scale included, and a mix that needs gains clips them.
+//=============================================================================
+static void FloatSelectRun(void)
+{
+  static const float Frames[2][4] = { { 0.25f, 2.5f, -3.0f, 0.125f }, { -0.5f, 1e-30f, 1.5f, 0.0f } };
+  LONG gains[2 * 4] = { 0 };
+  CLoopbackBuffer ring;
+  LOOPBACK_MATRIX matrix;
+  ULONG reader;
+  float floats[2 * 2];
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(CONVERT_RING_FRAMES, 4, LOOPBACK_SAMPLE_FLOAT32)));
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+  ring.StartReader(reader);
+
+  // channels 1 and 2, a run
+  gains[0 * 4 + 1] = RTSD_ROUTING_UNITY;
+  gains[1 * 4 + 2] = RTSD_ROUTING_UNITY;
+  InitMatrix(&matrix, 4, 2, gains, 4);
+  ring.Write((PVOID)Frames, LOOPBACK_SAMPLE_FLOAT32, 2);
+  ring.Read(reader, floats, LOOPBACK_SAMPLE_FLOAT32, 2, &matrix, NULL);
+  TEST_CHECK((floats[0] == 2.5f) && (floats[1] == -3.0f) && (floats[2] == 1e-30f) && (floats[3] == 1.5f));
+
+  // channels 2 and 0, apart and swapped
+  RtlZeroMemory(gains, sizeof(gains));
+  gains[0 * 4 + 2] = RTSD_ROUTING_UNITY;
+  gains[1 * 4 + 0] = RTSD_ROUTING_UNITY;
+  InitMatrix(&matrix, 4, 2, gains, 4);
+  ring.Write((PVOID)Frames, LOOPBACK_SAMPLE_FLOAT32, 2);
+  ring.Read(reader, floats, LOOPBACK_SAMPLE_FLOAT32, 2, &matrix, NULL);
+  TEST_CHECK((floats[0] == -3.0f) && (floats[1] == 0.25f) && (floats[2] == 1.5f) && (floats[3] == -0.5f));
+
+  // half of channel 1 and channel 0, through the pivot
+  RtlZeroMemory(gains, sizeof(gains));
+  gains[0 * 4 + 1] = RTSD_ROUTING_UNITY / 2;
+  gains[1 * 4 + 0] = RTSD_ROUTING_UNITY;
+  InitMatrix(&matrix, 4, 2, gains, 4);
+  TEST_CHECK(!matrix.Select);
+  ring.Write((PVOID)Frames, LOOPBACK_SAMPLE_FLOAT32, 2);
+  ring.Read(reader, floats, LOOPBACK_SAMPLE_FLOAT32, 2, &matrix, NULL);
+  TEST_CHECK((floats[0] == 0.5f) && (floats[1] == 0.25f) && (floats[2] == 0.0f) && (floats[3] == -0.5f));
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+// The default mixes, and a mix that changes nothing.
+//=============================================================================
+static void DefaultMixRun(void)
+{
+  PCLOOPBACK_CONVERTERS converters = GetConverters(LOOPBACK_CONVERT_SCALAR);
+  LONG stereo[2] = { 0x40000000, -0x20000000 };
+  LONG mono = 0x12345678;
+  LONG out[RTSD_LOOPBACK_MAX_CHANNELS];
+  LOOPBACK_MATRIX matrix;
+
+  // stereo averaged to mono
+  TEST_CHECK(InitMatrix(&matrix, 2, 1, NULL, 0));
+  TEST_CHECK(!matrix.Select);
+  converters->Mix(out, stereo, 1, &matrix);
+  TEST_CHECK(out[0] == 0x10000000);
+
+  // mono copied to every channel
+  TEST_CHECK(InitMatrix(&matrix, 1, 4, NULL, 0));
+  TEST_CHECK(matrix.Select);
+  converters->Mix(out, &mono, 1, &matrix);
+  TEST_CHECK((out[0] == mono) && (out[1] == mono) && (out[2] == mono) && (out[3] == mono));
+
+  // stereo into 4 channels, the rest silent
+  TEST_CHECK(InitMatrix(&matrix, 2, 4, NULL, 0));
+  TEST_CHECK(matrix.Select);
+  converters->Mix(out, stereo, 1, &matrix);
+  TEST_CHECK((out[0] == stereo[0]) && (out[1] == stereo[1]) && !out[2] && !out[3]);
+
+  // same channels, unity gains
+  for (ULONG channels = 1; channels <= RTSD_LOOPBACK_MAX_CHANNELS; channels++) {
+    TEST_CHECK(!InitMatrix(&matrix, channels, channels, NULL, 0));
+  }
+}
+
+//=============================================================================
+int main()
+{
+  ULONG best = (ULONG)GetBestConvertLevel();
+
+  for (ULONG level = 0; level <= best; level++) {
+    KernelRun((LOOPBACK_CONVERT_LEVEL)level);
+    RoundTripRun((LOOPBACK_CONVERT_LEVEL)level);
+    MixRun((LOOPBACK_CONVERT_LEVEL)level);
+    SelectRun((LOOPBACK_CONVERT_LEVEL)level);
+  }
+  FloatRingRun();
+  FloatSelectRun();
+  DefaultMixRun();
+
+  printf("levels up to %u checked\n", best);
+  return TestResult("test_convert");
+}
@@ -0,0 +1,271 @@
+/*
+Module Name:
+  test_cyclic.cpp
+
+Abstract:
+  CCyclicBuffer against a mocked port. The mock plays the audio engine: it
+  moves the stream through its states, reads the position at random times,
+  writes (render) or reads (capture) the buffer behind it, and the
+  scheduler calls Service with timer jitter and now and then more than a
+  buffer late. The transfer routine stands in for the loopback ring. The
+  test checks that the position follows the state machine to the frame,
+  that every frame is transferred once, in order and whole around the
+  wrap, that late services skip and count what the engine is past, and
+  that every notification is signaled exactly when a brute-force walk of
+  the buffer says it is reached.
+*/
+
+#include <vector>
+#include "rtsdcycl.h"
+#include "rtsdtest.h"
+
+#define CYCLIC_BLOCK_ALIGN          6
+#define CYCLIC_RATE                 48000
+#define CYCLIC_SERVICE              100000      // 10 ms in 100 ns units
+#define CYCLIC_SERVICES             20000
+
+//=============================================================================
+static ULONG NextRandom(ULONG *State)
+{
+  ULONG x = *State;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *State = x;
+}
+
+//=============================================================================
+// The mocked port.
+//=============================================================================
+struct CyclicPort {
+  BOOLEAN Capture;
+  std::vector<UCHAR> Buffer;
+  ULONG Frames;
+  ULONGLONG Transferred;                        // frames the transfer routine moved
+  ULONGLONG Expected;                           // frame it expects next
+  ULONG Signaled[CYCLIC_MAX_NOTIFICATIONS];
+};
+
+// Frame n of the stream, as the engine (render) or the ring (capture)
+// produces it.
+static void StoreFrame(PUCHAR Frame, ULONGLONG Number)
+{
+  for (ULONG i = 0; i < CYCLIC_BLOCK_ALIGN; i++) {
+    Frame[i] = (UCHAR)(Number >> (8 * (i % 4))) ^ (UCHAR)i;
+  }
+}
+
+static BOOLEAN CheckFrame(PUCHAR Frame, ULONGLONG Number)
+{
+  UCHAR expected[CYCLIC_BLOCK_ALIGN];
+  StoreFrame(expected, Number);
+  return !memcmp(Frame, expected, CYCLIC_BLOCK_ALIGN);
+}
+
+static void CyclicTransfer(PVOID Context, PUCHAR Data, ULONG FrameCount)
+{
+  CyclicPort *port = (CyclicPort *)Context;
+  ULONG offset = (ULONG)(Data - &port->Buffer[0]) / CYCLIC_BLOCK_ALIGN;
+
+  // one piece never crosses the end of the buffer
+  TEST_CHECK((ULONG)(Data - &port->Buffer[0]) % CYCLIC_BLOCK_ALIGN == 0);
+  TEST_CHECK(FrameCount && (offset + FrameCount <= port->Frames));
+
+  for (ULONG k = 0; k < FrameCount; k++) {
+    PUCHAR frame = Data + k * CYCLIC_BLOCK_ALIGN;
+    if (port->Capture) {
+      StoreFrame(frame, port->Expected + k);
+    } else {
+      TEST_CHECK(CheckFrame(frame, port->Expected + k));
+    }
+  }
+  port->Transferred += FrameCount;
+  port->Expected += FrameCount;
+}
+
+static void CyclicNotify(PVOID Context, PVOID Notification)
+{
+  // a notification is the counter of its signals
+  (void)Context;
+  (*(PULONG)Notification)++;
+}
+
+//=============================================================================
+// Whether the position reaches the notification at Offset moving from From
+// to To, walking the buffer frame by frame.
+//=============================================================================
+static BOOLEAN Reached(ULONG Offset, ULONG Frames, ULONGLONG From, ULONGLONG To)
+{
+  ULONG frame = ((Offset + CYCLIC_BLOCK_ALIGN - 1) / CYCLIC_BLOCK_ALIGN) % Frames;
+  for (ULONGLONG p = From + 1; p <= To; p++) {
+    if (p % Frames == frame) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+//=============================================================================
+static void CyclicRun(BOOLEAN Capture, ULONG Frames)
+{
+  CCyclicBuffer cyclic;
+  CyclicPort port;
+  volatile ULONG positionRegister = 0x55555555;
+  ULONG random = 0x3C6EF372 ^ Frames ^ (Capture ? 0x100 : 0);
+  ULONG offsets[CYCLIC_MAX_NOTIFICATIONS];
+  ULONG expected[CYCLIC_MAX_NOTIFICATIONS] = { 0 };
+  ULONG notifications = 0;
+  ULONGLONG now = 1000;
+  ULONGLONG clockFrames = 0;                    // the clock when it last stopped running
+  ULONGLONG runTime = 0;
+  ULONGLONG lost = 0;                           // frames left out by late services
+  ULONGLONG engineFrames = 0;                   // render: frames the engine has written
+  ULONG skipped = 0;
+
+  port.Capture = Capture;
+  port.Buffer.assign(Frames * CYCLIC_BLOCK_ALIGN + 5, 0);
+  port.Frames = Frames;
+  port.Transferred = 0;
+  port.Expected = 0;
+  RtlZeroMemory(port.Signaled, sizeof(port.Signaled));
+
+  cyclic.Init(CyclicTransfer, CyclicNotify, &port, Capture);
+  cyclic.SetFormat(CYCLIC_BLOCK_ALIGN, CYCLIC_RATE);
+  // a partial frame at the end is not used
+  TEST_CHECK(cyclic.SetBuffer(&port.Buffer[0], (ULONG)port.Buffer.size()) == Frames * CYCLIC_BLOCK_ALIGN);
+  cyclic.SetRegister(&positionRegister);
+  TEST_CHECK(positionRegister == 0);
+
+  // notifications anywhere in the buffer, inside frames and past its end too
+  while (notifications < CYCLIC_MAX_NOTIFICATIONS) {
+    offsets[notifications] = NextRandom(&random) % (Frames * CYCLIC_BLOCK_ALIGN + CYCLIC_BLOCK_ALIGN);
+    TEST_CHECK(NT_SUCCESS(cyclic.AddNotification(&port.Signaled[notifications], offsets[notifications])));
+    notifications++;
+  }
+  TEST_CHECK(cyclic.AddNotification(&skipped, 0) == STATUS_INSUFFICIENT_RESOURCES);
+
+  // the engine's walk: acquire, pause, run, and now and then pause and run again
+  cyclic.SetState(CYCLIC_STATE_ACQUIRE, now);
+  cyclic.SetState(CYCLIC_STATE_PAUSE, now);
+  TEST_CHECK(cyclic.GetPosition(now + CYCLIC_SERVICE) == 0);
+  cyclic.SetState(CYCLIC_STATE_RUN, now);
+  runTime = now;
+
+  for (ULONG s = 0; s < CYCLIC_SERVICES; s++) {
+    ULONG r = NextRandom(&random);
+    ULONGLONG late = (r % 4096 == 0) ? (ULONGLONG)Frames * _100NS_UNITS_PER_SECOND / CYCLIC_RATE + CYCLIC_SERVICE * (r % 5) : r % 20000;
+    ULONGLONG due = now + CYCLIC_SERVICE + late;
+
+    // the engine polls the position in between and keeps a render buffer
+    // filled up to the clock
+    for (ULONGLONG t = now; t < due; t += 1 + NextRandom(&random) % (CYCLIC_SERVICE / 2)) {
+      ULONGLONG clock = clockFrames + RtsdElapsedFrames(t - runTime, CYCLIC_RATE);
+      ULONGLONG position = cyclic.GetPosition(t);
+      if (Capture) {
+        TEST_CHECK(position == port.Transferred + lost);
+        TEST_CHECK(position <= clock);
+      } else {
+        TEST_CHECK(position == clock);
+      }
+      TEST_CHECK(cyclic.GetOffset(t) == (ULONG)(position % Frames) * CYCLIC_BLOCK_ALIGN);
+    }
+    if (!Capture) {
+      ULONGLONG clock = clockFrames + RtsdElapsedFrames(due - runTime, CYCLIC_RATE);
+      engineFrames = RTSD_MAX(engineFrames, clock - RTSD_MIN(clock, (ULONGLONG)Frames));
+      for (; engineFrames < clock; engineFrames++) {
+        StoreFrame(&port.Buffer[(engineFrames % Frames) * CYCLIC_BLOCK_ALIGN], engineFrames);
+      }
+    }
+
+    now = due;
+    ULONGLONG before = port.Transferred + lost;
+    ULONGLONG target = clockFrames + RtsdElapsedFrames(now - runTime, CYCLIC_RATE);
+    if (target - before > Frames) {
+      skipped += (ULONG)(target - before - Frames);
+      lost += target - before - Frames;
+      port.Expected += target - before - Frames;
+    }
+    for (ULONG i = 0; i < notifications; i++) {
+      expected[i] += Reached(offsets[i], Frames, before, target) ? 1 : 0;
+    }
+
+    cyclic.Service(now);
+
+    TEST_CHECK(port.Transferred + lost == target);
+    TEST_CHECK(positionRegister == (ULONG)(target % Frames) * CYCLIC_BLOCK_ALIGN);
+    TEST_CHECK(cyclic.GetSkipped() == skipped);
+    for (ULONG i = 0; i < notifications; i++) {
+      TEST_CHECK(port.Signaled[i] == expected[i]);
+    }
+
+    if (Capture) {
+      // what the ring wrote is in the buffer behind the position
+      ULONGLONG position = cyclic.GetPosition(now);
+      ULONGLONG back = RTSD_MIN(position, (ULONGLONG)RTSD_MIN(Frames, 16));
+      for (ULONGLONG p = position - back; p < position; p++) {
+        TEST_CHECK(CheckFrame(&port.Buffer[(p % Frames) * CYCLIC_BLOCK_ALIGN], p));
+      }
+    }
+
+    switch (r >> 28) {
+      case 0:
+        // pause holds the clock, a service while paused does nothing
+        cyclic.SetState(CYCLIC_STATE_PAUSE, now);
+        clockFrames = target;
+        TEST_CHECK(cyclic.GetState() == CYCLIC_STATE_PAUSE);
+        now += CYCLIC_SERVICE * 3;
+        cyclic.Service(now);
+        TEST_CHECK(port.Transferred + lost == target);
+        TEST_CHECK(cyclic.GetPosition(now) == target);
+        cyclic.SetState(CYCLIC_STATE_RUN, now);
+        runTime = now;
+        break;
+
+      case 1:
+        // a notification goes away and comes back at another offset
+        if (s & 1) {
+          ULONG i = (r >> 8) % notifications;
+          PVOID notification = &port.Signaled[i];
+          TEST_CHECK(cyclic.RemoveNotification(notification));
+          TEST_CHECK(!cyclic.RemoveNotification(notification));
+          offsets[i] = NextRandom(&random) % (Frames * CYCLIC_BLOCK_ALIGN);
+          TEST_CHECK(NT_SUCCESS(cyclic.AddNotification(notification, offsets[i])));
+        }
+        break;
+    }
+  }
+
+  // stop sets the position and the register back to the start
+  cyclic.SetState(CYCLIC_STATE_PAUSE, now);
+  cyclic.SetState(CYCLIC_STATE_STOP, now);
+  TEST_CHECK(cyclic.GetPosition(now + CYCLIC_SERVICE) == 0);
+  TEST_CHECK(cyclic.GetOffset(now + CYCLIC_SERVICE) == 0);
+  TEST_CHECK(positionRegister == 0);
+  cyclic.Service(now + CYCLIC_SERVICE);
+  TEST_CHECK(positionRegister == 0);
+
+  ULONG signaled = 0;
+  for (ULONG i = 0; i < notifications; i++) {
+    signaled += port.Signaled[i];
+  }
+  printf("%s %4u frames: %llu frames transferred, %u skipped, %u notifications signaled\n",
+         Capture ? "capture" : "render ", Frames, (unsigned long long)port.Transferred, skipped, signaled);
+
+  TEST_CHECK(skipped > 0);
+  TEST_CHECK(signaled > 0);
+}
+
+//=============================================================================
+int main()
+{
+  // buffers of little more than a service period (480 frames), of about
+  // two and of ten
+  static const ULONG Sizes[] = { 601, 1000, 4801 };
+
+  for (ULONG i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); i++) {
+    CyclicRun(FALSE, Sizes[i]);
+    CyclicRun(TRUE, Sizes[i]);
+  }
+
+  return TestResult("test_cyclic");
+}
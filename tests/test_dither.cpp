@@ -0,0 +1,225 @@
+/*
+Module Name:
+  test_dither.cpp
+
+Abstract:
+  Spectral test of the dither of 16 bit capture streams. The pivot samples
+  of a loud tone are dithered and the error against them is analysed in
+  frequency: TPDF noise must have zero mean, a power of 0.25 LSB^2 (1/6
+  of the noise and 1/12 of the rounding) and a flat spectrum; the shaped
+  noise must be pushed towards fs/2 by the first order shaper. A tone at
+  -100 dBFS, a third of an LSB, must come out at its amplitude and
+  without harmonics, which truncation would give it. Every kernel level
+  the processor supports must give the same samples as the scalar one.
+*/
+
+#include <math.h>
+#include <vector>
+#include <complex>
+#include "rtsdconv.h"
+#include "rtsdtest.h"
+
+#define DITHER_RATE                 48000
+#define DITHER_CHANNELS             2
+#define DITHER_SEGMENT              1024
+#define DITHER_SEGMENTS             256
+#define DITHER_FRAMES               (DITHER_SEGMENT * DITHER_SEGMENTS)
+#define DITHER_BLOCK                480
+#define DITHER_LSB                  65536.0
+
+//=============================================================================
+// In place radix 2 FFT of DITHER_SEGMENT points.
+//=============================================================================
+static void Fft(std::vector<std::complex<double> > &Data)
+{
+  size_t n = Data.size();
+
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      std::swap(Data[i], Data[j]);
+    }
+  }
+  for (size_t length = 2; length <= n; length <<= 1) {
+    std::complex<double> step = std::polar(1.0, -2.0 * M_PI / (double)length);
+    for (size_t i = 0; i < n; i += length) {
+      std::complex<double> w = 1.0;
+      for (size_t k = 0; k < length / 2; k++, w *= step) {
+        std::complex<double> odd = Data[i + k + length / 2] * w;
+        Data[i + k + length / 2] = Data[i + k] - odd;
+        Data[i + k] += odd;
+      }
+    }
+  }
+}
+
+//=============================================================================
+// Average power spectrum of Error, Hann windowed, DITHER_SEGMENT / 2 bins.
+//=============================================================================
+static std::vector<double> Spectrum(const std::vector<double> &Error)
+{
+  std::vector<double> power(DITHER_SEGMENT / 2, 0.0);
+  std::vector<std::complex<double> > segment(DITHER_SEGMENT);
+
+  for (size_t s = 0; s + DITHER_SEGMENT <= Error.size(); s += DITHER_SEGMENT) {
+    for (size_t i = 0; i < DITHER_SEGMENT; i++) {
+      double window = 0.5 - 0.5 * cos(2.0 * M_PI * i / DITHER_SEGMENT);
+      segment[i] = Error[s + i] * window;
+    }
+    Fft(segment);
+    for (size_t i = 0; i < DITHER_SEGMENT / 2; i++) {
+      power[i] += std::norm(segment[i]);
+    }
+  }
+  return power;
+}
+
+// Mean of Power over the bins from From to To, as fractions of fs/2.
+static double BandPower(const std::vector<double> &Power, double From, double To)
+{
+  size_t first = RTSD_MAX((size_t)(From * Power.size()), (size_t)1);
+  size_t last = (size_t)(To * Power.size());
+  double sum = 0.0;
+  for (size_t i = first; i < last; i++) {
+    sum += Power[i];
+  }
+  return sum / (double)(last - first);
+}
+
+//=============================================================================
+// Amplitude of the tone at Frequency (cycles per sample) in Samples, by a
+// least squares fit of a sine and a cosine.
+//=============================================================================
+static double ToneAmplitude(const std::vector<double> &Samples, double Frequency)
+{
+  double ss = 0, sc = 0, cc = 0, sy = 0, cy = 0;
+  for (size_t n = 0; n < Samples.size(); n++) {
+    double s = sin(2.0 * M_PI * Frequency * n);
+    double c = cos(2.0 * M_PI * Frequency * n);
+    ss += s * s;
+    sc += s * c;
+    cc += c * c;
+    sy += s * Samples[n];
+    cy += c * Samples[n];
+  }
+  double det = ss * cc - sc * sc;
+  double a = (sy * cc - cy * sc) / det;
+  double b = (cy * ss - sy * sc) / det;
+  return sqrt(a * a + b * b);
+}
+
+//=============================================================================
+// Dithers Tone (pivot samples, DITHER_CHANNELS interleaved) in blocks as
+// Read does, at Level. Returns the dithered samples.
+//=============================================================================
+static std::vector<LONG> DitherTone(const std::vector<LONG> &Tone, ULONG Mode, LOOPBACK_CONVERT_LEVEL Level)
+{
+  PCLOOPBACK_CONVERTERS converters = GetConverters(Level);
+  LOOPBACK_DITHER dither;
+  std::vector<LONG> samples(Tone);
+
+  TEST_CHECK(InitDither(&dither, Mode, LOOPBACK_SAMPLE_INT16, DITHER_CHANNELS, 1234));
+  for (ULONG frame = 0; frame < DITHER_FRAMES; frame += DITHER_BLOCK) {
+    ULONG count = RTSD_MIN((ULONG)DITHER_BLOCK, (ULONG)DITHER_FRAMES - frame);
+    converters->Dither(&samples[frame * DITHER_CHANNELS], count, &dither);
+  }
+  return samples;
+}
+
+//=============================================================================
+static std::vector<LONG> MakeTone(double Amplitude, double Frequency)
+{
+  std::vector<LONG> tone(DITHER_FRAMES * DITHER_CHANNELS);
+  for (ULONG n = 0; n < DITHER_FRAMES; n++) {
+    for (ULONG c = 0; c < DITHER_CHANNELS; c++) {
+      tone[n * DITHER_CHANNELS + c] = (LONG)(Amplitude * 2147483647.0 * sin(2.0 * M_PI * Frequency / DITHER_RATE * n + c));
+    }
+  }
+  return tone;
+}
+
+//=============================================================================
+static void DitherNoise(ULONG Mode)
+{
+  std::vector<LONG> tone = MakeTone(0.25, 997.0);
+  std::vector<LONG> dithered = DitherTone(tone, Mode, LOOPBACK_CONVERT_SCALAR);
+
+  for (ULONG c = 0; c < DITHER_CHANNELS; c++) {
+    std::vector<double> error(DITHER_FRAMES);
+    double mean = 0.0;
+    double power = 0.0;
+    for (ULONG n = 0; n < DITHER_FRAMES; n++) {
+      TEST_CHECK(!(dithered[n * DITHER_CHANNELS + c] & 0xFFFF));
+      error[n] = ((double)dithered[n * DITHER_CHANNELS + c] - (double)tone[n * DITHER_CHANNELS + c]) / DITHER_LSB;
+      mean += error[n];
+      power += error[n] * error[n];
+    }
+    mean /= DITHER_FRAMES;
+    power /= DITHER_FRAMES;
+
+    std::vector<double> spectrum = Spectrum(error);
+    double low = BandPower(spectrum, 0.0, 0.25);
+    double high = BandPower(spectrum, 0.75, 1.0);
+    double tilt = 10.0 * log10(high / low);
+
+    printf("%s channel %u: error mean %+.4f LSB, power %.3f LSB^2, %+.1f dB from below fs/8 to above 3/8 fs\n",
+           (Mode == LOOPBACK_DITHER_TPDF) ? "TPDF  " : "shaped", c, mean, power, tilt);
+
+    TEST_CHECK(fabs(mean) < 0.01);
+    if (Mode == LOOPBACK_DITHER_TPDF) {
+      TEST_CHECK(fabs(power - 0.25) < 0.01);
+      TEST_CHECK(fabs(tilt) < 0.5);
+    } else {
+      // 1 - z^-1 gives about 12.8 dB between the two bands
+      TEST_CHECK(tilt > 10.0);
+    }
+  }
+}
+
+//=============================================================================
+static void DitherQuietTone(void)
+{
+  double amplitude = pow(10.0, -100.0 / 20.0);
+  double frequency = 1000.0 / DITHER_RATE;
+  std::vector<LONG> tone = MakeTone(amplitude, 1000.0);
+  std::vector<LONG> dithered = DitherTone(tone, LOOPBACK_DITHER_TPDF, LOOPBACK_CONVERT_SCALAR);
+  std::vector<double> output(DITHER_FRAMES);
+  std::vector<double> truncated(DITHER_FRAMES);
+
+  for (ULONG n = 0; n < DITHER_FRAMES; n++) {
+    output[n] = dithered[n * DITHER_CHANNELS] / DITHER_LSB;
+    truncated[n] = (tone[n * DITHER_CHANNELS] >> 16);
+  }
+
+  double expected = amplitude * 32768.0;
+  double fundamental = ToneAmplitude(output, frequency);
+  double third = ToneAmplitude(output, 3 * frequency);
+  printf("-100 dBFS tone: %.3f LSB in, %.3f LSB out, 3rd harmonic %.4f LSB; truncated %.3f LSB, 3rd harmonic %.4f LSB\n",
+         expected, fundamental, third, ToneAmplitude(truncated, frequency), ToneAmplitude(truncated, 3 * frequency));
+
+  TEST_CHECK(fabs(fundamental / expected - 1.0) < 0.05);
+  TEST_CHECK(third < 0.05 * expected);
+}
+
+//=============================================================================
+int main()
+{
+  DitherNoise(LOOPBACK_DITHER_TPDF);
+  DitherNoise(LOOPBACK_DITHER_SHAPED);
+  DitherQuietTone();
+
+  // the vector kernels give the scalar kernel's samples
+  std::vector<LONG> tone = MakeTone(0.25, 997.0);
+  for (ULONG mode = LOOPBACK_DITHER_TPDF; mode < LOOPBACK_DITHER_MODE_COUNT; mode++) {
+    std::vector<LONG> scalar = DitherTone(tone, mode, LOOPBACK_CONVERT_SCALAR);
+    for (ULONG level = 1; level <= (ULONG)GetBestConvertLevel(); level++) {
+      TEST_CHECK(DitherTone(tone, mode, (LOOPBACK_CONVERT_LEVEL)level) == scalar);
+    }
+  }
+
+  return TestResult("test_dither");
+}
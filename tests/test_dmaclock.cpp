@@ -0,0 +1,78 @@
+/*
+Module Name:
+  test_dmaclock.cpp
+
+Abstract:
+  Position math of CDmaClock on the interrupt time. A stream polls its
+  position at random intervals, from 100 ns to 20 ms, for hours of stream
+  time, at the common rates and from start times far into the clock. Every
+  poll must return exactly the frames elapsed since the start, computed in
+  128 bit, so neither rounding nor the polling pattern can make the
+  position drift. Pass the number of hours as the first argument to run
+  longer or shorter.
+*/
+
+#include <stdlib.h>
+#include "rtsdclk.h"
+#include "rtsdtest.h"
+
+#define CLOCK_MAX_POLL              200000      // 20 ms in 100 ns units
+
+//=============================================================================
+static ULONG NextRandom(ULONG *State)
+{
+  ULONG x = *State;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *State = x;
+}
+
+//=============================================================================
+static void ClockRun(double Hours, ULONG Rate, ULONGLONG Start)
+{
+  CDmaClock clock;
+  ULONG random = 0x6A09E667 ^ Rate;
+  ULONGLONG end = Start + (ULONGLONG)(Hours * 3600.0 * _100NS_UNITS_PER_SECOND);
+  ULONGLONG polls = 0;
+  ULONGLONG frames = 0;
+
+  clock.Start(Start, Rate);
+  TEST_CHECK(clock.GetFrames(Start, DMA_CLOCK_FREE_RUN) == 0);
+
+  for (ULONGLONG now = Start; now < end; polls++) {
+    // mostly short polls, now and then a burst of back to back ones
+    ULONG step = NextRandom(&random);
+    now += (step & 0x80000000) ? (step & 0xFF) : 1 + step % CLOCK_MAX_POLL;
+
+    ULONGLONG expected = (ULONGLONG)((unsigned __int128)(now - Start) * Rate / _100NS_UNITS_PER_SECOND);
+    ULONGLONG position = clock.GetFrames(now, DMA_CLOCK_FREE_RUN);
+    TEST_CHECK(position == expected);
+    TEST_CHECK(position >= frames);
+    frames = position;
+  }
+
+  printf("%6u Hz from %llu: %llu polls, %llu frames\n", Rate, (unsigned long long)Start,
+         (unsigned long long)polls, (unsigned long long)frames);
+}
+
+//=============================================================================
+int main(int argc, char **argv)
+{
+  static const ULONG Rates[] = { 8000, 11025, 44100, 48000, 96000, 192000 };
+  static const ULONGLONG Starts[] = {
+    0,
+    _100NS_UNITS_PER_SECOND - 1,
+    // 400 days of uptime
+    400ULL * 86400 * _100NS_UNITS_PER_SECOND + 12345,
+  };
+  double hours = (argc > 1) ? atof(argv[1]) : 4.0;
+
+  for (ULONG rate = 0; rate < sizeof(Rates) / sizeof(Rates[0]); rate++) {
+    for (ULONG start = 0; start < sizeof(Starts) / sizeof(Starts[0]); start++) {
+      ClockRun((start == 1) ? hours : hours / 8, Rates[rate], Starts[start]);
+    }
+  }
+
+  return TestResult("test_dmaclock");
+}
@@ -0,0 +1,178 @@
+/*
+Module Name:
+  test_driftsim.cpp
+
+Abstract:
+  Long-run simulation of drift compensation on RTSD_VIRTUAL_CLOCK. A
+  48 kHz render side writes 10 ms periods into the loopback ring on a
+  clock that is off by a fixed number of ppm, a 44.1 kHz capture side
+  reads through CResampler with the ratio CDriftController trims, both
+  with timer jitter. After the loop has settled the ring must hold its
+  target without a single underrun or overrun for 24 virtual hours.
+  Pass the number of hours as the first argument to run longer or
+  shorter.
+  Drift control is off by default: a capture stream at the rate of the
+  ring then gets no resampler, and float samples reach it unchanged.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdsrc.h"
+#include "rtsdtest.h"
+
+ULONGLONG RtsdVirtualTime;
+
+#define DRIFT_RING_RATE             48000
+#define DRIFT_STREAM_RATE           44100
+#define DRIFT_PERIOD_S              0.010
+#define DRIFT_JITTER_S              0.001
+#define DRIFT_SETTLE_S              1800.0
+#define DRIFT_TEST_TARGET_MS        20
+
+// Largest distance from the target the fill level may stray once settled.
+#define DRIFT_BOUND_FRAMES          (DRIFT_RING_RATE / 100)
+
+//=============================================================================
+// Timer jitter, uniform in +-DRIFT_JITTER_S.
+//=============================================================================
+static double Jitter(ULONG *State)
+{
+  *State = *State * 1103515245 + 12345;
+  return DRIFT_JITTER_S * ((double)(*State >> 8) / (double)(1 << 23) * 2.0 - 1.0);
+}
+
+//=============================================================================
+static void DriftRun(double Hours, double Ppm)
+{
+  CLoopbackBuffer ring;
+  CResampler resampler;
+  CDriftController controller;
+  ULONG reader;
+  ULONG random = 1;
+  ULONG writeFrames = DRIFT_RING_RATE / 100;
+  ULONG readFrames = DRIFT_STREAM_RATE / 100;
+  LONG target = DRIFT_RING_RATE * DRIFT_TEST_TARGET_MS / 1000;
+  std::vector<SHORT> period(writeFrames);
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(DRIFT_RING_RATE * 300 / 1000, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+  ring.StartReader(reader);
+  TEST_CHECK(NT_SUCCESS(resampler.Init(DRIFT_RING_RATE, DRIFT_STREAM_RATE, 1, RESAMPLER_QUALITY_LINEAR, RESAMPLER_BLOCK_FRAMES)));
+  controller.Init(DRIFT_RING_RATE, DRIFT_STREAM_RATE, target);
+
+  // the render clock runs Ppm fast
+  double writePeriod = DRIFT_PERIOD_S / (1.0 + Ppm * 1e-6);
+  double writeTime = 0.0;
+  double readTime = 0.003;
+  double end = Hours * 3600.0;
+  ULONGLONG writes = 0;
+  ULONGLONG reads = 0;
+  LONG fillMin = INT32_MAX;
+  LONG fillMax = -INT32_MAX;
+  LONG adjustMin = INT32_MAX;
+  LONG adjustMax = -INT32_MAX;
+  BOOLEAN settled = FALSE;
+  ULONG settledUnderruns = 0;
+  ULONG settledOverruns = 0;
+  RTSD_LOOPBACK_STATISTICS statistics;
+
+  while (readTime < end) {
+    if (writeTime <= readTime) {
+      RtsdVirtualTime = (ULONGLONG)(writeTime * 1e7);
+      ring.Write(&period[0], LOOPBACK_SAMPLE_INT16, writeFrames);
+      writes++;
+      writeTime = writes * writePeriod + Jitter(&random);
+      continue;
+    }
+
+    RtsdVirtualTime = (ULONGLONG)(readTime * 1e7);
+    LONG fill = ring.GetFillLevel(reader, DRIFT_RING_RATE);
+    LONG adjust = controller.Update(fill, ring.TakeStretchPending(reader), readFrames);
+    resampler.SetRatioAdjust(adjust);
+
+    if (readTime >= DRIFT_SETTLE_S) {
+      if (!settled) {
+        ring.GetStatistics(&statistics);
+        settledUnderruns = statistics.Readers[reader].UnderrunSilenceHead;
+        settledOverruns = statistics.Readers[reader].Overrun;
+        settled = TRUE;
+      }
+      fillMin = RTSD_MIN(fillMin, fill);
+      fillMax = RTSD_MAX(fillMax, fill);
+      adjustMin = RTSD_MIN(adjustMin, adjust);
+      adjustMax = RTSD_MAX(adjustMax, adjust);
+    }
+
+    for (ULONG left = readFrames; left; ) {
+      ULONG block = RTSD_MIN(left, resampler.GetBlockFrames());
+      ULONG input = resampler.GetInputFrames(block);
+      if (input) {
+        ring.Read(reader, resampler.GetInputBuffer(), LOOPBACK_SAMPLE_INT32, input, NULL, NULL);
+      }
+      resampler.Process(input, block);
+      left -= block;
+    }
+
+    reads++;
+    readTime = 0.003 + reads * DRIFT_PERIOD_S + Jitter(&random);
+  }
+
+  ring.GetStatistics(&statistics);
+  ULONG underruns = statistics.Readers[reader].UnderrunSilenceHead - settledUnderruns;
+  ULONG overruns = statistics.Readers[reader].Overrun - settledOverruns;
+
+  printf("%+.0f ppm, %.1f h: fill %d..%d (target %d), adjust %d..%d ppb, %u underruns, %u overruns once settled\n",
+         Ppm, Hours, fillMin, fillMax, target, adjustMin, adjustMax, underruns, overruns);
+
+  TEST_CHECK(settled);
+  TEST_CHECK(!underruns);
+  TEST_CHECK(!overruns);
+  TEST_CHECK(fillMin >= target - DRIFT_BOUND_FRAMES);
+  TEST_CHECK(fillMax <= target + DRIFT_BOUND_FRAMES);
+  // the controller settles on the drift, well inside its range
+  TEST_CHECK(labs(adjustMin - (LONG)(Ppm * 1000.0)) < DRIFT_MAX_ADJUST_PPB / 10);
+  TEST_CHECK(labs(adjustMax - (LONG)(Ppm * 1000.0)) < DRIFT_MAX_ADJUST_PPB / 10);
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+// With the default settings a float capture stream at the ring rate reads
+// the ring directly and gets the render stream's bits back.
+//=============================================================================
+static void DefaultPassThroughRun(void)
+{
+  static const float Samples[] = { 0.25f, -0.5f, 1.5f, -2.0f, 1e-30f, 0.999f, 3.0e-39f, -1.0f };
+  const ULONG count = sizeof(Samples) / sizeof(Samples[0]) / 2;
+  CLoopbackBuffer ring;
+  ULONG reader;
+  float out[2 * count];
+
+  TEST_CHECK(!ResamplerNeeded(TRUE, DRIFT_RING_RATE, DRIFT_RING_RATE, DRIFT_TARGET_MS));
+  TEST_CHECK(!ResamplerNeeded(FALSE, DRIFT_RING_RATE, DRIFT_RING_RATE, DRIFT_TARGET_MS));
+  TEST_CHECK(ResamplerNeeded(TRUE, DRIFT_RING_RATE, DRIFT_RING_RATE, DRIFT_TEST_TARGET_MS));
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(DRIFT_RING_RATE / 100, 2, LOOPBACK_SAMPLE_FLOAT32)));
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+  ring.StartReader(reader);
+
+  ring.Write((PVOID)Samples, LOOPBACK_SAMPLE_FLOAT32, count);
+  ring.Read(reader, out, LOOPBACK_SAMPLE_FLOAT32, count, NULL, NULL);
+  TEST_CHECK(!memcmp(out, Samples, sizeof(out)));
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+int main(int argc, char **argv)
+{
+  double hours = (argc > 1) ? atof(argv[1]) : 24.0;
+
+  DefaultPassThroughRun();
+  DriftRun(hours, 150.0);
+  DriftRun(hours, -150.0);
+
+  return TestResult("test_driftsim");
+}
@@ -0,0 +1,201 @@
+/*
+Module Name:
+  test_loopalign.cpp
+
+Abstract:
+  Channel alignment of CLoopbackBuffer under forced overruns and
+  underruns. A writer outruns a slower reader, with periods and reads of
+  odd sizes, for 1 to 8 channels, every overrun policy and the underrun
+  modes that hand out whole frames unchanged. Every sample carries its
+  channel and frame, so a drop or fill that is not a whole number of
+  frames shows up as a sample in the wrong channel or a frame whose
+  samples do not belong together. The fade is checked to apply one
+  gain to all channels of a frame, and the same gain to every sample
+  layout.
+*/
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define ALIGN_RING_FRAMES           64
+#define ALIGN_PERIODS               2000
+#define ALIGN_MAX_PERIOD            (3 * ALIGN_RING_FRAMES)
+#define ALIGN_MAX_CHANNELS          8
+
+//=============================================================================
+// Sample of channel c of frame n: the channel in the top bits, the frame
+// below it, never 0.
+//=============================================================================
+static SHORT AlignValue(ULONG Frame, ULONG Channel)
+{
+  return (SHORT)(((Channel + 1) << 11) | (Frame & 0x3FF));
+}
+
+//=============================================================================
+static void AlignRun(ULONG Channels, ULONG Policy, ULONG Mode)
+{
+  CLoopbackBuffer ring;
+  ULONG reader;
+  std::vector<SHORT> period(ALIGN_MAX_PERIOD * Channels);
+  ULONG random = 0x2545F491 + Channels;
+  ULONG frame = 0;
+  ULONG checked = 0;
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(ALIGN_RING_FRAMES, Channels, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.SetOverrunPolicy(Policy)));
+  TEST_CHECK(NT_SUCCESS(ring.SetUnderrunMode(Mode)));
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+  ring.StartReader(reader);
+
+  for (ULONG p = 0; p < ALIGN_PERIODS; p++) {
+    random = random * 1103515245 + 12345;
+    ULONG writeCount = 1 + (random >> 8) % ALIGN_MAX_PERIOD;
+    random = random * 1103515245 + 12345;
+    // reads are three quarters of the writes on average: overruns, and
+    // now and then an underrun
+    ULONG readCount = 1 + (random >> 8) % (ALIGN_MAX_PERIOD * 3 / 4);
+
+    for (ULONG k = 0; k < writeCount; k++) {
+      for (ULONG c = 0; c < Channels; c++) {
+        period[k * Channels + c] = AlignValue(frame + k, c);
+      }
+    }
+    ring.Write(&period[0], LOOPBACK_SAMPLE_INT16, writeCount);
+    frame += writeCount;
+
+    ring.Read(reader, &period[0], LOOPBACK_SAMPLE_INT16, readCount, NULL, NULL);
+
+    for (ULONG k = 0; k < readCount; k++) {
+      SHORT first = period[k * Channels];
+      if (!first) {
+        for (ULONG c = 1; c < Channels; c++) {
+          TEST_CHECK(!period[k * Channels + c]);
+        }
+        continue;
+      }
+      ULONG frameBits = (ULONG)first & 0x3FF;
+      for (ULONG c = 0; c < Channels; c++) {
+        TEST_CHECK(period[k * Channels + c] == AlignValue(frameBits, c));
+      }
+      checked++;
+    }
+  }
+
+  RTSD_LOOPBACK_STATISTICS statistics;
+  ring.GetStatistics(&statistics);
+  TEST_CHECK(statistics.OverrunDropOldest + statistics.OverrunDropNewest + statistics.OverrunStretch > 0);
+  TEST_CHECK(checked > 0);
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+// The fade scales all channels of a frame by the same gain.
+//=============================================================================
+static void FadeRun(ULONG Channels)
+{
+  const ULONG have = 10;
+  const ULONG want = have + LOOPBACK_FADE_FRAMES + 5;
+  CLoopbackBuffer ring;
+  ULONG reader;
+  std::vector<SHORT> data(have * Channels);
+  std::vector<SHORT> out(want * Channels);
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(ALIGN_RING_FRAMES, Channels, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.SetUnderrunMode(RTSD_UNDERRUN_FADE)));
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+  ring.StartReader(reader);
+
+  // every channel holds its own constant, negative on odd channels
+  for (ULONG k = 0; k < have; k++) {
+    for (ULONG c = 0; c < Channels; c++) {
+      data[k * Channels + c] = (SHORT)((c & 1) ? -1000 * (LONG)(c + 1) : 1000 * (LONG)(c + 1));
+    }
+  }
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, have);
+  ring.Read(reader, &out[0], LOOPBACK_SAMPLE_INT16, want, NULL, NULL);
+
+  for (ULONG k = 0; k < want - have; k++) {
+    for (ULONG c = 0; c < Channels; c++) {
+      LONG value = data[c];
+      LONG expected = (k < LOOPBACK_FADE_FRAMES) ? value * (LONG)(LOOPBACK_FADE_FRAMES - k) / (LONG)LOOPBACK_FADE_FRAMES : 0;
+      TEST_CHECK(out[(have + k) * Channels + c] == (SHORT)expected);
+    }
+  }
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+// The fade of packed 24 bit, 32 bit and float samples follows the same
+// gain as 16 bit samples.
+//=============================================================================
+static void FadeTypeRun(LOOPBACK_SAMPLE_TYPE Type, ULONG SampleSize)
+{
+  const ULONG have = 10;
+  const ULONG want = have + LOOPBACK_FADE_FRAMES + 5;
+  const LONG value = -3000000;
+  CLoopbackBuffer ring;
+  ULONG reader;
+  std::vector<UCHAR> data(have * SampleSize);
+  std::vector<UCHAR> out(want * SampleSize);
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(ALIGN_RING_FRAMES, 1, (Type == LOOPBACK_SAMPLE_FLOAT32) ? LOOPBACK_SAMPLE_FLOAT32 : LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.SetUnderrunMode(RTSD_UNDERRUN_FADE)));
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+  ring.StartReader(reader);
+
+  float valueFloat = (float)value;
+  for (ULONG k = 0; k < have; k++) {
+    memcpy(&data[k * SampleSize], (Type == LOOPBACK_SAMPLE_FLOAT32) ? (void *)&valueFloat : (void *)&value, SampleSize);
+  }
+  ring.Write(&data[0], Type, have);
+  ring.Read(reader, &out[0], Type, want, NULL, NULL);
+
+  for (ULONG k = 0; k < want - have; k++) {
+    LONG expected = (k < LOOPBACK_FADE_FRAMES) ? (LONG)((LONGLONG)value * (LONG)(LOOPBACK_FADE_FRAMES - k) / (LONG)LOOPBACK_FADE_FRAMES) : 0;
+    PUCHAR pSample = &out[(have + k) * SampleSize];
+
+    if (Type == LOOPBACK_SAMPLE_FLOAT32) {
+      float sample;
+      memcpy(&sample, pSample, sizeof(sample));
+      TEST_CHECK(fabs(sample - (double)expected) <= 1.0);
+    } else if (Type == LOOPBACK_SAMPLE_INT24) {
+      LONG sample = (LONG)(((ULONG)pSample[0] << 8) | ((ULONG)pSample[1] << 16) | ((ULONG)pSample[2] << 24)) >> 8;
+      TEST_CHECK(sample == expected);
+    } else {
+      LONG sample;
+      memcpy(&sample, pSample, sizeof(sample));
+      TEST_CHECK(sample == expected);
+    }
+  }
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+int main()
+{
+  static const ULONG Modes[] = {
+    RTSD_UNDERRUN_SILENCE_HEAD,
+    RTSD_UNDERRUN_SILENCE_TAIL,
+    RTSD_UNDERRUN_REPEAT,
+  };
+
+  for (ULONG channels = 1; channels <= ALIGN_MAX_CHANNELS; channels++) {
+    for (ULONG policy = 0; policy < RTSD_OVERRUN_POLICY_COUNT; policy++) {
+      for (ULONG mode = 0; mode < sizeof(Modes) / sizeof(Modes[0]); mode++) {
+        AlignRun(channels, policy, Modes[mode]);
+      }
+    }
+    FadeRun(channels);
+  }
+  FadeTypeRun(LOOPBACK_SAMPLE_INT24, 3);
+  FadeTypeRun(LOOPBACK_SAMPLE_INT32, sizeof(LONG));
+  FadeTypeRun(LOOPBACK_SAMPLE_FLOAT32, sizeof(float));
+
+  return TestResult("test_loopalign");
+}
@@ -0,0 +1,537 @@
+/*
+Module Name:
+  test_loopstress.cpp
+
+Abstract:
+  Multithreaded stress test of CLoopbackBuffer: a writer thread and
+  several reader threads hammer a small ring with periods of random size.
+  Every sample carries its number, so a reader can tell samples out of
+  order, lost samples and samples from nowhere apart from the silence an
+  underrun hands out. First the writer stays inside the room the slowest
+  reader left, so every sample it writes must arrive at every reader; then
+  it runs free under every overrun policy, so samples may be lost but must
+  still arrive in order.
+*/
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define STRESS_RING_SAMPLES         1024
+#define STRESS_WRITES               200000
+#define STRESS_MAX_PERIOD           300
+#define STRESS_READERS              3
+
+//=============================================================================
+// Small xorshift, one per thread.
+//=============================================================================
+static ULONG NextRandom(ULONG *State)
+{
+  ULONG x = *State;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *State = x;
+}
+
+//=============================================================================
+// Sample n. 0 is left for silence.
+//=============================================================================
+static WORD Sample(ULONG Number)
+{
+  return (WORD)(1 + Number % 0xFFFF);
+}
+
+//=============================================================================
+// Attaches a reader and starts it, as a capture stream that runs.
+//=============================================================================
+static ULONG RunReader(CLoopbackBuffer *Ring)
+{
+  ULONG reader = (ULONG)-1;
+
+  TEST_CHECK(NT_SUCCESS(Ring->AttachReader(&reader)));
+  Ring->StartReader(reader);
+  return reader;
+}
+
+//=============================================================================
+// With RTSD_OVERRUN_DROP_NEWEST Write keeps what fits once the ring is full
+// and never moves the reader.
+//=============================================================================
+static void TestFull(void)
+{
+  CLoopbackBuffer ring;
+  std::vector<WORD> data(STRESS_RING_SAMPLES + 10);
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(STRESS_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.SetOverrunPolicy(RTSD_OVERRUN_DROP_NEWEST)));
+  ULONG reader = RunReader(&ring);
+  for (ULONG i = 0; i < data.size(); i++) {
+    data[i] = Sample(i);
+  }
+
+  // the whole ring is usable
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES + 10);
+  std::vector<WORD> out(STRESS_RING_SAMPLES);
+  ring.Read(reader, &out[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES, NULL, NULL);
+  for (ULONG i = 0; i < out.size(); i++) {
+    TEST_CHECK(out[i] == Sample(i));
+  }
+
+  // empty again: the next read is all silence
+  ring.Read(reader, &out[0], LOOPBACK_SAMPLE_INT16, 4, NULL, NULL);
+  for (ULONG i = 0; i < 4; i++) {
+    TEST_CHECK(!out[i]);
+  }
+}
+
+//=============================================================================
+// What each policy keeps of a write that does not fit.
+//=============================================================================
+static void TestPolicies(void)
+{
+  std::vector<WORD> data(2 * STRESS_RING_SAMPLES + 10);
+  std::vector<WORD> out(STRESS_RING_SAMPLES);
+  RTSD_LOOPBACK_STATISTICS statistics;
+
+  for (ULONG i = 0; i < data.size(); i++) {
+    data[i] = Sample(i);
+  }
+
+  for (ULONG policy = 0; policy < RTSD_OVERRUN_POLICY_COUNT; policy++) {
+    CLoopbackBuffer ring;
+
+    TEST_CHECK(NT_SUCCESS(ring.Allocate(STRESS_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32)));
+    TEST_CHECK(NT_SUCCESS(ring.SetOverrunPolicy(policy)));
+    ULONG reader = RunReader(&ring);
+
+    // a period longer than two rings
+    ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, (ULONG)data.size());
+    ring.Read(reader, &out[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES, NULL, NULL);
+
+    // drop oldest keeps the tail, the others the head
+    ULONG first = (policy == RTSD_OVERRUN_DROP_OLDEST) ? (ULONG)data.size() - STRESS_RING_SAMPLES : 0;
+    for (ULONG i = 0; i < out.size(); i++) {
+      TEST_CHECK(out[i] == Sample(first + i));
+    }
+
+    ring.GetStatistics(&statistics);
+    TEST_CHECK(statistics.OverrunDropOldest == (policy == RTSD_OVERRUN_DROP_OLDEST));
+    TEST_CHECK(statistics.OverrunDropNewest == (policy == RTSD_OVERRUN_DROP_NEWEST));
+    TEST_CHECK(statistics.OverrunStretch == (policy == RTSD_OVERRUN_STRETCH));
+
+    // reallocating resets the counters
+    TEST_CHECK(NT_SUCCESS(ring.Allocate(STRESS_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32)));
+    ring.GetStatistics(&statistics);
+    TEST_CHECK(!statistics.OverrunDropOldest && !statistics.OverrunDropNewest && !statistics.OverrunStretch);
+  }
+
+  CLoopbackBuffer ring;
+  TEST_CHECK(ring.SetOverrunPolicy(RTSD_OVERRUN_POLICY_COUNT) == STATUS_INVALID_PARAMETER);
+  TEST_CHECK(ring.GetOverrunPolicy() == RTSD_OVERRUN_DROP_OLDEST);
+}
+
+//=============================================================================
+// With RTSD_OVERRUN_STRETCH each reader is asked to catch up on the frames
+// that had no room behind it, and only on those.
+//=============================================================================
+static void TestStretch(void)
+{
+  CLoopbackBuffer ring;
+  std::vector<WORD> data(2 * STRESS_RING_SAMPLES);
+  std::vector<WORD> out(STRESS_RING_SAMPLES);
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(STRESS_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.SetOverrunPolicy(RTSD_OVERRUN_STRETCH)));
+  ULONG slow = RunReader(&ring);
+  ULONG fast = RunReader(&ring);
+
+  // a full ring keeps nothing out
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES);
+  ring.Read(fast, &out[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES, NULL, NULL);
+  TEST_CHECK(ring.TakeStretchPending(slow) == 0);
+  TEST_CHECK(ring.TakeStretchPending(fast) == 0);
+
+  // the slow reader holds the writer back, the fast one has room
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, 300);
+  TEST_CHECK(ring.TakeStretchPending(slow) == 300);
+  TEST_CHECK(ring.TakeStretchPending(slow) == 0);
+  TEST_CHECK(ring.TakeStretchPending(fast) == 0);
+
+  // 500 frames of room, then a period of which 100 frames do not fit
+  ring.Read(slow, &out[0], LOOPBACK_SAMPLE_INT16, 500, NULL, NULL);
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, 200);
+  TEST_CHECK(ring.TakeStretchPending(slow) == 0);
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, 400);
+  TEST_CHECK(ring.TakeStretchPending(slow) == 100);
+  TEST_CHECK(ring.TakeStretchPending(fast) == 0);
+
+  // what was kept out before a Read moved the cursor still counts
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, 100);
+  ring.Read(slow, &out[0], LOOPBACK_SAMPLE_INT16, 100, NULL, NULL);
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, 50);
+  TEST_CHECK(ring.TakeStretchPending(slow) == 100);
+  TEST_CHECK(ring.TakeStretchPending(fast) == 0);
+
+  // a period too long for every reader, at most a ring is asked for
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, (ULONG)data.size());
+  TEST_CHECK(ring.TakeStretchPending(slow) == STRESS_RING_SAMPLES);
+  TEST_CHECK(ring.TakeStretchPending(fast) == STRESS_RING_SAMPLES);
+
+  // a reader that starts again does not inherit what was kept out before
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, 100);
+  ring.StopReader(slow);
+  ring.StartReader(slow);
+  TEST_CHECK(ring.TakeStretchPending(slow) == 0);
+
+  ring.DetachReader(fast);
+  ring.DetachReader(slow);
+}
+
+//=============================================================================
+// How each underrun mode fills a period the ring only holds part of.
+//=============================================================================
+static void TestUnderrun(void)
+{
+  const ULONG have = 40;
+  const ULONG want = 100 + LOOPBACK_FADE_FRAMES;
+  std::vector<WORD> data(have);
+  std::vector<WORD> out(want);
+  RTSD_LOOPBACK_STATISTICS statistics;
+
+  for (ULONG i = 0; i < have; i++) {
+    data[i] = (WORD)(1000 + i);
+  }
+
+  for (ULONG mode = 0; mode < RTSD_UNDERRUN_MODE_COUNT; mode++) {
+    CLoopbackBuffer ring;
+
+    TEST_CHECK(NT_SUCCESS(ring.Allocate(STRESS_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32)));
+    TEST_CHECK(NT_SUCCESS(ring.SetUnderrunMode(mode)));
+    ULONG reader = RunReader(&ring);
+    ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, have);
+    ring.Read(reader, &out[0], LOOPBACK_SAMPLE_INT16, want, NULL, NULL);
+
+    // no valid sample is hidden by the gap
+    ULONG first = (mode == RTSD_UNDERRUN_SILENCE_HEAD) ? want - have : 0;
+    for (ULONG i = 0; i < have; i++) {
+      TEST_CHECK(out[first + i] == data[i]);
+    }
+
+    for (ULONG i = 0; i < want - have; i++) {
+      WORD gap = out[(mode == RTSD_UNDERRUN_SILENCE_HEAD) ? i : have + i];
+      WORD repeat = data[i % have];
+
+      switch (mode) {
+        case RTSD_UNDERRUN_REPEAT:
+          TEST_CHECK(gap == repeat);
+          break;
+
+        case RTSD_UNDERRUN_FADE:
+          // fades out, then stays silent
+          if (i < LOOPBACK_FADE_FRAMES) {
+            TEST_CHECK(gap == (WORD)((repeat * (LOOPBACK_FADE_FRAMES - i)) / LOOPBACK_FADE_FRAMES));
+          } else {
+            TEST_CHECK(gap == 0);
+          }
+          break;
+
+        default:
+          TEST_CHECK(gap == 0);
+          break;
+      }
+    }
+
+    ring.GetStatistics(&statistics);
+    PRTSD_LOOPBACK_READER_STATISTICS pCounters = &statistics.Readers[reader];
+    TEST_CHECK(pCounters->Active);
+    TEST_CHECK(pCounters->UnderrunSilenceHead == (mode == RTSD_UNDERRUN_SILENCE_HEAD));
+    TEST_CHECK(pCounters->UnderrunSilenceTail == (mode == RTSD_UNDERRUN_SILENCE_TAIL));
+    TEST_CHECK(pCounters->UnderrunRepeat == (mode == RTSD_UNDERRUN_REPEAT));
+    TEST_CHECK(pCounters->UnderrunFade == (mode == RTSD_UNDERRUN_FADE));
+
+    // a gap longer than the ring, with a whole ring of history behind the
+    // read cursor, repeats at most that ring
+    std::vector<WORD> lots(3 * STRESS_RING_SAMPLES);
+    ring.Write(&lots[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES);
+    ring.Read(reader, &lots[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES, NULL, NULL);
+    ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, have);
+    ring.Read(reader, &lots[0], LOOPBACK_SAMPLE_INT16, (ULONG)lots.size(), NULL, NULL);
+    first = (mode == RTSD_UNDERRUN_SILENCE_HEAD) ? (ULONG)lots.size() - have : 0;
+    for (ULONG i = 0; i < have; i++) {
+      TEST_CHECK(lots[first + i] == data[i]);
+    }
+  }
+
+  CLoopbackBuffer ring;
+  TEST_CHECK(ring.SetUnderrunMode(RTSD_UNDERRUN_MODE_COUNT) == STATUS_INVALID_PARAMETER);
+  TEST_CHECK(ring.GetUnderrunMode() == RTSD_UNDERRUN_SILENCE_HEAD);
+}
+
+//=============================================================================
+// Every running reader sees every sample, and only the running readers hold
+// the writer back.
+//=============================================================================
+static void TestReaders(void)
+{
+  CLoopbackBuffer ring;
+  ULONG readers[RTSD_LOOPBACK_MAX_READERS];
+  ULONG extra;
+  std::vector<WORD> data(STRESS_RING_SAMPLES);
+  std::vector<WORD> out(STRESS_RING_SAMPLES);
+  RTSD_LOOPBACK_STATISTICS statistics;
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(STRESS_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.SetOverrunPolicy(RTSD_OVERRUN_DROP_NEWEST)));
+  for (ULONG i = 0; i < data.size(); i++) {
+    data[i] = Sample(i);
+  }
+
+  // there are only so many slots, a detached one can be had again
+  for (ULONG i = 0; i < RTSD_LOOPBACK_MAX_READERS; i++) {
+    TEST_CHECK(NT_SUCCESS(ring.AttachReader(&readers[i])));
+  }
+  TEST_CHECK(ring.AttachReader(&extra) == STATUS_INSUFFICIENT_RESOURCES);
+  ring.DetachReader(readers[RTSD_LOOPBACK_MAX_READERS - 1]);
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&extra)));
+  TEST_CHECK(extra == readers[RTSD_LOOPBACK_MAX_READERS - 1]);
+
+  // reader 0 and 1 run, the others are open but idle
+  ring.StartReader(readers[0]);
+  ring.StartReader(readers[1]);
+
+  // both running readers get the same samples
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES / 2);
+  for (ULONG r = 0; r < 2; r++) {
+    ring.Read(readers[r], &out[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES / 2, NULL, NULL);
+    for (ULONG i = 0; i < STRESS_RING_SAMPLES / 2; i++) {
+      TEST_CHECK(out[i] == Sample(i));
+    }
+  }
+
+  // reader 1 stalls: the writer can only fill the ring up to it, however
+  // far reader 0 gets
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES);
+  ring.Read(readers[0], &out[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES, NULL, NULL);
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES);
+  ring.GetStatistics(&statistics);
+  TEST_CHECK(statistics.OverrunDropNewest == 1);
+
+  // once reader 1 stops, it no longer holds the writer back
+  ring.StopReader(readers[1]);
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES);
+  ring.GetStatistics(&statistics);
+  TEST_CHECK(statistics.OverrunDropNewest == 1);
+
+  // a restarted reader starts with what is written from then on
+  ring.Read(readers[0], &out[0], LOOPBACK_SAMPLE_INT16, STRESS_RING_SAMPLES, NULL, NULL);
+  ring.StartReader(readers[1]);
+  ring.Write(&data[0], LOOPBACK_SAMPLE_INT16, 10);
+  ring.Read(readers[1], &out[0], LOOPBACK_SAMPLE_INT16, 10, NULL, NULL);
+  for (ULONG i = 0; i < 10; i++) {
+    TEST_CHECK(out[i] == Sample(i));
+  }
+
+  ring.GetStatistics(&statistics);
+  for (ULONG i = 0; i < RTSD_LOOPBACK_MAX_READERS; i++) {
+    TEST_CHECK(statistics.Readers[i].Active);
+  }
+  ring.DetachReader(readers[2]);
+  ring.GetStatistics(&statistics);
+  TEST_CHECK(!statistics.Readers[readers[2]].Active);
+}
+
+//=============================================================================
+static void TestThreads(void)
+{
+  CLoopbackBuffer ring;
+  std::atomic<ULONG> received[STRESS_READERS];
+  std::atomic<ULONG> written(0);
+  std::atomic<bool> done(false);
+  ULONG silence[STRESS_READERS] = { 0 };
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(STRESS_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32)));
+  // the readers run before the writer starts, so they see every sample
+  ULONG slots[STRESS_READERS];
+  for (ULONG r = 0; r < STRESS_READERS; r++) {
+    received[r] = 0;
+    slots[r] = RunReader(&ring);
+  }
+
+  std::thread writer([&]() {
+    std::vector<WORD> period(STRESS_MAX_PERIOD);
+    ULONG random = 0x12345678;
+    ULONG sample = 0;
+
+    for (ULONG w = 0; w < STRESS_WRITES; w++) {
+      ULONG count = 1 + NextRandom(&random) % STRESS_MAX_PERIOD;
+      for (ULONG r = 0; r < STRESS_READERS; r++) {
+        while (sample - received[r] + count > STRESS_RING_SAMPLES) {
+          std::this_thread::yield();
+        }
+      }
+      for (ULONG k = 0; k < count; k++) {
+        period[k] = Sample(sample + k);
+      }
+      ring.Write(&period[0], LOOPBACK_SAMPLE_INT16, count);
+      sample += count;
+      written = sample;
+      if (!(NextRandom(&random) & 7)) {
+        std::this_thread::yield();
+      }
+    }
+    done = true;
+  });
+
+  auto read = [&](ULONG Reader, ULONG Slot) {
+    std::vector<WORD> period(STRESS_MAX_PERIOD);
+    ULONG random = 0x9E3779B9 + Slot;
+    ULONG next = 0;
+
+    for (;;) {
+      // read on until the writer is gone and everything is drained
+      bool last = done;
+      ULONG count = 1 + NextRandom(&random) % STRESS_MAX_PERIOD;
+      if (last) {
+        count = RTSD_MIN(written - next, (ULONG)STRESS_MAX_PERIOD);
+        if (!count) {
+          break;
+        }
+      }
+
+      ring.Read(Slot, &period[0], LOOPBACK_SAMPLE_INT16, count, NULL, NULL);
+
+      for (ULONG k = 0; k < count; k++) {
+        if (!period[k]) {
+          silence[Reader]++;
+          continue;
+        }
+        TEST_CHECK(period[k] == Sample(next));
+        next++;
+      }
+      received[Reader] = next;
+
+      if (!(NextRandom(&random) & 3)) {
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  std::vector<std::thread> readers;
+  for (ULONG r = 0; r < STRESS_READERS; r++) {
+    readers.push_back(std::thread(read, r, slots[r]));
+  }
+
+  writer.join();
+  for (ULONG r = 0; r < STRESS_READERS; r++) {
+    readers[r].join();
+    printf("reader %u: %u samples delivered, %u samples of silence\n", r, (ULONG)received[r], silence[r]);
+    TEST_CHECK(received[r] == written);
+  }
+}
+
+//=============================================================================
+// The writer never waits, so the ring overruns. Samples may go missing, but
+// whatever arrives must arrive in order and must have been written.
+//=============================================================================
+static void StressPolicy(ULONG Policy)
+{
+  CLoopbackBuffer ring;
+  std::atomic<ULONG> writing(0);
+  std::atomic<bool> done(false);
+  ULONG delivered[STRESS_READERS] = { 0 };
+  ULONG slots[STRESS_READERS];
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(STRESS_RING_SAMPLES, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.SetOverrunPolicy(Policy)));
+  for (ULONG r = 0; r < STRESS_READERS; r++) {
+    slots[r] = RunReader(&ring);
+  }
+
+  std::thread writer([&]() {
+    std::vector<WORD> period(STRESS_MAX_PERIOD);
+    ULONG random = 0x12345678;
+    ULONG sample = 0;
+
+    for (ULONG w = 0; w < STRESS_WRITES; w++) {
+      ULONG count = 1 + NextRandom(&random) % STRESS_MAX_PERIOD;
+      for (ULONG k = 0; k < count; k++) {
+        period[k] = Sample(sample + k);
+      }
+      writing = sample + count;
+      ring.Write(&period[0], LOOPBACK_SAMPLE_INT16, count);
+      sample += count;
+      if (!(NextRandom(&random) & 7)) {
+        std::this_thread::yield();
+      }
+    }
+    done = true;
+  });
+
+  auto read = [&](ULONG Reader) {
+    std::vector<WORD> period(STRESS_MAX_PERIOD);
+    ULONG random = 0x9E3779B9 + Reader;
+    LONG number = -1;
+
+    while (!done) {
+      ULONG count = 1 + NextRandom(&random) % STRESS_MAX_PERIOD;
+
+      ring.Read(slots[Reader], &period[0], LOOPBACK_SAMPLE_INT16, count, NULL, NULL);
+      ULONG written = writing;
+
+      for (ULONG k = 0; k < count; k++) {
+        if (!period[k]) {
+          continue;
+        }
+        // a sample only says its number modulo 0xFFFF, so take the smallest
+        // number it can have after the last one; that is never more than
+        // the real one, which must have been written already
+        number += 1 + (LONG)(((ULONG)period[k] + 0xFFFF - Sample((ULONG)(number + 1))) % 0xFFFF);
+        TEST_CHECK((ULONG)number < written);
+        delivered[Reader]++;
+      }
+
+      // the readers go at different speeds
+      if (!(NextRandom(&random) & (3 << Reader))) {
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  std::vector<std::thread> readers;
+  for (ULONG r = 0; r < STRESS_READERS; r++) {
+    readers.push_back(std::thread(read, r));
+  }
+
+  writer.join();
+  for (ULONG r = 0; r < STRESS_READERS; r++) {
+    readers[r].join();
+  }
+
+  RTSD_LOOPBACK_STATISTICS statistics;
+  ring.GetStatistics(&statistics);
+  printf("policy %u: overruns %u/%u/%u\n", Policy,
+         statistics.OverrunDropOldest, statistics.OverrunDropNewest, statistics.OverrunStretch);
+  for (ULONG r = 0; r < STRESS_READERS; r++) {
+    printf("  reader %u: %u samples delivered, lapped %u times\n", r, delivered[r], statistics.Readers[slots[r]].Overrun);
+    TEST_CHECK(delivered[r] > 0);
+  }
+}
+
+//=============================================================================
+int main()
+{
+  TestFull();
+  TestPolicies();
+  TestStretch();
+  TestUnderrun();
+  TestReaders();
+  TestThreads();
+  for (ULONG policy = 0; policy < RTSD_OVERRUN_POLICY_COUNT; policy++) {
+    StressPolicy(policy);
+  }
+
+  return TestResult("test_loopstress");
+}
@@ -0,0 +1,179 @@
+/*
+Module Name:
+  test_loopwrap.cpp
+
+Abstract:
+  Exhaustive wrap boundary test of the 64 bit cursors of CLoopbackBuffer.
+  For small rings, every start offset around a wrap and every write and
+  read size up to two rings are run against a model of what Read must
+  return, with the cursors started at 0, just below 2^31 and 2^32 samples
+  and further out, where a 32 bit cursor would have wrapped. Overfilling
+  is run with the writer keeping what fits and with it overwriting the
+  oldest samples.
+*/
+
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdtest.h"
+
+#define WRAP_MAX_SIZE               16
+
+//=============================================================================
+// Sample at cursor Position. Never 0, which is silence.
+//=============================================================================
+static WORD PositionSample(LONGLONG Position)
+{
+  ULONG hash = (ULONG)Position ^ (ULONG)(Position >> 29);
+  return (WORD)((hash & 0x7FFF) | 0x8000);
+}
+
+//=============================================================================
+// What the ring must do.
+//=============================================================================
+struct WrapModel {
+  LONGLONG Write;
+  LONGLONG Read;
+  LONGLONG Size;
+  ULONG    Policy;
+
+  // A Write of Count samples overwrites the oldest ones or keeps what fits.
+  void Accept(ULONG Count)
+  {
+    if (Policy == RTSD_OVERRUN_DROP_OLDEST) {
+      Write += Count;
+    } else {
+      Write += RTSD_MIN((LONGLONG)Count, Size - (Write - Read));
+    }
+  }
+
+  // Samples a Read of Count returns, after Silence samples of silence.
+  // What was overwritten is skipped first.
+  ULONG Take(ULONG Count, PULONG Silence)
+  {
+    Read = RTSD_MAX(Read, Write - Size);
+
+    ULONG available = (ULONG)(Write - Read);
+    *Silence = 0;
+    if (available < Count) {
+      *Silence = Count - available;
+    }
+    ULONG count = RTSD_MIN(Count - *Silence, available);
+    Read += count;
+    return count;
+  }
+};
+
+//=============================================================================
+static void Write(CLoopbackBuffer *Ring, WrapModel *Model, ULONG Count)
+{
+  std::vector<WORD> source(Count + 1);
+  LONGLONG first = Model->Write;
+
+  // every source sample carries the position it is meant for
+  for (ULONG k = 0; k < Count; k++) {
+    source[k] = PositionSample(first + k);
+  }
+
+  Model->Accept(Count);
+  Ring->Write(&source[0], LOOPBACK_SAMPLE_INT16, Count);
+}
+
+//=============================================================================
+static void Read(CLoopbackBuffer *Ring, ULONG Reader, WrapModel *Model, ULONG Count)
+{
+  std::vector<WORD> destination(Count + 1, 0xFFFF);
+  ULONG silence;
+
+  ULONG count = Model->Take(Count, &silence);
+  LONGLONG first = Model->Read - count;
+
+  Ring->Read(Reader, &destination[0], LOOPBACK_SAMPLE_INT16, Count, NULL, NULL);
+
+  // the gap comes first
+  for (ULONG k = 0; k < silence; k++) {
+    TEST_CHECK(destination[k] == 0);
+  }
+  for (ULONG k = 0; k < count; k++) {
+    TEST_CHECK(destination[silence + k] == PositionSample(first + k));
+  }
+  TEST_CHECK(destination[Count] == 0xFFFF);
+}
+
+//=============================================================================
+static void WrapRun(CLoopbackBuffer *Ring, ULONG Reader, LONGLONG Start, ULONG WriteCount, ULONG ReadCount)
+{
+  WrapModel model = { Start, Start, (LONGLONG)Ring->GetSize(), Ring->GetOverrunPolicy() };
+
+  Ring->SetCursors(Start);
+
+  // fill, drain part, overfill, drain twice
+  Write(Ring, &model, WriteCount);
+  Read(Ring, Reader, &model, ReadCount);
+  Write(Ring, &model, WriteCount);
+  Write(Ring, &model, WriteCount);
+  Read(Ring, Reader, &model, ReadCount);
+  Read(Ring, Reader, &model, ReadCount);
+}
+
+//=============================================================================
+int main()
+{
+  static const LONGLONG Bases[] = {
+    0,
+    ((LONGLONG)1 << 31) - 3 * WRAP_MAX_SIZE,
+    ((LONGLONG)1 << 32) - 3 * WRAP_MAX_SIZE,
+    ((LONGLONG)3 << 32) - 3 * WRAP_MAX_SIZE,
+    ((LONGLONG)1 << 52) - 3 * WRAP_MAX_SIZE,
+  };
+  ULONG runs = 0;
+
+  for (ULONG size = 1; size <= WRAP_MAX_SIZE; size <<= 1) {
+    CLoopbackBuffer ring;
+    ULONG reader;
+
+    TEST_CHECK(NT_SUCCESS(ring.Allocate(size, 1, LOOPBACK_SAMPLE_INT32)));
+    TEST_CHECK(ring.GetSize() == size);
+    TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+    ring.StartReader(reader);
+
+    for (ULONG policy = RTSD_OVERRUN_DROP_OLDEST; policy <= RTSD_OVERRUN_DROP_NEWEST; policy++) {
+      TEST_CHECK(NT_SUCCESS(ring.SetOverrunPolicy(policy)));
+
+      for (ULONG base = 0; base < sizeof(Bases) / sizeof(Bases[0]); base++) {
+        // the first sample at every offset from three rings before the
+        // base's wrap on, further on ring by ring
+        for (ULONG offset = 0; offset <= 6 * WRAP_MAX_SIZE; offset += (offset < 2 * WRAP_MAX_SIZE) ? 1 : size) {
+          for (ULONG writeCount = 0; writeCount <= 2 * size + 1; writeCount++) {
+            for (ULONG readCount = 0; readCount <= 2 * size + 1; readCount++) {
+              WrapRun(&ring, reader, Bases[base] + offset, writeCount, readCount);
+              runs++;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // a size that is no power of two is rounded up
+  CLoopbackBuffer ring;
+  ULONG reader;
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(WRAP_MAX_SIZE + 1, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(ring.GetSize() == 2 * WRAP_MAX_SIZE);
+
+  // reallocating resets the cursors, an empty ring reads silence
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+  ring.StartReader(reader);
+  WORD sample = 1;
+  ring.Write(&sample, LOOPBACK_SAMPLE_INT16, 1);
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(WRAP_MAX_SIZE, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(ring.GetSize() == WRAP_MAX_SIZE);
+  ring.Read(reader, &sample, LOOPBACK_SAMPLE_INT16, 1, NULL, NULL);
+  TEST_CHECK(sample == 0);
+
+  // the size is capped
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(0xFFFFFFFF, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(ring.GetSize() == LOOPBACK_BUFFER_MAX_BYTES / sizeof(LONG));
+
+  printf("%u runs\n", runs);
+  return TestResult("test_loopwrap");
+}
@@ -0,0 +1,117 @@
+/*
+Module Name:
+  test_renderclock.cpp
+
+Abstract:
+  Simulation of a capture stream clocked by the render stream on
+  RTSD_VIRTUAL_CLOCK. The render side writes 10 ms periods into the
+  loopback ring on a clock that is off by a fixed number of ppm, with
+  timer jitter. The capture side polls the position of CDmaClock, driven
+  by the ring's fill level as GetDmaPosition drives it, at random times
+  and, every service period, copies out up to the position the way the
+  port's CopyFrom does. Over 2 million polls the capture side must never
+  read ahead of the data, so not a single underrun, and every service must
+  copy out all the data there is, so the capture side does not fall behind
+  either, whatever the drift.
+*/
+
+#include <vector>
+#include "rtsdloop.h"
+#include "rtsdclk.h"
+#include "rtsdtest.h"
+
+ULONGLONG RtsdVirtualTime;
+
+#define RCLOCK_RATE                 48000
+#define RCLOCK_PERIOD_S             0.010
+#define RCLOCK_JITTER_S             0.002
+#define RCLOCK_MAX_POLL_S           0.004
+#define RCLOCK_POLLS                2000000
+
+//=============================================================================
+static double NextRandom(ULONG *State)
+{
+  *State = *State * 1103515245 + 12345;
+  return (double)(*State >> 8) / (double)(1 << 24);
+}
+
+//=============================================================================
+static void RenderClockRun(double Ppm)
+{
+  CLoopbackBuffer ring;
+  CDmaClock clock;
+  ULONG reader;
+  ULONG random = 7;
+  ULONG writeFrames = RCLOCK_RATE / 100;
+  std::vector<LONG> period(RCLOCK_RATE);
+
+  TEST_CHECK(NT_SUCCESS(ring.Allocate(RCLOCK_RATE / 4, 1, LOOPBACK_SAMPLE_INT32)));
+  TEST_CHECK(NT_SUCCESS(ring.AttachReader(&reader)));
+  ring.StartReader(reader);
+  clock.Start(0, RCLOCK_RATE);
+
+  // the render clock runs Ppm fast
+  double writePeriod = RCLOCK_PERIOD_S / (1.0 + Ppm * 1e-6);
+  double writeTime = 0.0;
+  double pollTime = 0.0;
+  double serviceTime = RCLOCK_PERIOD_S / 2;
+  ULONGLONG writes = 0;
+  ULONGLONG services = 0;
+  ULONGLONG copied = 0;
+  ULONGLONG position = 0;
+  LONGLONG lagMax = 0;
+
+  for (ULONG polls = 0; polls < RCLOCK_POLLS; ) {
+    if (writeTime <= pollTime) {
+      RtsdVirtualTime = (ULONGLONG)(writeTime * 1e7);
+      ring.Write(&period[0], LOOPBACK_SAMPLE_INT32, writeFrames);
+      writes++;
+      writeTime = writes * writePeriod + (NextRandom(&random) * 2.0 - 1.0) * RCLOCK_JITTER_S;
+      continue;
+    }
+
+    RtsdVirtualTime = (ULONGLONG)(pollTime * 1e7);
+    ULONGLONG frames = clock.GetFrames(RtsdVirtualTime, ring.GetFillLevel(reader, 0));
+    TEST_CHECK(frames >= position);
+    position = frames;
+    polls++;
+
+    if (pollTime >= serviceTime) {
+      // the port copies everything up to the position
+      ULONG count = (ULONG)(position - copied);
+      if (count) {
+        ring.Read(reader, &period[0], LOOPBACK_SAMPLE_INT32, count, NULL, NULL);
+        clock.Copied(count);
+        copied += count;
+      }
+      lagMax = RTSD_MAX(lagMax, (LONGLONG)(writes * writeFrames - copied));
+      services++;
+      serviceTime = RCLOCK_PERIOD_S / 2 + services * RCLOCK_PERIOD_S + (NextRandom(&random) * 2.0 - 1.0) * RCLOCK_JITTER_S;
+    }
+
+    pollTime += NextRandom(&random) * RCLOCK_MAX_POLL_S;
+  }
+
+  RTSD_LOOPBACK_STATISTICS statistics;
+  ring.GetStatistics(&statistics);
+
+  printf("%+.0f ppm: %.1f s, %llu frames written, %llu copied, lag up to %lld frames, %u underruns, %u overruns\n",
+         Ppm, pollTime, (unsigned long long)(writes * writeFrames), (unsigned long long)copied, (long long)lagMax,
+         statistics.Readers[reader].UnderrunSilenceHead, statistics.Readers[reader].Overrun);
+
+  TEST_CHECK(!statistics.Readers[reader].UnderrunSilenceHead);
+  TEST_CHECK(!statistics.Readers[reader].Overrun);
+  TEST_CHECK(!lagMax);
+
+  ring.DetachReader(reader);
+}
+
+//=============================================================================
+int main()
+{
+  RenderClockRun(0.0);
+  RenderClockRun(500.0);
+  RenderClockRun(-500.0);
+
+  return TestResult("test_renderclock");
+}
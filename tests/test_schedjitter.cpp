@@ -0,0 +1,180 @@
+/*
+Module Name:
+  test_schedjitter.cpp
+
+Abstract:
+  Simulated-time harness of CStreamScheduler on RTSD_VIRTUAL_CLOCK. The
+  timer fires late by a random latency, now and then by more than a
+  period, while streams of both lanes start and stop and the period
+  changes. The harness measures the jitter of the ticks against their
+  deadlines and checks that the deadlines stay on the grid whatever the
+  latency, that passed deadlines are skipped and counted, that every tick
+  services the running lanes render first with one time, and that the
+  timer is disarmed once the last stream stops.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "rtsdsched.h"
+#include "rtsdtest.h"
+
+ULONGLONG RtsdVirtualTime;
+
+#define SCHED_TICKS                 1000000
+#define SCHED_PERIODS               4
+#define SCHED_MAX_LATENCY           20000       // 2 ms in 100 ns units
+
+//=============================================================================
+// What the service routine saw.
+//=============================================================================
+struct SchedTrace {
+  ULONG Services[SCHEDULER_LANE_COUNT];
+  LONG LastLane;                                // in the current tick, or -1
+  ULONGLONG LastTime;
+  ULONG Ticks;                                  // ticks that serviced a lane
+};
+
+static void SchedService(PVOID Context, ULONG Lane, ULONGLONG CurrentTime)
+{
+  SchedTrace *trace = (SchedTrace *)Context;
+
+  if ((trace->LastLane >= 0) && (CurrentTime == trace->LastTime)) {
+    // the second lane of a tick: render comes first, the time is the same
+    TEST_CHECK((LONG)Lane > trace->LastLane);
+  } else {
+    TEST_CHECK(CurrentTime > trace->LastTime);
+    trace->Ticks++;
+  }
+  TEST_CHECK(CurrentTime == RtsdVirtualTime);
+  trace->Services[Lane]++;
+  trace->LastLane = (LONG)Lane;
+  trace->LastTime = CurrentTime;
+}
+
+//=============================================================================
+static ULONG NextRandom(ULONG *State)
+{
+  ULONG x = *State;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *State = x;
+}
+
+//=============================================================================
+// Latency of the timer: mostly well below a millisecond, one in a hundred
+// up to SCHED_MAX_LATENCY, one in a thousand a few periods.
+//=============================================================================
+static ULONGLONG Latency(ULONG *State, ULONGLONG Period)
+{
+  ULONG r = NextRandom(State);
+  if (r % 1000 == 0) {
+    return Period + NextRandom(State) % (3 * Period);
+  }
+  if (r % 100 == 0) {
+    return NextRandom(State) % SCHED_MAX_LATENCY;
+  }
+  return NextRandom(State) % 2000;
+}
+
+//=============================================================================
+int main()
+{
+  static const ULONG Periods[SCHED_PERIODS] = { 100000, 30000, 10000, 5000 };
+  CStreamScheduler scheduler;
+  SchedTrace trace = { { 0 }, -1, 0, 0 };
+  ULONG random = 0xB5297A4D;
+  ULONG running[SCHEDULER_LANE_COUNT] = { 0 };
+  ULONG expected[SCHEDULER_LANE_COUNT] = { 0 };
+  ULONG skipped = 0;
+  ULONGLONG lateMax = 0;
+  std::vector<ULONGLONG> jitter;
+
+  RtsdVirtualTime = 12345;
+  scheduler.Init(SchedService, &trace);
+
+  for (ULONG phase = 0; phase < SCHED_PERIODS; phase++) {
+    ULONGLONG period = Periods[phase];
+    scheduler.SetPeriod(Periods[phase]);
+
+    // the render stream starts first, the capture stream a little later
+    scheduler.Start(SCHEDULER_LANE_RENDER);
+    running[SCHEDULER_LANE_RENDER]++;
+    ULONGLONG grid = RtsdVirtualTime;
+    TEST_CHECK(scheduler.GetDueTime() == grid + period);
+
+    for (ULONG t = 0; t < SCHED_TICKS / SCHED_PERIODS; t++) {
+      ULONGLONG due = scheduler.GetDueTime();
+      // every deadline lies on the grid of the first start
+      TEST_CHECK(due > RtsdVirtualTime);
+      TEST_CHECK((due - grid) % period == 0);
+
+      ULONGLONG late = Latency(&random, period);
+      RtsdVirtualTime = due + late;
+      lateMax = RTSD_MAX(lateMax, late);
+      skipped += (ULONG)(late / period);
+      jitter.push_back(late);
+
+      for (ULONG lane = 0; lane < SCHEDULER_LANE_COUNT; lane++) {
+        expected[lane] += running[lane] ? 1 : 0;
+      }
+      trace.LastLane = -1;
+      scheduler.Tick(RtsdVirtualTime);
+      TEST_CHECK(scheduler.GetDueTime() == due + (late / period + 1) * period);
+
+      // streams start and stop between ticks, one always keeps running
+      ULONG r = NextRandom(&random) % 512;
+      if (r < SCHEDULER_LANE_COUNT) {
+        if (running[r] && (running[0] + running[1] > 1)) {
+          scheduler.Stop(r);
+          running[r]--;
+        } else if (running[r] < 2) {
+          scheduler.Start(r);
+          running[r]++;
+        }
+      }
+    }
+
+    while (running[SCHEDULER_LANE_CAPTURE]) {
+      scheduler.Stop(SCHEDULER_LANE_CAPTURE);
+      running[SCHEDULER_LANE_CAPTURE]--;
+    }
+    // a stray tick after the last Stop services nothing and does not arm
+    // the timer again
+    while (running[SCHEDULER_LANE_RENDER]) {
+      scheduler.Stop(SCHEDULER_LANE_RENDER);
+      running[SCHEDULER_LANE_RENDER]--;
+    }
+    TEST_CHECK(scheduler.GetDueTime() == 0);
+    ULONG ticks = trace.Ticks;
+    trace.LastLane = -1;
+    RtsdVirtualTime += period;
+    scheduler.Tick(RtsdVirtualTime);
+    TEST_CHECK(trace.Ticks == ticks);
+    TEST_CHECK(scheduler.GetDueTime() == 0);
+    RtsdVirtualTime += 7 * period / 3;
+  }
+
+  scheduler.Shutdown();
+
+  std::sort(jitter.begin(), jitter.end());
+  double mean = 0.0;
+  for (size_t i = 0; i < jitter.size(); i++) {
+    mean += (double)jitter[i];
+  }
+  mean /= (double)jitter.size();
+
+  printf("%u ticks: jitter mean %.1f us, median %.1f us, 99%% %.1f us, 99.9%% %.1f us, max %.1f us, %u deadlines skipped\n",
+         scheduler.GetTicks(), mean / 10.0, jitter[jitter.size() / 2] / 10.0,
+         jitter[jitter.size() * 99 / 100] / 10.0, jitter[jitter.size() * 999 / 1000] / 10.0,
+         scheduler.GetLateMax() / 10.0, scheduler.GetSkipped());
+
+  TEST_CHECK(scheduler.GetTicks() == SCHED_TICKS + SCHED_PERIODS);
+  TEST_CHECK(scheduler.GetSkipped() == skipped);
+  TEST_CHECK(scheduler.GetLateMax() == lateMax);
+  TEST_CHECK(trace.Services[SCHEDULER_LANE_RENDER] == expected[SCHEDULER_LANE_RENDER]);
+  TEST_CHECK(trace.Services[SCHEDULER_LANE_CAPTURE] == expected[SCHEDULER_LANE_CAPTURE]);
+  TEST_CHECK(trace.Services[SCHEDULER_LANE_CAPTURE] > 0);
+
+  return TestResult("test_schedjitter");
+}
@@ -27,10 +27,39 @@ static KSDATARANGE_AUDIO PinDataRangesStream[] = {
         MIN_SAMPLE_RATE,            
         MAX_SAMPLE_RATE             
     },
+    {
+        {
+            sizeof(KSDATARANGE_AUDIO),
+            0,
+            0,
+            0,
+            STATICGUIDOF(KSDATAFORMAT_TYPE_AUDIO),
+            STATICGUIDOF(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT),
+            STATICGUIDOF(KSDATAFORMAT_SPECIFIER_WAVEFORMATEX)
+        },
+        MAX_CHANNELS_PCM,           
+        BITS_PER_SAMPLE_FLOAT,      
+        BITS_PER_SAMPLE_FLOAT,      
+        MIN_SAMPLE_RATE,            
+        MAX_SAMPLE_RATE             
+    },
+};
+
+// Channel mask offered for each channel count, 1 to MAX_CHANNELS_PCM.
+static ULONG ChannelMasks[MAX_CHANNELS_PCM] = {
+    KSAUDIO_SPEAKER_MONO,
+    KSAUDIO_SPEAKER_STEREO,
+    KSAUDIO_SPEAKER_STEREO | SPEAKER_LOW_FREQUENCY,
+    KSAUDIO_SPEAKER_QUAD,
+    KSAUDIO_SPEAKER_QUAD | SPEAKER_LOW_FREQUENCY,
+    KSAUDIO_SPEAKER_5POINT1,
+    KSAUDIO_SPEAKER_5POINT1 | SPEAKER_BACK_CENTER,
+    KSAUDIO_SPEAKER_7POINT1_SURROUND
 };
 
 static PKSDATARANGE PinDataRangePointersStream[] = {
-    PKSDATARANGE(&PinDataRangesStream[0])
+    PKSDATARANGE(&PinDataRangesStream[0]),
+    PKSDATARANGE(&PinDataRangesStream[1])
 };
 
 //=============================================================================
@@ -50,6 +79,18 @@ static PKSDATARANGE PinDataRangePointersBridge[] = {
     &PinDataRangesBridge[0]
 };
 
+//=============================================================================
+static PCPROPERTY_ITEM PropertiesWaveCapturePin[] = {
+  {
+    &KSPROPSETID_RtsdLoopback,
+    KSPROPERTY_RTSD_LOOPBACK_ROUTING,
+    KSPROPERTY_TYPE_ALL,
+    PropertyHandler_WaveCapturePin
+  },
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationWaveCapturePin, PropertiesWaveCapturePin);
+
 //=============================================================================
 static PCPIN_DESCRIPTOR MiniportPins[] = {
     // Wave In Streaming Pin (Capture) KSPIN_WAVE_CAPTURE_SINK
@@ -57,7 +98,7 @@ static PCPIN_DESCRIPTOR MiniportPins[] = {
         MAX_OUTPUT_STREAMS,
         MAX_OUTPUT_STREAMS,
         0,
-        NULL,
+        &AutomationWaveCapturePin,
         {
             0,
             NULL,
@@ -172,6 +213,30 @@ static PCPROPERTY_ITEM PropertiesWaveFilter[] = {
     KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
     PropertyHandler_WaveFilter
   },
+  {
+    &KSPROPSETID_RtsdLoopback,
+    KSPROPERTY_RTSD_LOOPBACK_BUFFER,
+    KSPROPERTY_TYPE_ALL,
+    PropertyHandler_WaveFilter
+  },
+  {
+    &KSPROPSETID_RtsdLoopback,
+    KSPROPERTY_RTSD_LOOPBACK_OVERRUN_POLICY,
+    KSPROPERTY_TYPE_ALL,
+    PropertyHandler_WaveFilter
+  },
+  {
+    &KSPROPSETID_RtsdLoopback,
+    KSPROPERTY_RTSD_LOOPBACK_STATISTICS,
+    KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+    PropertyHandler_WaveFilter
+  },
+  {
+    &KSPROPSETID_RtsdLoopback,
+    KSPROPERTY_RTSD_LOOPBACK_UNDERRUN_MODE,
+    KSPROPERTY_TYPE_ALL,
+    PropertyHandler_WaveFilter
+  },
 };
 
 DEFINE_PCAUTOMATION_TABLE_PROP(AutomationWaveFilter, PropertiesWaveFilter);